@@ -5,43 +5,87 @@
  */
 
 
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
+#include <malloc.h>
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
+#include "uart_rx.h"
+#include "uart_tx.h"
 
 /// \tag::hello_uart[]
 
 #define UART_ID uart0
+#ifndef BAUD_RATE
 #define BAUD_RATE 115200
+#endif
 
 // We are using pins 0 and 1, but see the GPIO function select table in the
 // datasheet for information on which other pins can be used.
 #define UART_TX_PIN 0
 #define UART_RX_PIN 1
 
+// 1: queue hello lines as fast as the ring takes them, to measure sustained throughput
+#ifndef TX_SATURATE
+#define TX_SATURATE 0
+#endif
+// keeps room in the ring for the stats line while saturating
+#define SATURATE_HEADROOM 192
 
-char* get_agent_code(const char* agent, int agent_id) {
-    // Calculate the maximum size needed
-    // Include space for the agent, integer (max 12 chars), and null terminator
-    size_t buffer_size = strlen(agent) + 12;
+#define HELLO_INTERVAL_MS 1000
+// longest busy <ms>, the board doesn't answer meanwhile
+#define BUSY_MAX_MS 10000
+#define STATS_INTERVAL_MS 10000
 
-    // Allocate memory for the result
-    char* result = (char*)malloc(buffer_size);
-    if (result == NULL) {
-        fprintf(stderr, "Memory allocation failed.\n");
-        return NULL; // Handle memory allocation failure
-    }
 
-    // Combine agent and agent_id into the result buffer
-    snprintf(result, buffer_size, "%s%d", agent, agent_id);
+int count = 0;
 
-    return result; // Caller is responsible for freeing the memory
+static absolute_time_t stats_start;
+
+static void print_stats() {
+    uint32_t elapsed_ms = MAX(absolute_time_diff_us(stats_start, get_absolute_time()) / 1000, 1);
+    stats_start = get_absolute_time();
+
+    struct uart_tx_stats stats;
+    uart_tx_get_stats(&stats, true);
+    // heap in use must not grow, nothing on the TX path allocates
+    struct mallinfo heap = mallinfo();
+
+    uint32_t bytes_per_s = (uint64_t)stats.sent * 1000 / elapsed_ms;
+    uint32_t line_rate = BAUD_RATE / 10;    // 8N1: 10 bits per byte
+    uint32_t cpu_ns_per_byte = stats.queued ? (uint64_t)(stats.producer_us + stats.irq_us) * 1000 / stats.queued : 0;
+    uart_tx_printf("tx: %u B/s (%u%% of %u baud), cpu %u ns/byte, %u dropped, heap %u bytes in use\n",
+                   bytes_per_s, (uint)((uint64_t)bytes_per_s * 100 / line_rate), BAUD_RATE,
+                   cpu_ns_per_byte, stats.dropped, heap.uordblks);
+
+    struct uart_rx_stats rx_stats;
+    uart_rx_get_stats(&rx_stats, true);
+    uart_tx_printf("rx: %u bytes, max fill %u/%u, %u dropped, %u overruns, %u errors, %u bursts, %u long lines\n",
+                   rx_stats.received, rx_stats.max_fill, UART_RX_RING_SIZE, rx_stats.dropped,
+                   rx_stats.overruns, rx_stats.errors, rx_stats.idle_events, rx_stats.long_lines);
 }
 
-
-int count = 0;
+// Commands work on the line where it sits in the RX ring, nothing is copied out
+static void run_command(const struct uart_rx_slice *line) {
+    struct uart_rx_slice args;
+    int value;
+
+    if (!uart_rx_slice_len(line))
+        return;
+    if (uart_rx_slice_word(line, "stats", NULL)) {
+        print_stats();
+    } else if (uart_rx_slice_word(line, "agent", &args) && uart_rx_slice_to_int(&args, &value)) {
+        count = value;
+    } else if (uart_rx_slice_word(line, "echo", &args)) {
+        uart_tx_write(args.ptr[0], args.len[0]);
+        uart_tx_write(args.ptr[1], args.len[1]);
+        uart_tx_write("\n", 1);
+    } else if (uart_rx_slice_word(line, "busy", &args) && uart_rx_slice_to_int(&args, &value) &&
+               value >= 0 && value <= BUSY_MAX_MS) {
+        // stand in for a long render/sample, input keeps landing in the ring meanwhile
+        busy_wait_ms(value);
+    } else {
+        uart_tx_printf("commands: stats, agent <n>, echo <text>, busy <ms> (up to %u)\n", BUSY_MAX_MS);
+    }
+}
 
 int main() {
     // Set up our UART with the required speed.
@@ -52,21 +96,32 @@ int main() {
     gpio_set_function(UART_TX_PIN, UART_FUNCSEL_NUM(UART_ID, UART_TX_PIN));
     gpio_set_function(UART_RX_PIN, UART_FUNCSEL_NUM(UART_ID, UART_RX_PIN));
 
-    // Use some the various UART functions to send out data
-    // In a default system, printf will also output via the default UART
+    // Everything goes out through the DMA ring, the calls below never wait on the UART
+    uart_tx_init(UART_ID);
+    uart_rx_init(UART_ID);
+
+    absolute_time_t next_hello = get_absolute_time();
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+    stats_start = get_absolute_time();
     while (true) {
-        // Send out a character without any conversions
-        uart_puts(UART_ID, "Pico2");
-
-        // Send out a character but do CR/LF conversions
-        uart_putc(UART_ID, ':');
-
-        // Send out a string, with CR/LF conversions
-        uart_puts(UART_ID, " Hello, UART !! I am ");
-        uart_puts(UART_ID, get_agent_code("Agent-", count));
-        uart_putc_raw(UART_ID, '\n');
-        count = (count + 1) % 10;
-        sleep_ms(1000);
+        struct uart_rx_slice line;
+        while (uart_rx_next_line(&line)) {
+            run_command(&line);
+            uart_rx_consume(&line);
+        }
+
+        if (TX_SATURATE ? uart_tx_free() > SATURATE_HEADROOM : time_reached(next_hello)) {
+            uart_tx_printf("Pico2: Hello, UART !! I am Agent-%d\n", count);
+            count = (count + 1) % 10;
+            next_hello = delayed_by_ms(next_hello, HELLO_INTERVAL_MS);
+        }
+        if (time_reached(next_stats)) {
+            print_stats();
+            next_stats = delayed_by_ms(next_stats, STATS_INTERVAL_MS);
+        }
+        // the RX IRQ wakes us up early when input arrives
+        if (!TX_SATURATE)
+            best_effort_wfe_or_timeout(absolute_time_min(next_hello, next_stats));
     }
     return 0;
 }
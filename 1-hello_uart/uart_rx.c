@@ -0,0 +1,164 @@
+#include <limits.h>
+#include <string.h>
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "uart_rx.h"
+
+#define RING_MASK   (UART_RX_RING_SIZE - 1)
+
+static_assert((UART_RX_RING_SIZE & RING_MASK) == 0, "UART_RX_RING_SIZE must be a power of 2");
+
+static uint8_t ring[UART_RX_RING_SIZE];
+
+static struct {
+    uart_inst_t *uart;
+    // free running indices, masked on access
+    volatile uint32_t head;     // next byte to fill, IRQ only
+    volatile uint32_t tail;     // oldest byte still in use, consumer only
+    uint32_t line_start;        // start of the next line to hand out
+    uint32_t scan;              // next byte to check for a line ending
+    volatile uint32_t last_rx_us;
+    struct uart_rx_stats stats;
+} rx;
+
+static void uart_rx_irq_handler(void) {
+    uart_hw_t *hw = uart_get_hw(rx.uart);
+    uint32_t timed_out = hw->mis & UART_UARTMIS_RTMIS_BITS;
+    uint32_t head = rx.head;
+    uint32_t tail = rx.tail;
+
+    // empty the FIFO, that also clears the level interrupt
+    while (!(hw->fr & UART_UARTFR_RXFE_BITS)) {
+        uint32_t dr = hw->dr;
+        if (dr & UART_UARTDR_OE_BITS)
+            rx.stats.overruns++;
+        if (dr & (UART_UARTDR_BE_BITS | UART_UARTDR_PE_BITS | UART_UARTDR_FE_BITS))
+            rx.stats.errors++;
+        if (head - tail == UART_RX_RING_SIZE) {
+            rx.stats.dropped++;
+            continue;
+        }
+        ring[head++ & RING_MASK] = (uint8_t)dr;
+        rx.stats.received++;
+    }
+    rx.stats.max_fill = MAX(rx.stats.max_fill, head - tail);
+    rx.head = head;
+    rx.last_rx_us = time_us_32();
+
+    if (timed_out) {
+        rx.stats.idle_events++;
+        hw->icr = UART_UARTICR_RTIC_BITS;
+    }
+}
+
+void uart_rx_init(uart_inst_t *uart) {
+    rx.uart = uart;
+    uart_hw_t *hw = uart_get_hw(uart);
+
+    // interrupt at half full (16 bytes), leaving 16 byte times for the IRQ to get in
+    hw_write_masked(&hw->ifls, 2 << UART_UARTIFLS_RXIFLSEL_LSB, UART_UARTIFLS_RXIFLSEL_BITS);
+
+    irq_set_exclusive_handler(UART_IRQ_NUM(uart), uart_rx_irq_handler);
+    irq_set_enabled(UART_IRQ_NUM(uart), true);
+    hw_set_bits(&hw->imsc, UART_UARTIMSC_RXIM_BITS | UART_UARTIMSC_RTIM_BITS);
+}
+
+bool uart_rx_next_line(struct uart_rx_slice *line) {
+    uint32_t head = rx.head;
+
+    while (rx.scan != head) {
+        uint8_t c = ring[rx.scan++ & RING_MASK];
+        if (c != '\n' && c != '\r')
+            continue;
+
+        uint32_t start = rx.line_start;
+        size_t len = rx.scan - 1 - start;
+        size_t first = MIN(len, UART_RX_RING_SIZE - (start & RING_MASK));
+        line->ptr[0] = &ring[start & RING_MASK];
+        line->len[0] = first;
+        line->ptr[1] = ring;
+        line->len[1] = len - first;
+        line->end = rx.scan;
+        rx.line_start = rx.scan;
+        return true;
+    }
+
+    // a full ring without a line ending can never complete, throw it away
+    if (rx.line_start == rx.tail && head - rx.tail == UART_RX_RING_SIZE) {
+        rx.stats.long_lines++;
+        rx.line_start = rx.scan;
+        rx.tail = rx.scan;
+    }
+    return false;
+}
+
+void uart_rx_consume(const struct uart_rx_slice *line) {
+    rx.tail = line->end;
+}
+
+uint32_t uart_rx_idle_us(void) {
+    return time_us_32() - rx.last_rx_us;
+}
+
+void uart_rx_get_stats(struct uart_rx_stats *stats, bool reset) {
+    uint32_t status = save_and_disable_interrupts();
+    *stats = rx.stats;
+    if (reset)
+        memset(&rx.stats, 0, sizeof(rx.stats));
+    restore_interrupts(status);
+}
+
+static void slice_sub(const struct uart_rx_slice *s, size_t offset, struct uart_rx_slice *sub) {
+    if (offset < s->len[0]) {
+        sub->ptr[0] = s->ptr[0] + offset;
+        sub->len[0] = s->len[0] - offset;
+        sub->ptr[1] = s->ptr[1];
+        sub->len[1] = s->len[1];
+    } else {
+        offset -= s->len[0];
+        sub->ptr[0] = s->ptr[1] + offset;
+        sub->len[0] = s->len[1] - offset;
+        sub->ptr[1] = s->ptr[1];
+        sub->len[1] = 0;
+    }
+    sub->end = s->end;
+}
+
+bool uart_rx_slice_word(const struct uart_rx_slice *s, const char *word, struct uart_rx_slice *args) {
+    size_t len = uart_rx_slice_len(s);
+    size_t i = 0;
+    for (; word[i]; i++) {
+        if (i == len || uart_rx_slice_at(s, i) != (uint8_t)word[i])
+            return false;
+    }
+    if (i < len && uart_rx_slice_at(s, i) != ' ')
+        return false;
+    while (i < len && uart_rx_slice_at(s, i) == ' ')
+        i++;
+    if (args)
+        slice_sub(s, i, args);
+    return true;
+}
+
+bool uart_rx_slice_to_int(const struct uart_rx_slice *s, int *value) {
+    size_t len = uart_rx_slice_len(s);
+    size_t i = 0;
+    bool neg = false;
+    unsigned v = 0;
+
+    if (len && (uart_rx_slice_at(s, 0) == '-' || uart_rx_slice_at(s, 0) == '+'))
+        neg = uart_rx_slice_at(s, i++) == '-';
+    if (i == len)
+        return false;
+    for (; i < len; i++) {
+        uint8_t c = uart_rx_slice_at(s, i);
+        if (c < '0' || c > '9')
+            return false;
+        // INT_MIN has one more than INT_MAX
+        if (v > ((unsigned)INT_MAX + neg - (c - '0')) / 10)
+            return false;
+        v = v * 10 + c - '0';
+    }
+    *value = neg ? (int)(0u - v) : (int)v;
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef _UART_RX_H
+#define _UART_RX_H
+
+#include "hardware/uart.h"
+#include "pico/stdlib.h"
+
+// UART receive into a static ring buffer, fed from the UART IRQ.
+//
+// The IRQ fires when the RX FIFO is half full, or on the RX timeout when the line
+// has been idle for 32 bit times with data still in the FIFO. Either way it empties
+// the FIFO into the ring, so the main loop can be busy for as long as the ring takes
+// to fill (UART_RX_RING_SIZE / (baud / 10) seconds) without losing anything.
+//
+// Lines are handed out as slices of the ring, no copies: up to two spans, since a
+// line can wrap around the end of the ring. A slice stays valid until it is
+// consumed, consuming a line also releases every line before it.
+
+// must be a power of 2
+#ifndef UART_RX_RING_SIZE
+#define UART_RX_RING_SIZE   2048
+#endif
+
+struct uart_rx_stats {
+    uint32_t received;          // bytes put in the ring
+    uint32_t dropped;           // bytes lost because the ring was full
+    uint32_t overruns;          // bytes lost because the hardware FIFO was full
+    uint32_t errors;            // framing, parity and break errors
+    uint32_t idle_events;       // RX timeouts, i.e. bursts that ended
+    uint32_t long_lines;        // lines that filled the ring and were thrown away
+    uint32_t max_fill;          // high water mark of the ring
+};
+
+struct uart_rx_slice {
+    const uint8_t *ptr[2];
+    size_t len[2];
+    uint32_t end;               // ring index just past the line terminator
+};
+
+// The UART must already be set up with uart_init. Takes over the UART IRQ
+void uart_rx_init(uart_inst_t *uart);
+
+// Next complete line (ended by \n or \r), without the terminator. Empty lines are
+// returned too, so \r\n gives an empty line after each real one.
+bool uart_rx_next_line(struct uart_rx_slice *line);
+
+// Releases the ring space up to and including line
+void uart_rx_consume(const struct uart_rx_slice *line);
+
+// Time since the last byte came in
+uint32_t uart_rx_idle_us(void);
+
+void uart_rx_get_stats(struct uart_rx_stats *stats, bool reset);
+
+static inline size_t uart_rx_slice_len(const struct uart_rx_slice *s) {
+    return s->len[0] + s->len[1];
+}
+
+static inline uint8_t uart_rx_slice_at(const struct uart_rx_slice *s, size_t i) {
+    return i < s->len[0] ? s->ptr[0][i] : s->ptr[1][i - s->len[0]];
+}
+
+// True if s starts with the word word, followed by a space or the end of the line.
+// args is set to the rest of the line with leading spaces skipped.
+bool uart_rx_slice_word(const struct uart_rx_slice *s, const char *word, struct uart_rx_slice *args);
+
+// Parses a decimal integer, with optional sign, that makes up all of s. False if it
+// doesn't fit an int
+bool uart_rx_slice_to_int(const struct uart_rx_slice *s, int *value);
+
+#endif
@@ -0,0 +1,215 @@
+#include <string.h>
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "uart_tx.h"
+
+#define RING_MASK   (UART_TX_RING_SIZE - 1)
+
+static_assert((UART_TX_RING_SIZE & RING_MASK) == 0, "UART_TX_RING_SIZE must be a power of 2");
+
+// aligned to its size so the DMA ring wrap lines up with the buffer
+static uint8_t ring[UART_TX_RING_SIZE] __aligned(UART_TX_RING_SIZE);
+
+static struct {
+    uart_inst_t *uart;
+    uint dma_chan;
+    // free running indices, masked on access
+    volatile uint32_t head;     // next byte to write, producer only
+    volatile uint32_t tail;     // next byte to send, IRQ only
+    volatile uint32_t in_flight;    // bytes in the current DMA transfer
+    struct uart_tx_stats stats;
+} tx;
+
+// Starts the DMA on everything queued. Called with interrupts off or from the IRQ.
+static void kick(void) {
+    uint32_t pending = tx.head - tx.tail;
+    if (!pending || tx.in_flight)
+        return;
+    tx.in_flight = pending;
+    // the read address wraps at the end of the ring, so one transfer covers it all
+    dma_channel_transfer_from_buffer_now(tx.dma_chan, &ring[tx.tail & RING_MASK], pending);
+}
+
+static void dma_irq_handler(void) {
+    if (!dma_channel_get_irq0_status(tx.dma_chan))
+        return;
+    uint32_t start = time_us_32();
+    dma_channel_acknowledge_irq0(tx.dma_chan);
+    tx.tail += tx.in_flight;
+    tx.stats.sent += tx.in_flight;
+    tx.in_flight = 0;
+    kick();
+    tx.stats.irq_us += time_us_32() - start;
+}
+
+static void commit(uint32_t head) {
+    uint32_t status = save_and_disable_interrupts();
+    tx.stats.queued += head - tx.head;
+    tx.head = head;
+    kick();
+    restore_interrupts(status);
+}
+
+void uart_tx_init(uart_inst_t *uart) {
+    tx.uart = uart;
+    tx.dma_chan = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(tx.dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_ring(&c, false, __builtin_ctz(UART_TX_RING_SIZE));
+    channel_config_set_dreq(&c, uart_get_dreq(uart, true));
+    dma_channel_configure(tx.dma_chan, &c, &uart_get_hw(uart)->dr, ring, 0, false);
+
+    dma_channel_set_irq0_enabled(tx.dma_chan, true);
+    irq_add_shared_handler(DMA_IRQ_0, dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+size_t uart_tx_free(void) {
+    return UART_TX_RING_SIZE - (tx.head - tx.tail);
+}
+
+size_t uart_tx_write(const void *src, size_t len) {
+    uint32_t start = time_us_32();
+    if (len > uart_tx_free()) {
+        tx.stats.dropped++;
+        return 0;
+    }
+    uint32_t head = tx.head;
+    size_t first = MIN(len, UART_TX_RING_SIZE - (head & RING_MASK));
+    memcpy(&ring[head & RING_MASK], src, first);
+    memcpy(ring, (const uint8_t *)src + first, len - first);
+    commit(head + len);
+    tx.stats.producer_us += time_us_32() - start;
+    return len;
+}
+
+/* Formatting */
+
+struct fmt_out {
+    uint32_t head;
+    uint32_t limit;             // head may not reach this
+    bool full;
+};
+
+static inline void out_char(struct fmt_out *o, char c) {
+    if (o->head == o->limit) {
+        o->full = true;
+        return;
+    }
+    ring[o->head++ & RING_MASK] = c;
+}
+
+static void out_uint(struct fmt_out *o, uint32_t v, uint base, bool upper, bool neg, int width, char pad) {
+    char digits[10];
+    int n = 0;
+    do {
+        uint d = v % base;
+        digits[n++] = d < 10 ? '0' + d : (upper ? 'A' : 'a') + d - 10;
+        v /= base;
+    } while (v);
+
+    int len = n + neg;
+    if (neg && pad == '0')
+        out_char(o, '-');
+    for (; width > len; width--)
+        out_char(o, pad);
+    if (neg && pad != '0')
+        out_char(o, '-');
+    while (n)
+        out_char(o, digits[--n]);
+}
+
+size_t uart_tx_vprintf(const char *fmt, va_list args) {
+    uint32_t start = time_us_32();
+    struct fmt_out o = {
+        .head = tx.head,
+        .limit = tx.tail + UART_TX_RING_SIZE,
+    };
+
+    for (; *fmt && !o.full; fmt++) {
+        if (*fmt != '%') {
+            out_char(&o, *fmt);
+            continue;
+        }
+        char pad = ' ';
+        int width = 0;
+        if (*++fmt == '0') {
+            pad = '0';
+            fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+            width = width * 10 + *fmt++ - '0';
+        while (*fmt == 'l')
+            fmt++;
+
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            int v = va_arg(args, int);
+            out_uint(&o, v < 0 ? -(uint32_t)v : (uint32_t)v, 10, false, v < 0, width, pad);
+            break;
+        }
+        case 'u':
+            out_uint(&o, va_arg(args, unsigned), 10, false, false, width, pad);
+            break;
+        case 'x':
+        case 'X':
+            out_uint(&o, va_arg(args, unsigned), 16, *fmt == 'X', false, width, pad);
+            break;
+        case 'c':
+            out_char(&o, (char)va_arg(args, int));
+            break;
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            int len = strlen(s);
+            for (; width > len; width--)
+                out_char(&o, ' ');
+            while (*s)
+                out_char(&o, *s++);
+            break;
+        }
+        case '\0':
+            fmt--;
+            break;
+        default:
+            out_char(&o, *fmt);
+            break;
+        }
+    }
+
+    size_t len = o.head - tx.head;
+    if (o.full) {
+        tx.stats.dropped++;
+        len = 0;
+    } else {
+        commit(o.head);
+    }
+    tx.stats.producer_us += time_us_32() - start;
+    return len;
+}
+
+size_t uart_tx_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t len = uart_tx_vprintf(fmt, args);
+    va_end(args);
+    return len;
+}
+
+void uart_tx_flush(void) {
+    while (tx.head != tx.tail)
+        tight_loop_contents();
+    uart_tx_wait_blocking(tx.uart);
+}
+
+void uart_tx_get_stats(struct uart_tx_stats *stats, bool reset) {
+    uint32_t status = save_and_disable_interrupts();
+    *stats = tx.stats;
+    if (reset)
+        memset(&tx.stats, 0, sizeof(tx.stats));
+    restore_interrupts(status);
+}
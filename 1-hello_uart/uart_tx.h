@@ -0,0 +1,46 @@
+#ifndef _UART_TX_H
+#define _UART_TX_H
+
+#include <stdarg.h>
+#include "hardware/uart.h"
+#include "pico/stdlib.h"
+
+// UART transmit through a static ring buffer that a DMA channel drains into the
+// UART FIFO. Writers copy into the ring and return straight away, the DMA
+// completion IRQ picks up whatever was queued meanwhile. Nothing is allocated.
+//
+// Writes are all or nothing: if a message does not fit in the free space it is
+// dropped and counted, never cut short. Only one producer, don't call from IRQs.
+
+// must be a power of 2, the DMA read address wraps on it (max 32k)
+#ifndef UART_TX_RING_SIZE
+#define UART_TX_RING_SIZE   1024
+#endif
+
+struct uart_tx_stats {
+    uint32_t queued;            // bytes accepted by write/printf
+    uint32_t sent;              // bytes handed to the UART FIFO
+    uint32_t dropped;           // messages that did not fit
+    uint32_t producer_us;       // time spent in write/printf
+    uint32_t irq_us;            // time spent in the DMA IRQ
+};
+
+// The UART must already be set up with uart_init. Claims a DMA channel and shares DMA_IRQ_0
+void uart_tx_init(uart_inst_t *uart);
+
+// Returns len, or 0 if there was not room for all of it
+size_t uart_tx_write(const void *src, size_t len);
+
+// printf subset formatted straight into the ring: %d %i %u %x %X %c %s %%, with
+// optional '0' flag and width. Returns the length, or 0 if it was dropped.
+size_t uart_tx_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+size_t uart_tx_vprintf(const char *fmt, va_list args);
+
+size_t uart_tx_free(void);
+
+// Blocks until the ring and the UART FIFO are empty
+void uart_tx_flush(void);
+
+void uart_tx_get_stats(struct uart_tx_stats *stats, bool reset);
+
+#endif
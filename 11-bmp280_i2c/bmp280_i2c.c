@@ -1,6 +1,8 @@
 #include <stdio.h>
 
 #include "hardware/i2c.h"
+#include "i2c_bus.h"
+#include "telemetry.h"
 #include "pico/binary_info.h"
 #include "pico/stdlib.h"
 
@@ -10,6 +12,20 @@
 #define BMP280_I2C_SCL_PIN    5
 #define BMP280_I2C_BAUDRATE    100*1000 //100KhZ
 
+#ifndef SAMPLE_INTERVAL_MS
+#define SAMPLE_INTERVAL_MS    1000
+#endif
+
+// Define TELEMETRY_BINARY to send COBS framed binary records instead of text,
+// TELEMETRY_BATCH samples per frame (see telemetry.h, decode with host/telemetry_decode)
+#ifdef TELEMETRY_BINARY
+#ifndef TELEMETRY_BATCH
+#define TELEMETRY_BATCH       16
+#endif
+// a partial batch still goes out after this long
+#define TELEMETRY_MAX_AGE_MS  1000
+#endif
+
 // hardware registers
 #define REG_CONFIG _u(0xF5)
 #define REG_CTRL_MEAS _u(0xF4)
@@ -49,6 +65,17 @@
 #define REG_DIG_P9_LSB _u(0x9E)
 #define REG_DIG_P9_MSB _u(0x9F)
 
+// a stuck bus is cleared and the transfer retried, 1ms then 2ms backoff
+static i2c_bus_t bmp280_bus = {
+    .i2c = i2c0,
+    .sda_pin = BMP280_I2C_SDA_PIN,
+    .scl_pin = BMP280_I2C_SCL_PIN,
+    .baudrate = BMP280_I2C_BAUDRATE,
+    .max_retries = 2,
+    .backoff_us = 1000,
+    .backoff_max_us = 4000,
+};
+
 // number of calibration registers to be read
 #define NUM_CALIB_PARAMS 24
 
@@ -74,7 +101,7 @@ struct BMP280_calib_param {
 void BMP280_reset() {
     // reset the device with the power-on-reset procedure
     uint8_t buf[2] = { REG_RESET, 0xB6 };
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, buf, 2, false);
+    i2c_bus_write(&bmp280_bus, BMP280_I2C_ADDR, buf, 2, false);
 }
 
 
@@ -127,19 +154,22 @@ int32_t BMP280_convert_temp(int32_t temp, struct BMP280_calib_param* params) {
 }
 
 
-void BMP280_read_raw(int32_t* temp, int32_t* pressure) {
+int BMP280_read_raw(int32_t* temp, int32_t* pressure) {
     // BMP280 data registers are auto-incrementing and we have 3 temperature and
     // pressure registers each, so we start at 0xF7 and read 6 bytes to 0xFC
     // note: normal mode does not require further ctrl_meas and config register writes
 
     uint8_t buf[6];
     uint8_t reg = REG_PRESSURE_MSB;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, &reg, 1, true);  // true to keep master control of bus
-    i2c_read_blocking(i2c0, BMP280_I2C_ADDR, buf, 6, false);  // false - finished with bus
+    // register write and read are joined with a RESTART to keep master control of bus
+    int ret = i2c_bus_write_read(&bmp280_bus, BMP280_I2C_ADDR, &reg, 1, buf, 6);
+    if (ret < 0)
+        return ret;
 
     // store the 20 bit read in a 32 bit signed integer for conversion
     *pressure = (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
     *temp = (buf[3] << 12) | (buf[4] << 4) | (buf[5] >> 4);
+    return ret;
 }
 
 
@@ -151,9 +181,8 @@ void BMP280_get_calib_params(struct BMP280_calib_param* params) {
 
     uint8_t buf[NUM_CALIB_PARAMS] = { 0 };
     uint8_t reg = REG_DIG_T1_LSB;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, &reg, 1, true);  // true to keep master control of bus
     // read in one go as register addresses auto-increment
-    i2c_read_blocking(i2c0, BMP280_I2C_ADDR, buf, NUM_CALIB_PARAMS, false);  // false, we're done reading
+    i2c_bus_write_read(&bmp280_bus, BMP280_I2C_ADDR, &reg, 1, buf, NUM_CALIB_PARAMS);
 
     // store these in a struct for later use
     params->dig_t1 = (uint16_t)(buf[1] << 8) | buf[0];
@@ -176,34 +205,37 @@ void BMP280_init() {
     // use the "handheld device dynamic" optimal setting (see datasheet)
     uint8_t buf[2];
 
-    // 500ms sampling time, x16 filter
-    const uint8_t reg_config_val = ((0x04 << 5) | (0x05 << 2)) & 0xFC;
+    // 500ms sampling time (0.5ms when sampling faster than that), x16 filter
+    const uint8_t t_sb = SAMPLE_INTERVAL_MS < 500 ? 0x00 : 0x04;
+    const uint8_t reg_config_val = ((t_sb << 5) | (0x05 << 2)) & 0xFC;
 
     // send register number followed by its corresponding value
     buf[0] = REG_CONFIG;
     buf[1] = reg_config_val;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, buf, 2, false);
+    i2c_bus_write(&bmp280_bus, BMP280_I2C_ADDR, buf, 2, false);
 
     // osrs_t x1, osrs_p x4, normal mode operation
     const uint8_t reg_ctrl_meas_val = (0x01 << 5) | (0x03 << 2) | (0x03);
     buf[0] = REG_CTRL_MEAS;
     buf[1] = reg_ctrl_meas_val;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, buf, 2, false);
+    i2c_bus_write(&bmp280_bus, BMP280_I2C_ADDR, buf, 2, false);
 }
 
 
 void BMP280_init_i2c() {
-    gpio_init(BMP280_I2C_SDA_PIN);
-    gpio_set_function(BMP280_I2C_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(BMP280_I2C_SDA_PIN);
+    i2c_bus_init(&bmp280_bus);
+}
 
-    gpio_init(BMP280_I2C_SCL_PIN);
-    gpio_set_function(BMP280_I2C_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(BMP280_I2C_SCL_PIN);
 
-    i2c_init(i2c0, BMP280_I2C_BAUDRATE);
-}
+#ifdef TELEMETRY_BINARY
+static telemetry_t telemetry;
 
+static void telemetry_write(const uint8_t *data, size_t len) {
+    // raw, no CR/LF translation
+    for (size_t i = 0; i < len; i++)
+        putchar_raw(data[i]);
+}
+#endif
 
 int main() {
     stdio_init_all();
@@ -218,16 +250,36 @@ int main() {
     int32_t raw_temperature;
     int32_t raw_pressure;
     sleep_ms(250); // sleep so that data polling and register update don't collide
+#ifdef TELEMETRY_BINARY
+    telemetry_init(&telemetry, TELEMETRY_F_TEMP | TELEMETRY_F_PRESS | TELEMETRY_F_RAW_TEMP | TELEMETRY_F_RAW_PRESS,
+                   TELEMETRY_BATCH, TELEMETRY_MAX_AGE_MS * 1000, telemetry_write);
+#endif
 
 measurement_poll:
-    BMP280_read_raw(&raw_temperature, &raw_pressure);
+    if (BMP280_read_raw(&raw_temperature, &raw_pressure) < 0) {
+        i2c_bus_print_counters(&bmp280_bus);
+        sleep_ms(1000);
+        goto measurement_poll;
+    }
     //printf("\nRaw Temp: %d\nRaw Pressure: %d\n", raw_temperature, raw_pressure);
     int32_t temperature = BMP280_convert_temp(raw_temperature, &params);
     int32_t pressure = BMP280_convert_pressure(raw_pressure, raw_temperature, &params);
+#ifdef TELEMETRY_BINARY
+    struct telemetry_sample sample = {
+        .timestamp_us = time_us_32(),
+        .temp = temperature,
+        .press = pressure,
+        .raw_temp = raw_temperature,
+        .raw_press = raw_pressure,
+    };
+    telemetry_add(&telemetry, &sample);
+    telemetry_poll(&telemetry, time_us_32());
+#else
     printf("Pressure = %.3f kPa\r", pressure / 1000.f);
     printf("Temp. = %.2f C\r", temperature / 100.f);
+#endif
 
-    sleep_ms(1000);
+    sleep_ms(SAMPLE_INTERVAL_MS);
     goto measurement_poll;
 
     return 0;
@@ -0,0 +1,281 @@
+// Host side decoder for the binary telemetry frames (see ../telemetry.h).
+//
+//   telemetry_decode [file]      decode a capture or a serial port (set up with stty
+//                                first) to CSV on stdout, stdin if no file
+//   telemetry_decode --bench [n] compare text and binary output on n synthetic samples
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "../telemetry.h"
+}
+
+class TelemetryDecoder {
+public:
+    using SampleFn = std::function<void(uint32_t seq, uint8_t fields, const telemetry_sample &s)>;
+
+    struct Stats {
+        uint64_t frames = 0;
+        uint64_t samples = 0;
+        uint64_t crc_errors = 0;
+        uint64_t malformed = 0;
+        uint64_t lost_samples = 0;  // from gaps in the sequence numbers
+    };
+
+    explicit TelemetryDecoder(SampleFn fn) : fn_(std::move(fn)) {}
+
+    void feed(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if (data[i]) {
+                // no frame is ever this long, we must have missed a delimiter
+                if (encoded_.size() < TELEMETRY_MAX_ENCODED)
+                    encoded_.push_back(data[i]);
+                continue;
+            }
+            if (!encoded_.empty())
+                decode_frame();
+            encoded_.clear();
+        }
+    }
+
+    const Stats &stats() const { return stats_; }
+
+private:
+    static bool get_varint(const uint8_t *&p, const uint8_t *end, uint32_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (p == end)
+                return false;
+            uint8_t b = *p++;
+            v |= uint32_t(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    static int32_t unzigzag(uint32_t v) {
+        return int32_t(v >> 1) ^ -int32_t(v & 1);
+    }
+
+    static uint32_t get_u32(const uint8_t *p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    void decode_frame() {
+        uint8_t frame[TELEMETRY_MAX_ENCODED];
+        size_t len = cobs_decode(encoded_.data(), encoded_.size(), frame);
+        if (len < TELEMETRY_HDR_LEN + TELEMETRY_CRC_LEN) {
+            stats_.malformed++;
+            return;
+        }
+        len -= TELEMETRY_CRC_LEN;
+        uint16_t crc = frame[len] | (frame[len + 1] << 8);
+        if (telemetry_crc16(frame, len) != crc) {
+            stats_.crc_errors++;
+            return;
+        }
+        if ((frame[0] >> 4) != TELEMETRY_VERSION) {
+            stats_.malformed++;
+            return;
+        }
+
+        uint8_t fields = frame[0] & 0xf;
+        uint8_t count = frame[1];
+        uint32_t seq = get_u32(&frame[2]);
+        if (have_seq_ && seq != next_seq_)
+            stats_.lost_samples += seq - next_seq_;
+
+        telemetry_sample s = {};
+        s.timestamp_us = get_u32(&frame[6]);
+        const uint8_t *p = frame + TELEMETRY_HDR_LEN;
+        const uint8_t *end = frame + len;
+        for (uint8_t i = 0; i < count; i++) {
+            uint32_t v;
+            if (!get_varint(p, end, v)) {
+                stats_.malformed++;
+                return;
+            }
+            s.timestamp_us += v;
+            int32_t *values[] = {&s.temp, &s.press, &s.raw_temp, &s.raw_press};
+            for (int f = 0; f < 4; f++) {
+                if (!(fields & (1 << f)))
+                    continue;
+                if (!get_varint(p, end, v)) {
+                    stats_.malformed++;
+                    return;
+                }
+                *values[f] += unzigzag(v);
+            }
+            fn_(seq + i, fields, s);
+            stats_.samples++;
+        }
+        stats_.frames++;
+        have_seq_ = true;
+        next_seq_ = seq + count;
+    }
+
+    SampleFn fn_;
+    std::vector<uint8_t> encoded_;
+    Stats stats_;
+    bool have_seq_ = false;
+    uint32_t next_seq_ = 0;
+};
+
+static int decode(FILE *in) {
+    std::printf("seq,timestamp_us,temp_c,press_pa,raw_temp,raw_press\n");
+    TelemetryDecoder dec([](uint32_t seq, uint8_t fields, const telemetry_sample &s) {
+        std::printf("%u,%u,", seq, s.timestamp_us);
+        if (fields & TELEMETRY_F_TEMP)
+            std::printf("%.2f", s.temp / 100.0);
+        std::printf(",");
+        if (fields & TELEMETRY_F_PRESS)
+            std::printf("%d", s.press);
+        std::printf(",");
+        if (fields & TELEMETRY_F_RAW_TEMP)
+            std::printf("%d", s.raw_temp);
+        std::printf(",");
+        if (fields & TELEMETRY_F_RAW_PRESS)
+            std::printf("%d", s.raw_press);
+        std::printf("\n");
+    });
+
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), in)) > 0)
+        dec.feed(buf, n);
+
+    const auto &st = dec.stats();
+    std::fprintf(stderr, "%llu frames, %llu samples, %llu crc errors, %llu malformed, %llu samples lost\n",
+                 (unsigned long long)st.frames, (unsigned long long)st.samples,
+                 (unsigned long long)st.crc_errors, (unsigned long long)st.malformed,
+                 (unsigned long long)st.lost_samples);
+    return 0;
+}
+
+/* Benchmark */
+
+static std::vector<uint8_t> bench_out;
+
+static void bench_write(const uint8_t *data, size_t len) {
+    bench_out.insert(bench_out.end(), data, data + len);
+}
+
+// slow drift plus ADC noise, sampled every 10ms
+static std::vector<telemetry_sample> make_samples(size_t n) {
+    std::vector<telemetry_sample> samples(n);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        int noise = int((seed >> 16) % 5) - 2;
+        telemetry_sample &s = samples[i];
+        s.timestamp_us = uint32_t(i * 10000 + (seed >> 24));
+        s.temp = 2300 + int32_t(150 * std::sin(i / 5000.0)) + noise;
+        s.press = 101325 + int32_t(300 * std::sin(i / 20000.0)) + 3 * noise;
+        s.raw_temp = 519888 + 8 * s.temp;
+        s.raw_press = 415148 - 2 * (s.press - 101325);
+    }
+    return samples;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, size_t n, size_t bytes, double encode_s, double decode_s) {
+    double per_sample = double(bytes) / n;
+    std::printf("%-22s %6.2f B/sample %8.1f ns enc %8.1f ns dec %8.0f samples/s @115200 %9.0f samples/s @1MB/s\n",
+                name, per_sample, encode_s * 1e9 / n, decode_s * 1e9 / n,
+                11520 / per_sample, 1e6 / per_sample);
+}
+
+static int bench(size_t n) {
+    auto samples = make_samples(n);
+
+    // what the sensor loops print today: "Pressure = %.3f kPa\rTemp. = %.2f C\r"
+    {
+        std::string text;
+        char line[64];
+        auto start = std::chrono::steady_clock::now();
+        for (const auto &s : samples) {
+            int len = std::snprintf(line, sizeof(line), "Pressure = %.3f kPa\rTemp. = %.2f C\r",
+                                    s.press / 1000.f, s.temp / 100.f);
+            text.append(line, len);
+        }
+        double encode_s = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        // strtof rather than sscanf, which would strlen the whole capture every call
+        size_t parsed = 0;
+        volatile float sink = 0;
+        const char *end = text.c_str() + text.size();
+        for (const char *p = text.c_str(); p < end;) {
+            char *e;
+            float press = std::strtof(p + std::strlen("Pressure = "), &e);
+            float temp = std::strtof(e + std::strlen(" kPa\rTemp. = "), &e);
+            sink = sink + press + temp;
+            parsed++;
+            p = e + std::strlen(" C\r");
+        }
+        double decode_s = seconds_since(start);
+        report("text", parsed, text.size(), encode_s, decode_s);
+    }
+
+    const struct {
+        const char *name;
+        uint8_t fields;
+        uint8_t batch;
+    } configs[] = {
+        {"binary temp+press x1", TELEMETRY_F_TEMP | TELEMETRY_F_PRESS, 1},
+        {"binary temp+press x8", TELEMETRY_F_TEMP | TELEMETRY_F_PRESS, 8},
+        {"binary temp+press x32", TELEMETRY_F_TEMP | TELEMETRY_F_PRESS, 32},
+        {"binary all x32", 0xf, 32},
+    };
+    for (const auto &c : configs) {
+        bench_out.clear();
+        bench_out.reserve(n * 16);
+        telemetry_t t;
+        telemetry_init(&t, c.fields, c.batch, UINT32_MAX, bench_write);
+        auto start = std::chrono::steady_clock::now();
+        for (const auto &s : samples)
+            telemetry_add(&t, &s);
+        telemetry_flush(&t);
+        double encode_s = seconds_since(start);
+
+        size_t errors = 0, i = 0;
+        TelemetryDecoder dec([&](uint32_t seq, uint8_t, const telemetry_sample &s) {
+            const telemetry_sample &ref = samples[i++];
+            if (s.timestamp_us != ref.timestamp_us || s.temp != ref.temp || s.press != ref.press)
+                errors++;
+        });
+        start = std::chrono::steady_clock::now();
+        dec.feed(bench_out.data(), bench_out.size());
+        double decode_s = seconds_since(start);
+
+        report(c.name, n, bench_out.size(), encode_s, decode_s);
+        if (errors || i != n || dec.stats().crc_errors) {
+            std::fprintf(stderr, "%s: round trip failed, %zu/%zu samples, %zu mismatches\n", c.name, i, n, errors);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !std::strcmp(argv[1], "--bench"))
+        return bench(argc > 2 ? std::strtoul(argv[2], nullptr, 0) : 1000000);
+
+    FILE *in = stdin;
+    if (argc > 1 && !(in = std::fopen(argv[1], "rb"))) {
+        std::perror(argv[1]);
+        return 1;
+    }
+    return decode(in);
+}
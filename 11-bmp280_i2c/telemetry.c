@@ -0,0 +1,152 @@
+#include <string.h>
+#include "telemetry.h"
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static size_t put_varint(uint8_t *p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+// small deltas of either sign become small unsigned numbers
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+uint16_t telemetry_crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xffff;
+    while (len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i]) {
+            dst[out++] = src[i];
+            code++;
+        }
+        if (!src[i] || code == 0xff) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        }
+    }
+    dst[code_pos] = code;
+    return out;
+}
+
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t in = 0, out = 0;
+    while (in < len) {
+        uint8_t code = src[in++];
+        if (!code || in + code - 1 > len)
+            return 0;
+        for (uint8_t i = 1; i < code; i++) {
+            if (!src[in])
+                return 0;
+            dst[out++] = src[in++];
+        }
+        if (code != 0xff && in < len)
+            dst[out++] = 0;
+    }
+    return out;
+}
+
+void telemetry_init(telemetry_t *t, uint8_t fields, uint8_t max_batch, uint32_t max_age_us, telemetry_write_fn write) {
+    memset(t, 0, sizeof(*t));
+    t->fields = fields & 0xf;
+    t->max_batch = max_batch ? max_batch : 1;
+    t->max_age_us = max_age_us;
+    t->write = write;
+}
+
+void telemetry_flush(telemetry_t *t) {
+    if (!t->count)
+        return;
+
+    t->frame[1] = t->count;
+    uint16_t crc = telemetry_crc16(t->frame, t->len);
+    t->frame[t->len++] = crc;
+    t->frame[t->len++] = crc >> 8;
+
+    // delimiters on both sides, so text that got in between frames costs no frame
+    uint8_t encoded[TELEMETRY_MAX_ENCODED];
+    encoded[0] = 0;
+    size_t n = 1 + cobs_encode(t->frame, t->len, encoded + 1);
+    encoded[n++] = 0;
+    t->write(encoded, n);
+
+    t->frames++;
+    t->bytes += n;
+    t->count = 0;
+    t->len = 0;
+}
+
+bool telemetry_add(telemetry_t *t, const struct telemetry_sample *s) {
+    bool sent = false;
+    if (t->count && t->len + TELEMETRY_MAX_SAMPLE_LEN + TELEMETRY_CRC_LEN > TELEMETRY_MAX_FRAME) {
+        telemetry_flush(t);
+        sent = true;
+    }
+
+    uint8_t *p = t->frame;
+    if (!t->count) {
+        memset(&t->prev, 0, sizeof(t->prev));
+        t->prev.timestamp_us = s->timestamp_us;
+        p[0] = (TELEMETRY_VERSION << 4) | t->fields;
+        put_u32(&p[2], t->seq);
+        put_u32(&p[6], s->timestamp_us);
+        t->len = TELEMETRY_HDR_LEN;
+    }
+
+    p += t->len;
+    p += put_varint(p, s->timestamp_us - t->prev.timestamp_us);
+    if (t->fields & TELEMETRY_F_TEMP)
+        p += put_varint(p, zigzag(s->temp - t->prev.temp));
+    if (t->fields & TELEMETRY_F_PRESS)
+        p += put_varint(p, zigzag(s->press - t->prev.press));
+    if (t->fields & TELEMETRY_F_RAW_TEMP)
+        p += put_varint(p, zigzag(s->raw_temp - t->prev.raw_temp));
+    if (t->fields & TELEMETRY_F_RAW_PRESS)
+        p += put_varint(p, zigzag(s->raw_press - t->prev.raw_press));
+    t->len = p - t->frame;
+
+    t->prev = *s;
+    t->count++;
+    t->seq++;
+    t->samples++;
+
+    if (t->count >= t->max_batch) {
+        telemetry_flush(t);
+        sent = true;
+    }
+    return sent;
+}
+
+bool telemetry_poll(telemetry_t *t, uint32_t now_us) {
+    if (!t->count)
+        return false;
+    uint32_t first_us = t->frame[6] | (t->frame[7] << 8) | (t->frame[8] << 16) | ((uint32_t)t->frame[9] << 24);
+    if (now_us - first_us < t->max_age_us)
+        return false;
+    telemetry_flush(t);
+    return true;
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
 
 #include "hardware/i2c.h"
+#include "i2c_bus.h"
+#include "idle_sched.h"
+#include "telemetry.h"
 #include "pico/stdlib.h"
 
  // device has default bus address of 0x76
@@ -9,6 +12,26 @@
 #define BMP280_I2C_SCL_PIN    5
 #define BMP280_I2C_BAUDRATE    100*1000 //100KhZ
 
+#ifndef SAMPLE_INTERVAL_MS
+#define SAMPLE_INTERVAL_MS    1000
+#endif
+
+// time per low power state and wake latency, printed this often
+#ifndef IDLE_STATS_INTERVAL_MS
+#define IDLE_STATS_INTERVAL_MS  (10 * SAMPLE_INTERVAL_MS)
+#endif
+
+// Define TELEMETRY_BINARY to send COBS framed binary records instead of text,
+// TELEMETRY_BATCH samples per frame. See telemetry.h, decode with
+// 11-bmp280_i2c/host/telemetry_decode
+#ifdef TELEMETRY_BINARY
+#ifndef TELEMETRY_BATCH
+#define TELEMETRY_BATCH       16
+#endif
+// a partial batch still goes out after this long
+#define TELEMETRY_MAX_AGE_MS  1000
+#endif
+
 // hardware registers
 #define REG_CONFIG _u(0xF5)
 #define REG_CTRL_MEAS _u(0xF4)
@@ -26,6 +49,17 @@
 #define REG_DIG_T3_LSB _u(0x8C)
 #define REG_DIG_T3_MSB _u(0x8D)
 
+// a stuck bus is cleared and the transfer retried, 1ms then 2ms backoff
+static i2c_bus_t bmp280_bus = {
+    .i2c = i2c0,
+    .sda_pin = BMP280_I2C_SDA_PIN,
+    .scl_pin = BMP280_I2C_SCL_PIN,
+    .baudrate = BMP280_I2C_BAUDRATE,
+    .max_retries = 2,
+    .backoff_us = 1000,
+    .backoff_max_us = 4000,
+};
+
 // number of calibration registers to be read
 #define NUM_CALIB_PARAMS 6
 
@@ -40,7 +74,7 @@ struct BMP280_calib_param {
 void BMP280_reset() {
     // reset the device with the power-on-reset procedure
     uint8_t buf[2] = { REG_RESET, 0xB6 };
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, buf, 2, false);
+    i2c_bus_write(&bmp280_bus, BMP280_I2C_ADDR, buf, 2, false);
 }
 
 
@@ -64,16 +98,19 @@ int32_t BMP280_convert_temp(int32_t temp, struct BMP280_calib_param* params) {
 }
 
 
-void BMP280_read_raw(int32_t* temp) {
+int BMP280_read_raw(int32_t* temp) {
     // BMP280 data registers are auto-incrementing and we have 3 temperature
     // registers, so we start at 0xFA and read 3 bytes to 0xFC
     // note: normal mode does not require further ctrl_meas and config register writes
     uint8_t buf[3];
     uint8_t reg = REG_TEMP_MSB;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, &reg, 1, true);  // true to keep master control of bus
-    i2c_read_blocking(i2c0, BMP280_I2C_ADDR, buf, 3, false);  // false - finished with bus
+    // register write and read are joined with a RESTART to keep master control of bus
+    int ret = i2c_bus_write_read(&bmp280_bus, BMP280_I2C_ADDR, &reg, 1, buf, 3);
+    if (ret < 0)
+        return ret;
     // store the 20 bit read in a 32 bit signed integer for conversion
     *temp = (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
+    return ret;
 }
 
 
@@ -85,9 +122,8 @@ void BMP280_get_calib_params(struct BMP280_calib_param* params) {
 
     uint8_t buf[NUM_CALIB_PARAMS] = { 0 };
     uint8_t reg = REG_DIG_T1_LSB;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, &reg, 1, true);  // true to keep master control of bus
     // read in one go as register addresses auto-increment
-    i2c_read_blocking(i2c0, BMP280_I2C_ADDR, buf, NUM_CALIB_PARAMS, false);  // false, we're done reading
+    i2c_bus_write_read(&bmp280_bus, BMP280_I2C_ADDR, &reg, 1, buf, NUM_CALIB_PARAMS);
 
     // store these in a struct for later use
     params->dig_t1 = (uint16_t)(buf[1] << 8) | buf[0];
@@ -100,34 +136,84 @@ void BMP280_init() {
     // use the "handheld device dynamic" optimal setting (see datasheet)
     uint8_t buf[2];
 
-    // 500ms sampling time, x16 filter
-    const uint8_t reg_config_val = ((0x04 << 5) | (0x05 << 2)) & 0xFC;
+    // 500ms sampling time (0.5ms when sampling faster than that), x16 filter
+    const uint8_t t_sb = SAMPLE_INTERVAL_MS < 500 ? 0x00 : 0x04;
+    const uint8_t reg_config_val = ((t_sb << 5) | (0x05 << 2)) & 0xFC;
 
     // send register number followed by its corresponding value
     buf[0] = REG_CONFIG;
     buf[1] = reg_config_val;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, buf, 2, false);
+    i2c_bus_write(&bmp280_bus, BMP280_I2C_ADDR, buf, 2, false);
 
     // osrs_t x1, osrs_p x4, normal mode operation
     const uint8_t reg_ctrl_meas_val = (0x01 << 5) | (0x03 << 2) | (0x03);
     buf[0] = REG_CTRL_MEAS;
     buf[1] = reg_ctrl_meas_val;
-    i2c_write_blocking(i2c0, BMP280_I2C_ADDR, buf, 2, false);
+    i2c_bus_write(&bmp280_bus, BMP280_I2C_ADDR, buf, 2, false);
 }
 
 
 void BMP280_init_i2c() {
-    gpio_init(BMP280_I2C_SDA_PIN);
-    gpio_set_function(BMP280_I2C_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(BMP280_I2C_SDA_PIN);
+    i2c_bus_init(&bmp280_bus);
+}
+
 
-    gpio_init(BMP280_I2C_SCL_PIN);
-    gpio_set_function(BMP280_I2C_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(BMP280_I2C_SCL_PIN);
+#ifdef TELEMETRY_BINARY
+static telemetry_t telemetry;
 
-    i2c_init(i2c0, BMP280_I2C_BAUDRATE);
+static void telemetry_write(const uint8_t *data, size_t len) {
+    // raw, no CR/LF translation
+    for (size_t i = 0; i < len; i++)
+        putchar_raw(data[i]);
 }
+#endif
 
+static struct BMP280_calib_param params;
+
+static void sample_job(void *arg) {
+    int32_t raw_temperature;
+    if (BMP280_read_raw(&raw_temperature) < 0) {
+        // try again on the next sample
+        i2c_bus_print_counters(&bmp280_bus);
+        return;
+    }
+    //printf("\nRaw Temp: %d\nRaw Pressure: %d\n", raw_temperature, raw_pressure);
+    int32_t temperature = BMP280_convert_temp(raw_temperature, &params);
+#ifdef TELEMETRY_BINARY
+    struct telemetry_sample sample = {
+        .timestamp_us = time_us_32(),
+        .temp = temperature,
+        .raw_temp = raw_temperature,
+    };
+    telemetry_add(&telemetry, &sample);
+    telemetry_poll(&telemetry, time_us_32());
+#else
+    printf("Temp. = %.2f C\r", temperature / 100.f);
+#endif
+}
+
+static void idle_stats_job(void *arg) {
+#ifndef TELEMETRY_BINARY
+    struct idle_sched_stats stats;
+    idle_sched_get_stats(&stats, true);
+
+    uint64_t total_us = 0;
+    for (int s = 0; s < IDLE_STATE_COUNT; s++)
+        total_us += stats.time_us[s];
+    if (!total_us)
+        return;
+    printf("\nidle:");
+    for (int s = 0; s < IDLE_STATE_COUNT; s++)
+        printf(" %s %.2f%%", idle_state_name(s), 100.f * stats.time_us[s] / total_us);
+    printf(", asleep %.2f%%\n", 100.f * (total_us - stats.time_us[IDLE_ACTIVE]) / total_us);
+    for (int s = IDLE_WFI; s < IDLE_STATE_COUNT; s++) {
+        if (stats.entries[s])
+            printf("  %s: %u entries, wake latency avg %uus max %uus\n", idle_state_name(s),
+                   stats.entries[s], stats.wake_latency_avg_us[s], stats.wake_latency_max_us[s]);
+    }
+    printf("  %u early wakes\n", stats.early_wakes);
+#endif
+}
 
 int main() {
     stdio_init_all();
@@ -136,20 +222,23 @@ int main() {
     BMP280_init_i2c();
     BMP280_init();
     // retrieve fixed compensation params
-    struct BMP280_calib_param params;
     BMP280_get_calib_params(&params);
 
-    int32_t raw_temperature;
-    sleep_ms(250); // sleep so that data polling and register update don't collide
-
-measurement_poll:
-    BMP280_read_raw(&raw_temperature);
-    //printf("\nRaw Temp: %d\nRaw Pressure: %d\n", raw_temperature, raw_pressure);
-    int32_t temperature = BMP280_convert_temp(raw_temperature, &params);
-    printf("Temp. = %.2f C\r", temperature / 100.f);
-
-    sleep_ms(1000);
-    goto measurement_poll;
+#ifdef TELEMETRY_BINARY
+    telemetry_init(&telemetry, TELEMETRY_F_TEMP | TELEMETRY_F_RAW_TEMP,
+                   TELEMETRY_BATCH, TELEMETRY_MAX_AGE_MS * 1000, telemetry_write);
+#endif
+
+    // Between samples the core sleeps until the next one is due, instead of spinning
+    // in sleep_ms. The first sample waits so that data polling and register update
+    // don't collide
+    static idle_job_t sample, idle_stats;
+    idle_sched_init();
+    idle_sched_add(&sample, sample_job, NULL, SAMPLE_INTERVAL_MS, 250);
+    idle_sched_add(&idle_stats, idle_stats_job, NULL, IDLE_STATS_INTERVAL_MS, IDLE_STATS_INTERVAL_MS);
+
+    while (true)
+        idle_sched_run_once();
 
     return 0;
 }
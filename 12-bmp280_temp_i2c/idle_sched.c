@@ -0,0 +1,229 @@
+#include <string.h>
+#include <time.h>
+#include "hardware/clocks.h"
+#include "hardware/structs/scb.h"
+#include "hardware/timer.h"
+#include "pico/sleep.h"
+#if !PICO_RP2040
+#include "pico/aon_timer.h"
+#endif
+#include "idle_sched.h"
+
+static struct {
+    idle_job_t *jobs[IDLE_SCHED_MAX_JOBS];
+    uint num_jobs;
+    enum idle_state deepest;
+    uint alarm;                 // hardware alarm that ends a SLEEP
+    // time accounting
+    enum idle_state state;
+    uint64_t state_start_us;
+    uint32_t latency_ewma_us[IDLE_STATE_COUNT];
+    uint64_t latency_total_us[IDLE_STATE_COUNT];
+    struct idle_sched_stats stats;
+} sched;
+
+static const char *state_names[IDLE_STATE_COUNT] = { "active", "wfi", "sleep", "dormant" };
+
+const char *idle_state_name(enum idle_state state) {
+    return state < IDLE_STATE_COUNT ? state_names[state] : "?";
+}
+
+static void account(enum idle_state next) {
+    uint64_t now = time_us_64();
+    sched.stats.time_us[sched.state] += now - sched.state_start_us;
+    sched.state = next;
+    sched.state_start_us = now;
+}
+
+// only here to have the IRQ enabled and acknowledged, waking up is all it is for
+static void sleep_alarm_cb(uint alarm_num) {
+}
+
+void idle_sched_init(void) {
+    memset(&sched, 0, sizeof(sched));
+    sched.state_start_us = time_us_64();
+    sched.alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(sched.alarm, sleep_alarm_cb);
+#if LIB_PICO_STDIO_USB
+    // SLEEP and DORMANT stop clk_usb, the host would see the device vanish
+    sched.deepest = IDLE_WFI;
+#elif PICO_RP2040
+    sched.deepest = IDLE_SLEEP;
+#else
+    sched.deepest = IDLE_DORMANT;
+    struct timespec ts = { 0, 0 };
+    aon_timer_start(&ts);
+#endif
+}
+
+void idle_sched_add(idle_job_t *job, idle_job_fn fn, void *arg, uint32_t period_ms, uint32_t first_ms) {
+    hard_assert(sched.num_jobs < IDLE_SCHED_MAX_JOBS);
+    job->fn = fn;
+    job->arg = arg;
+    job->period_us = period_ms * 1000;
+    job->next = make_timeout_time_ms(first_ms);
+    sched.jobs[sched.num_jobs++] = job;
+}
+
+void idle_sched_limit(enum idle_state deepest) {
+#if PICO_RP2040
+    deepest = MIN(deepest, IDLE_SLEEP);
+#endif
+#if LIB_PICO_STDIO_USB
+    deepest = MIN(deepest, IDLE_WFI);
+#endif
+    sched.deepest = deepest;
+}
+
+/* Low power states */
+
+static void flush_stdio(void) {
+    stdio_flush();
+#if LIB_PICO_STDIO_UART
+    // the last bytes are still in the FIFO when stdio is done with them
+    uart_default_tx_wait_blocking();
+#endif
+}
+
+// sleep_power_up brings up the default clocks, go back to what we had if that differs
+static void restore_clocks(uint32_t sys_hz) {
+    if (clock_get_hz(clk_sys) != sys_hz)
+        set_sys_clock_hz(sys_hz, true);
+}
+
+static void go_sleep(absolute_time_t wake_at) {
+    uint32_t sys_hz = clock_get_hz(clk_sys);
+    flush_stdio();
+
+    // off the PLLs onto the crystal, the timer keeps its 1us tick
+    sleep_run_from_xosc();
+    if (!hardware_alarm_set_target(sched.alarm, wake_at)) {
+        // only the timer keeps its clock while the core sleeps
+        clocks_hw->sleep_en0 = 0;
+#if PICO_RP2040
+        clocks_hw->sleep_en1 = CLOCKS_SLEEP_EN1_CLK_SYS_TIMER_BITS;
+#else
+        clocks_hw->sleep_en1 = CLOCKS_SLEEP_EN1_CLK_REF_TICKS_BITS | CLOCKS_SLEEP_EN1_CLK_SYS_TIMER0_BITS;
+#endif
+        scb_hw->scr |= ARM_CPU_PREFIXED(SCR_SLEEPDEEP_BITS);
+        __wfi();
+        // woken by something else, the alarm must not fire into the next idle
+        hardware_alarm_cancel(sched.alarm);
+    }
+    sleep_power_up();
+    restore_clocks(sys_hz);
+}
+
+#if !PICO_RP2040
+static void dormant_alarm_cb(void) {
+}
+
+static void go_dormant(absolute_time_t wake_at) {
+    uint32_t sys_hz = clock_get_hz(clk_sys);
+    flush_stdio();
+
+    struct timespec before, ts;
+    aon_timer_get_time(&before);
+    uint64_t timer_before = time_us_64();
+    int64_t us = absolute_time_diff_us(get_absolute_time(), wake_at);
+    ts.tv_sec = before.tv_sec + us / 1000000;
+    ts.tv_nsec = before.tv_nsec + (us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    // the AON timer keeps counting on the LPOSC while everything else stops
+    sleep_run_from_lposc();
+    sleep_goto_dormant_until(&ts, dormant_alarm_cb);
+    sleep_power_up();
+    restore_clocks(sys_hz);
+
+    // The system timer stood still, move it on by what the AON timer counted. Only
+    // ever forwards, and nothing else may have alarms pending across a DORMANT
+    struct timespec after;
+    aon_timer_get_time(&after);
+    uint64_t slept_us = (uint64_t)(after.tv_sec - before.tv_sec) * 1000000 + (after.tv_nsec - before.tv_nsec) / 1000;
+    uint64_t t = timer_before + slept_us;
+    if (t > time_us_64()) {
+        uint32_t status = save_and_disable_interrupts();
+        timer_hw->timelw = (uint32_t)t;
+        timer_hw->timehw = (uint32_t)(t >> 32);
+        restore_interrupts(status);
+    }
+}
+#endif
+
+static void idle_until(absolute_time_t deadline) {
+    int64_t left = absolute_time_diff_us(get_absolute_time(), deadline);
+    if (left <= 0 || sched.deepest == IDLE_ACTIVE)
+        return;
+
+    enum idle_state state = IDLE_WFI;
+    if (sched.deepest >= IDLE_DORMANT && left >= IDLE_DORMANT_MIN_US)
+        state = IDLE_DORMANT;
+    else if (sched.deepest >= IDLE_SLEEP && left >= IDLE_SLEEP_MIN_US)
+        state = IDLE_SLEEP;
+
+    // leave early by what waking up has been taking
+    absolute_time_t wake_at = from_us_since_boot(to_us_since_boot(deadline) - sched.latency_ewma_us[state]);
+
+    account(state);
+    switch (state) {
+    case IDLE_SLEEP:
+        go_sleep(wake_at);
+        break;
+#if !PICO_RP2040
+    case IDLE_DORMANT:
+        go_dormant(wake_at);
+        break;
+#endif
+    default:
+        best_effort_wfe_or_timeout(wake_at);
+        break;
+    }
+    account(IDLE_ACTIVE);
+
+    sched.stats.entries[state]++;
+    int64_t late_us = absolute_time_diff_us(wake_at, get_absolute_time());
+    if (late_us < 0) {
+        sched.stats.early_wakes++;
+        return;
+    }
+    sched.latency_total_us[state] += late_us;
+    sched.stats.wake_latency_max_us[state] = MAX(sched.stats.wake_latency_max_us[state], (uint32_t)late_us);
+    // slow to follow, one slow wake shouldn't make every following one early
+    sched.latency_ewma_us[state] += ((int32_t)late_us - (int32_t)sched.latency_ewma_us[state]) / 8;
+}
+
+void idle_sched_run_once(void) {
+    absolute_time_t next = at_the_end_of_time;
+
+    for (uint i = 0; i < sched.num_jobs; i++) {
+        idle_job_t *job = sched.jobs[i];
+        if (time_reached(job->next)) {
+            job->fn(job->arg);
+            job->next = delayed_by_us(job->next, job->period_us);
+            // fell behind by more than a period, skip rather than run back to back
+            if (time_reached(job->next))
+                job->next = make_timeout_time_us(job->period_us);
+        }
+        if (absolute_time_diff_us(job->next, next) > 0)
+            next = job->next;
+    }
+    idle_until(next);
+}
+
+void idle_sched_get_stats(struct idle_sched_stats *stats, bool reset) {
+    // close the current period, so it is counted up to now
+    account(sched.state);
+    *stats = sched.stats;
+    for (int s = 0; s < IDLE_STATE_COUNT; s++) {
+        uint32_t wakes = stats->entries[s];
+        stats->wake_latency_avg_us[s] = wakes ? sched.latency_total_us[s] / wakes : 0;
+    }
+    if (reset) {
+        memset(&sched.stats, 0, sizeof(sched.stats));
+        memset(sched.latency_total_us, 0, sizeof(sched.latency_total_us));
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef _IDLE_SCHED_H
+#define _IDLE_SCHED_H
+
+#include "pico/stdlib.h"
+
+// Periodic jobs with low power idle in between.
+//
+// idle_sched_run_once() runs the jobs that are due, then sleeps until the earliest
+// next deadline in the deepest state that is allowed and pays off for that long:
+//
+//   WFI       core clock gated, any interrupt wakes it
+//   SLEEP     runs from the crystal, everything but the timer gated, PLLs off.
+//             Wakes on the timer alarm (or any interrupt that still has a clock)
+//   DORMANT   RP2350 only: oscillators stopped, the AON timer (on the LPOSC) wakes
+//             it. The system timer stops too and is moved on by what the AON timer
+//             counted. Millisecond resolution
+//
+// SLEEP and DORMANT restart the clocks on wake, at the frequency they had before.
+// They stop clk_usb, so with USB stdio nothing deeper than WFI is ever used.
+// Each state wakes early by its measured wake latency, so jobs still run on time.
+
+#ifndef IDLE_SCHED_MAX_JOBS
+#define IDLE_SCHED_MAX_JOBS     8
+#endif
+
+// shortest idle worth the clock restart
+#ifndef IDLE_SLEEP_MIN_US
+#define IDLE_SLEEP_MIN_US       5000
+#endif
+#ifndef IDLE_DORMANT_MIN_US
+#define IDLE_DORMANT_MIN_US     200000
+#endif
+
+enum idle_state {
+    IDLE_ACTIVE = 0,            // running jobs, or the caller between calls
+    IDLE_WFI,
+    IDLE_SLEEP,
+    IDLE_DORMANT,
+    IDLE_STATE_COUNT
+};
+
+typedef void (*idle_job_fn)(void *arg);
+
+// The caller owns the storage, it must stay valid while the job is registered
+typedef struct {
+    idle_job_fn fn;
+    void *arg;
+    uint32_t period_us;
+    absolute_time_t next;
+} idle_job_t;
+
+struct idle_sched_stats {
+    uint64_t time_us[IDLE_STATE_COUNT];
+    uint32_t entries[IDLE_STATE_COUNT];
+    uint32_t wake_latency_avg_us[IDLE_STATE_COUNT]; // past the deadline the state was left for
+    uint32_t wake_latency_max_us[IDLE_STATE_COUNT];
+    uint32_t early_wakes;       // interrupts that ended an idle before its deadline
+};
+
+void idle_sched_init(void);
+
+// Runs fn every period_ms, first after first_ms
+void idle_sched_add(idle_job_t *job, idle_job_fn fn, void *arg, uint32_t period_ms, uint32_t first_ms);
+
+// Deepest state allowed from now on, e.g. IDLE_WFI while a peripheral needs its clock
+void idle_sched_limit(enum idle_state deepest);
+
+void idle_sched_run_once(void);
+
+void idle_sched_get_stats(struct idle_sched_stats *stats, bool reset);
+
+const char *idle_state_name(enum idle_state state);
+
+#endif
@@ -4,9 +4,56 @@
 #include <stdint.h>
 #include <string.h>
 #include "hardware/i2c.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/multicore.h"
 #include "pico/stdlib.h"
+#include "boot.h"
+#include "fixfmt.h"
+#include "i2c_sched.h"
+#include "log.h"
+#include "telemetry.h"
 #include "ssd1306_font.h"
 
+// Define SHARED_I2C_BUS to put the BMP280 on the OLED bus (GP4/GP5). The scheduler
+// switches the baudrate per transaction and sensor reads go in between frame chunks.
+#ifdef SHARED_I2C_BUS
+#define BMP280_I2C_INST             i2c0
+#else
+#define BMP280_I2C_INST             i2c1
+#endif
+#define SSD1306_I2C_INST            i2c0
+
+// Define MULTICORE_PIPELINE to move the BMP280 to core1: it sets up its own bus,
+// samples and hands compensated readings to core0 through a seqlock. Core0 keeps the
+// OLED, the logs and stdio, and renders only when a new reading is in
+#if defined(MULTICORE_PIPELINE) && defined(SHARED_I2C_BUS)
+#error "MULTICORE_PIPELINE needs the BMP280 on a bus of its own"
+#endif
+// longest core0 waits for a reading or an I2C transaction, the log drain runs at
+// least this often
+#define CORE0_WAIT_MS               10
+
+#ifndef SAMPLE_INTERVAL_MS
+#define SAMPLE_INTERVAL_MS          1000
+#endif
+#define STATS_INTERVAL_MS           10000
+
+// Define TELEMETRY_BINARY to send COBS framed binary records instead of text,
+// TELEMETRY_BATCH samples per frame. See telemetry.h, decode with
+// 11-bmp280_i2c/host/telemetry_decode
+#ifdef TELEMETRY_BINARY
+#ifndef TELEMETRY_BATCH
+#define TELEMETRY_BATCH             16
+#endif
+// a partial batch still goes out after this long
+#define TELEMETRY_MAX_AGE_MS        1000
+#endif
+
+// records formatted per pass of the main loop, the rest wait for the next pass
+#define LOG_DRAIN_BATCH             4
+
 /* SSD1306 Registers, Pins & Structs */
 
 #define SSD1306_HEIGHT              32
@@ -53,6 +100,11 @@
 #define SSD1306_WRITE_MODE         _u(0xFE)
 #define SSD1306_READ_MODE          _u(0xFF)
 
+// frame writes are split into chunks of this many bytes so that a sensor read
+// waits at most one chunk (~0.8ms at 400kHz) instead of a whole frame (~13ms)
+#define SSD1306_CHUNK_LEN           32
+#define SSD1306_MAX_CHUNKS          ((SSD1306_BUF_LEN + SSD1306_CHUNK_LEN - 1) / SSD1306_CHUNK_LEN)
+
 
 struct render_area {
     uint8_t start_col;
@@ -71,6 +123,10 @@ struct render_area {
 #define BMP280_I2C_SCL_PIN    15
 #define BMP280_I2C_BAUDRATE    100*1000 //100KhZ
 
+// first conversion after switching to normal mode, t_measure max for osrs_t x1,
+// osrs_p x4 is 13.3ms (see datasheet)
+#define BMP280_MEAS_TIME_US   14000
+
 // hardware registers
 #define REG_CONFIG _u(0xF5)
 #define REG_CTRL_MEAS _u(0xF4)
@@ -154,59 +210,131 @@ void calc_render_area_buflen(struct render_area *area) {
     area->buflen = (area->end_col - area->start_col + 1) * (area->end_page - area->start_page + 1);
 }
 
-void SSD1306_send_cmd(uint8_t cmd) {
-    // I2C write process expects a control byte followed by data
-    // this "data" can be a command or data to follow up a command
-    // Co = 1, D/C = 0 => the driver expects a command
-    uint8_t buf[2] = {0x80, cmd};
-    i2c_write_blocking(i2c0, SSD1306_I2C_ADDR, buf, 2, false);
+static void wait_i2c_idle(i2c_inst_t *i2c) {
+    while (!i2c_sched_idle(i2c))
+        i2c_sched_poll(i2c);
 }
 
-void SSD1306_send_cmd_list(uint8_t *buf, int num) {
-    for (int i=0;i<num;i++)
-        SSD1306_send_cmd(buf[i]);
+void SSD1306_send_cmd_list(const uint8_t *buf, int num) {
+    // I2C write process expects a control byte followed by data
+    // Co = 0, D/C = 0 => all the following bytes are commands, so the whole
+    // list goes out in a single transaction
+    static i2c_txn_t txn;
+    txn = (i2c_txn_t) {
+        .addr = SSD1306_I2C_ADDR,
+        .prio = I2C_PRIO_LOW,
+        .hdr = { 0x00 },
+        .hdr_len = 1,
+        .wbuf = buf,
+        .wlen = num,
+    };
+    i2c_sched_submit(SSD1306_I2C_INST, &txn);
+    wait_i2c_idle(SSD1306_I2C_INST);
 }
 
-void SSD1306_send_buf(uint8_t buf[], int buflen) {
-    // in horizontal addressing mode, the column address pointer auto-increments
-    // and then wraps around to the next page, so we can send the entire frame
-    // buffer in one gooooooo!
-
-    // copy our frame buffer into a new buffer because we need to add the control byte
-    // to the beginning
+void SSD1306_send_cmd(uint8_t cmd) {
+    SSD1306_send_cmd_list(&cmd, 1);
+}
 
-    uint8_t *temp_buf = malloc(buflen + 1);
+static volatile bool frame_busy;
+// part of the last frame didn't make it, the display needs a whole one again
+static volatile bool frame_failed;
+// when the reading in the frame being sent was taken
+static uint32_t frame_sample_us;
+
+// written by the frame IRQ and the core0 loop
+static struct {
+    uint32_t frames;
+    uint64_t latency_total_us;  // sensor to pixel: read done to the last chunk of its frame sent
+    uint32_t latency_max_us;
+    uint32_t skipped;           // readings overwritten before core0 got to them
+} pipeline;
+
+static void SSD1306_chunk_done(i2c_txn_t *txn, int result) {
+    if (result < 0)
+        frame_failed = true;
+}
 
-    temp_buf[0] = 0x40;
-    memcpy(temp_buf+1, buf, buflen);
+static void SSD1306_frame_done(i2c_txn_t *txn, int result) {
+    SSD1306_chunk_done(txn, result);
+    uint32_t latency_us = time_us_32() - frame_sample_us;
+    pipeline.frames++;
+    pipeline.latency_total_us += latency_us;
+    pipeline.latency_max_us = MAX(pipeline.latency_max_us, latency_us);
+    frame_busy = false;
+}
 
-    i2c_write_blocking(i2c0, SSD1306_I2C_ADDR, temp_buf, buflen + 1, false);
+void render_async(uint8_t *buf, struct render_area *area) {
+    // update a portion of the display with a render area, returns straight away.
+    // buf must not change until frame_busy is cleared by the last chunk
+    static uint8_t cmds[6];
+    static i2c_txn_t cmd_txn;
+    static i2c_txn_t chunk_txns[SSD1306_MAX_CHUNKS];
+
+    cmds[0] = SSD1306_SET_COL_ADDR;
+    cmds[1] = area->start_col;
+    cmds[2] = area->end_col;
+    cmds[3] = SSD1306_SET_PAGE_ADDR;
+    cmds[4] = area->start_page;
+    cmds[5] = area->end_page;
+
+    frame_busy = true;
+    frame_failed = false;
+    cmd_txn = (i2c_txn_t) {
+        .addr = SSD1306_I2C_ADDR,
+        .prio = I2C_PRIO_LOW,
+        .hdr = { 0x00 },
+        .hdr_len = 1,
+        .wbuf = cmds,
+        .wlen = count_of(cmds),
+        .cb = SSD1306_chunk_done,
+    };
+    i2c_sched_submit(SSD1306_I2C_INST, &cmd_txn);
 
-    free(temp_buf);
+    // in horizontal addressing mode, the column address pointer auto-increments
+    // and then wraps around to the next page, so each chunk carries on where the
+    // last one stopped. Every chunk starts with its own data control byte. A chunk
+    // sent again would land where its first attempt stopped, so a failed one isn't
+    // retried, the whole frame is sent again with the window set up first
+    int num_chunks = (area->buflen + SSD1306_CHUNK_LEN - 1) / SSD1306_CHUNK_LEN;
+    assert(num_chunks <= SSD1306_MAX_CHUNKS);
+    for (int i = 0; i < num_chunks; i++) {
+        int offset = i * SSD1306_CHUNK_LEN;
+        int len = MIN(SSD1306_CHUNK_LEN, area->buflen - offset);
+        chunk_txns[i] = (i2c_txn_t) {
+            .addr = SSD1306_I2C_ADDR,
+            .prio = I2C_PRIO_LOW,
+            .hdr = { 0x40 },
+            .hdr_len = 1,
+            .wbuf = buf + offset,
+            .wlen = len,
+            .flags = I2C_TXN_NO_RETRY,
+            .cb = (i == num_chunks - 1) ? SSD1306_frame_done : SSD1306_chunk_done,
+        };
+        i2c_sched_submit(SSD1306_I2C_INST, &chunk_txns[i]);
+    }
 }
 
 void render(uint8_t *buf, struct render_area *area) {
-    // update a portion of the display with a render area
-    uint8_t cmds[] = {
-        SSD1306_SET_COL_ADDR,
-        area->start_col,
-        area->end_col,
-        SSD1306_SET_PAGE_ADDR,
-        area->start_page,
-        area->end_page
-    };
+    render_async(buf, area);
+    while (frame_busy)
+        i2c_sched_poll(SSD1306_I2C_INST);
+}
 
-    SSD1306_send_cmd_list(cmds, count_of(cmds));
-    SSD1306_send_buf(buf, area->buflen);
+static void SSD1306_init_done(i2c_txn_t *txn, int result) {
+    if (result < 0)
+        LOG("\nSSD1306 init failed: %d", result);
+    boot_mark(BOOT_DISPLAY_READY);
 }
 
-void SSD1306_init() {
+void SSD1306_init_async() {
+    // Queued and sent from the I2C IRQ, the caller doesn't wait for it.
     // Some of these commands are not strictly necessary as the reset
     // process defaults to some of these but they are shown here
     // to demonstrate what the initialization sequence looks like
     // Some configuration values are recommended by the board manufacturer
 
-    uint8_t cmds[] = {
+    static const uint8_t cmds[] = {
         SSD1306_SET_DISP,               // set display off
         /* memory mapping */
         SSD1306_SET_MEM_MODE,           // set memory address mode 0 = horizontal, 1 = vertical, 2 = page
@@ -243,10 +371,41 @@ void SSD1306_init() {
         SSD1306_SET_CHARGE_PUMP,        // set charge pump
         0x14,                           // Vcc internally generated on our board
         SSD1306_SET_SCROLL | 0x00,      // deactivate horizontal scrolling if set. This is necessary as memory writes will corrupt if scrolling was enabled
-        SSD1306_SET_DISP | 0x01, // turn display on
+        // the display stays off until the first frame is in its RAM, see SSD1306_display_on_async
     };
 
-    SSD1306_send_cmd_list(cmds, count_of(cmds));
+    static i2c_txn_t txn;
+    txn = (i2c_txn_t) {
+        .addr = SSD1306_I2C_ADDR,
+        .prio = I2C_PRIO_LOW,
+        .hdr = { 0x00 },
+        .hdr_len = 1,
+        .wbuf = cmds,
+        .wlen = count_of(cmds),
+        .cb = SSD1306_init_done,
+    };
+    i2c_sched_submit(SSD1306_I2C_INST, &txn);
+}
+
+static void SSD1306_display_on_done(i2c_txn_t *txn, int result) {
+    boot_mark(BOOT_FIRST_FRAME);
+}
+
+// Queued behind a frame, so it shows that frame instead of whatever was in RAM at
+// power up. Saves clearing the display first
+void SSD1306_display_on_async() {
+    static const uint8_t cmd = SSD1306_SET_DISP | 0x01;
+    static i2c_txn_t txn;
+    txn = (i2c_txn_t) {
+        .addr = SSD1306_I2C_ADDR,
+        .prio = I2C_PRIO_LOW,
+        .hdr = { 0x00 },
+        .hdr_len = 1,
+        .wbuf = &cmd,
+        .wlen = 1,
+        .cb = SSD1306_display_on_done,
+    };
+    i2c_sched_submit(SSD1306_I2C_INST, &txn);
 }
 
 /* BMP280 related functions */
@@ -270,55 +429,111 @@ int32_t BMP280_convert_temp(int32_t temp, struct BMP280_calib_param* params) {
     return (t_fine * 5 + 128) >> 8;
 }
 
-void BMP280_read_raw(int32_t* temp) {
+// store the 20 bit read in a 32 bit signed integer for conversion
+static inline int32_t BMP280_raw_temp(const uint8_t buf[3]) {
+    return (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
+}
+
+static uint8_t sample_buf[3];
+static i2c_txn_t sample_txn;
+static volatile bool sample_pending;
+static volatile bool sample_ready;
+static volatile uint32_t sample_us;
+
+static void BMP280_sample_done(i2c_txn_t *txn, int result) {
+    sample_us = time_us_32();
+    sample_pending = false;
+    sample_ready = result > 0;
+}
+
+void BMP280_read_raw_async() {
     // BMP280 data registers are auto-incrementing and we have 3 temperature
-    // registers, so we start at 0xFA and read 3 bytes to 0xFC
+    // registers, so we start at 0xFA and read 3 bytes to 0xFC. The register write
+    // and the read are joined with a RESTART so we keep master control of the bus
     // note: normal mode does not require further ctrl_meas and config register writes
-    uint8_t buf[3];
-    uint8_t reg = REG_TEMP_MSB;
-    i2c_write_blocking(i2c1, BMP280_I2C_ADDR, &reg, 1, true);  // true to keep master control of bus
-    i2c_read_blocking(i2c1, BMP280_I2C_ADDR, buf, 3, false);  // false - finished with bus
-    // store the 20 bit read in a 32 bit signed integer for conversion
-    *temp = (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
+    sample_txn = (i2c_txn_t) {
+        .addr = BMP280_I2C_ADDR,
+        .prio = I2C_PRIO_HIGH,
+        .hdr = { REG_TEMP_MSB },
+        .hdr_len = 1,
+        .rbuf = sample_buf,
+        .rlen = sizeof(sample_buf),
+        .baudrate = BMP280_I2C_BAUDRATE,
+        .cb = BMP280_sample_done,
+    };
+    sample_pending = true;
+    i2c_sched_submit(BMP280_I2C_INST, &sample_txn);
 }
 
-void BMP280_get_calib_params(struct BMP280_calib_param* params) {
+static struct BMP280_calib_param bmp280_params;
+static uint8_t calib_buf[NUM_CALIB_PARAMS];
+static absolute_time_t bmp280_first_sample;
+
+static void BMP280_meas_started(i2c_txn_t *txn, int result) {
+    // normal mode from here, the first conversion is done one measurement time later
+    bmp280_first_sample = make_timeout_time_us(BMP280_MEAS_TIME_US);
+}
+
+static void BMP280_calib_done(i2c_txn_t *txn, int result) {
+    if (result < 0) {
+        LOG("\nBMP280 init failed: %d", result);
+        return;
+    }
     // raw temp values need to be calibrated according to
     // parameters generated during the manufacturing of the sensor
     // there are 3 temperature params, each with a LSB
     // and MSB register, so we read from 6 registers
-
-    uint8_t buf[NUM_CALIB_PARAMS] = { 0 };
-    uint8_t reg = REG_DIG_T1_LSB;
-    i2c_write_blocking(i2c1, BMP280_I2C_ADDR, &reg, 1, true);  // true to keep master control of bus
-    // read in one go as register addresses auto-increment
-    i2c_read_blocking(i2c1, BMP280_I2C_ADDR, buf, NUM_CALIB_PARAMS, false);  // false, we're done reading
-
-    // store these in a struct for later use
-    params->dig_t1 = (uint16_t)(buf[1] << 8) | buf[0];
-    params->dig_t2 = (int16_t)(buf[3] << 8) | buf[2];
-    params->dig_t3 = (int16_t)(buf[5] << 8) | buf[4];
+    const uint8_t *buf = calib_buf;
+    bmp280_params.dig_t1 = (uint16_t)(buf[1] << 8) | buf[0];
+    bmp280_params.dig_t2 = (int16_t)(buf[3] << 8) | buf[2];
+    bmp280_params.dig_t3 = (int16_t)(buf[5] << 8) | buf[4];
+    boot_mark(BOOT_SENSOR_READY);
 }
 
-void BMP280_init() {
+void BMP280_init_async() {
+    // Configuration and the calibration read are queued together and run from the
+    // I2C IRQ, BOOT_SENSOR_READY is marked when they are done.
     // use the "handheld device dynamic" optimal setting (see datasheet)
-    uint8_t buf[2];
+    static i2c_txn_t txns[3];
 
     // 500ms sampling time, x16 filter
     const uint8_t reg_config_val = ((0x04 << 5) | (0x05 << 2)) & 0xFC;
-
-    // send register number followed by its corresponding value
-    buf[0] = REG_CONFIG;
-    buf[1] = reg_config_val;
-    i2c_write_blocking(i2c1, BMP280_I2C_ADDR, buf, 2, false);
-
     // osrs_t x1, osrs_p x4, normal mode operation
     const uint8_t reg_ctrl_meas_val = (0x01 << 5) | (0x03 << 2) | (0x03);
-    buf[0] = REG_CTRL_MEAS;
-    buf[1] = reg_ctrl_meas_val;
-    i2c_write_blocking(i2c1, BMP280_I2C_ADDR, buf, 2, false);
+
+    // register number followed by its value, both in the header
+    txns[0] = (i2c_txn_t) {
+        .addr = BMP280_I2C_ADDR,
+        .prio = I2C_PRIO_HIGH,
+        .hdr = { REG_CONFIG, reg_config_val },
+        .hdr_len = 2,
+        .baudrate = BMP280_I2C_BAUDRATE,
+    };
+    txns[1] = (i2c_txn_t) {
+        .addr = BMP280_I2C_ADDR,
+        .prio = I2C_PRIO_HIGH,
+        .hdr = { REG_CTRL_MEAS, reg_ctrl_meas_val },
+        .hdr_len = 2,
+        .baudrate = BMP280_I2C_BAUDRATE,
+        .cb = BMP280_meas_started,
+    };
+    // read in one go as register addresses auto-increment
+    txns[2] = (i2c_txn_t) {
+        .addr = BMP280_I2C_ADDR,
+        .prio = I2C_PRIO_HIGH,
+        .hdr = { REG_DIG_T1_LSB },
+        .hdr_len = 1,
+        .rbuf = calib_buf,
+        .rlen = sizeof(calib_buf),
+        .baudrate = BMP280_I2C_BAUDRATE,
+        .cb = BMP280_calib_done,
+    };
+    for (int i = 0; i < count_of(txns); i++)
+        i2c_sched_submit(BMP280_I2C_INST, &txns[i]);
 }
 
+void init_bmp280_i2c();
+
 void init_i2c() {
     // i2c for OLED
     gpio_init(SSD1306_I2C_SDA_PIN);
@@ -329,8 +544,17 @@ void init_i2c() {
     gpio_set_function(SSD1306_I2C_SCL_PIN, GPIO_FUNC_I2C);
     gpio_pull_up(SSD1306_I2C_SCL_PIN);
 
-    i2c_init(i2c0, SSD1306_I2C_BAUDRATE);
+    i2c_init(SSD1306_I2C_INST, SSD1306_I2C_BAUDRATE);
+    i2c_sched_init(SSD1306_I2C_INST, SSD1306_I2C_SDA_PIN, SSD1306_I2C_SCL_PIN, SSD1306_I2C_BAUDRATE);
 
+#if !defined(SHARED_I2C_BUS) && !defined(MULTICORE_PIPELINE)
+    // in the pipeline core1 does this itself, so the bus IRQ is on core1
+    init_bmp280_i2c();
+#endif
+}
+
+#ifndef SHARED_I2C_BUS
+void init_bmp280_i2c() {
     // i2c for BMP280
     gpio_init(BMP280_I2C_SDA_PIN);
     gpio_set_function(BMP280_I2C_SDA_PIN, GPIO_FUNC_I2C);
@@ -340,22 +564,272 @@ void init_i2c() {
     gpio_set_function(BMP280_I2C_SCL_PIN, GPIO_FUNC_I2C);
     gpio_pull_up(BMP280_I2C_SCL_PIN);
 
-    i2c_init(i2c1, BMP280_I2C_BAUDRATE);
+    i2c_init(BMP280_I2C_INST, BMP280_I2C_BAUDRATE);
+    i2c_sched_init(BMP280_I2C_INST, BMP280_I2C_SDA_PIN, BMP280_I2C_SCL_PIN, BMP280_I2C_BAUDRATE);
+}
+#endif
+
+static void print_i2c_stats(i2c_inst_t *i2c) {
+    static const char *prio_names[I2C_PRIO_COUNT] = { "high", "low" };
+    struct i2c_sched_stats stats[I2C_PRIO_COUNT];
+    i2c_sched_get_stats(i2c, stats, true);
+    for (int p = 0; p < I2C_PRIO_COUNT; p++) {
+        if (!stats[p].count)
+            continue;
+        LOG("\ni2c%d %-4s: %u txns", i2c_get_index(i2c), prio_names[p], stats[p].count);
+        LOG(", latency avg %u us max %u us", (uint32_t)(stats[p].total_us / stats[p].count), stats[p].max_us);
+        LOG(", %u nacks, %u timeouts, %u retries, %u errors",
+            stats[p].nacks, stats[p].timeouts, stats[p].retries, stats[p].errors);
+    }
+}
+
+static void print_log_stats(void) {
+    struct log_stats stats;
+    log_get_stats(&stats, true);
+    LOG("\nlog: %u records, %u dropped, max fill %u words, %u cycles per call",
+        stats.records, stats.dropped, stats.max_fill, stats.cycles_per_call);
+}
+
+// "Temp: 23.45 ^C", padded with spaces to the full row so a shorter reading
+// overwrites all of the previous one
+static void format_temperature(char *text, size_t size, int32_t centi_degrees) {
+    size_t len = fixfmt_str(text, size, "Temp: ");
+    len += fixfmt_fixed(text + len, size - len, centi_degrees, 2, 2);
+    len += fixfmt_str(text + len, size - len, " ^C");
+    while (len < size - 1)
+        text[len++] = ' ';
+    text[len] = '\0';
+}
+
+#ifdef FIXFMT_BENCH
+// cycles of the processor clock for one call of fn, averaged over runs
+static uint32_t bench_cycles(void (*fn)(char *, int32_t), char *text, int runs) {
+    systick_hw->rvr = 0xffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;      // enabled, processor clock, no interrupt
+    uint32_t start = systick_hw->cvr;
+    for (int i = 0; i < runs; i++)
+        fn(text, 2345 - 37 * i);
+    return ((start - systick_hw->cvr) & 0xffffff) / runs;
+}
+
+static void bench_printf(char *text, int32_t t) {
+    snprintf(text, SSD1306_WIDTH / 8 + 1, "Temp: %.2f ^C", t / 100.0f);
+}
+
+static void bench_fixfmt(char *text, int32_t t) {
+    format_temperature(text, SSD1306_WIDTH / 8 + 1, t);
+}
+
+// Checks fixfmt against printf, then times both on the display string. The flash
+// saved shows in arm-none-eabi-size with PICO_PRINTF_SUPPORT_FLOAT=0 (see CMakeLists.txt)
+static void fixfmt_bench(void) {
+    char a[24], b[24];
+    uint mismatches = 0;
+    for (int32_t v = -100000; v <= 100000; v += 7) {
+        snprintf(a, sizeof(a), "%.2f", v / 100.0f);
+        fixfmt_fixed(b, sizeof(b), v, 2, 2);
+        mismatches += strcmp(a, b) != 0;
+    }
+    char text[SSD1306_WIDTH / 8 + 1];
+    uint32_t printf_cycles = bench_cycles(bench_printf, text, 256);
+    uint32_t fixfmt_cycles = bench_cycles(bench_fixfmt, text, 256);
+    printf("\nfixfmt: %u mismatches with printf, snprintf(\"%%.2f\") %u cycles, fixfmt %u cycles (%ux)\n",
+           mismatches, printf_cycles, fixfmt_cycles, printf_cycles / MAX(fixfmt_cycles, 1));
+}
+#endif
+
+#ifdef TELEMETRY_BINARY
+static telemetry_t telemetry;
+
+static void telemetry_write(const uint8_t *data, size_t len) {
+    // raw, no CR/LF translation
+    for (size_t i = 0; i < len; i++)
+        putchar_raw(data[i]);
+}
+#endif
+
+/* Readings, the same on one core or two */
+
+struct sample {
+    int32_t raw;
+    int32_t temp;
+    uint32_t sample_us;         // when the read finished
+};
+
+// one display row, 8 pixels per character
+static char text_temperature[SSD1306_WIDTH / 8 + 1];
+static uint32_t text_sample_us;
+static bool frame_dirty;
+
+// on core0, with a new reading
+static void handle_sample(const struct sample *s) {
+    boot_mark(BOOT_FIRST_SAMPLE);
+    format_temperature(text_temperature, sizeof(text_temperature), s->temp);
+    text_sample_us = s->sample_us;
+#ifdef TELEMETRY_BINARY
+    struct telemetry_sample sample = {
+        .timestamp_us = s->sample_us,
+        .temp = s->temp,
+        .raw_temp = s->raw,
+    };
+    telemetry_add(&telemetry, &sample);
+#else
+    // integers only, so nothing needs float printf
+    LOG("Temp: %s%d.%02d ^C :)", s->temp < 0 ? "-" : "", abs(s->temp) / 100, abs(s->temp) % 100);
+#endif
+    frame_dirty = true;
+}
+
+static void print_pipeline_stats(void) {
+    uint32_t status = save_and_disable_interrupts();
+    uint32_t frames = pipeline.frames;
+    uint64_t latency_total_us = pipeline.latency_total_us;
+    uint32_t latency_max_us = pipeline.latency_max_us;
+    uint32_t skipped = pipeline.skipped;
+    memset(&pipeline, 0, sizeof(pipeline));
+    restore_interrupts(status);
+
+    if (frames)
+        LOG("\npipeline: %u frames, sensor to pixel avg %u us max %u us, %u readings skipped",
+            frames, (uint32_t)(latency_total_us / frames), latency_max_us, skipped);
+}
+
+#ifdef MULTICORE_PIPELINE
+/* Core1: BMP280 */
+
+// Latest reading from core1. Core1 makes seq odd while it writes, core0 copies and
+// tries again if seq was odd or has changed meanwhile. Neither side waits for the other
+static struct {
+    volatile uint32_t seq;
+    volatile int32_t raw;
+    volatile int32_t temp;
+    volatile uint32_t sample_us;
+} exchange;
+
+// us each core spent waiting, only ever written by its own core
+static volatile uint64_t core_idle_us[NUM_CORES];
+
+static uint core1_alarm;
+
+static void exchange_publish(const struct sample *s) {
+    uint32_t seq = exchange.seq;
+    exchange.seq = seq + 1;
+    __mem_fence_release();
+    exchange.raw = s->raw;
+    exchange.temp = s->temp;
+    exchange.sample_us = s->sample_us;
+    __mem_fence_release();
+    exchange.seq = seq + 2;
+    // core0 may be waiting for it in WFE
+    __sev();
+}
+
+// on core0, true with a reading it hasn't seen yet
+static bool exchange_read(struct sample *s) {
+    static uint32_t last_seq;
+    uint32_t seq;
+    do {
+        seq = exchange.seq;
+        __mem_fence_acquire();
+        s->raw = exchange.raw;
+        s->temp = exchange.temp;
+        s->sample_us = exchange.sample_us;
+        __mem_fence_acquire();
+    } while ((seq & 1) || exchange.seq != seq);
+
+    if (seq == last_seq)
+        return false;
+    if (last_seq)
+        pipeline.skipped += (seq - last_seq) / 2 - 1;
+    last_seq = seq;
+    return true;
 }
 
+// only here to have the IRQ on core1, waking up is all it is for
+static void core1_alarm_cb(uint alarm_num) {
+}
+
+// WFE until t, or until an I2C IRQ or a spurious event ends it early. IRQ handlers
+// taken while waiting count as idle, for the short I2C and alarm ones that is noise
+static void core1_wait_until(absolute_time_t t) {
+    uint64_t start = time_us_64();
+    if (!hardware_alarm_set_target(core1_alarm, t))
+        __wfe();
+    core_idle_us[1] += time_us_64() - start;
+}
+
+static void core1_main(void) {
+    // set up from here, so the alarm and the bus IRQs are taken by core1
+    core1_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(core1_alarm, core1_alarm_cb);
+    init_bmp280_i2c();
+    BMP280_init_async();
+
+    bool sampling = false;
+    absolute_time_t next_sample = nil_time;
+    while (true) {
+        // the first sample as soon as the first conversion is done
+        if (!sampling && boot_reached(BOOT_SENSOR_READY)) {
+            next_sample = bmp280_first_sample;
+            sampling = true;
+        }
+        if (sampling && time_reached(next_sample) && !sample_pending) {
+            BMP280_read_raw_async();
+            next_sample = delayed_by_ms(next_sample, SAMPLE_INTERVAL_MS);
+        }
+        if (sample_ready) {
+            sample_ready = false;
+            struct sample s = {
+                .raw = BMP280_raw_temp(sample_buf),
+                .sample_us = sample_us,
+            };
+            s.temp = BMP280_convert_temp(s.raw, &bmp280_params);
+            exchange_publish(&s);
+        }
+        i2c_sched_poll(BMP280_I2C_INST);
+        core1_wait_until(sampling ? next_sample : make_timeout_time_ms(1));
+    }
+}
+
+static void print_core_load(void) {
+    static uint64_t last_idle_us[NUM_CORES];
+    static uint64_t last_us;
+    uint64_t now = time_us_64();
+    uint64_t elapsed = now - last_us;
+
+    LOG("\ncores:");
+    for (uint core = 0; core < NUM_CORES; core++) {
+        uint64_t idle_us = core_idle_us[core];
+        uint32_t busy_permille = 1000 - (uint32_t)((idle_us - last_idle_us[core]) * 1000 / elapsed);
+        LOG(" core%u %u.%u%% busy", core, busy_permille / 10, busy_permille % 10);
+        last_idle_us[core] = idle_us;
+    }
+    last_us = now;
+}
+#endif
+
+/* Core0: display, logs, stdio */
+
 int main() {
-    stdio_init_all();
-    //Code here
+    boot_mark(BOOT_MAIN);
+    // before anything logs, nothing below waits on stdio
+    log_init();
     init_i2c();
-    //BMP280 init
-    BMP280_init();
-    struct BMP280_calib_param params; // retrieve fixed compensation params
-    BMP280_get_calib_params(&params);
-    int32_t raw_temperature;
-    int32_t temperature;
-    char* text_temperature;
-    //SSD1306 init
-    SSD1306_init();
+    boot_mark(BOOT_I2C_UP);
+    // Both device inits go out now and run from the I2C IRQs, one per controller at the
+    // same time, while USB comes up below
+#ifdef MULTICORE_PIPELINE
+    multicore_launch_core1(core1_main);
+#else
+    BMP280_init_async();
+#endif
+    SSD1306_init_async();
+    // doesn't wait for the host (see CMakeLists.txt), LOGs stay in their rings until
+    // it connects
+    stdio_init_all();
+    boot_mark(BOOT_STDIO_UP);
+
     // Initialize render area for entire frame
     struct render_area frame_area = {
         start_col: 0,
@@ -363,24 +837,104 @@ int main() {
         start_page : 0,
         end_page : SSD1306_NUM_PAGES - 1
         };
-    // zero the entire display
-    uint8_t buf[SSD1306_BUF_LEN];
-    memset(buf, 0, SSD1306_BUF_LEN);
-    render(buf, &frame_area);
+    calc_render_area_buflen(&frame_area);
+    // the first frame covers the entire display, no need to clear it before
+    static uint8_t buf[SSD1306_BUF_LEN];
 
-    sleep_ms(250); // sleep so that data polling and register update don't collide
+#ifndef MULTICORE_PIPELINE
+    bool sampling = false;
+    absolute_time_t next_sample = nil_time;
+#endif
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+    bool display_on = false;
+    bool boot_reported = false;
+#ifdef TELEMETRY_BINARY
+    telemetry_init(&telemetry, TELEMETRY_F_TEMP | TELEMETRY_F_RAW_TEMP,
+                   TELEMETRY_BATCH, TELEMETRY_MAX_AGE_MS * 1000, telemetry_write);
+#endif
 
-measure_display_loop:
-    calc_render_area_buflen(&frame_area);
-    BMP280_read_raw(&raw_temperature);
-    temperature = BMP280_convert_temp(raw_temperature, &params);
-    sprintf(text_temperature, "Temp: %.2f ^C", temperature/100.0f);
-    printf("%s :)", text_temperature);
-    // Write temperature to display
-    WriteString(buf, 0, 0, text_temperature);
-    render(buf, &frame_area);
-    sleep_ms(1000);
-    goto measure_display_loop;
+    while (true) {
+#ifdef MULTICORE_PIPELINE
+        struct sample s;
+        if (exchange_read(&s))
+            handle_sample(&s);
+#else
+        // the first sample as soon as the first conversion is done
+        if (!sampling && boot_reached(BOOT_SENSOR_READY)) {
+            next_sample = bmp280_first_sample;
+            sampling = true;
+        }
+        if (sampling && time_reached(next_sample) && !sample_pending) {
+            BMP280_read_raw_async();
+            next_sample = delayed_by_ms(next_sample, SAMPLE_INTERVAL_MS);
+        }
+        if (sample_ready) {
+            sample_ready = false;
+            struct sample s = {
+                .raw = BMP280_raw_temp(sample_buf),
+                .sample_us = sample_us,
+            };
+            s.temp = BMP280_convert_temp(s.raw, &bmp280_params);
+            handle_sample(&s);
+        }
+#endif
+#ifdef TELEMETRY_BINARY
+        telemetry_poll(&telemetry, time_us_32());
+#endif
+        // bus recovery after a timeout, core1 does its own bus in the pipeline
+        i2c_sched_poll(SSD1306_I2C_INST);
+#if !defined(SHARED_I2C_BUS) && !defined(MULTICORE_PIPELINE)
+        i2c_sched_poll(BMP280_I2C_INST);
+#endif
+        // Write temperature to display, the frame buffer is only touched between flushes
+        if ((frame_dirty || frame_failed) && !frame_busy && boot_reached(BOOT_DISPLAY_READY)) {
+            WriteString(buf, 0, 0, text_temperature);
+            frame_sample_us = text_sample_us;
+            render_async(buf, &frame_area);
+            if (!display_on) {
+                SSD1306_display_on_async();
+                display_on = true;
+            }
+            frame_dirty = false;
+        }
+        if (time_reached(next_stats)) {
+            print_i2c_stats(SSD1306_I2C_INST);
+#ifndef SHARED_I2C_BUS
+            print_i2c_stats(BMP280_I2C_INST);
+#endif
+            print_log_stats();
+            print_pipeline_stats();
+#ifdef MULTICORE_PIPELINE
+            print_core_load();
+#endif
+            next_stats = delayed_by_ms(next_stats, STATS_INTERVAL_MS);
+        }
+        // nobody listening yet, the LOGs wait in their rings instead of going nowhere
+        if (boot_stdio_ready()) {
+            if (!boot_reported && boot_reached(BOOT_FIRST_FRAME)) {
+                boot_report();
+#ifdef FIXFMT_BENCH
+                fixfmt_bench();
+#endif
+                boot_reported = true;
+            }
+            // formatting and stdio happen here, and only as much as the sink takes now
+            log_drain(LOG_DRAIN_BATCH);
+        }
+#ifdef MULTICORE_PIPELINE
+        // until core1 has a reading (SEV), a frame is done or the logs need draining
+        uint64_t wait_start = time_us_64();
+        best_effort_wfe_or_timeout(make_timeout_time_ms(CORE0_WAIT_MS));
+        core_idle_us[0] += time_us_64() - wait_start;
+#else
+        // until the next sample or stats are due, a transaction is done (SEV from the
+        // I2C IRQ) or the logs need draining
+        absolute_time_t wake = absolute_time_min(next_stats, make_timeout_time_ms(CORE0_WAIT_MS));
+        if (sampling)
+            wake = absolute_time_min(wake, next_sample);
+        best_effort_wfe_or_timeout(wake);
+#endif
+    }
 
     return 0;
 }
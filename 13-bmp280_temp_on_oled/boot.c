@@ -0,0 +1,60 @@
+#include "boot.h"
+#include "log.h"
+
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#endif
+
+static const char *phase_names[BOOT_PHASE_COUNT] = {
+    "main", "i2c up", "stdio up", "sensor ready", "display ready",
+    "first sample", "first frame", "host connected",
+};
+
+// 0 until reached, the timer is well past 0 by the time main runs
+static volatile uint64_t phase_us[BOOT_PHASE_COUNT];
+
+void boot_mark(enum boot_phase phase) {
+    uint32_t status = save_and_disable_interrupts();
+    if (!phase_us[phase])
+        phase_us[phase] = time_us_64();
+    restore_interrupts(status);
+}
+
+bool boot_reached(enum boot_phase phase) {
+    return phase_us[phase] != 0;
+}
+
+uint64_t boot_time_us(enum boot_phase phase) {
+    return phase_us[phase];
+}
+
+bool boot_stdio_ready(void) {
+    if (boot_reached(BOOT_HOST_CONNECTED))
+        return true;
+#if LIB_PICO_STDIO_USB
+    if (!stdio_usb_connected())
+        return false;
+#endif
+    boot_mark(BOOT_HOST_CONNECTED);
+    return true;
+}
+
+void boot_report(void) {
+    // in time order, the phases on the two buses finish in either order
+    bool done[BOOT_PHASE_COUNT] = { false };
+    uint64_t prev = 0;
+    LOG("\nboot:");
+    while (true) {
+        int next = -1;
+        for (int p = 0; p < BOOT_PHASE_COUNT; p++) {
+            if (boot_reached(p) && !done[p] && (next < 0 || phase_us[p] < phase_us[next]))
+                next = p;
+        }
+        if (next < 0)
+            break;
+        done[next] = true;
+        uint64_t t = phase_us[next];
+        LOG("\n  %-14s %7u us (+%u us)", phase_names[next], (uint32_t)t, (uint32_t)(t - prev));
+        prev = t;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef _BOOT_H
+#define _BOOT_H
+
+#include "pico/stdlib.h"
+
+// Boot phase timestamps, to see where the time from reset to the first sample and
+// the first frame on the display goes.
+//
+// Times are us on the system timer, which starts counting during runtime init. The
+// boot ROM and the flash second stage before that are not included (a few ms).
+// Each phase keeps the time of its first boot_mark(), marks are safe from IRQs.
+
+enum boot_phase {
+    BOOT_MAIN = 0,              // main() entered
+    BOOT_I2C_UP,                // controllers and schedulers set up
+    BOOT_STDIO_UP,              // stdio_init_all() returned
+    BOOT_SENSOR_READY,          // BMP280 configured, calibration read
+    BOOT_DISPLAY_READY,         // SSD1306 init sequence sent
+    BOOT_FIRST_SAMPLE,
+    BOOT_FIRST_FRAME,           // first reading on the display, display switched on
+    BOOT_HOST_CONNECTED,        // stdio reaches someone, buffered logs start to flow
+    BOOT_PHASE_COUNT
+};
+
+void boot_mark(enum boot_phase phase);
+
+bool boot_reached(enum boot_phase phase);
+
+uint64_t boot_time_us(enum boot_phase phase);
+
+// True once output goes somewhere: the USB host has the port open, or straight
+// away with UART stdio. Marks BOOT_HOST_CONNECTED the first time
+bool boot_stdio_ready(void);
+
+// LOGs the phases reached so far in time order, each with the time since the one before
+void boot_report(void);
+
+#endif
@@ -0,0 +1,65 @@
+#include "fixfmt.h"
+
+static const uint32_t pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+size_t fixfmt_fixed(char *buf, size_t size, int32_t value, uint frac_digits, uint decimals) {
+    // digits in reverse, at most 10 plus the point, the sign and zero padding
+    char tmp[24];
+    uint n = 0;
+    bool neg = value < 0;
+    uint32_t mag = neg ? 0u - (uint32_t)value : (uint32_t)value;
+    uint pad = 0;
+
+    frac_digits = MIN(frac_digits, 9);
+    decimals = MIN(decimals, 9);
+    if (decimals < frac_digits) {
+        uint32_t div = pow10[frac_digits - decimals];
+        uint32_t rem = mag % div;
+        mag /= div;
+        // rem < 10^9, doubling it can't overflow
+        if (rem * 2 >= div)
+            mag++;
+        frac_digits = decimals;
+    } else {
+        pad = decimals - frac_digits;
+    }
+    // no "-0.00" for something that rounded to nothing
+    neg = neg && mag;
+
+    while (pad--)
+        tmp[n++] = '0';
+    for (uint i = 0; i < frac_digits; i++) {
+        tmp[n++] = '0' + mag % 10;
+        mag /= 10;
+    }
+    if (decimals)
+        tmp[n++] = '.';
+    do {
+        tmp[n++] = '0' + mag % 10;
+        mag /= 10;
+    } while (mag);
+    if (neg)
+        tmp[n++] = '-';
+
+    if (!size)
+        return 0;
+    size_t len = MIN(n, size - 1);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = tmp[n - 1 - i];
+    buf[len] = '\0';
+    return len;
+}
+
+size_t fixfmt_str(char *buf, size_t size, const char *str) {
+    if (!size)
+        return 0;
+    size_t len = 0;
+    while (str[len] && len < size - 1) {
+        buf[len] = str[len];
+        len++;
+    }
+    buf[len] = '\0';
+    return len;
+}
@@ -0,0 +1,28 @@
+#ifndef _FIXFMT_H
+#define _FIXFMT_H
+
+#include "pico/stdlib.h"
+
+// Integer only number formatting for fixed point readings, in place of
+// sprintf("%.2f"), which pulls float printf into the image and costs thousands of
+// cycles per call on a core without an FPU.
+//
+// All functions write into buf, never more than size bytes, always NUL terminate
+// (size > 0) and return the length written without the NUL. Appending is
+//   len += fixfmt_...(buf + len, sizeof(buf) - len, ...)
+
+// value has frac_digits implied decimals, e.g. centi-degrees have 2. It is written
+// with decimals decimals, rounded half away from zero if that is fewer:
+//   fixfmt_fixed(buf, size, 2345, 2, 2)      "23.45"     centi-degrees
+//   fixfmt_fixed(buf, size, 101325, 3, 1)    "101.3"     Pa as kPa
+//   fixfmt_fixed(buf, size, -5, 2, 1)        "-0.1"
+// Up to 9 of either.
+size_t fixfmt_fixed(char *buf, size_t size, int32_t value, uint frac_digits, uint decimals);
+
+static inline size_t fixfmt_int(char *buf, size_t size, int32_t value) {
+    return fixfmt_fixed(buf, size, value, 0, 0);
+}
+
+size_t fixfmt_str(char *buf, size_t size, const char *str);
+
+#endif
@@ -0,0 +1,235 @@
+// Host side formatter for LOG_BINARY records (see ../log.h).
+//
+//   log_decode [-t] <elf> [file]   format a capture or a serial port (set up with stty
+//                                  first), stdin if no file. The format strings and any
+//                                  %s arguments are looked up in the ELF the device runs.
+//                                  -t puts the timestamp and core in front of each record
+//
+// Frames that are not log records, e.g. telemetry frames on the same port, are counted
+// and skipped.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "../telemetry.h"
+}
+
+// as in ../log.h, which needs the SDK
+#define LOG_HDR_WORDS   3
+#define LOG_MAX_ARGS    4
+
+// Allocated sections of an ELF, enough to read strings at their run time address
+class ElfStrings {
+public:
+    bool load(const char *path) {
+        FILE *f = std::fopen(path, "rb");
+        if (!f)
+            return false;
+        std::fseek(f, 0, SEEK_END);
+        image_.resize(std::ftell(f));
+        std::fseek(f, 0, SEEK_SET);
+        bool ok = std::fread(image_.data(), 1, image_.size(), f) == image_.size();
+        std::fclose(f);
+        if (!ok || image_.size() < 64 || std::memcmp(image_.data(), "\x7f" "ELF", 4) || image_[5] != 1)
+            return false;
+
+        // 32 bit for the Pico, 64 bit is only here so a host build can be checked too
+        bool is64 = image_[4] == 2;
+        uint64_t shoff = is64 ? get(0x28, 8) : get(0x20, 4);
+        uint64_t shentsize = get(is64 ? 0x3a : 0x2e, 2);
+        uint64_t shnum = get(is64 ? 0x3c : 0x30, 2);
+        for (uint64_t i = 0; i < shnum; i++) {
+            uint64_t sh = shoff + i * shentsize;
+            if (sh + shentsize > image_.size())
+                return false;
+            uint32_t type = get(sh + 4, 4);
+            uint64_t flags = is64 ? get(sh + 8, 8) : get(sh + 8, 4);
+            Section s;
+            s.addr = is64 ? get(sh + 0x10, 8) : get(sh + 0x0c, 4);
+            s.offset = is64 ? get(sh + 0x18, 8) : get(sh + 0x10, 4);
+            s.size = is64 ? get(sh + 0x20, 8) : get(sh + 0x14, 4);
+            // SHT_PROGBITS, SHF_ALLOC
+            if (type == 1 && (flags & 2) && s.offset + s.size <= image_.size())
+                sections_.push_back(s);
+        }
+        return !sections_.empty();
+    }
+
+    // NULL unless addr is a NUL terminated string in the image
+    const char *string_at(uint32_t addr) const {
+        for (const auto &s : sections_) {
+            if (addr < s.addr || addr >= s.addr + s.size)
+                continue;
+            const char *p = reinterpret_cast<const char *>(image_.data() + s.offset + (addr - s.addr));
+            if (!std::memchr(p, 0, s.size - (addr - s.addr)))
+                return nullptr;
+            return p;
+        }
+        return nullptr;
+    }
+
+private:
+    struct Section {
+        uint64_t addr, offset, size;
+    };
+
+    uint64_t get(uint64_t off, int len) const {
+        uint64_t v = 0;
+        for (int i = len - 1; i >= 0; i--)
+            v = (v << 8) | image_[off + i];
+        return v;
+    }
+
+    std::vector<uint8_t> image_;
+    std::vector<Section> sections_;
+};
+
+class LogDecoder {
+public:
+    struct Stats {
+        uint64_t records = 0;
+        uint64_t lost = 0;              // dropped on the device, as the records report it
+        uint64_t other_frames = 0;      // not a log record, or a format not in the ELF
+    };
+
+    LogDecoder(const ElfStrings &elf, bool timestamps) : elf_(elf), timestamps_(timestamps) {}
+
+    void feed(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if (data[i]) {
+                // no record is ever this long, we must have missed a delimiter
+                if (encoded_.size() < 256)
+                    encoded_.push_back(data[i]);
+                continue;
+            }
+            if (!encoded_.empty())
+                decode_frame();
+            encoded_.clear();
+        }
+    }
+
+    const Stats &stats() const { return stats_; }
+
+private:
+    void decode_frame() {
+        uint8_t frame[256];
+        size_t len = cobs_decode(encoded_.data(), encoded_.size(), frame);
+        uint32_t w[LOG_HDR_WORDS + LOG_MAX_ARGS];
+        if (len < 4 * LOG_HDR_WORDS || len > sizeof(w) || len % 4) {
+            stats_.other_frames++;
+            return;
+        }
+        for (size_t i = 0; i < len / 4; i++)
+            w[i] = frame[4 * i] | (frame[4 * i + 1] << 8) | (frame[4 * i + 2] << 16) | (uint32_t(frame[4 * i + 3]) << 24);
+
+        uint32_t nargs = w[2] & 0xff;
+        const char *fmt = elf_.string_at(w[0]);
+        if (nargs > LOG_MAX_ARGS || len != 4 * (LOG_HDR_WORDS + nargs) || !fmt) {
+            stats_.other_frames++;
+            return;
+        }
+
+        uint32_t lost = w[2] >> 16;
+        if (lost) {
+            std::printf("[%u log records lost]\n", lost);
+            stats_.lost += lost;
+        }
+        if (timestamps_)
+            std::printf("%10.6f core%u: ", w[1] / 1e6, (w[2] >> 8) & 0xff);
+        std::fputs(format(fmt, w + LOG_HDR_WORDS, nargs).c_str(), stdout);
+        stats_.records++;
+    }
+
+    // One conversion at a time like the device does, with the length modifiers taken
+    // out since every argument is 32 bits on the device
+    std::string format(const char *fmt, const uint32_t *args, uint32_t nargs) const {
+        std::string out;
+        char buf[256];
+        for (const char *p = fmt; *p;) {
+            if (*p != '%') {
+                out += *p++;
+                continue;
+            }
+            const char *end = p + 1;
+            std::string conv = "%";
+            while (*end && std::strchr("-+ #0123456789.hlzjt", *end)) {
+                if (!std::strchr("hlzjt", *end))
+                    conv += *end;
+                end++;
+            }
+            if (!*end)
+                break;
+            conv += *end;
+            p = end + 1;
+
+            if (*end == '%') {
+                out += '%';
+                continue;
+            }
+            if (!nargs)
+                continue;
+            uint32_t arg = *args++;
+            nargs--;
+            if (std::strchr("fFeEgGaA", *end)) {
+                float f;
+                std::memcpy(&f, &arg, sizeof(f));
+                std::snprintf(buf, sizeof(buf), conv.c_str(), double(f));
+            } else if (*end == 's') {
+                const char *s = elf_.string_at(arg);
+                std::snprintf(buf, sizeof(buf), conv.c_str(), s ? s : "(?)");
+            } else {
+                std::snprintf(buf, sizeof(buf), conv.c_str(), arg);
+            }
+            out += buf;
+        }
+        return out;
+    }
+
+    const ElfStrings &elf_;
+    bool timestamps_;
+    std::vector<uint8_t> encoded_;
+    Stats stats_;
+};
+
+int main(int argc, char **argv) {
+    bool timestamps = false;
+    int arg = 1;
+    if (arg < argc && !std::strcmp(argv[arg], "-t")) {
+        timestamps = true;
+        arg++;
+    }
+    if (arg >= argc) {
+        std::fprintf(stderr, "usage: %s [-t] <elf> [file]\n", argv[0]);
+        return 1;
+    }
+
+    ElfStrings elf;
+    if (!elf.load(argv[arg])) {
+        std::fprintf(stderr, "%s: not a readable little endian ELF\n", argv[arg]);
+        return 1;
+    }
+    FILE *in = stdin;
+    if (++arg < argc && !(in = std::fopen(argv[arg], "rb"))) {
+        std::perror(argv[arg]);
+        return 1;
+    }
+
+    LogDecoder dec(elf, timestamps);
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), in)) > 0) {
+        dec.feed(buf, n);
+        // a serial port trickles, show records as they come
+        std::fflush(stdout);
+    }
+
+    const auto &st = dec.stats();
+    std::fprintf(stderr, "%llu records, %llu lost on the device, %llu other frames\n",
+                 (unsigned long long)st.records, (unsigned long long)st.lost,
+                 (unsigned long long)st.other_frames);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include "i2c_bus.h"
+
+// half an SCL period while bit banging the bus clear, ~100kHz
+#define I2C_BUS_CLEAR_HALF_PERIOD_US    5
+
+void i2c_bus_init(i2c_bus_t *bus) {
+    gpio_init(bus->sda_pin);
+    gpio_set_function(bus->sda_pin, GPIO_FUNC_I2C);
+    gpio_pull_up(bus->sda_pin);
+
+    gpio_init(bus->scl_pin);
+    gpio_set_function(bus->scl_pin, GPIO_FUNC_I2C);
+    gpio_pull_up(bus->scl_pin);
+
+    i2c_init(bus->i2c, bus->baudrate);
+}
+
+uint32_t i2c_bus_deadline_us(uint baudrate, size_t len) {
+    // 9 clocks per byte (8 data + ack), plus the address byte
+    uint64_t wire_us = ((uint64_t)(len + 1) * 9 * 1000000) / baudrate;
+    return (uint32_t)(2 * wire_us) + I2C_BUS_SLACK_US;
+}
+
+// open drain emulation: low = drive the pin, high = let the pull-up have it
+static inline void line_release(uint pin) {
+    gpio_set_dir(pin, GPIO_IN);
+}
+
+static inline void line_low(uint pin) {
+    gpio_put(pin, 0);
+    gpio_set_dir(pin, GPIO_OUT);
+}
+
+void i2c_bus_recover(i2c_inst_t *i2c, uint sda_pin, uint scl_pin, uint baudrate) {
+    i2c_deinit(i2c);
+
+    gpio_set_function(sda_pin, GPIO_FUNC_SIO);
+    gpio_set_function(scl_pin, GPIO_FUNC_SIO);
+    line_release(sda_pin);
+    line_release(scl_pin);
+    busy_wait_us_32(I2C_BUS_CLEAR_HALF_PERIOD_US);
+
+    // a slave stuck half way through a byte lets go of SDA within 9 clocks
+    for (int i = 0; i < 9 && !gpio_get(sda_pin); i++) {
+        line_low(scl_pin);
+        busy_wait_us_32(I2C_BUS_CLEAR_HALF_PERIOD_US);
+        line_release(scl_pin);
+        busy_wait_us_32(I2C_BUS_CLEAR_HALF_PERIOD_US);
+    }
+
+    // STOP: SDA goes high while SCL is high
+    line_low(scl_pin);
+    busy_wait_us_32(I2C_BUS_CLEAR_HALF_PERIOD_US);
+    line_low(sda_pin);
+    busy_wait_us_32(I2C_BUS_CLEAR_HALF_PERIOD_US);
+    line_release(scl_pin);
+    busy_wait_us_32(I2C_BUS_CLEAR_HALF_PERIOD_US);
+    line_release(sda_pin);
+    busy_wait_us_32(I2C_BUS_CLEAR_HALF_PERIOD_US);
+
+    gpio_set_function(sda_pin, GPIO_FUNC_I2C);
+    gpio_set_function(scl_pin, GPIO_FUNC_I2C);
+    i2c_init(i2c, baudrate);
+}
+
+static int transfer_once(i2c_bus_t *bus, uint8_t addr, const uint8_t *src, size_t wlen,
+                         uint8_t *dst, size_t rlen, bool nostop) {
+    int ret = 0;
+    if (wlen) {
+        ret = i2c_write_timeout_us(bus->i2c, addr, src, wlen, rlen ? true : nostop,
+                                   i2c_bus_deadline_us(bus->baudrate, wlen));
+        if (ret < 0)
+            return ret;
+    }
+    if (rlen) {
+        ret = i2c_read_timeout_us(bus->i2c, addr, dst, rlen, nostop,
+                                  i2c_bus_deadline_us(bus->baudrate, rlen));
+    }
+    return ret;
+}
+
+static int transfer(i2c_bus_t *bus, uint8_t addr, const uint8_t *src, size_t wlen,
+                    uint8_t *dst, size_t rlen, bool nostop) {
+    uint backoff_us = bus->backoff_us;
+    bus->counters.transfers++;
+
+    for (uint attempt = 0;; attempt++) {
+        int ret = transfer_once(bus, addr, src, wlen, dst, rlen, nostop);
+        if (ret >= 0)
+            return ret;
+
+        if (ret == PICO_ERROR_TIMEOUT) {
+            bus->counters.timeouts++;
+            i2c_bus_recover(bus->i2c, bus->sda_pin, bus->scl_pin, bus->baudrate);
+            bus->counters.recoveries++;
+        } else {
+            bus->counters.nacks++;
+        }
+
+        if (attempt >= bus->max_retries) {
+            bus->counters.failures++;
+            return ret;
+        }
+        bus->counters.retries++;
+        if (backoff_us) {
+            sleep_us(backoff_us);
+            backoff_us = MIN(backoff_us * 2, bus->backoff_max_us);
+        }
+    }
+}
+
+int i2c_bus_write(i2c_bus_t *bus, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    return transfer(bus, addr, src, len, NULL, 0, nostop);
+}
+
+int i2c_bus_read(i2c_bus_t *bus, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    return transfer(bus, addr, NULL, 0, dst, len, nostop);
+}
+
+int i2c_bus_write_read(i2c_bus_t *bus, uint8_t addr, const uint8_t *src, size_t wlen, uint8_t *dst, size_t rlen) {
+    return transfer(bus, addr, src, wlen, dst, rlen, false);
+}
+
+void i2c_bus_print_counters(const i2c_bus_t *bus) {
+    const struct i2c_bus_counters *c = &bus->counters;
+    printf("i2c%d: %u transfers, %u timeouts, %u nacks, %u recoveries, %u retries, %u failures\n",
+           i2c_get_index(bus->i2c), c->transfers, c->timeouts, c->nacks, c->recoveries, c->retries, c->failures);
+}
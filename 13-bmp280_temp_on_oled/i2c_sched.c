@@ -0,0 +1,362 @@
+#include "i2c_sched.h"
+#include "i2c_bus.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+// keep a few commands in the TX FIFO so the bus does not stall between refills
+#define I2C_SCHED_TX_THRESHOLD  4
+
+typedef struct {
+    i2c_inst_t *i2c;
+    uint sda_pin;
+    uint scl_pin;
+    uint baudrate;
+    uint cur_baudrate;
+    spin_lock_t *lock;
+    i2c_txn_t *head[I2C_PRIO_COUNT];
+    i2c_txn_t *tail[I2C_PRIO_COUNT];
+
+    // transaction on the bus
+    i2c_txn_t *active;
+    uint16_t cmd_pos;       // commands pushed into the TX FIFO
+    uint16_t rx_pos;        // bytes pulled out of the RX FIFO
+    bool aborted;
+    alarm_id_t deadline_alarm;
+    // set by the deadline alarm, the active transaction stays on until i2c_sched_poll
+    // has cleared the bus so nothing else starts meanwhile
+    bool timed_out;
+    bool recovering;
+
+    // a retry is waiting for this alarm, nothing starts before it fires
+    alarm_id_t backoff_alarm;
+
+    struct i2c_sched_stats stats[I2C_PRIO_COUNT];
+} i2c_sched_t;
+
+static i2c_sched_t scheds[NUM_I2CS];
+
+static inline i2c_sched_t *get_sched(i2c_inst_t *i2c) {
+    return &scheds[i2c_get_index(i2c)];
+}
+
+static inline uint txn_write_len(const i2c_txn_t *txn) {
+    return txn->hdr_len + txn->wlen;
+}
+
+static inline uint txn_total_len(const i2c_txn_t *txn) {
+    return txn->hdr_len + txn->wlen + txn->rlen;
+}
+
+static void push_front(i2c_sched_t *s, i2c_txn_t *txn) {
+    txn->next = s->head[txn->prio];
+    s->head[txn->prio] = txn;
+    if (!s->tail[txn->prio])
+        s->tail[txn->prio] = txn;
+}
+
+static i2c_txn_t *pop_next(i2c_sched_t *s) {
+    for (int p = 0; p < I2C_PRIO_COUNT; p++) {
+        i2c_txn_t *txn = s->head[p];
+        if (txn) {
+            s->head[p] = txn->next;
+            if (!s->head[p])
+                s->tail[p] = NULL;
+            return txn;
+        }
+    }
+    return NULL;
+}
+
+// read commands in flight are limited by the RX FIFO depth
+static inline bool rx_fifo_limited(const i2c_sched_t *s) {
+    uint wlen = txn_write_len(s->active);
+    return s->cmd_pos >= wlen && s->cmd_pos - wlen - s->rx_pos >= IC_RX_BUFFER_DEPTH;
+}
+
+static void fill_tx_fifo(i2c_sched_t *s) {
+    i2c_hw_t *hw = i2c_get_hw(s->i2c);
+    const i2c_txn_t *txn = s->active;
+    uint wlen = txn_write_len(txn);
+    uint total = txn_total_len(txn);
+
+    while (s->cmd_pos < total && hw->txflr < IC_TX_BUFFER_DEPTH) {
+        uint32_t cmd;
+        if (s->cmd_pos < txn->hdr_len) {
+            cmd = txn->hdr[s->cmd_pos];
+        } else if (s->cmd_pos < wlen) {
+            cmd = txn->wbuf[s->cmd_pos - txn->hdr_len];
+        } else {
+            if (rx_fifo_limited(s))
+                break;
+            cmd = I2C_IC_DATA_CMD_CMD_BITS;
+            if (s->cmd_pos == wlen && wlen)
+                cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+        }
+        if (s->cmd_pos == total - 1)
+            cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        hw->data_cmd = cmd;
+        s->cmd_pos++;
+    }
+}
+
+static void drain_rx_fifo(i2c_sched_t *s) {
+    i2c_hw_t *hw = i2c_get_hw(s->i2c);
+    i2c_txn_t *txn = s->active;
+    while (hw->rxflr) {
+        uint8_t b = (uint8_t)hw->data_cmd;
+        if (s->rx_pos < txn->rlen)
+            txn->rbuf[s->rx_pos++] = b;
+    }
+}
+
+static int64_t deadline_expired(alarm_id_t id, void *user_data);
+static int64_t backoff_expired(alarm_id_t id, void *user_data);
+
+static void setup_controller(i2c_sched_t *s) {
+    i2c_hw_t *hw = i2c_get_hw(s->i2c);
+    hw->intr_mask = 0;
+    hw->tx_tl = I2C_SCHED_TX_THRESHOLD;
+    hw->rx_tl = 0;
+}
+
+// called with the lock held, bus must be idle
+static void start_next(i2c_sched_t *s) {
+    i2c_txn_t *txn = pop_next(s);
+    s->active = txn;
+    if (!txn)
+        return;
+
+    i2c_hw_t *hw = i2c_get_hw(s->i2c);
+    uint baudrate = txn->baudrate ? txn->baudrate : s->baudrate;
+    if (baudrate != s->cur_baudrate) {
+        i2c_set_baudrate(s->i2c, baudrate);
+        s->cur_baudrate = baudrate;
+    }
+
+    hw->enable = 0;
+    hw->tar = txn->addr;
+    hw->enable = 1;
+    (void)hw->clr_intr;
+
+    s->cmd_pos = 0;
+    s->rx_pos = 0;
+    s->aborted = false;
+    txn->attempts++;
+    s->deadline_alarm = add_alarm_in_us(i2c_bus_deadline_us(baudrate, txn_total_len(txn)),
+                                        deadline_expired, s, true);
+    fill_tx_fifo(s);
+
+    hw->intr_mask = I2C_IC_INTR_MASK_M_TX_EMPTY_BITS | I2C_IC_INTR_MASK_M_RX_FULL_BITS |
+                    I2C_IC_INTR_MASK_M_TX_ABRT_BITS | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+}
+
+// called with the lock held
+static void start_if_idle(i2c_sched_t *s) {
+    if (!s->active && !s->backoff_alarm)
+        start_next(s);
+}
+
+// called with the lock held once the active transaction is off the bus. Returns the
+// transaction to call back, or NULL if it was queued again for a retry
+static i2c_txn_t *finish_active(i2c_sched_t *s, int status, int *result) {
+    i2c_txn_t *txn = s->active;
+    struct i2c_sched_stats *st = &s->stats[txn->prio];
+    s->active = NULL;
+
+    if (status < 0 && !(txn->flags & I2C_TXN_NO_RETRY) && txn->attempts <= I2C_SCHED_MAX_RETRIES) {
+        st->retries++;
+        push_front(s, txn);
+        // give the slave time to get over whatever it was busy with. Never fired from
+        // here, the lock is held; without an alarm to be had it goes again straight away
+        uint32_t backoff_us = MIN((uint32_t)I2C_SCHED_BACKOFF_US << (txn->attempts - 1),
+                                  I2C_SCHED_BACKOFF_MAX_US);
+        s->backoff_alarm = add_alarm_in_us(backoff_us, backoff_expired, s, false);
+        if (s->backoff_alarm < 0)
+            s->backoff_alarm = 0;
+        return NULL;
+    }
+
+    uint32_t latency = (uint32_t)(time_us_64() - txn->submit_us);
+    st->count++;
+    st->total_us += latency;
+    if (latency > st->max_us)
+        st->max_us = latency;
+    if (status < 0)
+        st->errors++;
+    *result = status;
+    return txn;
+}
+
+// timer IRQ: the slave is holding the bus or the controller is stuck. Clearing the
+// bus takes a couple of hundred us of bit banging, that is left to i2c_sched_poll
+static int64_t deadline_expired(alarm_id_t id, void *user_data) {
+    i2c_sched_t *s = (i2c_sched_t *)user_data;
+
+    uint32_t save = spin_lock_blocking(s->lock);
+    if (s->active && s->deadline_alarm == id) {
+        s->deadline_alarm = 0;
+        s->stats[s->active->prio].timeouts++;
+        i2c_get_hw(s->i2c)->intr_mask = 0;
+        s->timed_out = true;
+    }
+    spin_unlock(s->lock, save);
+    // the poller may be waiting in WFE
+    __sev();
+    return 0;
+}
+
+// timer IRQ: a retry has waited long enough
+static int64_t backoff_expired(alarm_id_t id, void *user_data) {
+    i2c_sched_t *s = (i2c_sched_t *)user_data;
+
+    uint32_t save = spin_lock_blocking(s->lock);
+    if (s->backoff_alarm == id) {
+        s->backoff_alarm = 0;
+        start_if_idle(s);
+    }
+    spin_unlock(s->lock, save);
+    return 0;
+}
+
+static void i2c_sched_irq(i2c_sched_t *s) {
+    i2c_hw_t *hw = i2c_get_hw(s->i2c);
+    i2c_txn_t *done = NULL;
+    int result = 0;
+
+    uint32_t save = spin_lock_blocking(s->lock);
+    uint32_t stat = hw->intr_stat;
+
+    // recovery resets the controller, which unmasks its interrupts until it is set up again
+    if (!s->active || s->timed_out) {
+        hw->intr_mask = 0;
+        spin_unlock(s->lock, save);
+        return;
+    }
+
+    if (stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+        // the controller flushes the TX FIFO and sends a STOP, wait for STOP_DET to finish up
+        (void)hw->clr_tx_abrt;
+        s->aborted = true;
+        s->cmd_pos = txn_total_len(s->active);
+    }
+    if (stat & (I2C_IC_INTR_STAT_R_RX_FULL_BITS | I2C_IC_INTR_STAT_R_TX_EMPTY_BITS)) {
+        drain_rx_fifo(s);
+        fill_tx_fifo(s);
+        // nothing more to push until the outstanding reads come back through RX_FULL
+        if (s->cmd_pos == txn_total_len(s->active) || rx_fifo_limited(s))
+            hw->intr_mask &= ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+        else
+            hw->intr_mask |= I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+    }
+    if (stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+        (void)hw->clr_stop_det;
+        drain_rx_fifo(s);
+        hw->intr_mask = 0;
+
+        if (s->deadline_alarm > 0)
+            cancel_alarm(s->deadline_alarm);
+        s->deadline_alarm = 0;
+
+        if (s->aborted)
+            s->stats[s->active->prio].nacks++;
+        done = finish_active(s, s->aborted ? PICO_ERROR_GENERIC : (int)txn_total_len(s->active), &result);
+        start_if_idle(s);
+    }
+    spin_unlock(s->lock, save);
+
+    // run the callback outside the lock so it can queue follow up transactions
+    if (done && done->cb)
+        done->cb(done, result);
+    // a loop waiting on the bus or on a callback's results may be in WFE
+    if (stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS)
+        __sev();
+}
+
+static void i2c0_sched_irq(void) {
+    i2c_sched_irq(&scheds[0]);
+}
+
+static void i2c1_sched_irq(void) {
+    i2c_sched_irq(&scheds[1]);
+}
+
+void i2c_sched_init(i2c_inst_t *i2c, uint sda_pin, uint scl_pin, uint baudrate) {
+    i2c_sched_t *s = get_sched(i2c);
+    s->i2c = i2c;
+    s->sda_pin = sda_pin;
+    s->scl_pin = scl_pin;
+    s->baudrate = baudrate;
+    s->cur_baudrate = baudrate;
+    s->lock = spin_lock_instance(spin_lock_claim_unused(true));
+    setup_controller(s);
+
+    uint irq = i2c_get_index(i2c) ? I2C1_IRQ : I2C0_IRQ;
+    irq_set_exclusive_handler(irq, i2c_get_index(i2c) ? i2c1_sched_irq : i2c0_sched_irq);
+    irq_set_enabled(irq, true);
+}
+
+void i2c_sched_submit(i2c_inst_t *i2c, i2c_txn_t *txn) {
+    i2c_sched_t *s = get_sched(i2c);
+    assert(txn_total_len(txn) > 0 && txn->prio < I2C_PRIO_COUNT);
+
+    txn->next = NULL;
+    txn->submit_us = time_us_64();
+    txn->attempts = 0;
+
+    uint32_t save = spin_lock_blocking(s->lock);
+    if (s->tail[txn->prio])
+        s->tail[txn->prio]->next = txn;
+    else
+        s->head[txn->prio] = txn;
+    s->tail[txn->prio] = txn;
+
+    start_if_idle(s);
+    spin_unlock(s->lock, save);
+}
+
+void i2c_sched_poll(i2c_inst_t *i2c) {
+    i2c_sched_t *s = get_sched(i2c);
+    i2c_txn_t *done = NULL;
+    int result = 0;
+
+    uint32_t save = spin_lock_blocking(s->lock);
+    bool recover = s->timed_out && !s->recovering;
+    s->recovering |= recover;
+    spin_unlock(s->lock, save);
+    if (!recover)
+        return;
+
+    // with interrupts on, the active transaction keeps everyone else off the bus
+    i2c_bus_recover(s->i2c, s->sda_pin, s->scl_pin, s->baudrate);
+
+    save = spin_lock_blocking(s->lock);
+    s->cur_baudrate = s->baudrate;
+    setup_controller(s);
+    s->timed_out = false;
+    s->recovering = false;
+    done = finish_active(s, PICO_ERROR_TIMEOUT, &result);
+    start_if_idle(s);
+    spin_unlock(s->lock, save);
+
+    if (done && done->cb)
+        done->cb(done, result);
+}
+
+bool i2c_sched_idle(i2c_inst_t *i2c) {
+    i2c_sched_t *s = get_sched(i2c);
+    uint32_t save = spin_lock_blocking(s->lock);
+    bool idle = !s->active && !s->backoff_alarm;
+    spin_unlock(s->lock, save);
+    return idle;
+}
+
+void i2c_sched_get_stats(i2c_inst_t *i2c, struct i2c_sched_stats stats[I2C_PRIO_COUNT], bool reset) {
+    i2c_sched_t *s = get_sched(i2c);
+    uint32_t save = spin_lock_blocking(s->lock);
+    for (int p = 0; p < I2C_PRIO_COUNT; p++) {
+        stats[p] = s->stats[p];
+        if (reset)
+            s->stats[p] = (struct i2c_sched_stats){0};
+    }
+    spin_unlock(s->lock, save);
+}
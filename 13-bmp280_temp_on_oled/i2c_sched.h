@@ -0,0 +1,106 @@
+#ifndef _I2C_SCHED_H
+#define _I2C_SCHED_H
+
+#include "hardware/i2c.h"
+#include "pico/stdlib.h"
+
+// Interrupt driven I2C transaction queue, one per hardware controller.
+//
+// A transaction is a write phase (up to 2 header bytes followed by wbuf) and/or a
+// read phase (rlen bytes into rbuf, issued with a RESTART), terminated with a STOP.
+// Transactions are queued by priority and started back to back from the I2C IRQ,
+// so a higher priority transaction never waits for more than the one that is
+// currently on the bus. Split long writes into chunks to bound that wait.
+//
+// Every transaction gets a deadline from its length and baudrate (see i2c_bus.h). If
+// it passes, the bus is held until i2c_sched_poll clears it and reinitialises the
+// controller, then the transaction is retried up to I2C_SCHED_MAX_RETRIES times.
+// NACKed transactions are retried too. Retries wait I2C_SCHED_BACKOFF_US, doubled
+// each time up to I2C_SCHED_BACKOFF_MAX_US, and the bus stays idle meanwhile. A retry
+// sends the whole transaction again, so one that may have been partly taken (e.g.
+// data to a device with an auto-incrementing pointer) is marked I2C_TXN_NO_RETRY
+// and fails straight away instead.
+//
+// The caller owns the transaction storage, it must stay valid until the callback.
+
+#ifndef I2C_SCHED_MAX_RETRIES
+#define I2C_SCHED_MAX_RETRIES   2
+#endif
+
+#ifndef I2C_SCHED_BACKOFF_US
+#define I2C_SCHED_BACKOFF_US        100
+#endif
+
+#ifndef I2C_SCHED_BACKOFF_MAX_US
+#define I2C_SCHED_BACKOFF_MAX_US    2000
+#endif
+
+enum i2c_sched_prio {
+    I2C_PRIO_HIGH = 0,  // sensor reads, short and latency sensitive
+    I2C_PRIO_LOW,       // display traffic, long and latency tolerant
+    I2C_PRIO_COUNT
+};
+
+// i2c_txn flags
+#define I2C_TXN_NO_RETRY        0x01
+
+typedef struct i2c_txn i2c_txn_t;
+
+// Called from the I2C IRQ when a transaction is done, or from i2c_sched_poll after a
+// timeout. result is the number of bytes transferred (header + write + read),
+// PICO_ERROR_GENERIC if the slave did not ack or PICO_ERROR_TIMEOUT if the deadline
+// passed, once the retries have run out.
+typedef void (*i2c_txn_cb_t)(i2c_txn_t *txn, int result);
+
+struct i2c_txn {
+    uint8_t addr;
+    uint8_t prio;               // enum i2c_sched_prio
+    uint8_t hdr[2];             // sent before wbuf, e.g. control byte or register number
+    uint8_t hdr_len;
+    const uint8_t *wbuf;
+    uint16_t wlen;
+    uint8_t *rbuf;
+    uint16_t rlen;
+    uint32_t baudrate;          // 0 to use the controller baudrate
+    uint8_t flags;              // I2C_TXN_*
+    i2c_txn_cb_t cb;
+    void *user_data;
+
+    // owned by the scheduler
+    i2c_txn_t *next;
+    uint64_t submit_us;
+    uint8_t attempts;
+};
+
+// per priority latency, from submit to completion
+struct i2c_sched_stats {
+    uint32_t count;
+    uint32_t errors;            // failed after all retries
+    uint32_t nacks;
+    uint32_t timeouts;          // each one costs a bus recovery
+    uint32_t retries;
+    uint64_t total_us;
+    uint32_t max_us;
+};
+
+// Takes over the controller IRQ, the controller must already be set up with i2c_init.
+// The pins are needed to clear the bus after a timeout.
+void i2c_sched_init(i2c_inst_t *i2c, uint sda_pin, uint scl_pin, uint baudrate);
+
+// Queues txn and starts it straight away if the bus is idle. Safe to call from
+// either core and from completion callbacks.
+void i2c_sched_submit(i2c_inst_t *i2c, i2c_txn_t *txn);
+
+// Clears the bus after a timeout, which takes a few hundred us of bit banging and
+// doesn't belong in an IRQ. Call it often from the loop of the core that submits to
+// this controller, and while waiting for the bus; nothing else goes out until it has
+// run. The deadline alarm sends an event, so a WFE wait ends for it.
+void i2c_sched_poll(i2c_inst_t *i2c);
+
+// False while a transaction is on the bus or a retry is waiting for its backoff
+bool i2c_sched_idle(i2c_inst_t *i2c);
+
+// Copies out the latency stats, optionally clearing them for the next interval.
+void i2c_sched_get_stats(i2c_inst_t *i2c, struct i2c_sched_stats stats[I2C_PRIO_COUNT], bool reset);
+
+#endif
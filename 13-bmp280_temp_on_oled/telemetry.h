@@ -0,0 +1,94 @@
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary framed sample records, in place of printf text.
+//
+// Samples are batched into a frame, the frame gets a CRC-16 and is COBS encoded, so
+// a 0x00 byte only ever appears as the frame delimiter and a receiver can pick up
+// from any point in the stream. Each frame goes out between two delimiters. Frame
+// before COBS, little endian:
+//
+//   version/fields  u8      high nibble TELEMETRY_VERSION, low nibble TELEMETRY_F_*
+//   count           u8      samples in the frame
+//   seq             u32     sequence number of the first sample
+//   timestamp       u32     us since boot of the first sample
+//   samples...              per sample, varints in field order:
+//                             timestamp delta from the previous sample (unsigned)
+//                             then zigzag deltas from the previous sample of
+//                             temp, press, raw_temp, raw_press if present
+//                           the first sample's deltas are from 0
+//   crc             u16     CRC-16/CCITT-FALSE of everything above
+//
+// The encoder has no SDK dependencies, the host decoder builds it as is.
+
+#define TELEMETRY_VERSION       1
+
+#define TELEMETRY_F_TEMP        0x1     // compensated temperature, 0.01 degC
+#define TELEMETRY_F_PRESS       0x2     // compensated pressure, Pa
+#define TELEMETRY_F_RAW_TEMP    0x4     // 20 bit ADC value
+#define TELEMETRY_F_RAW_PRESS   0x8
+
+#define TELEMETRY_HDR_LEN       10
+#define TELEMETRY_CRC_LEN       2
+// largest encoded sample: timestamp and four values, 5 bytes each as varints
+#define TELEMETRY_MAX_SAMPLE_LEN 25
+
+#ifndef TELEMETRY_MAX_FRAME
+#define TELEMETRY_MAX_FRAME     254
+#endif
+// COBS adds a byte per 254, plus the delimiters
+#define TELEMETRY_MAX_ENCODED   (TELEMETRY_MAX_FRAME + TELEMETRY_MAX_FRAME / 254 + 3)
+
+struct telemetry_sample {
+    uint32_t timestamp_us;
+    int32_t temp;
+    int32_t press;
+    int32_t raw_temp;
+    int32_t raw_press;
+};
+
+// Gets each encoded frame, delimiters included
+typedef void (*telemetry_write_fn)(const uint8_t *data, size_t len);
+
+typedef struct {
+    uint8_t fields;
+    uint8_t max_batch;
+    uint32_t max_age_us;        // flush a partial batch once its first sample is this old
+    telemetry_write_fn write;
+    uint32_t seq;               // of the next sample
+
+    // frame being built
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    size_t len;
+    uint8_t count;
+    struct telemetry_sample prev;
+
+    // totals
+    uint32_t frames;
+    uint32_t samples;
+    uint32_t bytes;             // on the wire
+} telemetry_t;
+
+void telemetry_init(telemetry_t *t, uint8_t fields, uint8_t max_batch, uint32_t max_age_us, telemetry_write_fn write);
+
+// Adds a sample, sending the frame when the batch is full. Returns true if a frame went out
+bool telemetry_add(telemetry_t *t, const struct telemetry_sample *s);
+
+// Sends a partial batch if its first sample is older than max_age_us
+bool telemetry_poll(telemetry_t *t, uint32_t now_us);
+
+void telemetry_flush(telemetry_t *t);
+
+uint16_t telemetry_crc16(const uint8_t *data, size_t len);
+
+// dst must hold len + len / 254 + 1 bytes, no delimiter is added. Returns the encoded length
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+
+// Decodes one frame without its delimiter, returns the decoded length or 0 if malformed
+size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst);
+
+#endif
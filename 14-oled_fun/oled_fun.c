@@ -5,6 +5,7 @@
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
 #include "hardware/i2c.h"
+#include "i2c_bus.h"
 //#include "oled_fun26x32.h"
 #include "ssd1306_font.h"
 
@@ -57,6 +58,17 @@
 #define SSD1306_READ_MODE          _u(0xFF)
 
 
+// a stuck bus is cleared and the transfer retried once, a lost frame is not worth more
+static i2c_bus_t ssd1306_bus = {
+    .i2c = i2c0,
+    .sda_pin = SSD1306_I2C_SDA_PIN,
+    .scl_pin = SSD1306_I2C_SCL_PIN,
+    .baudrate = SSD1306_I2C_CLK * 1000,
+    .max_retries = 1,
+    .backoff_us = 1000,
+    .backoff_max_us = 1000,
+};
+
 struct render_area {
     uint8_t start_col;
     uint8_t end_col;
@@ -76,7 +88,7 @@ void SSD1306_send_cmd(uint8_t cmd) {
     // this "data" can be a command or data to follow up a command
     // Co = 1, D/C = 0 => the driver expects a command
     uint8_t buf[2] = {0x80, cmd};
-    i2c_write_blocking(i2c0, SSD1306_I2C_ADDR, buf, 2, false);
+    i2c_bus_write(&ssd1306_bus, SSD1306_I2C_ADDR, buf, 2, false);
 }
 
 void SSD1306_send_cmd_list(uint8_t *buf, int num) {
@@ -97,7 +109,7 @@ void SSD1306_send_buf(uint8_t buf[], int buflen) {
     temp_buf[0] = 0x40;
     memcpy(temp_buf+1, buf, buflen);
 
-    i2c_write_blocking(i2c0, SSD1306_I2C_ADDR, temp_buf, buflen + 1, false);
+    i2c_bus_write(&ssd1306_bus, SSD1306_I2C_ADDR, temp_buf, buflen + 1, false);
 
     free(temp_buf);
 }
@@ -285,15 +297,7 @@ static void WriteString(uint8_t *buf, int16_t x, int16_t y, char *str) {
 }
 
 void SSD1306_init_i2c() {
-    gpio_init(SSD1306_I2C_SDA_PIN);
-    gpio_set_function(SSD1306_I2C_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(SSD1306_I2C_SDA_PIN);
-
-    gpio_init(SSD1306_I2C_SCL_PIN);
-    gpio_set_function(SSD1306_I2C_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(SSD1306_I2C_SCL_PIN);
-
-    i2c_init(i2c0, SSD1306_I2C_CLK * 1000);
+    i2c_bus_init(&ssd1306_bus);
 }
 
 int main() {
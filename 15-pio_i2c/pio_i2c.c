@@ -0,0 +1,306 @@
+#include <string.h>
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "pio_i2c.h"
+#include "pio_i2c.pio.h"
+
+#define PIO_I2C_ICOUNT_LSB  10
+#define PIO_I2C_FINAL_LSB   9
+#define PIO_I2C_DATA_LSB    1
+#define PIO_I2C_NAK_LSB     0
+
+// how long we give the STOP after an error before leaving the bus to the next transfer
+#define PIO_I2C_STOP_TIMEOUT_US 1000
+
+static bool program_loaded[NUM_PIOS];
+static uint program_offset[NUM_PIOS];
+
+static inline uint scl_pin(const pio_i2c_inst_t *i2c) {
+    return i2c->sda_pin + 1;
+}
+
+static inline bool check_error(const pio_i2c_inst_t *i2c) {
+    return pio_interrupt_get(i2c->pio, i2c->sm);
+}
+
+static inline void put16(pio_i2c_inst_t *i2c, uint16_t word) {
+    // halfword write so the data is in the top of the OSR for the left shifting autopull
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+    *(io_rw_16 *)&i2c->pio->txf[i2c->sm] = word;
+#pragma GCC diagnostic pop
+}
+
+static void rx_enable(pio_i2c_inst_t *i2c, bool en) {
+    if (en)
+        hw_set_bits(&i2c->pio->sm[i2c->sm].shiftctrl, PIO_SM0_SHIFTCTRL_AUTOPUSH_BITS);
+    else
+        hw_clear_bits(&i2c->pio->sm[i2c->sm].shiftctrl, PIO_SM0_SHIFTCTRL_AUTOPUSH_BITS);
+}
+
+/* Transfer encoding */
+
+static inline void put_word(pio_i2c_inst_t *i2c, uint16_t word) {
+    assert(i2c->num_words < PIO_I2C_MAX_WORDS);
+    i2c->words[i2c->num_words++] = word;
+}
+
+static void encode_start(pio_i2c_inst_t *i2c, bool read) {
+    // reads also clear the ISR shift count, so the RX bytes line up with the bus bytes
+    uint extra = read ? 1 : 0;
+    if (i2c->restart_on_next) {
+        put_word(i2c, (3u + extra) << PIO_I2C_ICOUNT_LSB);
+        put_word(i2c, set_scl_sda_program_instructions[I2C_SC0_SD1]);
+        put_word(i2c, set_scl_sda_program_instructions[I2C_SC1_SD1]);
+        put_word(i2c, set_scl_sda_program_instructions[I2C_SC1_SD0]);
+        put_word(i2c, set_scl_sda_program_instructions[I2C_SC0_SD0]);
+    } else {
+        put_word(i2c, (1u + extra) << PIO_I2C_ICOUNT_LSB);
+        put_word(i2c, set_scl_sda_program_instructions[I2C_SC1_SD0]);
+        put_word(i2c, set_scl_sda_program_instructions[I2C_SC0_SD0]);
+    }
+    if (read)
+        put_word(i2c, pio_encode_mov(pio_isr, pio_null));
+}
+
+static void encode_stop(pio_i2c_inst_t *i2c) {
+    put_word(i2c, 2u << PIO_I2C_ICOUNT_LSB);
+    put_word(i2c, set_scl_sda_program_instructions[I2C_SC0_SD0]);
+    put_word(i2c, set_scl_sda_program_instructions[I2C_SC1_SD0]);
+    put_word(i2c, set_scl_sda_program_instructions[I2C_SC1_SD1]);
+}
+
+static void encode_write(pio_i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    i2c->num_words = 0;
+    encode_start(i2c, false);
+    put_word(i2c, (addr << 2) | 1u);
+    for (size_t i = 0; i < len; i++)
+        put_word(i2c, (src[i] << PIO_I2C_DATA_LSB) | ((i == len - 1) << PIO_I2C_FINAL_LSB) | 1u);
+    if (!nostop)
+        encode_stop(i2c);
+    i2c->restart_on_next = nostop;
+    i2c->rx_dst = NULL;
+    i2c->rx_len = 0;
+    i2c->xfer_len = len;
+}
+
+static void encode_read(pio_i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    i2c->num_words = 0;
+    encode_start(i2c, true);
+    put_word(i2c, (addr << 2) | 3u);
+    // clock in 0xff, we ACK every byte but the last one
+    for (size_t i = 0; i < len; i++) {
+        bool last = i == len - 1;
+        put_word(i2c, (0xffu << PIO_I2C_DATA_LSB) | (last ? (1u << PIO_I2C_FINAL_LSB) | (1u << PIO_I2C_NAK_LSB) : 0));
+    }
+    if (!nostop)
+        encode_stop(i2c);
+    i2c->restart_on_next = nostop;
+    i2c->rx_dst = dst;
+    i2c->rx_len = len;
+    i2c->xfer_len = len;
+}
+
+/* Running a transfer */
+
+// the state machine is done once it stalls on an empty TX FIFO
+static bool wait_idle(pio_i2c_inst_t *i2c, absolute_time_t deadline) {
+    PIO pio = i2c->pio;
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + i2c->sm);
+    pio->fdebug = stall_mask;
+    while (!(pio->fdebug & stall_mask)) {
+        if (check_error(i2c) || time_reached(deadline))
+            return false;
+        tight_loop_contents();
+    }
+    return true;
+}
+
+static int recover(pio_i2c_inst_t *i2c, int err) {
+    PIO pio = i2c->pio;
+    uint sm = i2c->sm;
+
+    if (i2c->tx_dma >= 0) {
+        dma_channel_abort(i2c->tx_dma);
+        dma_channel_abort(i2c->rx_dma);
+    }
+
+    // throw away the rest of the transfer and restart from the entry point, this
+    // also gets the state machine out of a stretched clock wait
+    pio_sm_drain_tx_fifo(pio, sm);
+    pio_sm_exec(pio, sm, pio_encode_jmp(i2c->offset + pio_i2c_offset_entry_point));
+    pio_interrupt_clear(pio, sm);
+    rx_enable(i2c, false);
+    pio_sm_clear_fifos(pio, sm);
+    i2c->restart_on_next = false;
+
+    // leave the bus idle, unless the slave is still holding SCL down
+    if (gpio_get(scl_pin(i2c))) {
+        i2c->num_words = 0;
+        encode_stop(i2c);
+        for (uint i = 0; i < i2c->num_words; i++)
+            put16(i2c, i2c->words[i]);
+        if (!wait_idle(i2c, make_timeout_time_us(PIO_I2C_STOP_TIMEOUT_US)))
+            pio_interrupt_clear(pio, sm);
+    }
+    return err;
+}
+
+static int finish(pio_i2c_inst_t *i2c, absolute_time_t deadline) {
+    if (!wait_idle(i2c, deadline))
+        return recover(i2c, check_error(i2c) ? PICO_ERROR_GENERIC : PICO_ERROR_TIMEOUT);
+    if (i2c->rx_dst)
+        rx_enable(i2c, false);
+    return (int)i2c->xfer_len;
+}
+
+static int run_cpu(pio_i2c_inst_t *i2c, absolute_time_t deadline) {
+    PIO pio = i2c->pio;
+    uint sm = i2c->sm;
+    uint tx = 0;
+    size_t rx = 0;
+    // reads get the address byte back first
+    size_t rx_total = i2c->rx_dst ? i2c->rx_len + 1 : 0;
+
+    if (i2c->rx_dst) {
+        rx_enable(i2c, true);
+        pio_sm_clear_fifos(pio, sm);
+    }
+
+    while (tx < i2c->num_words || rx < rx_total) {
+        if (check_error(i2c))
+            return recover(i2c, PICO_ERROR_GENERIC);
+        if (time_reached(deadline))
+            return recover(i2c, PICO_ERROR_TIMEOUT);
+        if (tx < i2c->num_words && !pio_sm_is_tx_fifo_full(pio, sm))
+            put16(i2c, i2c->words[tx++]);
+        if (rx < rx_total && !pio_sm_is_rx_fifo_empty(pio, sm)) {
+            uint8_t b = (uint8_t)pio_sm_get(pio, sm);
+            if (rx)
+                i2c->rx_dst[rx - 1] = b;
+            rx++;
+        }
+    }
+    return finish(i2c, deadline);
+}
+
+static void start_dma(pio_i2c_inst_t *i2c) {
+    PIO pio = i2c->pio;
+    uint sm = i2c->sm;
+
+    if (i2c->rx_dst) {
+        rx_enable(i2c, true);
+        pio_sm_clear_fifos(pio, sm);
+
+        dma_channel_config c = dma_channel_get_default_config(i2c->rx_dma);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+        dma_channel_configure(i2c->rx_dma, &c, i2c->rx_buf, &pio->rxf[sm], i2c->rx_len + 1, true);
+    }
+
+    dma_channel_config c = dma_channel_get_default_config(i2c->tx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(i2c->tx_dma, &c, &pio->txf[sm], i2c->words, i2c->num_words, true);
+}
+
+/* API */
+
+int pio_i2c_init(pio_i2c_inst_t *i2c, PIO pio, uint sda_pin, uint baudrate, bool use_dma) {
+    uint pio_idx = pio_get_index(pio);
+    if (!program_loaded[pio_idx]) {
+        if (!pio_can_add_program(pio, &pio_i2c_program))
+            return PICO_ERROR_GENERIC;
+        program_offset[pio_idx] = pio_add_program(pio, &pio_i2c_program);
+        program_loaded[pio_idx] = true;
+    }
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0)
+        return PICO_ERROR_GENERIC;
+
+    memset(i2c, 0, sizeof(*i2c));
+    i2c->pio = pio;
+    i2c->sm = sm;
+    i2c->offset = program_offset[pio_idx];
+    i2c->sda_pin = sda_pin;
+    i2c->baudrate = baudrate;
+    i2c->tx_dma = -1;
+    i2c->rx_dma = -1;
+    if (use_dma) {
+        i2c->tx_dma = dma_claim_unused_channel(true);
+        i2c->rx_dma = dma_claim_unused_channel(true);
+    }
+
+    pio_i2c_program_init(pio, sm, i2c->offset, sda_pin, sda_pin + 1, baudrate);
+    return PICO_OK;
+}
+
+void pio_i2c_set_baudrate(pio_i2c_inst_t *i2c, uint baudrate) {
+    i2c->baudrate = baudrate;
+    pio_sm_set_clkdiv(i2c->pio, i2c->sm, (float)clock_get_hz(clk_sys) / (32.f * baudrate));
+}
+
+int pio_i2c_write_timeout_us(pio_i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint timeout_us) {
+    if (i2c->tx_dma >= 0) {
+        int ret = pio_i2c_write_dma_start(i2c, addr, src, len, nostop);
+        return ret < 0 ? ret : pio_i2c_dma_finish(i2c, timeout_us);
+    }
+    if (len > PIO_I2C_MAX_XFER_LEN)
+        return PICO_ERROR_GENERIC;
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    encode_write(i2c, addr, src, len, nostop);
+    return run_cpu(i2c, deadline);
+}
+
+int pio_i2c_read_timeout_us(pio_i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint timeout_us) {
+    if (i2c->tx_dma >= 0) {
+        int ret = pio_i2c_read_dma_start(i2c, addr, dst, len, nostop);
+        return ret < 0 ? ret : pio_i2c_dma_finish(i2c, timeout_us);
+    }
+    if (!len || len > PIO_I2C_MAX_XFER_LEN)
+        return PICO_ERROR_GENERIC;
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    encode_read(i2c, addr, dst, len, nostop);
+    return run_cpu(i2c, deadline);
+}
+
+int pio_i2c_write_dma_start(pio_i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    if (i2c->tx_dma < 0 || len > PIO_I2C_MAX_XFER_LEN)
+        return PICO_ERROR_GENERIC;
+    encode_write(i2c, addr, src, len, nostop);
+    start_dma(i2c);
+    return PICO_OK;
+}
+
+int pio_i2c_read_dma_start(pio_i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    if (i2c->tx_dma < 0 || !len || len > PIO_I2C_MAX_XFER_LEN)
+        return PICO_ERROR_GENERIC;
+    encode_read(i2c, addr, dst, len, nostop);
+    start_dma(i2c);
+    return PICO_OK;
+}
+
+bool pio_i2c_dma_busy(pio_i2c_inst_t *i2c) {
+    if (check_error(i2c))
+        return false;
+    return dma_channel_is_busy(i2c->tx_dma) || (i2c->rx_dst && dma_channel_is_busy(i2c->rx_dma));
+}
+
+int pio_i2c_dma_finish(pio_i2c_inst_t *i2c, uint timeout_us) {
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    while (pio_i2c_dma_busy(i2c)) {
+        if (time_reached(deadline))
+            return recover(i2c, PICO_ERROR_TIMEOUT);
+        tight_loop_contents();
+    }
+    if (check_error(i2c))
+        return recover(i2c, PICO_ERROR_GENERIC);
+    int ret = finish(i2c, deadline);
+    if (ret >= 0 && i2c->rx_dst)
+        memcpy(i2c->rx_dst, i2c->rx_buf + 1, i2c->rx_len);
+    return ret;
+}
@@ -0,0 +1,72 @@
+#ifndef _PIO_I2C_H
+#define _PIO_I2C_H
+
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+
+// I2C master on a PIO state machine, for when both hardware controllers are taken.
+// Each state machine is one more bus (8 on RP2040, 12 on RP2350), with clock
+// stretching and rates up to fast mode plus (1MHz).
+//
+// The read/write calls mirror hardware/i2c.h: they return the number of bytes
+// transferred, PICO_ERROR_GENERIC if the address or data was not acknowledged and
+// PICO_ERROR_TIMEOUT if the deadline passed. With nostop the next transfer starts
+// with a RESTART instead of a START.
+//
+// A transfer is first encoded into TX FIFO words (see pio_i2c.pio), then either fed
+// by the CPU or, if the bus was set up with DMA, by a DMA channel. The _dma_start
+// calls return straight away so the CPU is free while the transfer runs.
+
+#ifndef PIO_I2C_MAX_XFER_LEN
+#define PIO_I2C_MAX_XFER_LEN    256
+#endif
+
+// START/RESTART and STOP sequences plus the address byte
+#define PIO_I2C_MAX_WORDS       (PIO_I2C_MAX_XFER_LEN + 12)
+
+typedef struct {
+    PIO pio;
+    uint sm;
+    uint offset;
+    uint sda_pin;           // SCL is sda_pin + 1
+    uint baudrate;
+    bool restart_on_next;
+
+    int tx_dma;             // -1 when the CPU feeds the FIFO
+    int rx_dma;
+
+    // transfer in progress
+    uint16_t words[PIO_I2C_MAX_WORDS];
+    uint num_words;
+    uint8_t rx_buf[PIO_I2C_MAX_XFER_LEN + 1];   // includes the echoed address byte
+    uint8_t *rx_dst;
+    size_t rx_len;
+    size_t xfer_len;
+} pio_i2c_inst_t;
+
+// Claims a state machine on pio (and two DMA channels if use_dma) and takes over
+// sda_pin and sda_pin + 1
+int pio_i2c_init(pio_i2c_inst_t *i2c, PIO pio, uint sda_pin, uint baudrate, bool use_dma);
+
+void pio_i2c_set_baudrate(pio_i2c_inst_t *i2c, uint baudrate);
+
+int pio_i2c_write_timeout_us(pio_i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint timeout_us);
+int pio_i2c_read_timeout_us(pio_i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint timeout_us);
+
+static inline int pio_i2c_write_blocking(pio_i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    return pio_i2c_write_timeout_us(i2c, addr, src, len, nostop, UINT32_MAX);
+}
+
+static inline int pio_i2c_read_blocking(pio_i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    return pio_i2c_read_timeout_us(i2c, addr, dst, len, nostop, UINT32_MAX);
+}
+
+// DMA only: start a transfer and return. dst must stay valid until pio_i2c_dma_finish
+int pio_i2c_write_dma_start(pio_i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int pio_i2c_read_dma_start(pio_i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+bool pio_i2c_dma_busy(pio_i2c_inst_t *i2c);
+
+// Waits for the transfer started with _dma_start, same return values as the blocking calls
+int pio_i2c_dma_finish(pio_i2c_inst_t *i2c, uint timeout_us);
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdio.h>
+
+#include "hardware/clocks.h"
+#include "hardware/i2c.h"
+#include "hardware/structs/systick.h"
+#include "pico/binary_info.h"
+#include "pico/stdlib.h"
+#include "pio_i2c.h"
+
+// Reads the BMP280 calibration block over and over, first with the hardware
+// controller, then with the PIO master fed by the CPU and by DMA, at 100kHz, 400kHz
+// and 1MHz. The same two pins are handed back and forth between i2c0 and the PIO.
+
+ // device has default bus address of 0x76
+#define BMP280_I2C_ADDR _u(0x76)
+#define BMP280_I2C_SDA_PIN    4
+#define BMP280_I2C_SCL_PIN    5     // PIO I2C needs SCL = SDA + 1
+
+#define REG_DIG_T1_LSB _u(0x88)
+#define REG_ID _u(0xD0)
+
+// number of calibration registers to be read
+#define NUM_CALIB_PARAMS 24
+
+#define BENCH_DURATION_US   (2 * 1000 * 1000)
+#define XFER_TIMEOUT_US     10000
+
+enum bench_mode {
+    MODE_HW_I2C,
+    MODE_PIO_CPU,
+    MODE_PIO_DMA,
+    MODE_COUNT
+};
+
+static const char *mode_names[MODE_COUNT] = {"hardware_i2c", "pio_cpu", "pio_dma"};
+static const uint baudrates[] = {100 * 1000, 400 * 1000, 1000 * 1000};
+
+static pio_i2c_inst_t pio_cpu_bus;
+static pio_i2c_inst_t pio_dma_bus;
+
+static void use_hw_i2c(uint baudrate) {
+    i2c_init(i2c0, baudrate);
+    gpio_set_function(BMP280_I2C_SDA_PIN, GPIO_FUNC_I2C);
+    gpio_set_function(BMP280_I2C_SCL_PIN, GPIO_FUNC_I2C);
+    gpio_set_oeover(BMP280_I2C_SDA_PIN, GPIO_OVERRIDE_NORMAL);
+    gpio_set_oeover(BMP280_I2C_SCL_PIN, GPIO_OVERRIDE_NORMAL);
+}
+
+static void use_pio(pio_i2c_inst_t *bus, uint baudrate) {
+    i2c_deinit(i2c0);
+    pio_gpio_init(bus->pio, BMP280_I2C_SDA_PIN);
+    pio_gpio_init(bus->pio, BMP280_I2C_SCL_PIN);
+    gpio_set_oeover(BMP280_I2C_SDA_PIN, GPIO_OVERRIDE_INVERT);
+    gpio_set_oeover(BMP280_I2C_SCL_PIN, GPIO_OVERRIDE_INVERT);
+    pio_i2c_set_baudrate(bus, baudrate);
+}
+
+// SysTick free running on the processor clock, 24 bits down: 134ms at 125MHz, well
+// past XFER_TIMEOUT_US
+static void cycle_counter_init(void) {
+    systick_hw->rvr = 0xffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;      // enabled, processor clock, no interrupt
+}
+
+static inline uint32_t cycles_now(void) {
+    return systick_hw->cvr;
+}
+
+static inline uint32_t cycles_since(uint32_t start) {
+    return (start - systick_hw->cvr) & 0xffffff;
+}
+
+// polls until the DMA transfer is done, returns the cycles spent waiting: the
+// CPU's for anything else had it not polled
+static uint32_t dma_wait(pio_i2c_inst_t *bus) {
+    uint32_t start = cycles_now();
+    while (pio_i2c_dma_busy(bus))
+        tight_loop_contents();
+    return cycles_since(start);
+}
+
+// one register read: write the register number, then read with a RESTART.
+// *busy_us is how long the CPU was tied up by the transfer.
+static int read_calib(enum bench_mode mode, uint8_t *buf, uint32_t *busy_us) {
+    uint8_t reg = REG_DIG_T1_LSB;
+    uint64_t start = time_us_64();
+    int ret;
+
+    switch (mode) {
+    case MODE_HW_I2C:
+        ret = i2c_write_timeout_us(i2c0, BMP280_I2C_ADDR, &reg, 1, true, XFER_TIMEOUT_US);
+        if (ret >= 0)
+            ret = i2c_read_timeout_us(i2c0, BMP280_I2C_ADDR, buf, NUM_CALIB_PARAMS, false, XFER_TIMEOUT_US);
+        *busy_us = time_us_64() - start;
+        return ret;
+
+    case MODE_PIO_CPU:
+        ret = pio_i2c_write_timeout_us(&pio_cpu_bus, BMP280_I2C_ADDR, &reg, 1, true, XFER_TIMEOUT_US);
+        if (ret >= 0)
+            ret = pio_i2c_read_timeout_us(&pio_cpu_bus, BMP280_I2C_ADDR, buf, NUM_CALIB_PARAMS, false, XFER_TIMEOUT_US);
+        *busy_us = time_us_64() - start;
+        return ret;
+
+    default: {
+        // the CPU is tied up setting up and finishing, not while the DMA runs the bus
+        uint32_t start_cycles = cycles_now(), wait_cycles = 0;
+        ret = pio_i2c_write_dma_start(&pio_dma_bus, BMP280_I2C_ADDR, &reg, 1, true);
+        if (ret >= 0) {
+            wait_cycles += dma_wait(&pio_dma_bus);
+            ret = pio_i2c_dma_finish(&pio_dma_bus, XFER_TIMEOUT_US);
+        }
+        if (ret >= 0)
+            ret = pio_i2c_read_dma_start(&pio_dma_bus, BMP280_I2C_ADDR, buf, NUM_CALIB_PARAMS, false);
+        if (ret >= 0) {
+            wait_cycles += dma_wait(&pio_dma_bus);
+            ret = pio_i2c_dma_finish(&pio_dma_bus, XFER_TIMEOUT_US);
+        }
+        uint32_t busy_cycles = cycles_since(start_cycles) - wait_cycles;
+        *busy_us = (uint64_t)busy_cycles * 1000000 / clock_get_hz(clk_sys);
+        return ret;
+    }
+    }
+}
+
+static void run_bench(enum bench_mode mode, uint baudrate) {
+    uint8_t ref[NUM_CALIB_PARAMS];
+    uint8_t buf[NUM_CALIB_PARAMS];
+    uint32_t busy_us, total_busy_us = 0;
+    uint32_t transfers = 0, errors = 0, mismatches = 0;
+    bool have_ref = false;
+
+    if (mode == MODE_HW_I2C)
+        use_hw_i2c(baudrate);
+    else
+        use_pio(mode == MODE_PIO_CPU ? &pio_cpu_bus : &pio_dma_bus, baudrate);
+
+    uint64_t start = time_us_64();
+    while (time_us_64() - start < BENCH_DURATION_US) {
+        int ret = read_calib(mode, buf, &busy_us);
+        total_busy_us += busy_us;
+        if (ret < 0) {
+            errors++;
+            continue;
+        }
+        transfers++;
+        if (!have_ref) {
+            for (int i = 0; i < NUM_CALIB_PARAMS; i++)
+                ref[i] = buf[i];
+            have_ref = true;
+        }
+        for (int i = 0; i < NUM_CALIB_PARAMS; i++) {
+            if (buf[i] != ref[i]) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    uint32_t elapsed_us = time_us_64() - start;
+
+    // bytes on the wire per transfer: 2 address bytes, the register and the data
+    uint32_t bytes = transfers * (NUM_CALIB_PARAMS + 3);
+    printf("%-13s %5ukHz: %6lu xfer/s %7lu B/s  cpu %3u%%  errors %u  mismatches %u\n",
+           mode_names[mode], baudrate / 1000,
+           (unsigned long)((uint64_t)transfers * 1000000 / elapsed_us),
+           (unsigned long)((uint64_t)bytes * 1000000 / elapsed_us),
+           (uint)((uint64_t)total_busy_us * 100 / elapsed_us), errors, mismatches);
+}
+
+int main() {
+    stdio_init_all();
+    sleep_ms(3000);
+    printf("PIO I2C vs hardware I2C\n");
+
+    gpio_pull_up(BMP280_I2C_SDA_PIN);
+    gpio_pull_up(BMP280_I2C_SCL_PIN);
+    // Make the I2C pins available to picotool
+    bi_decl(bi_2pins_with_func(BMP280_I2C_SDA_PIN, BMP280_I2C_SCL_PIN, GPIO_FUNC_I2C));
+
+    if (pio_i2c_init(&pio_cpu_bus, pio0, BMP280_I2C_SDA_PIN, baudrates[0], false) < 0 ||
+        pio_i2c_init(&pio_dma_bus, pio1, BMP280_I2C_SDA_PIN, baudrates[0], true) < 0) {
+        printf("No free PIO state machine\n");
+        return 1;
+    }
+    cycle_counter_init();
+
+    // check the sensor is there before benchmarking anything
+    use_pio(&pio_cpu_bus, baudrates[0]);
+    uint8_t reg = REG_ID, id = 0;
+    pio_i2c_write_blocking(&pio_cpu_bus, BMP280_I2C_ADDR, &reg, 1, true);
+    if (pio_i2c_read_timeout_us(&pio_cpu_bus, BMP280_I2C_ADDR, &id, 1, false, XFER_TIMEOUT_US) < 0) {
+        printf("No BMP280 at 0x%02x\n", BMP280_I2C_ADDR);
+        return 1;
+    }
+    printf("BMP280 chip id 0x%02x\n", id);
+
+start:
+    for (uint b = 0; b < count_of(baudrates); b++) {
+        for (int mode = 0; mode < MODE_COUNT; mode++)
+            run_bench(mode, baudrates[b]);
+        printf("\n");
+    }
+    sleep_ms(5000);
+    goto start;
+}
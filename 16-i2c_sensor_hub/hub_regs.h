@@ -0,0 +1,58 @@
+#ifndef _HUB_REGS_H
+#define _HUB_REGS_H
+
+#include <stdint.h>
+
+// Register map the sensor hub serves on its slave address. Masters write the
+// register number and then read any number of bytes, the address wraps at the end
+// of the map. Everything is little endian and read only, writes past the register
+// number are ignored.
+//
+// The whole map is a snapshot taken when the transaction starts, so one read of
+// the header and the sensor blocks is always consistent. Bump HUB_REGS_VERSION on
+// any layout change, fields are only ever added in the reserved space.
+
+#define HUB_REGS_MAGIC          0x48    // 'H'
+#define HUB_REGS_VERSION        1
+#define HUB_REGS_SIZE           64
+#define HUB_MAX_SENSORS         2
+
+// status bits per sensor
+#define HUB_SENSOR_PRESENT      0x01    // answered at boot
+#define HUB_SENSOR_VALID        0x02    // temperature/pressure hold a reading
+#define HUB_SENSOR_STALE        0x04    // the last read failed, values are from an older sample
+
+// register numbers
+#define HUB_REG_MAGIC           0x00
+#define HUB_REG_VERSION         0x01
+#define HUB_REG_SEQ             0x04
+#define HUB_REG_SENSOR(n)       (0x10 + (n) * 0x18)
+
+struct hub_sensor_regs {
+    int32_t temperature;        // 0.01 degC
+    uint32_t pressure;          // Pa
+    uint32_t timestamp_ms;      // when the sample was taken, ms since boot
+    uint32_t samples;
+    int16_t temp_min;           // 0.01 degC, since boot
+    int16_t temp_max;
+    uint16_t errors;            // failed reads
+    uint8_t status;
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct hub_regs {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t size;               // HUB_REGS_SIZE
+    uint8_t num_sensors;
+    uint32_t seq;               // bumped on every publish
+    uint32_t uptime_ms;         // when the snapshot was published
+    uint16_t interval_ms;       // sampling interval
+    uint16_t reserved;
+    struct hub_sensor_regs sensor[HUB_MAX_SENSORS];
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct hub_sensor_regs) == 0x18, "sensor block layout");
+_Static_assert(sizeof(struct hub_regs) == HUB_REGS_SIZE, "register map layout");
+
+#endif
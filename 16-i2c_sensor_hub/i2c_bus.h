@@ -0,0 +1,59 @@
+#ifndef _I2C_BUS_H
+#define _I2C_BUS_H
+
+#include "hardware/i2c.h"
+#include "pico/stdlib.h"
+
+// Bounded latency wrapper around the hardware I2C controller.
+//
+// Every transfer gets a deadline worked out from its length and the bus baudrate,
+// so a slave holding SDA (or SCL) low costs a few milliseconds instead of hanging
+// the caller. After a timeout the bus is cleared (9 SCL pulses and a STOP) and the
+// controller is reinitialised, then the transfer is retried with exponential backoff.
+
+// allowance for clock stretching and IRQ latency on top of the wire time
+#ifndef I2C_BUS_SLACK_US
+#define I2C_BUS_SLACK_US        1000
+#endif
+
+struct i2c_bus_counters {
+    uint32_t transfers;
+    uint32_t timeouts;
+    uint32_t nacks;
+    uint32_t recoveries;
+    uint32_t retries;
+    uint32_t failures;      // transfers that ran out of retries
+};
+
+typedef struct {
+    i2c_inst_t *i2c;
+    uint sda_pin;
+    uint scl_pin;
+    uint baudrate;
+    uint max_retries;       // attempts after the first one
+    uint backoff_us;        // wait before the first retry, doubled every retry
+    uint backoff_max_us;
+    struct i2c_bus_counters counters;
+} i2c_bus_t;
+
+// Sets up the pins and the controller
+void i2c_bus_init(i2c_bus_t *bus);
+
+// Same return values as the SDK: number of bytes, PICO_ERROR_GENERIC if the address
+// or data was not acknowledged, PICO_ERROR_TIMEOUT if the deadline passed
+int i2c_bus_write(i2c_bus_t *bus, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int i2c_bus_read(i2c_bus_t *bus, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+
+// Register style read: write wlen bytes then read rlen bytes after a RESTART. Retried
+// as a unit, returns rlen on success
+int i2c_bus_write_read(i2c_bus_t *bus, uint8_t addr, const uint8_t *src, size_t wlen, uint8_t *dst, size_t rlen);
+
+// Wire time of len bytes plus the address byte, doubled, plus I2C_BUS_SLACK_US
+uint32_t i2c_bus_deadline_us(uint baudrate, size_t len);
+
+// Clocks out a stuck slave and issues a STOP, then reinitialises the controller
+void i2c_bus_recover(i2c_inst_t *i2c, uint sda_pin, uint scl_pin, uint baudrate);
+
+void i2c_bus_print_counters(const i2c_bus_t *bus);
+
+#endif
@@ -0,0 +1,368 @@
+// Smart sensor hub: samples the local BMP280s on its own schedule and serves the
+// compensated readings from an I2C slave register map (see hub_regs.h). An upstream
+// master gets the latest values with one short read and never waits on a conversion.
+//
+// BMP280s on i2c1 (GP14 SDA, GP15 SCL) at 0x76 and 0x77, slave on i2c0 (GP4 SDA,
+// GP5 SCL) at 0x18.
+//
+// The register map is triple buffered. The main loop fills a spare buffer and
+// publishes it by switching one index. The slave ISR latches the published buffer
+// at the start of each transaction and serves bytes from it, so neither side ever
+// waits on the other.
+
+#include <hardware/i2c.h>
+#include <pico/i2c_slave.h>
+#include <pico/stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hub_regs.h"
+#include "i2c_bus.h"
+
+static const uint I2C_SLAVE_ADDRESS = 0x18;
+static const uint I2C_BAUDRATE = 400000; // 400 kHz
+
+static const uint I2C_SLAVE_SDA_PIN = 4;
+static const uint I2C_SLAVE_SCL_PIN = 5;
+
+#define BMP280_I2C_SDA_PIN    14
+#define BMP280_I2C_SCL_PIN    15
+#define BMP280_I2C_BAUDRATE    400*1000 //400KhZ
+
+#define SAMPLE_INTERVAL_MS  250
+#define STATS_INTERVAL_MS   10000
+
+// hardware registers
+#define REG_CONFIG _u(0xF5)
+#define REG_CTRL_MEAS _u(0xF4)
+#define REG_RESET _u(0xE0)
+#define REG_ID _u(0xD0)
+#define REG_PRESSURE_MSB _u(0xF7)
+#define REG_DIG_T1_LSB _u(0x88)
+
+#define BMP280_CHIP_ID _u(0x58)
+
+// number of calibration registers to be read
+#define NUM_CALIB_PARAMS 24
+
+static i2c_bus_t bmp280_bus = {
+    .i2c = i2c1,
+    .sda_pin = BMP280_I2C_SDA_PIN,
+    .scl_pin = BMP280_I2C_SCL_PIN,
+    .baudrate = BMP280_I2C_BAUDRATE,
+    .max_retries = 1,
+    .backoff_us = 1000,
+    .backoff_max_us = 1000,
+};
+
+struct BMP280_calib_param {
+    // temperature params
+    uint16_t dig_t1;
+    int16_t dig_t2;
+    int16_t dig_t3;
+
+    // pressure params
+    uint16_t dig_p1;
+    int16_t dig_p2;
+    int16_t dig_p3;
+    int16_t dig_p4;
+    int16_t dig_p5;
+    int16_t dig_p6;
+    int16_t dig_p7;
+    int16_t dig_p8;
+    int16_t dig_p9;
+};
+
+static struct {
+    uint8_t addr;
+    struct BMP280_calib_param params;
+} sensors[HUB_MAX_SENSORS] = {
+    { .addr = 0x76 },
+    { .addr = 0x77 },
+};
+
+// working copy of the sensor blocks, only touched by the main loop
+static struct hub_sensor_regs sensor_regs[HUB_MAX_SENSORS];
+static uint8_t num_sensors;
+
+/* Register map buffers */
+
+static struct hub_regs regs[3];
+static volatile uint8_t live;           // last published buffer
+static volatile int8_t held = -1;       // buffer the slave ISR is reading from, -1 between transactions
+static uint32_t publish_seq;
+
+static struct
+{
+    const uint8_t *snapshot;
+    uint8_t mem_address;
+    bool mem_address_written;
+    bool requested;
+    volatile uint32_t reads;            // transactions that read at least one byte
+} context;
+
+static inline void latch_snapshot() {
+    if (!context.snapshot) {
+        held = live;
+        context.snapshot = (const uint8_t *)&regs[held];
+    }
+}
+
+// Our handler is called from the I2C ISR, so it must complete quickly. It only ever
+// copies bytes out of the latched snapshot.
+static void i2c_slave_handler(i2c_inst_t *i2c, i2c_slave_event_t event) {
+    switch (event) {
+    case I2C_SLAVE_RECEIVE: { // master has written some data
+        latch_snapshot();
+        uint8_t b = i2c_read_byte_raw(i2c);
+        // writes always start with the register number, the map is read only
+        if (!context.mem_address_written) {
+            context.mem_address = b % HUB_REGS_SIZE;
+            context.mem_address_written = true;
+        }
+        break;
+    }
+    case I2C_SLAVE_REQUEST: // master is requesting data
+        latch_snapshot();
+        i2c_write_byte_raw(i2c, context.snapshot[context.mem_address]);
+        context.mem_address = (context.mem_address + 1) % HUB_REGS_SIZE;
+        context.requested = true;
+        break;
+    case I2C_SLAVE_FINISH: // master has signalled Stop / Restart
+        if (context.requested)
+            context.reads++;
+        context.requested = false;
+        context.snapshot = NULL;
+        held = -1;
+        context.mem_address_written = false;
+        break;
+    default:
+        break;
+    }
+}
+
+// Fills the buffer that is neither published nor held by the ISR and publishes it.
+// The ISR only ever latches the published buffer, so the one picked here stays ours.
+static void publish() {
+    uint8_t next = 0;
+    while (next == live || next == held)
+        next++;
+
+    struct hub_regs *r = &regs[next];
+    r->magic = HUB_REGS_MAGIC;
+    r->version = HUB_REGS_VERSION;
+    r->size = HUB_REGS_SIZE;
+    r->num_sensors = num_sensors;
+    r->seq = ++publish_seq;
+    r->uptime_ms = to_ms_since_boot(get_absolute_time());
+    r->interval_ms = SAMPLE_INTERVAL_MS;
+    r->reserved = 0;
+    memcpy(r->sensor, sensor_regs, sizeof(r->sensor));
+
+    // the buffer must be complete before the ISR can see it
+    __dmb();
+    live = next;
+}
+
+static void setup_slave() {
+    gpio_init(I2C_SLAVE_SDA_PIN);
+    gpio_set_function(I2C_SLAVE_SDA_PIN, GPIO_FUNC_I2C);
+    gpio_pull_up(I2C_SLAVE_SDA_PIN);
+
+    gpio_init(I2C_SLAVE_SCL_PIN);
+    gpio_set_function(I2C_SLAVE_SCL_PIN, GPIO_FUNC_I2C);
+    gpio_pull_up(I2C_SLAVE_SCL_PIN);
+
+    i2c_init(i2c0, I2C_BAUDRATE);
+
+    i2c_slave_init(i2c0, I2C_SLAVE_ADDRESS, &i2c_slave_handler); // configure I2C0 for slave mode
+}
+
+/* BMP280 */
+
+// intermediate function that calculates the fine resolution temperature
+// used for both pressure and temperature conversions
+int32_t BMP280_convert(int32_t temp, struct BMP280_calib_param* params) {
+    // use the 32-bit fixed point compensation implementation given in the
+    // datasheet
+
+    int32_t var1, var2;
+    var1 = ((((temp >> 3) - ((int32_t)params->dig_t1 << 1))) * ((int32_t)params->dig_t2)) >> 11;
+    var2 = (((((temp >> 4) - ((int32_t)params->dig_t1)) * ((temp >> 4) - ((int32_t)params->dig_t1))) >> 12) * ((int32_t)params->dig_t3)) >> 14;
+    return var1 + var2;
+}
+
+
+int32_t BMP280_convert_pressure(int32_t pressure, int32_t temp, struct BMP280_calib_param* params) {
+    // uses the BMP280 calibration parameters to compensate the pressure value read from its registers
+
+    int32_t t_fine = BMP280_convert(temp, params);
+
+    int32_t var1, var2;
+    uint32_t converted = 0.0;
+    var1 = (((int32_t)t_fine) >> 1) - (int32_t)64000;
+    var2 = (((var1 >> 2) * (var1 >> 2)) >> 11) * ((int32_t)params->dig_p6);
+    var2 += ((var1 * ((int32_t)params->dig_p5)) << 1);
+    var2 = (var2 >> 2) + (((int32_t)params->dig_p4) << 16);
+    var1 = (((params->dig_p3 * (((var1 >> 2) * (var1 >> 2)) >> 13)) >> 3) + ((((int32_t)params->dig_p2) * var1) >> 1)) >> 18;
+    var1 = ((((32768 + var1)) * ((int32_t)params->dig_p1)) >> 15);
+    if (var1 == 0) {
+        return 0;  // avoid exception caused by division by zero
+    }
+    converted = (((uint32_t)(((int32_t)1048576) - pressure) - (var2 >> 12))) * 3125;
+    if (converted < 0x80000000) {
+        converted = (converted << 1) / ((uint32_t)var1);
+    } else {
+        converted = (converted / (uint32_t)var1) * 2;
+    }
+    var1 = (((int32_t)params->dig_p9) * ((int32_t)(((converted >> 3) * (converted >> 3)) >> 13))) >> 12;
+    var2 = (((int32_t)(converted >> 2)) * ((int32_t)params->dig_p8)) >> 13;
+    converted = (uint32_t)((int32_t)converted + ((var1 + var2 + params->dig_p7) >> 4));
+    return converted;
+}
+
+
+int32_t BMP280_convert_temp(int32_t temp, struct BMP280_calib_param* params) {
+    // uses the BMP280 calibration parameters to compensate the temperature value read from its registers
+    int32_t t_fine = BMP280_convert(temp, params);
+    return (t_fine * 5 + 128) >> 8;
+}
+
+
+int BMP280_read_raw(uint8_t addr, int32_t* temp, int32_t* pressure) {
+    // pressure and temperature registers are auto-incrementing, read all 6 from 0xF7
+    uint8_t buf[6];
+    uint8_t reg = REG_PRESSURE_MSB;
+    int ret = i2c_bus_write_read(&bmp280_bus, addr, &reg, 1, buf, 6);
+    if (ret < 0)
+        return ret;
+
+    // store the 20 bit read in a 32 bit signed integer for conversion
+    *pressure = (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
+    *temp = (buf[3] << 12) | (buf[4] << 4) | (buf[5] >> 4);
+    return ret;
+}
+
+
+int BMP280_get_calib_params(uint8_t addr, struct BMP280_calib_param* params) {
+    // 3 temperature and 9 pressure params, each with a LSB and MSB register
+    uint8_t buf[NUM_CALIB_PARAMS] = { 0 };
+    uint8_t reg = REG_DIG_T1_LSB;
+    int ret = i2c_bus_write_read(&bmp280_bus, addr, &reg, 1, buf, NUM_CALIB_PARAMS);
+    if (ret < 0)
+        return ret;
+
+    params->dig_t1 = (uint16_t)(buf[1] << 8) | buf[0];
+    params->dig_t2 = (int16_t)(buf[3] << 8) | buf[2];
+    params->dig_t3 = (int16_t)(buf[5] << 8) | buf[4];
+
+    params->dig_p1 = (uint16_t)(buf[7] << 8) | buf[6];
+    params->dig_p2 = (int16_t)(buf[9] << 8) | buf[8];
+    params->dig_p3 = (int16_t)(buf[11] << 8) | buf[10];
+    params->dig_p4 = (int16_t)(buf[13] << 8) | buf[12];
+    params->dig_p5 = (int16_t)(buf[15] << 8) | buf[14];
+    params->dig_p6 = (int16_t)(buf[17] << 8) | buf[16];
+    params->dig_p7 = (int16_t)(buf[19] << 8) | buf[18];
+    params->dig_p8 = (int16_t)(buf[21] << 8) | buf[20];
+    params->dig_p9 = (int16_t)(buf[23] << 8) | buf[22];
+    return ret;
+}
+
+
+int BMP280_init(uint8_t addr) {
+    uint8_t buf[2];
+    uint8_t reg = REG_ID;
+    int ret = i2c_bus_write_read(&bmp280_bus, addr, &reg, 1, buf, 1);
+    if (ret < 0 || buf[0] != BMP280_CHIP_ID)
+        return PICO_ERROR_GENERIC;
+
+    // 125ms standby so there is a fresh conversion for every sample, x16 filter
+    buf[0] = REG_CONFIG;
+    buf[1] = ((0x02 << 5) | (0x05 << 2)) & 0xFC;
+    ret = i2c_bus_write(&bmp280_bus, addr, buf, 2, false);
+    if (ret < 0)
+        return ret;
+
+    // osrs_t x1, osrs_p x4, normal mode operation
+    buf[0] = REG_CTRL_MEAS;
+    buf[1] = (0x01 << 5) | (0x03 << 2) | (0x03);
+    return i2c_bus_write(&bmp280_bus, addr, buf, 2, false);
+}
+
+
+static void sample(uint n) {
+    struct hub_sensor_regs *s = &sensor_regs[n];
+    int32_t raw_temperature, raw_pressure;
+
+    if (BMP280_read_raw(sensors[n].addr, &raw_temperature, &raw_pressure) < 0) {
+        s->errors++;
+        s->status |= HUB_SENSOR_STALE;
+        return;
+    }
+    int32_t temperature = BMP280_convert_temp(raw_temperature, &sensors[n].params);
+    s->temperature = temperature;
+    s->pressure = BMP280_convert_pressure(raw_pressure, raw_temperature, &sensors[n].params);
+    s->timestamp_ms = to_ms_since_boot(get_absolute_time());
+    if (!(s->status & HUB_SENSOR_VALID) || temperature < s->temp_min)
+        s->temp_min = temperature;
+    if (!(s->status & HUB_SENSOR_VALID) || temperature > s->temp_max)
+        s->temp_max = temperature;
+    s->samples++;
+    s->status = (s->status | HUB_SENSOR_VALID) & ~HUB_SENSOR_STALE;
+}
+
+
+int main() {
+    stdio_init_all();
+    printf("\nI2C sensor hub\n");
+
+    i2c_bus_init(&bmp280_bus);
+    for (uint n = 0; n < HUB_MAX_SENSORS; n++) {
+        if (BMP280_init(sensors[n].addr) < 0 || BMP280_get_calib_params(sensors[n].addr, &sensors[n].params) < 0) {
+            printf("No BMP280 at 0x%02x\n", sensors[n].addr);
+            continue;
+        }
+        printf("BMP280 at 0x%02x\n", sensors[n].addr);
+        sensor_regs[n].status = HUB_SENSOR_PRESENT;
+        num_sensors++;
+    }
+
+    // publish an empty map so the master can see the hub before the first sample
+    publish();
+    setup_slave();
+    printf("i2c0 slave at 0x%02x, %d byte register map v%d\n", I2C_SLAVE_ADDRESS, HUB_REGS_SIZE, HUB_REGS_VERSION);
+    sleep_ms(250); // sleep so that data polling and register update don't collide
+
+    absolute_time_t next_sample = get_absolute_time();
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+    uint32_t last_reads = 0, last_seq = 0;
+
+sample_loop:
+    for (uint n = 0; n < HUB_MAX_SENSORS; n++) {
+        if (sensor_regs[n].status & HUB_SENSOR_PRESENT)
+            sample(n);
+    }
+    publish();
+
+    if (time_reached(next_stats)) {
+        uint32_t reads = context.reads;
+        printf("seq %u: %u publishes, %u master reads in %ds\n", publish_seq,
+               publish_seq - last_seq, reads - last_reads, STATS_INTERVAL_MS / 1000);
+        for (uint n = 0; n < HUB_MAX_SENSORS; n++) {
+            const struct hub_sensor_regs *s = &sensor_regs[n];
+            if (s->status & HUB_SENSOR_VALID)
+                printf("  0x%02x: %.2f C %.3f kPa, %u samples, %u errors\n", sensors[n].addr,
+                       s->temperature / 100.f, s->pressure / 1000.f, s->samples, s->errors);
+        }
+        i2c_bus_print_counters(&bmp280_bus);
+        last_reads = reads;
+        last_seq = publish_seq;
+        next_stats = delayed_by_ms(next_stats, STATS_INTERVAL_MS);
+    }
+
+    next_sample = delayed_by_ms(next_sample, SAMPLE_INTERVAL_MS);
+    sleep_until(next_sample);
+    goto sample_loop;
+
+    return 0;
+}
@@ -0,0 +1,276 @@
+// Polls telemetry from many slave Picos on one bus. Each node runs the 5-i2c_slave
+// firmware built with its own I2C_SLAVE_ADDRESS (and SLAVE_TRACE=0), and refreshes an
+// 8 byte telemetry block at 0xF8 every 100ms: seq, uptime in us, seq again.
+//
+// The poller scans the bus for nodes, then reads each node's block with a single
+// register write + RESTART + 8 byte read. Nodes that are due are read back to back
+// in one pass, starting from a different node each pass. The poll interval follows
+// each node's own update rate: an estimate of its update period is kept from the
+// seq numbers, and a poll that finds nothing new checks back after a quarter period.
+//
+// Data age is worked out from the node uptime stamp against the smallest offset
+// seen between our clock and the node's, which is as close as we get to zero
+// transit time.
+
+#include <hardware/i2c.h>
+#include <pico/stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "i2c_bus.h"
+
+static const uint I2C_BAUDRATE = 400000; // 400 kHz
+
+// For this example, we run the master from pin GP18 (SDA) and pin GP19 (SCL).
+static const uint I2C_MASTER_SDA_PIN = 18;
+static const uint I2C_MASTER_SCL_PIN = 19;
+
+#define TELEMETRY_ADDRESS   0xF8
+#define TELEMETRY_LEN       8
+
+#define MAX_NODES               64
+#define POLL_PERIOD_INIT_US     100000
+#define POLL_PERIOD_MIN_US      5000
+#define POLL_PERIOD_MAX_US      2000000
+#define ERROR_BACKOFF_MAX_US    1000000
+#define NODE_OFFLINE_ERRORS     5       // consecutive errors before a node is dropped
+#define DISCOVERY_INTERVAL_MS   10000
+#define DISCOVERY_READS         3       // a torn block is read again this many times at most
+#define STATS_INTERVAL_MS       5000
+
+// register write, address + 8 bytes after the RESTART, with the two address bytes
+#define POLL_WIRE_BYTES         (1 + 1 + 1 + TELEMETRY_LEN)
+
+struct node {
+    uint8_t addr;
+    bool online;
+    uint16_t last_seq;
+    uint32_t period_us;         // estimated update period of the node
+    uint64_t next_poll_us;
+    uint64_t last_fresh_us;     // our time of the last poll that found new data
+    uint32_t offset_us;         // smallest (our clock - node clock) seen
+    uint32_t error_backoff_us;
+    uint8_t consecutive_errors;
+
+    // since the last report
+    uint32_t polls;
+    uint32_t fresh;
+    uint32_t missed;            // updates we never saw, seq jumped by more than one
+    uint32_t torn;              // block changed while we read it
+    uint32_t errors;
+    uint64_t age_total_us;
+    uint32_t age_max_us;
+};
+
+static i2c_bus_t master_bus;
+static struct node nodes[MAX_NODES];
+static uint num_nodes;
+static uint rr_start;
+
+// I2C reserves some addresses for special purposes. We exclude these from the scan.
+// These are any addresses of the form 000 0xxx or 111 1xxx
+static bool reserved_addr(uint8_t addr) {
+    return (addr & 0x78) == 0 || (addr & 0x78) == 0x78;
+}
+
+static void setup_master() {
+    master_bus = (i2c_bus_t) {
+        .i2c = i2c1,
+        .sda_pin = I2C_MASTER_SDA_PIN,
+        .scl_pin = I2C_MASTER_SCL_PIN,
+        .baudrate = I2C_BAUDRATE,
+        // a failed poll is just rescheduled, never hold up the other nodes
+        .max_retries = 0,
+    };
+    i2c_bus_init(&master_bus);
+}
+
+// One combined transaction: register number, RESTART, the whole telemetry block
+static int read_telemetry(uint8_t addr, uint16_t *seq, uint32_t *uptime_us) {
+    uint8_t reg = TELEMETRY_ADDRESS;
+    uint8_t buf[TELEMETRY_LEN];
+    int ret = i2c_bus_write_read(&master_bus, addr, &reg, 1, buf, TELEMETRY_LEN);
+    if (ret < 0)
+        return ret;
+
+    uint16_t seq_check = buf[6] | (buf[7] << 8);
+    *seq = buf[0] | (buf[1] << 8);
+    *uptime_us = buf[2] | (buf[3] << 8) | (buf[4] << 16) | ((uint32_t)buf[5] << 24);
+    return *seq == seq_check ? ret : PICO_ERROR_NO_DATA;
+}
+
+static struct node *find_node(uint8_t addr) {
+    for (uint i = 0; i < num_nodes; i++) {
+        if (nodes[i].addr == addr)
+            return &nodes[i];
+    }
+    return NULL;
+}
+
+static void discover() {
+    uint found = 0;
+    for (uint8_t addr = 0; addr < (1 << 7); addr++) {
+        struct node *n = find_node(addr);
+        if (reserved_addr(addr) || (n && n->online))
+            continue;
+
+        // only a whole block gives the seq and clock offset to start from
+        uint16_t seq;
+        uint32_t uptime_us;
+        int ret = PICO_ERROR_NO_DATA;
+        for (uint i = 0; i < DISCOVERY_READS && ret == PICO_ERROR_NO_DATA; i++)
+            ret = read_telemetry(addr, &seq, &uptime_us);
+        if (ret != TELEMETRY_LEN)
+            continue;
+        if (!n) {
+            if (num_nodes == MAX_NODES)
+                break;
+            n = &nodes[num_nodes++];
+        }
+
+        memset(n, 0, sizeof(*n));
+        n->addr = addr;
+        n->online = true;
+        n->last_seq = seq;
+        n->period_us = POLL_PERIOD_INIT_US;
+        n->offset_us = time_us_32() - uptime_us;
+        n->last_fresh_us = time_us_64();
+        n->next_poll_us = n->last_fresh_us + n->period_us;
+        found++;
+    }
+    if (found)
+        printf("Found %u new node(s), %u known\n", found, num_nodes);
+}
+
+static void poll_node(struct node *n, uint64_t now_us) {
+    uint16_t seq;
+    uint32_t uptime_us;
+    int ret = read_telemetry(n->addr, &seq, &uptime_us);
+    n->polls++;
+
+    if (ret == PICO_ERROR_NO_DATA) {
+        // caught the block half way through an update, it's fresh right after
+        n->torn++;
+        n->next_poll_us = now_us + POLL_PERIOD_MIN_US;
+        return;
+    }
+    if (ret < 0) {
+        n->errors++;
+        n->error_backoff_us = n->error_backoff_us ? MIN(n->error_backoff_us * 2, ERROR_BACKOFF_MAX_US) : n->period_us;
+        n->next_poll_us = now_us + n->error_backoff_us;
+        if (++n->consecutive_errors >= NODE_OFFLINE_ERRORS) {
+            n->online = false;
+            printf("Node 0x%02x offline\n", n->addr);
+        }
+        return;
+    }
+    n->consecutive_errors = 0;
+    n->error_backoff_us = 0;
+
+    uint16_t delta = seq - n->last_seq;
+    if (!delta) {
+        // nothing new yet, look again a bit later
+        n->next_poll_us = now_us + MAX(n->period_us / 4, POLL_PERIOD_MIN_US);
+        return;
+    }
+
+    // age of the data: node clock against the best offset seen so far
+    uint32_t offset_us = time_us_32() - uptime_us;
+    int32_t age_us = (int32_t)(offset_us - n->offset_us);
+    if (age_us < 0) {
+        n->offset_us = offset_us;
+        age_us = 0;
+    }
+    n->age_total_us += age_us;
+    n->age_max_us = MAX(n->age_max_us, (uint32_t)age_us);
+
+    // period estimate, smoothed over ~8 updates
+    uint32_t period_us = (uint32_t)((now_us - n->last_fresh_us) / delta);
+    n->period_us = (7 * (uint64_t)n->period_us + period_us) / 8;
+    n->period_us = MAX(MIN(n->period_us, POLL_PERIOD_MAX_US), POLL_PERIOD_MIN_US);
+
+    n->fresh++;
+    n->missed += delta - 1;
+    n->last_seq = seq;
+    n->last_fresh_us = now_us;
+    // the next update should land a period after this one was stamped
+    n->next_poll_us = now_us + (n->period_us > (uint32_t)age_us ? n->period_us - age_us : POLL_PERIOD_MIN_US);
+}
+
+// one pass over the nodes that are due, back to back
+static uint poll_due_nodes() {
+    uint polled = 0;
+    for (uint i = 0; i < num_nodes; i++) {
+        struct node *n = &nodes[(rr_start + i) % num_nodes];
+        uint64_t now_us = time_us_64();
+        if (n->online && now_us >= n->next_poll_us) {
+            poll_node(n, now_us);
+            polled++;
+        }
+    }
+    if (num_nodes)
+        rr_start = (rr_start + 1) % num_nodes;
+    return polled;
+}
+
+static uint64_t next_due_us() {
+    uint64_t next_us = UINT64_MAX;
+    for (uint i = 0; i < num_nodes; i++) {
+        if (nodes[i].online)
+            next_us = MIN(next_us, nodes[i].next_poll_us);
+    }
+    return next_us;
+}
+
+static void print_stats(uint32_t elapsed_ms) {
+    uint32_t polls = 0, fresh = 0, online = 0;
+    printf("\nnode   period  polls  fresh missed torn err  age avg/max\n");
+    for (uint i = 0; i < num_nodes; i++) {
+        struct node *n = &nodes[i];
+        printf("0x%02x %6ums %6u %6u %6u %4u %3u %5u/%ums%s\n", n->addr, n->period_us / 1000,
+               n->polls, n->fresh, n->missed, n->torn, n->errors,
+               n->fresh ? (uint32_t)(n->age_total_us / n->fresh / 1000) : 0, n->age_max_us / 1000,
+               n->online ? "" : " offline");
+        polls += n->polls;
+        fresh += n->fresh;
+        online += n->online;
+        n->polls = n->fresh = n->missed = n->torn = n->errors = 0;
+        n->age_total_us = 0;
+        n->age_max_us = 0;
+    }
+    printf("%u/%u nodes online: %u polls/s, %u fresh/s, %u B/s on the wire\n", online, num_nodes,
+           polls * 1000 / elapsed_ms, fresh * 1000 / elapsed_ms, polls * POLL_WIRE_BYTES * 1000 / elapsed_ms);
+    i2c_bus_print_counters(&master_bus);
+}
+
+static void run_poller() {
+    setup_master();
+
+    absolute_time_t next_discovery = get_absolute_time();
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+
+    while (true) {
+        if (time_reached(next_discovery)) {
+            discover();
+            next_discovery = make_timeout_time_ms(DISCOVERY_INTERVAL_MS);
+        }
+
+        poll_due_nodes();
+
+        if (time_reached(next_stats)) {
+            print_stats(STATS_INTERVAL_MS);
+            next_stats = delayed_by_ms(next_stats, STATS_INTERVAL_MS);
+        }
+
+        // sleep until the next node is due, or the next housekeeping job
+        uint64_t wake_us = MIN(next_due_us(), to_us_since_boot(next_discovery));
+        wake_us = MIN(wake_us, to_us_since_boot(next_stats));
+        sleep_until(from_us_since_boot(wake_us));
+    }
+}
+
+int main() {
+    stdio_init_all();
+    //Code here
+    printf("\nI2C node poller :");
+    run_poller();
+}
@@ -0,0 +1,342 @@
+// Host side reader for the bulk stream (see ../usb_stream.h).
+//
+//   usb_bulk_reader [--verify] [seconds]
+//       read the device's stream, printing MB/s and dropped blocks every second.
+//       --verify also checks the payload is the counter trace usb_bulk_stream sends.
+//       On Linux the device needs a udev rule for 0xcafe:0x4053, or run as root.
+//   usb_bulk_reader --loopback [drop_permille] [seconds]
+//       no device: a stand-in producer builds blocks the way usb_stream.c does, with
+//       random drops and early flushes, and the same parser checks they all add up
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#ifdef HAVE_LIBUSB
+#include <libusb.h>
+#endif
+
+extern "C" {
+#include "../usb_descriptors.h"
+#include "../usb_stream.h"
+}
+
+class BlockParser {
+public:
+    struct Stats {
+        uint64_t bytes = 0;             // on the wire
+        uint64_t payload = 0;
+        uint64_t blocks = 0;
+        uint64_t dropped = 0;           // from gaps in the sequence numbers
+        uint64_t partial = 0;
+        uint64_t bad = 0;               // wrong magic or length
+        uint64_t verify_errors = 0;     // counter words out of order
+    };
+
+    explicit BlockParser(bool verify) : verify_(verify) {}
+
+    // Takes any split of the stream, blocks that straddle calls are put back together
+    void feed(const uint8_t *data, size_t len) {
+        stats_.bytes += len;
+        if (!carry_.empty()) {
+            size_t n = std::min(len, USB_STREAM_BLOCK_SIZE - carry_.size());
+            carry_.insert(carry_.end(), data, data + n);
+            data += n;
+            len -= n;
+            if (carry_.size() < USB_STREAM_BLOCK_SIZE)
+                return;
+            block(carry_.data());
+            carry_.clear();
+        }
+        for (; len >= USB_STREAM_BLOCK_SIZE; data += USB_STREAM_BLOCK_SIZE, len -= USB_STREAM_BLOCK_SIZE)
+            block(data);
+        carry_.assign(data, data + len);
+    }
+
+    const Stats &stats() const { return stats_; }
+
+private:
+    static uint32_t get_u32(const uint8_t *p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    void block(const uint8_t *b) {
+        uint16_t magic = b[0] | (b[1] << 8);
+        uint16_t len = b[2] | (b[3] << 8);
+        uint32_t seq = get_u32(&b[4]);
+        if (magic != USB_STREAM_MAGIC || len > USB_STREAM_PAYLOAD) {
+            // the transfers are block aligned, nothing to resync on
+            stats_.bad++;
+            return;
+        }
+
+        bool gap = have_seq_ && seq != next_seq_;
+        if (gap)
+            stats_.dropped += seq - next_seq_;
+        have_seq_ = true;
+        next_seq_ = seq + 1;
+
+        stats_.blocks++;
+        stats_.payload += len;
+        if (len < USB_STREAM_PAYLOAD)
+            stats_.partial++;
+
+        if (!verify_)
+            return;
+        const uint8_t *p = b + USB_STREAM_HDR_LEN;
+        for (size_t i = 0; i + 4 <= len; i += 4) {
+            uint32_t word = get_u32(p + i);
+            // after a gap the trace picks up wherever the producer got to
+            if (have_word_ && !(gap && i == 0) && word != next_word_)
+                stats_.verify_errors++;
+            have_word_ = true;
+            next_word_ = word + 1;
+        }
+    }
+
+    bool verify_;
+    std::vector<uint8_t> carry_;
+    Stats stats_;
+    bool have_seq_ = false;
+    uint32_t next_seq_ = 0;
+    bool have_word_ = false;
+    uint32_t next_word_ = 0;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *what, const BlockParser::Stats &st, const BlockParser::Stats &prev, double seconds) {
+    std::printf("%s %7.3f MB/s (%7.3f MB/s payload), %llu blocks, %llu dropped, %llu partial, %llu bad, %llu verify errors\n",
+                what, (st.bytes - prev.bytes) / seconds / 1e6, (st.payload - prev.payload) / seconds / 1e6,
+                (unsigned long long)st.blocks, (unsigned long long)st.dropped, (unsigned long long)st.partial,
+                (unsigned long long)st.bad, (unsigned long long)st.verify_errors);
+}
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int) {
+    running = 0;
+}
+
+/* Loopback */
+
+// Builds blocks the way usb_stream.c does: the counter trace in 256 byte writes,
+// a block now and then flushed early, and drop_permille of finished blocks thrown
+// away with their sequence number used up. Handed over in transfer sized pieces.
+static int loopback(unsigned drop_permille, double seconds) {
+    const size_t xfer_size = USB_STREAM_XFER_BLOCKS * USB_STREAM_BLOCK_SIZE;
+    std::vector<uint8_t> xfer;
+    xfer.reserve(xfer_size);
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<unsigned> permille(0, 999);
+    uint8_t block[USB_STREAM_BLOCK_SIZE];
+    uint16_t fill = 0;
+    uint32_t seq = 0;
+    uint32_t counter = 0;
+    uint64_t dropped = 0;
+
+    BlockParser parser(true);
+    BlockParser::Stats prev;
+
+    auto commit = [&](bool may_drop) {
+        block[0] = USB_STREAM_MAGIC & 0xff;
+        block[1] = USB_STREAM_MAGIC >> 8;
+        block[2] = fill & 0xff;
+        block[3] = fill >> 8;
+        std::memcpy(&block[4], &seq, 4);
+        seq++;
+        fill = 0;
+        if (may_drop && permille(rng) < drop_permille) {
+            dropped++;
+            return;
+        }
+        xfer.insert(xfer.end(), block, block + sizeof(block));
+        if (xfer.size() == xfer_size) {
+            parser.feed(xfer.data(), xfer.size());
+            xfer.clear();
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    auto last = start;
+    while (running && seconds_since(start) < seconds) {
+        for (int n = 0; n < 1000; n++) {
+            uint32_t words[64];
+            for (auto &w : words)
+                w = counter++;
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(words);
+            size_t len = sizeof(words);
+            while (len) {
+                size_t chunk = std::min(len, size_t(USB_STREAM_PAYLOAD - fill));
+                std::memcpy(block + USB_STREAM_HDR_LEN + fill, p, chunk);
+                fill += chunk;
+                p += chunk;
+                len -= chunk;
+                if (fill == USB_STREAM_PAYLOAD)
+                    commit(true);
+            }
+            // the idle flush of a slow producer
+            if (fill && permille(rng) == 0)
+                commit(true);
+        }
+
+        double interval = seconds_since(last);
+        if (interval >= 1) {
+            report("loopback", parser.stats(), prev, interval);
+            prev = parser.stats();
+            last = std::chrono::steady_clock::now();
+        }
+    }
+    // a drop at the very end would leave no gap to see
+    commit(false);
+    parser.feed(xfer.data(), xfer.size());
+
+    const auto &st = parser.stats();
+    report("total   ", st, BlockParser::Stats(), seconds_since(start));
+    if (st.dropped != dropped || st.blocks + st.dropped != seq || st.bad || st.verify_errors) {
+        std::fprintf(stderr, "loopback mismatch: %llu of %u blocks dropped, parser saw %llu blocks and %llu dropped\n",
+                     (unsigned long long)dropped, seq, (unsigned long long)st.blocks, (unsigned long long)st.dropped);
+        return 1;
+    }
+    return 0;
+}
+
+/* Device */
+
+#ifdef HAVE_LIBUSB
+
+// several transfers queued so the host always has one waiting for the next packet
+#define NUM_XFERS       4
+#define XFER_SIZE       (32 * USB_STREAM_BLOCK_SIZE)
+// a slow stream still gets parsed, a timed out transfer keeps what it got
+#define XFER_TIMEOUT_MS 100
+
+struct Reader {
+    BlockParser parser;
+    int pending = 0;
+    int errors = 0;
+    bool gone = false;
+
+    explicit Reader(bool verify) : parser(verify) {}
+};
+
+static void LIBUSB_CALL xfer_done(libusb_transfer *xfer) {
+    Reader *r = static_cast<Reader *>(xfer->user_data);
+    r->pending--;
+
+    switch (xfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        r->parser.feed(xfer->buffer, xfer->actual_length);
+        break;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        r->gone = true;
+        return;
+    case LIBUSB_TRANSFER_CANCELLED:
+        return;
+    default:
+        r->errors++;
+        break;
+    }
+
+    if (running && !r->gone && libusb_submit_transfer(xfer) == 0)
+        r->pending++;
+}
+
+static int read_device(bool verify, double seconds) {
+    libusb_context *ctx;
+    int err = libusb_init(&ctx);
+    if (err) {
+        std::fprintf(stderr, "libusb_init: %s\n", libusb_error_name(err));
+        return 1;
+    }
+    libusb_device_handle *dev = libusb_open_device_with_vid_pid(ctx, USB_STREAM_VID, USB_STREAM_PID);
+    if (!dev) {
+        std::fprintf(stderr, "no device %04x:%04x, or no permission to open it\n", USB_STREAM_VID, USB_STREAM_PID);
+        libusb_exit(ctx);
+        return 1;
+    }
+    if ((err = libusb_claim_interface(dev, ITF_NUM_STREAM))) {
+        std::fprintf(stderr, "claiming interface %d: %s\n", ITF_NUM_STREAM, libusb_error_name(err));
+        libusb_close(dev);
+        libusb_exit(ctx);
+        return 1;
+    }
+
+    Reader r(verify);
+    std::vector<std::vector<uint8_t>> buffers(NUM_XFERS, std::vector<uint8_t>(XFER_SIZE));
+    std::vector<libusb_transfer *> xfers;
+    for (auto &buf : buffers) {
+        libusb_transfer *xfer = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(xfer, dev, USB_STREAM_EP, buf.data(), buf.size(), xfer_done, &r, XFER_TIMEOUT_MS);
+        if ((err = libusb_submit_transfer(xfer))) {
+            std::fprintf(stderr, "submit: %s\n", libusb_error_name(err));
+            running = 0;
+        } else {
+            r.pending++;
+        }
+        xfers.push_back(xfer);
+    }
+
+    BlockParser::Stats prev;
+    auto start = std::chrono::steady_clock::now();
+    auto last = start;
+    while (running && !r.gone && (seconds <= 0 || seconds_since(start) < seconds)) {
+        timeval tv = {0, 100000};
+        libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+
+        double interval = seconds_since(last);
+        if (interval >= 1) {
+            report("device", r.parser.stats(), prev, interval);
+            prev = r.parser.stats();
+            last = std::chrono::steady_clock::now();
+        }
+    }
+
+    running = 0;
+    for (auto *xfer : xfers)
+        libusb_cancel_transfer(xfer);
+    while (r.pending > 0)
+        libusb_handle_events(ctx);
+    for (auto *xfer : xfers)
+        libusb_free_transfer(xfer);
+
+    report("total ", r.parser.stats(), BlockParser::Stats(), seconds_since(start));
+    if (r.gone)
+        std::fprintf(stderr, "device went away\n");
+    if (r.errors)
+        std::fprintf(stderr, "%d transfer errors\n", r.errors);
+
+    libusb_release_interface(dev, ITF_NUM_STREAM);
+    libusb_close(dev);
+    libusb_exit(ctx);
+    return r.errors || r.parser.stats().verify_errors ? 1 : 0;
+}
+
+#endif
+
+int main(int argc, char **argv) {
+    std::signal(SIGINT, on_signal);
+
+    if (argc > 1 && !std::strcmp(argv[1], "--loopback")) {
+        unsigned drop_permille = argc > 2 ? std::strtoul(argv[2], nullptr, 0) : 5;
+        double seconds = argc > 3 ? std::strtod(argv[3], nullptr) : 5;
+        return loopback(drop_permille, seconds);
+    }
+
+#ifdef HAVE_LIBUSB
+    bool verify = argc > 1 && !std::strcmp(argv[1], "--verify");
+    double seconds = argc > 1 + verify ? std::strtod(argv[1 + verify], nullptr) : 0;
+    return read_device(verify, seconds);
+#else
+    std::fprintf(stderr, "built without libusb, only --loopback is available\n");
+    return 1;
+#endif
+}
@@ -0,0 +1,27 @@
+#ifndef _TUSB_CONFIG_H
+#define _TUSB_CONFIG_H
+
+// Linking tinyusb_device directly means the SDK's stdio_usb no longer brings its
+// own descriptors and config, this replaces both: CDC for stdio, and a vendor
+// interface for the bulk stream served by the class driver in usb_stream.c.
+
+#define CFG_TUSB_RHPORT0_MODE   OPT_MODE_DEVICE
+
+#ifndef CFG_TUSB_OS
+#define CFG_TUSB_OS             OPT_OS_PICO
+#endif
+
+#define CFG_TUD_ENDPOINT0_SIZE  64
+
+#define CFG_TUD_CDC             1
+#define CFG_TUD_CDC_RX_BUFSIZE  256
+#define CFG_TUD_CDC_TX_BUFSIZE  256
+
+// the stream interface is not TinyUSB's vendor class, which would copy every byte
+// through its own FIFO
+#define CFG_TUD_VENDOR          0
+#define CFG_TUD_MSC             0
+#define CFG_TUD_HID             0
+#define CFG_TUD_MIDI            0
+
+#endif
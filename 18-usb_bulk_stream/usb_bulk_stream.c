@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "usb_stream.h"
+
+// Streams a synthetic trace out of the bulk endpoint as fast as USB takes it, with
+// stats on CDC stdio. Read it with host/usb_bulk_reader.
+//
+// The trace is consecutive 32 bit counter values, so the reader can check every
+// byte. TRACE_RATE paces it in bytes/s instead, set it above what the bus carries
+// (about 1MB/s at full speed) to see blocks being dropped.
+
+#ifndef TRACE_RATE
+#define TRACE_RATE          0       // 0: fill whatever space the ring has
+#endif
+
+#define TRACE_CHUNK_WORDS   64
+#define STATS_INTERVAL_MS   5000
+
+static uint32_t trace_counter;
+
+static void produce(uint32_t *budget) {
+    uint32_t words[TRACE_CHUNK_WORDS];
+
+    while (TRACE_RATE ? *budget >= sizeof(words) : usb_stream_free() >= sizeof(words)) {
+        for (int i = 0; i < TRACE_CHUNK_WORDS; i++)
+            words[i] = trace_counter++;
+        usb_stream_write(words, sizeof(words));
+        if (TRACE_RATE)
+            *budget -= sizeof(words);
+    }
+}
+
+static absolute_time_t stats_start;
+
+static void print_stats() {
+    uint32_t elapsed_ms = MAX(absolute_time_diff_us(stats_start, get_absolute_time()) / 1000, 1);
+    stats_start = get_absolute_time();
+
+    struct usb_stream_stats stats;
+    usb_stream_get_stats(&stats, true);
+    uint32_t payload_per_s = (uint64_t)stats.blocks_sent * USB_STREAM_PAYLOAD * 1000 / elapsed_ms;
+    printf("stream: %s, %u.%03u MB/s, %u blocks sent, %u dropped, %u partial, %u xfers, max fill %u/%u\n",
+           usb_stream_ready() ? "open" : "no host", payload_per_s / 1000000, payload_per_s / 1000 % 1000,
+           stats.blocks_sent, stats.blocks_dropped, stats.partial_blocks, stats.xfers,
+           stats.max_fill, USB_STREAM_BLOCKS);
+}
+
+int main() {
+    // With tinyusb_device linked, stdio_usb expects TinyUSB up before it starts
+    tusb_init();
+    stdio_init_all();
+
+    uint32_t budget = 0;
+    absolute_time_t last_refill = get_absolute_time();
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+    stats_start = get_absolute_time();
+    while (true) {
+        tud_task();
+
+        if (USB_STREAM && usb_stream_ready()) {
+            if (TRACE_RATE) {
+                absolute_time_t now = get_absolute_time();
+                uint64_t us = absolute_time_diff_us(last_refill, now);
+                // in whole ms so rounding doesn't eat into the rate, and at most
+                // 10ms worth so a stall doesn't turn into a burst
+                if (us >= 1000) {
+                    budget = MIN(budget + us * TRACE_RATE / 1000000, TRACE_RATE / 100 + 1024);
+                    last_refill = now;
+                }
+            }
+            produce(&budget);
+        }
+        usb_stream_task();
+
+        if (time_reached(next_stats)) {
+            print_stats();
+            next_stats = delayed_by_ms(next_stats, STATS_INTERVAL_MS);
+        }
+    }
+}
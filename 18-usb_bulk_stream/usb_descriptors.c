@@ -0,0 +1,90 @@
+#include "pico/unique_id.h"
+#include "tusb.h"
+#include "usb_descriptors.h"
+
+#define USB_BCD     0x0200
+
+static const tusb_desc_device_t desc_device = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = USB_BCD,
+    // IAD, so the host groups the two CDC interfaces
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USB_STREAM_VID,
+    .idProduct = USB_STREAM_PID,
+    .bcdDevice = 0x0100,
+    .iManufacturer = 1,
+    .iProduct = 2,
+    .iSerialNumber = 3,
+    .bNumConfigurations = 1,
+};
+
+const uint8_t *tud_descriptor_device_cb(void) {
+    return (const uint8_t *)&desc_device;
+}
+
+#if USB_STREAM
+#define ITF_NUM_TOTAL       3
+#define STREAM_DESC_LEN     (9 + 7)
+#else
+#define ITF_NUM_TOTAL       2
+#define STREAM_DESC_LEN     0
+#endif
+
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + STREAM_DESC_LEN)
+
+#define EPNUM_CDC_NOTIF     0x81
+#define EPNUM_CDC_OUT       0x02
+#define EPNUM_CDC_IN        0x82
+
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0, 250),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+#if USB_STREAM
+    // vendor interface with a single bulk IN endpoint, no OUT, so not TUD_VENDOR_DESCRIPTOR
+    9, TUSB_DESC_INTERFACE, ITF_NUM_STREAM, 0, 1, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 5,
+    7, TUSB_DESC_ENDPOINT, USB_STREAM_EP, TUSB_XFER_BULK, U16_TO_U8S_LE(64), 0,
+#endif
+};
+
+const uint8_t *tud_descriptor_configuration_cb(uint8_t index) {
+    return desc_configuration;
+}
+
+static const char *const string_desc[] = {
+    NULL,                       // 0: language, handled below
+    "Raspberry Pi",             // 1: manufacturer
+    "Pico bulk stream",         // 2: product
+    NULL,                       // 3: serial, the board id
+    "Board CDC",                // 4: CDC interface
+    "Bulk stream",              // 5: stream interface
+};
+
+const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    static uint16_t desc_str[1 + 32];
+    char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    const char *str;
+    size_t len;
+
+    if (index == 0) {
+        desc_str[1] = 0x0409;   // English
+        len = 1;
+    } else {
+        if (index >= count_of(string_desc))
+            return NULL;
+        str = string_desc[index];
+        if (index == 3) {
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            str = serial;
+        }
+        for (len = 0; str[len] && len < count_of(desc_str) - 1; len++)
+            desc_str[1 + len] = str[len];
+    }
+
+    // first half word is the length in bytes, including itself, and the type
+    desc_str[0] = (TUSB_DESC_STRING << 8) | (2 * len + 2);
+    return desc_str;
+}
@@ -0,0 +1,19 @@
+#ifndef _USB_DESCRIPTORS_H
+#define _USB_DESCRIPTORS_H
+
+// set to 0 for plain CDC stdio, without the stream interface
+#ifndef USB_STREAM
+#define USB_STREAM          1
+#endif
+
+// TinyUSB's test VID, fine on the bench, not for anything shipped. The host reader
+// finds the device by these
+#define USB_STREAM_VID      0xCafe
+#define USB_STREAM_PID      0x4053
+
+#define ITF_NUM_CDC         0   // and 1 for its data interface
+#define ITF_NUM_STREAM      2
+
+#define USB_STREAM_EP       0x83
+
+#endif
@@ -0,0 +1,188 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "usb_stream.h"
+
+#define RING_MASK   (USB_STREAM_BLOCKS - 1)
+
+static_assert((USB_STREAM_BLOCKS & RING_MASK) == 0, "USB_STREAM_BLOCKS must be a power of 2");
+
+struct block {
+    uint16_t magic;
+    uint16_t len;
+    uint32_t seq;
+    uint8_t payload[USB_STREAM_PAYLOAD];
+};
+
+static_assert(sizeof(struct block) == USB_STREAM_BLOCK_SIZE, "block layout");
+
+// the endpoint reads straight out of the ring
+static struct block ring[USB_STREAM_BLOCKS] __attribute__((aligned(4)));
+
+static struct {
+    uint8_t rhport;
+    uint8_t ep_in;              // 0 until the host configures the interface
+    // free running block indices, masked on access
+    uint32_t head;              // block being filled
+    uint32_t tail;              // oldest committed block
+    uint32_t in_flight;         // blocks from tail on in the current transfer
+    uint32_t seq;               // of the block being filled
+    uint32_t fill_start_us;     // first write into the block being filled
+    struct usb_stream_stats stats;
+} st;
+
+static void start_xfer(void) {
+    if (!st.ep_in || st.in_flight || st.head == st.tail)
+        return;
+
+    // as many committed blocks as are contiguous, the transfer can't wrap
+    uint32_t first = st.tail & RING_MASK;
+    uint32_t n = MIN(st.head - st.tail, USB_STREAM_BLOCKS - first);
+    n = MIN(n, USB_STREAM_XFER_BLOCKS);
+
+    if (!usbd_edpt_claim(st.rhport, st.ep_in))
+        return;
+    if (!usbd_edpt_xfer(st.rhport, st.ep_in, (uint8_t *)&ring[first], n * USB_STREAM_BLOCK_SIZE)) {
+        usbd_edpt_release(st.rhport, st.ep_in);
+        return;
+    }
+    st.in_flight = n;
+    st.stats.xfers++;
+}
+
+static bool commit(void) {
+    struct block *b = &ring[st.head & RING_MASK];
+    b->magic = USB_STREAM_MAGIC;
+    b->seq = st.seq++;
+    if (b->len < USB_STREAM_PAYLOAD)
+        st.stats.partial_blocks++;
+
+    // the block being filled must never be one the endpoint may be reading
+    if (st.head - st.tail >= USB_STREAM_BLOCKS - 1) {
+        st.stats.blocks_dropped++;
+        b->len = 0;
+        return false;
+    }
+
+    st.head++;
+    st.stats.max_fill = MAX(st.stats.max_fill, st.head - st.tail);
+    ring[st.head & RING_MASK].len = 0;
+    start_xfer();
+    return true;
+}
+
+bool usb_stream_ready(void) {
+    return st.ep_in && tud_mounted();
+}
+
+bool usb_stream_write(const void *data, size_t len) {
+    const uint8_t *p = data;
+    bool ok = true;
+
+    while (len) {
+        struct block *b = &ring[st.head & RING_MASK];
+        if (!b->len)
+            st.fill_start_us = time_us_32();
+        size_t n = MIN(len, USB_STREAM_PAYLOAD - b->len);
+        memcpy(b->payload + b->len, p, n);
+        b->len += n;
+        p += n;
+        len -= n;
+        st.stats.bytes += n;
+        if (b->len == USB_STREAM_PAYLOAD)
+            ok &= commit();
+    }
+    return ok;
+}
+
+size_t usb_stream_free(void) {
+    // blocks that can still be committed, plus what fits in the current one short
+    // of completing it
+    uint32_t blocks = USB_STREAM_BLOCKS - 1 - (st.head - st.tail);
+    return blocks * USB_STREAM_PAYLOAD + USB_STREAM_PAYLOAD - ring[st.head & RING_MASK].len - 1;
+}
+
+void usb_stream_flush(void) {
+    if (ring[st.head & RING_MASK].len)
+        commit();
+}
+
+void usb_stream_task(void) {
+    // a partial block only goes out once the endpoint has nothing better to do
+    if (st.ep_in && !st.in_flight && ring[st.head & RING_MASK].len &&
+        time_us_32() - st.fill_start_us >= USB_STREAM_FLUSH_US)
+        commit();
+    start_xfer();
+}
+
+void usb_stream_get_stats(struct usb_stream_stats *stats, bool reset) {
+    *stats = st.stats;
+    if (reset)
+        memset(&st.stats, 0, sizeof(st.stats));
+}
+
+/* Class driver */
+
+static void stream_init(void) {
+}
+
+static void stream_reset(uint8_t rhport) {
+    // anything committed was meant for the previous host
+    st.ep_in = 0;
+    st.in_flight = 0;
+    st.tail = st.head;
+}
+
+static uint16_t stream_open(uint8_t rhport, tusb_desc_interface_t const *itf, uint16_t max_len) {
+    uint16_t len = sizeof(tusb_desc_interface_t) + sizeof(tusb_desc_endpoint_t);
+    TU_VERIFY(itf->bInterfaceClass == TUSB_CLASS_VENDOR_SPECIFIC && itf->bNumEndpoints == 1, 0);
+    TU_VERIFY(max_len >= len, 0);
+
+    tusb_desc_endpoint_t const *ep = (tusb_desc_endpoint_t const *)tu_desc_next(itf);
+    TU_VERIFY(ep->bDescriptorType == TUSB_DESC_ENDPOINT, 0);
+    TU_VERIFY(tu_edpt_dir(ep->bEndpointAddress) == TUSB_DIR_IN, 0);
+    TU_VERIFY(usbd_edpt_open(rhport, ep), 0);
+
+    st.rhport = rhport;
+    st.ep_in = ep->bEndpointAddress;
+    st.in_flight = 0;
+    st.tail = st.head;
+    return len;
+}
+
+// no vendor requests, stall them
+static bool stream_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request) {
+    return false;
+}
+
+static bool stream_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes) {
+    if (ep_addr != st.ep_in)
+        return false;
+
+    if (result == XFER_RESULT_SUCCESS)
+        st.stats.blocks_sent += st.in_flight;
+    else
+        st.stats.blocks_dropped += st.in_flight;
+    st.tail += st.in_flight;
+    st.in_flight = 0;
+
+    // keep the endpoint busy with whatever was committed meanwhile
+    start_xfer();
+    return true;
+}
+
+static const usbd_class_driver_t stream_driver = {
+    .init = stream_init,
+    .reset = stream_reset,
+    .open = stream_open,
+    .control_xfer_cb = stream_control_xfer_cb,
+    .xfer_cb = stream_xfer_cb,
+    .sof = NULL,
+};
+
+// TinyUSB asks the application for drivers beyond its built in classes
+usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count) {
+    *driver_count = 1;
+    return &stream_driver;
+}
@@ -0,0 +1,75 @@
+#ifndef _USB_STREAM_H
+#define _USB_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Raw byte stream out of a vendor class bulk IN endpoint, next to CDC stdio.
+//
+// The producer writes into a ring of fixed size blocks. A full block is committed
+// and a new one started, while the USB side sends runs of committed blocks in one
+// endpoint transfer straight out of the ring, so one part of the ring is filled
+// while another is on the wire. Every block is USB_STREAM_BLOCK_SIZE bytes on the
+// wire, little endian:
+//
+//   magic       u16     USB_STREAM_MAGIC
+//   len         u16     payload bytes used, less than USB_STREAM_PAYLOAD if flushed early
+//   seq         u32     block sequence number
+//   payload     u8[USB_STREAM_PAYLOAD]
+//
+// A block that is finished while the ring is full is thrown away, its sequence
+// number is still used up, so the host sees every lost block as a gap.
+//
+// The producer side must run on the same core as tud_task, there is no locking.
+// The format part of this header has no SDK dependencies, the host reader uses it.
+
+#define USB_STREAM_MAGIC        0x4253  // "SB"
+#define USB_STREAM_BLOCK_SIZE   512     // a multiple of the 64 byte bulk packet
+#define USB_STREAM_HDR_LEN      8
+#define USB_STREAM_PAYLOAD      (USB_STREAM_BLOCK_SIZE - USB_STREAM_HDR_LEN)
+
+// must be a power of 2
+#ifndef USB_STREAM_BLOCKS
+#define USB_STREAM_BLOCKS       16
+#endif
+
+// most blocks handed to the endpoint in one transfer
+#ifndef USB_STREAM_XFER_BLOCKS
+#define USB_STREAM_XFER_BLOCKS  8
+#endif
+
+// a partial block is sent once it has waited this long with the endpoint idle
+#ifndef USB_STREAM_FLUSH_US
+#define USB_STREAM_FLUSH_US     10000
+#endif
+
+struct usb_stream_stats {
+    uint32_t bytes;             // payload bytes written
+    uint32_t blocks_sent;
+    uint32_t blocks_dropped;    // finished while the ring was full
+    uint32_t partial_blocks;    // flushed before they were full
+    uint32_t xfers;             // endpoint transfers
+    uint32_t max_fill;          // high water mark of committed blocks
+};
+
+// True while a host has the device configured
+bool usb_stream_ready(void);
+
+// Appends to the current block, starting new ones as needed. Returns false if a
+// block this completed had to be dropped.
+bool usb_stream_write(const void *data, size_t len);
+
+// Bytes that can be written right now without a block being dropped
+size_t usb_stream_free(void);
+
+// Commits the current block even if it isn't full
+void usb_stream_flush(void);
+
+// Starts a transfer if the endpoint is idle, and sends a partial block once it has
+// waited USB_STREAM_FLUSH_US. Call from the main loop after tud_task.
+void usb_stream_task(void);
+
+void usb_stream_get_stats(struct usb_stream_stats *stats, bool reset);
+
+#endif
@@ -0,0 +1,429 @@
+#include <string.h>
+#include "lwip/igmp.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "collector.h"
+
+#if !LWIP_IGMP
+#error collector needs LWIP_IGMP for discovery
+#endif
+
+_Static_assert(MEMP_NUM_TCP_PCB > COLLECTOR_MAX_NODES, "MEMP_NUM_TCP_PCB has to take a connection per node");
+
+// a sequence number this far back is a reboot, not reordering
+#define RESTART_GAP     1024
+
+struct node {
+    bool used;
+    bool tcp;
+    uint32_t id;
+    ip4_addr_t addr;
+    uint32_t last_seen_us;
+
+    bool clock_synced;
+    uint32_t offset_us;         // this clock minus the node's
+    bool seq_synced;
+    uint32_t next_seq;
+
+    uint32_t tokens;            // thousandths of a sample
+    uint32_t refill_us;
+
+    struct tcp_pcb *pcb;
+    uint8_t partial[sizeof(struct node_tcp_record)];    // a record split across segments
+    uint32_t partial_len;
+    uint32_t unrecved;          // bytes taken in but not given back to the window yet
+
+    struct collector_node_stats stats;
+};
+
+static struct {
+    struct netif *netif;
+    uint32_t (*now_us)(void);
+    struct udp_pcb *data_pcb;
+    struct udp_pcb *discovery_pcb;
+    struct tcp_pcb *listen_pcb;
+    ip_addr_t group;
+    uint32_t next_beacon_us;
+
+    struct node nodes[COLLECTOR_MAX_NODES];
+
+    // binary heap, the oldest sample at the top
+    struct collector_sample heap[COLLECTOR_MERGE_SAMPLES];
+    uint32_t heap_len;
+    bool popped;
+    uint32_t last_out_us;
+
+    struct collector_stats stats;
+} col;
+
+static bool earlier(const struct collector_sample *a, const struct collector_sample *b) {
+    return (int32_t)(a->time_us - b->time_us) < 0;
+}
+
+static void swap(uint32_t i, uint32_t j) {
+    struct collector_sample t = col.heap[i];
+    col.heap[i] = col.heap[j];
+    col.heap[j] = t;
+}
+
+static bool merge_put(uint32_t time_us, uint32_t node_id, int32_t value) {
+    if (col.popped && (int32_t)(time_us - col.last_out_us) < 0) {
+        col.stats.late++;
+        return false;
+    }
+    if (col.heap_len == COLLECTOR_MERGE_SAMPLES) {
+        col.stats.overflow++;
+        return false;
+    }
+    uint32_t i = col.heap_len++;
+    col.heap[i] = (struct collector_sample){ time_us, node_id, value };
+    while (i && earlier(&col.heap[i], &col.heap[(i - 1) / 2])) {
+        swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    if (col.heap_len > col.stats.merge_max)
+        col.stats.merge_max = col.heap_len;
+    col.stats.samples++;
+    return true;
+}
+
+static void merge_take_top(void) {
+    col.heap[0] = col.heap[--col.heap_len];
+    uint32_t i = 0;
+    while (true) {
+        uint32_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < col.heap_len && earlier(&col.heap[l], &col.heap[least]))
+            least = l;
+        if (r < col.heap_len && earlier(&col.heap[r], &col.heap[least]))
+            least = r;
+        if (least == i)
+            break;
+        swap(i, least);
+        i = least;
+    }
+}
+
+// The node's slot, or a new one: a free slot, else one quiet for longer than
+// COLLECTOR_NODE_TIMEOUT_MS. UDP nodes by id, TCP nodes by address
+static struct node *find_node(bool tcp, uint32_t id, const ip4_addr_t *addr, uint32_t now) {
+    struct node *free = NULL, *stale = NULL;
+    for (int i = 0; i < COLLECTOR_MAX_NODES; i++) {
+        struct node *n = &col.nodes[i];
+        if (!n->used) {
+            if (!free)
+                free = n;
+        } else if (n->tcp == tcp && (tcp ? ip4_addr_cmp(&n->addr, addr) : n->id == id)) {
+            return n;
+        } else if (!n->pcb && now - n->last_seen_us > COLLECTOR_NODE_TIMEOUT_MS * 1000 && !stale) {
+            stale = n;
+        }
+    }
+    struct node *n = free ? free : stale;
+    if (!n) {
+        col.stats.no_slot++;
+        return NULL;
+    }
+    memset(n, 0, sizeof(*n));
+    n->used = true;
+    n->tcp = tcp;
+    n->id = id;
+    ip4_addr_copy(n->addr, *addr);
+    n->last_seen_us = now;
+    n->tokens = COLLECTOR_NODE_BURST * 1000;
+    n->refill_us = now;
+    return n;
+}
+
+static uint32_t refill(struct node *n, uint32_t now) {
+    uint64_t tokens = n->tokens + (uint64_t)(now - n->refill_us) * COLLECTOR_NODE_RATE_HZ / 1000;
+    n->tokens = LWIP_MIN(tokens, COLLECTOR_NODE_BURST * 1000);
+    n->refill_us = now;
+    return n->tokens / 1000;
+}
+
+// The smallest arrival minus send time is the least delayed packet, its offset
+// wins. A larger one pulls the offset up by 1/256 of the difference, which follows
+// a node clock that runs slow without jumping on every delayed packet
+static void map_clock(struct node *n, uint32_t node_us, uint32_t now) {
+    uint32_t offset = now - node_us;
+    int32_t diff = offset - n->offset_us;
+    if (!n->clock_synced || diff < 0)
+        n->offset_us = offset;
+    else
+        n->offset_us += diff / 256;
+    n->clock_synced = true;
+}
+
+// false for a sequence number seen before
+static bool check_seq(struct node *n, uint32_t seq, uint32_t count) {
+    int32_t gap = seq - n->next_seq;
+    if (!n->seq_synced || gap < -RESTART_GAP) {
+        n->seq_synced = true;
+        n->next_seq = seq + count;
+        return true;
+    }
+    if (gap < 0)
+        return false;
+    n->stats.lost += gap;
+    n->next_seq = seq + count;
+    return true;
+}
+
+static void data_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    static uint8_t buf[NODE_UDP_MAX_PAYLOAD];
+    uint16_t len = pbuf_copy_partial(p, buf, sizeof(buf), 0);
+    pbuf_free(p);
+
+    struct node_udp_header h;
+    if (len < sizeof(h)) {
+        col.stats.malformed++;
+        return;
+    }
+    memcpy(&h, buf, sizeof(h));
+    if (h.magic != NODE_UDP_MAGIC || h.count > NODE_UDP_MAX_SAMPLES ||
+        len != sizeof(h) + h.count * sizeof(struct node_udp_sample)) {
+        col.stats.malformed++;
+        return;
+    }
+    uint32_t now = col.now_us();
+    struct node *n = find_node(false, h.node_id, ip_2_ip4(addr), now);
+    if (!n)
+        return;
+    col.stats.datagrams++;
+    ip4_addr_copy(n->addr, *ip_2_ip4(addr));
+    n->last_seen_us = now;
+    // a datagram that comes after the ones behind it is still good, the merge sorts it
+    if (!check_seq(n, h.seq, 1) && n->stats.lost)
+        n->stats.lost--;
+    map_clock(n, h.sent_us, now);
+
+    uint32_t allowed = LWIP_MIN(refill(n, now), h.count);
+    n->tokens -= allowed * 1000;
+    n->stats.rate_dropped += h.count - allowed;
+    col.stats.rate_dropped += h.count - allowed;
+    for (uint32_t i = 0; i < allowed; i++) {
+        struct node_udp_sample s;
+        memcpy(&s, buf + sizeof(h) + i * sizeof(s), sizeof(s));
+        if (merge_put(h.base_us + s.offset_us + n->offset_us, h.node_id, s.value))
+            n->stats.samples++;
+    }
+}
+
+// record i of the partial one and p's bytes together, only the first can start in partial
+static void read_record(const struct node *n, struct pbuf *p, uint32_t i, struct node_tcp_record *r) {
+    uint8_t *b = (uint8_t *)r;
+    uint32_t at = i * sizeof(*r), from_partial = 0;
+    if (at < n->partial_len) {
+        from_partial = n->partial_len - at;
+        memcpy(b, n->partial + at, from_partial);
+    }
+    pbuf_copy_partial(p, b + from_partial, sizeof(*r) - from_partial, at + from_partial - n->partial_len);
+}
+
+static bool record_ok(const struct node_tcp_record *r) {
+    return r->check == (r->seq ^ r->timestamp_us ^ (uint32_t)r->value ^ NODE_TCP_CHECK);
+}
+
+// Gives back as much of the window as the tokens pay for, a byte costs its share of
+// a record. The rest stays shut until collector_poll() has more tokens
+static void tcp_node_credit(struct node *n, uint32_t now) {
+    refill(n, now);
+    uint32_t allowed = (uint64_t)n->tokens * sizeof(struct node_tcp_record) / 1000;
+    uint32_t give = LWIP_MIN(n->unrecved, allowed);
+    if (!give)
+        return;
+    n->tokens -= (uint64_t)give * 1000 / sizeof(struct node_tcp_record);
+    n->unrecved -= give;
+    tcp_recved(n->pcb, give);
+}
+
+static void tcp_node_close(struct node *n) {
+    struct tcp_pcb *pcb = n->pcb;
+    n->pcb = NULL;
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_err(pcb, NULL);
+    if (tcp_close(pcb) != ERR_OK)
+        tcp_abort(pcb);
+}
+
+static err_t tcp_node_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    struct node *n = arg;
+    if (!p) {
+        if (n)
+            tcp_node_close(n);
+        return ERR_OK;
+    }
+    if (!n) {
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+        return ERR_OK;
+    }
+    uint32_t now = col.now_us();
+    uint32_t records = (n->partial_len + p->tot_len) / sizeof(struct node_tcp_record);
+    n->last_seen_us = now;
+
+    struct node_tcp_record r;
+    if (records) {
+        // the newest record is the least delayed one
+        read_record(n, p, records - 1, &r);
+        if (record_ok(&r))
+            map_clock(n, r.timestamp_us, now);
+    }
+    for (uint32_t i = 0; i < records; i++) {
+        read_record(n, p, i, &r);
+        if (!record_ok(&r)) {
+            col.stats.malformed++;
+        } else if (!check_seq(n, r.seq, 1)) {
+            n->stats.duplicates++;
+        } else if (merge_put(r.timestamp_us + n->offset_us, n->id, r.value)) {
+            n->stats.samples++;
+        }
+    }
+    // what is left starts the next record
+    uint32_t used = records * sizeof(struct node_tcp_record);
+    if (records) {
+        n->partial_len = pbuf_copy_partial(p, n->partial, sizeof(n->partial), used - n->partial_len);
+    } else {
+        pbuf_copy_partial(p, n->partial + n->partial_len, p->tot_len, 0);
+        n->partial_len += p->tot_len;
+    }
+    // the data is in, the pbufs go back to the pool now and only the window waits
+    n->unrecved += p->tot_len;
+    pbuf_free(p);
+    tcp_node_credit(n, now);
+    if (n->unrecved)
+        n->stats.rate_held++;
+    return ERR_OK;
+}
+
+static void tcp_node_err(void *arg, err_t err) {
+    struct node *n = arg;
+    if (n)
+        n->pcb = NULL;
+}
+
+static err_t tcp_node_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK || !pcb)
+        return ERR_VAL;
+    uint32_t now = col.now_us();
+    struct node *n = find_node(true, ip4_addr_get_u32(ip_2_ip4(&pcb->remote_ip)), ip_2_ip4(&pcb->remote_ip), now);
+    if (!n) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    // a node only connects again once it has given up on the old connection
+    if (n->pcb)
+        tcp_node_close(n);
+    n->pcb = pcb;
+    n->partial_len = 0;
+    n->unrecved = 0;
+    n->last_seen_us = now;
+    tcp_arg(pcb, n);
+    tcp_recv(pcb, tcp_node_recv);
+    tcp_err(pcb, tcp_node_err);
+    col.stats.tcp_connects++;
+    return ERR_OK;
+}
+
+static void send_beacon(const ip_addr_t *to) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct node_discovery), PBUF_RAM);
+    if (!p)
+        return;
+    struct node_discovery *b = p->payload;
+    b->magic = NODE_DISCOVERY_MAGIC;
+    b->type = NODE_BEACON;
+    b->port = NODE_UDP_PORT;
+    b->node_id = 0;
+    udp_sendto_if(col.discovery_pcb, p, to, NODE_DISCOVERY_PORT, col.netif);
+    pbuf_free(p);
+}
+
+static void discovery_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    struct node_discovery d;
+    if (pbuf_copy_partial(p, &d, sizeof(d), 0) == sizeof(d) && d.magic == NODE_DISCOVERY_MAGIC &&
+        d.type == NODE_QUERY) {
+        col.stats.queries++;
+        send_beacon(addr);
+    }
+    pbuf_free(p);
+}
+
+/* API */
+
+bool collector_init(struct netif *netif, uint32_t (*now_us)(void)) {
+    memset(&col, 0, sizeof(col));
+    col.netif = netif;
+    col.now_us = now_us;
+    col.next_beacon_us = now_us();
+    ipaddr_aton(NODE_GROUP, &col.group);
+
+    col.data_pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    col.discovery_pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_V4);
+    if (!col.data_pcb || !col.discovery_pcb || !pcb)
+        return false;
+    udp_bind(col.data_pcb, IP4_ADDR_ANY, NODE_UDP_PORT);
+    udp_recv(col.data_pcb, data_recv, NULL);
+    udp_bind(col.discovery_pcb, IP4_ADDR_ANY, NODE_DISCOVERY_PORT);
+    udp_recv(col.discovery_pcb, discovery_recv, NULL);
+    igmp_joingroup_netif(netif, ip_2_ip4(&col.group));
+
+    if (tcp_bind(pcb, IP4_ADDR_ANY, NODE_TCP_PORT) != ERR_OK)
+        return false;
+    col.listen_pcb = tcp_listen_with_backlog(pcb, COLLECTOR_MAX_NODES);
+    if (!col.listen_pcb)
+        return false;
+    tcp_accept(col.listen_pcb, tcp_node_accept);
+    return true;
+}
+
+void collector_poll(void) {
+    uint32_t now = col.now_us();
+    if ((int32_t)(now - col.next_beacon_us) >= 0) {
+        send_beacon(&col.group);
+        col.next_beacon_us = now + NODE_BEACON_MS * 1000;
+    }
+    for (int i = 0; i < COLLECTOR_MAX_NODES; i++) {
+        struct node *n = &col.nodes[i];
+        if (n->pcb && n->unrecved)
+            tcp_node_credit(n, now);
+    }
+}
+
+uint32_t collector_pop(struct collector_sample *samples, uint32_t max) {
+    uint32_t now = col.now_us();
+    uint32_t n = 0;
+    while (n < max && col.heap_len && (int32_t)(now - col.heap[0].time_us) >= COLLECTOR_REORDER_MS * 1000) {
+        samples[n++] = col.heap[0];
+        col.last_out_us = col.heap[0].time_us;
+        col.popped = true;
+        merge_take_top();
+    }
+    col.stats.out += n;
+    return n;
+}
+
+uint32_t collector_nodes(struct collector_node_stats *nodes, uint32_t max, bool reset) {
+    uint32_t now = col.now_us();
+    uint32_t count = 0;
+    for (int i = 0; i < COLLECTOR_MAX_NODES && count < max; i++) {
+        struct node *n = &col.nodes[i];
+        if (!n->used || (!n->pcb && now - n->last_seen_us > COLLECTOR_NODE_TIMEOUT_MS * 1000))
+            continue;
+        struct collector_node_stats *s = &nodes[count++];
+        *s = n->stats;
+        s->node_id = n->id;
+        ip4_addr_copy(s->addr, n->addr);
+        s->tcp = n->tcp;
+        if (reset)
+            memset(&n->stats, 0, sizeof(n->stats));
+    }
+    return count;
+}
+
+void collector_get_stats(struct collector_stats *stats, bool reset) {
+    *stats = col.stats;
+    if (reset)
+        memset(&col.stats, 0, sizeof(col.stats));
+}
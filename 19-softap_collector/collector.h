@@ -0,0 +1,102 @@
+#ifndef _COLLECTOR_H
+#define _COLLECTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lwip/netif.h"
+#include "node_wire.h"
+
+// Telemetry from many station nodes merged into one stream in time order, on the
+// lwIP raw API.
+//
+// Nodes send UDP datagrams (found by multicast discovery, answered on the given
+// netif) or a TCP stream each, see node_wire.h. Every node has a slot, a UDP node is
+// known by its node_id and a TCP node by its address; a slot whose node has been
+// quiet for COLLECTOR_NODE_TIMEOUT_MS goes to the next new one.
+//
+// Node clocks are mapped onto this one with an offset per node, arrival time minus
+// send time at its smallest: the least delayed datagram or segment sets it, and it
+// creeps up slowly so a node clock running slow is followed too.
+//
+// Each node has a token bucket of COLLECTOR_NODE_RATE_HZ samples a second, up to
+// COLLECTOR_NODE_BURST. A UDP node's samples past it are dropped. A TCP node's
+// segments are always taken in, so no pbuf waits on tokens, but the window is only
+// given back (tcp_recved) as the tokens pay for it: the window closes and the node
+// slows down instead of losing data.
+//
+// Accepted samples go into a heap ordered by time and come out of collector_pop()
+// once they are COLLECTOR_REORDER_MS old, so nodes delivering at different delays
+// still come out in order. A sample older than the last one out is dropped as late.
+// All calls with the lwIP lock held (cyw43_arch_lwip_begin() on the Pico).
+
+#ifndef COLLECTOR_MAX_NODES
+#define COLLECTOR_MAX_NODES         16
+#endif
+
+#ifndef COLLECTOR_NODE_RATE_HZ
+#define COLLECTOR_NODE_RATE_HZ      500
+#endif
+#ifndef COLLECTOR_NODE_BURST
+#define COLLECTOR_NODE_BURST        1024
+#endif
+
+#ifndef COLLECTOR_NODE_TIMEOUT_MS
+#define COLLECTOR_NODE_TIMEOUT_MS   30000
+#endif
+
+#ifndef COLLECTOR_REORDER_MS
+#define COLLECTOR_REORDER_MS        250
+#endif
+
+// samples waiting to come out
+#ifndef COLLECTOR_MERGE_SAMPLES
+#define COLLECTOR_MERGE_SAMPLES     2048
+#endif
+
+struct collector_sample {
+    uint32_t time_us;           // on this clock
+    uint32_t node_id;
+    int32_t value;
+};
+
+struct collector_node_stats {
+    uint32_t node_id;
+    ip4_addr_t addr;
+    bool tcp;
+    uint32_t samples;           // accepted
+    uint32_t rate_dropped;      // UDP, over the bucket
+    uint32_t rate_held;         // TCP, segments whose window waits for tokens
+    uint32_t lost;              // sequence gaps: datagrams for UDP, records for TCP
+    uint32_t duplicates;        // TCP records sent again after a reconnect
+};
+
+struct collector_stats {
+    uint32_t datagrams;
+    uint32_t samples;           // accepted, all nodes
+    uint32_t out;               // popped
+    uint32_t rate_dropped;
+    uint32_t late;              // older than the last one out
+    uint32_t overflow;          // merge heap full
+    uint32_t malformed;
+    uint32_t no_slot;           // packets from new nodes with every slot taken
+    uint32_t queries;
+    uint32_t tcp_connects;
+    uint32_t merge_max;         // most samples waiting at once
+};
+
+// Listens for nodes and answers discovery on netif, now_us is the clock samples are
+// mapped onto. False if lwIP is out of pcbs
+bool collector_init(struct netif *netif, uint32_t (*now_us)(void));
+
+// Beacons on the group and opens TCP windows as tokens come in, call often
+void collector_poll(void);
+
+// Takes up to max samples that have waited COLLECTOR_REORDER_MS, oldest first
+uint32_t collector_pop(struct collector_sample *samples, uint32_t max);
+
+// Nodes heard from in the last COLLECTOR_NODE_TIMEOUT_MS, up to max, returns how many
+uint32_t collector_nodes(struct collector_node_stats *nodes, uint32_t max, bool reset);
+
+void collector_get_stats(struct collector_stats *stats, bool reset);
+
+#endif
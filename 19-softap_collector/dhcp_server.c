@@ -0,0 +1,222 @@
+#include <stddef.h>
+#include <string.h>
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+#include "dhcp_server.h"
+
+#define SERVER_PORT     67
+#define CLIENT_PORT     68
+
+#define BOOTREQUEST     1
+#define BOOTREPLY       2
+#define MAGIC_COOKIE    0x63825363u
+
+enum { DISCOVER = 1, OFFER, REQUEST, DECLINE, ACK, NAK, RELEASE };
+
+enum {
+    OPT_PAD = 0,
+    OPT_SUBNET_MASK = 1,
+    OPT_ROUTER = 3,
+    OPT_REQUESTED_IP = 50,
+    OPT_LEASE_TIME = 51,
+    OPT_MSG_TYPE = 53,
+    OPT_SERVER_ID = 54,
+    OPT_END = 255,
+};
+
+// RFC 2131, the options field at its minimum size
+struct dhcp_msg {
+    uint8_t op, htype, hlen, hops;
+    uint32_t xid;
+    uint16_t secs, flags;
+    uint8_t ciaddr[4], yiaddr[4], siaddr[4], giaddr[4];
+    uint8_t chaddr[16];
+    uint8_t sname[64];
+    uint8_t file[128];
+    uint8_t options[312];       // magic cookie first
+};
+
+struct lease {
+    uint8_t mac[6];
+    bool used;
+    uint32_t expires_ms;
+};
+
+static struct {
+    struct netif *netif;
+    struct udp_pcb *pcb;
+    struct lease leases[DHCP_SERVER_MAX_LEASES];
+    struct dhcp_server_stats stats;
+} server;
+
+// the address lease i hands out, in network order
+static uint32_t lease_addr(uint32_t i) {
+    const ip4_addr_t *ip = netif_ip4_addr(server.netif), *mask = netif_ip4_netmask(server.netif);
+    return (ip4_addr_get_u32(ip) & ip4_addr_get_u32(mask)) | lwip_htonl(DHCP_SERVER_FIRST_HOST + i);
+}
+
+// the station's lease, else a free or expired one. -1 if none
+static int find_lease(const uint8_t *mac, bool assign) {
+    int spare = -1;
+    uint32_t now = sys_now();
+    for (int i = 0; i < DHCP_SERVER_MAX_LEASES; i++) {
+        struct lease *l = &server.leases[i];
+        if (l->used && !memcmp(l->mac, mac, 6))
+            return i;
+        if (spare < 0 && (!l->used || (int32_t)(now - l->expires_ms) >= 0))
+            spare = i;
+    }
+    if (spare >= 0 && assign) {
+        memcpy(server.leases[spare].mac, mac, 6);
+        // held for a few seconds until the request comes, the whole lease once acked
+        server.leases[spare].used = true;
+        server.leases[spare].expires_ms = now + 10000;
+    }
+    return spare;
+}
+
+// the option's value and its length, NULL if it isn't there
+static const uint8_t *find_option(const struct dhcp_msg *msg, uint32_t len, uint8_t code, uint8_t *opt_len) {
+    const uint8_t *p = msg->options + 4, *end = (const uint8_t *)msg + len;
+    while (p < end && *p != OPT_END) {
+        if (*p == OPT_PAD) {
+            p++;
+            continue;
+        }
+        if (p + 2 > end || p + 2 + p[1] > end)
+            break;
+        if (*p == code) {
+            *opt_len = p[1];
+            return p + 2;
+        }
+        p += 2 + p[1];
+    }
+    return NULL;
+}
+
+static uint8_t *put_option(uint8_t *p, uint8_t code, uint8_t len, const void *value) {
+    *p++ = code;
+    *p++ = len;
+    memcpy(p, value, len);
+    return p + len;
+}
+
+static void reply(const struct dhcp_msg *request, uint8_t type, uint32_t yiaddr) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct dhcp_msg), PBUF_RAM);
+    if (!p)
+        return;
+    struct dhcp_msg *msg = p->payload;
+    memset(msg, 0, sizeof(*msg));
+    msg->op = BOOTREPLY;
+    msg->htype = request->htype;
+    msg->hlen = request->hlen;
+    msg->xid = request->xid;
+    msg->flags = request->flags;
+    memcpy(msg->chaddr, request->chaddr, sizeof(msg->chaddr));
+    memcpy(msg->yiaddr, &yiaddr, 4);
+    uint32_t server_id = ip4_addr_get_u32(netif_ip4_addr(server.netif));
+    memcpy(msg->siaddr, &server_id, 4);
+
+    uint32_t cookie = lwip_htonl(MAGIC_COOKIE);
+    memcpy(msg->options, &cookie, 4);
+    uint8_t *o = msg->options + 4;
+    o = put_option(o, OPT_MSG_TYPE, 1, &type);
+    o = put_option(o, OPT_SERVER_ID, 4, &server_id);
+    if (type != NAK) {
+        uint32_t lease_s = lwip_htonl(DHCP_SERVER_LEASE_S);
+        uint32_t mask = ip4_addr_get_u32(netif_ip4_netmask(server.netif));
+        o = put_option(o, OPT_LEASE_TIME, 4, &lease_s);
+        o = put_option(o, OPT_SUBNET_MASK, 4, &mask);
+        o = put_option(o, OPT_ROUTER, 4, &server_id);
+    }
+    *o = OPT_END;
+    udp_sendto_if(server.pcb, p, IP_ADDR_BROADCAST, CLIENT_PORT, server.netif);
+    pbuf_free(p);
+}
+
+static void server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    static struct dhcp_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    uint32_t len = pbuf_copy_partial(p, &msg, sizeof(msg), 0);
+    pbuf_free(p);
+
+    uint32_t cookie;
+    memcpy(&cookie, msg.options, 4);
+    uint8_t opt_len;
+    const uint8_t *type = find_option(&msg, len, OPT_MSG_TYPE, &opt_len);
+    if (len < offsetof(struct dhcp_msg, options) + 4 || msg.op != BOOTREQUEST || msg.hlen != 6 ||
+        cookie != lwip_htonl(MAGIC_COOKIE) || !type || opt_len != 1)
+        return;
+
+    int i;
+    switch (*type) {
+    case DISCOVER:
+        server.stats.discovers++;
+        i = find_lease(msg.chaddr, true);
+        if (i < 0) {
+            server.stats.full++;
+            return;
+        }
+        reply(&msg, OFFER, lease_addr(i));
+        break;
+    case REQUEST: {
+        server.stats.requests++;
+        // for another server, the station took its offer
+        const uint8_t *server_id = find_option(&msg, len, OPT_SERVER_ID, &opt_len);
+        uint32_t ours = ip4_addr_get_u32(netif_ip4_addr(server.netif));
+        if (server_id && (opt_len != 4 || memcmp(server_id, &ours, 4)))
+            return;
+        // selecting or rebooting name the address in an option, renewing in ciaddr
+        uint32_t requested;
+        const uint8_t *ip = find_option(&msg, len, OPT_REQUESTED_IP, &opt_len);
+        memcpy(&requested, ip && opt_len == 4 ? ip : msg.ciaddr, 4);
+        i = find_lease(msg.chaddr, false);
+        if (i < 0 || lease_addr(i) != requested || !server.leases[i].used ||
+            memcmp(server.leases[i].mac, msg.chaddr, 6)) {
+            // not the address it was offered, or a lease from before a restart: the
+            // station starts over with a discover
+            server.stats.naks++;
+            reply(&msg, NAK, 0);
+            return;
+        }
+        server.leases[i].expires_ms = sys_now() + DHCP_SERVER_LEASE_S * 1000u;
+        server.stats.acks++;
+        reply(&msg, ACK, requested);
+        break;
+    }
+    case DECLINE:
+    case RELEASE:
+        server.stats.releases++;
+        i = find_lease(msg.chaddr, false);
+        if (i >= 0 && server.leases[i].used && !memcmp(server.leases[i].mac, msg.chaddr, 6))
+            server.leases[i].used = false;
+        break;
+    default:
+        break;
+    }
+}
+
+/* API */
+
+bool dhcp_server_init(struct netif *netif) {
+    memset(&server, 0, sizeof(server));
+    server.netif = netif;
+    server.pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (!server.pcb)
+        return false;
+    ip_set_option(server.pcb, SOF_BROADCAST);
+    if (udp_bind(server.pcb, IP4_ADDR_ANY, SERVER_PORT) != ERR_OK)
+        return false;
+    udp_recv(server.pcb, server_recv, NULL);
+    return true;
+}
+
+void dhcp_server_get_stats(struct dhcp_server_stats *stats, bool reset) {
+    uint32_t now = sys_now();
+    server.stats.leases = 0;
+    for (int i = 0; i < DHCP_SERVER_MAX_LEASES; i++)
+        server.stats.leases += server.leases[i].used && (int32_t)(now - server.leases[i].expires_ms) < 0;
+    *stats = server.stats;
+    if (reset)
+        memset(&server.stats, 0, sizeof(server.stats));
+}
@@ -0,0 +1,45 @@
+#ifndef _DHCP_SERVER_H
+#define _DHCP_SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lwip/netif.h"
+
+// The least DHCP server stations need to get an address from the access point, on
+// the lwIP raw API: DISCOVER is offered, REQUEST acked (or refused if the address
+// isn't the one leased to it), RELEASE frees the lease.
+//
+// Leases are kept by MAC, one per station for as long as DHCP_SERVER_LEASE_S and for
+// the same address every time while the slot lasts. Addresses are handed out from
+// DHCP_SERVER_FIRST_HOST up in the netif's subnet, with the netif as the router and
+// no DNS. Replies are broadcast, a station has no address to send to yet. All calls
+// with the lwIP lock held (cyw43_arch_lwip_begin() on the Pico).
+
+#ifndef DHCP_SERVER_MAX_LEASES
+#define DHCP_SERVER_MAX_LEASES  16
+#endif
+
+#ifndef DHCP_SERVER_FIRST_HOST
+#define DHCP_SERVER_FIRST_HOST  16
+#endif
+
+#ifndef DHCP_SERVER_LEASE_S
+#define DHCP_SERVER_LEASE_S     (24 * 3600)
+#endif
+
+struct dhcp_server_stats {
+    uint32_t discovers;
+    uint32_t requests;
+    uint32_t acks;
+    uint32_t naks;
+    uint32_t releases;
+    uint32_t full;              // no lease free for a new station
+    uint32_t leases;            // held now
+};
+
+// Serves on netif's address and subnet. False if lwIP is out of pcbs
+bool dhcp_server_init(struct netif *netif);
+
+void dhcp_server_get_stats(struct dhcp_server_stats *stats, bool reset);
+
+#endif
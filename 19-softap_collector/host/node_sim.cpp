@@ -0,0 +1,216 @@
+// Stand-in station nodes for softap_collector (see ../node_wire.h), run on a host
+// joined to its access point.
+//
+//   node_sim [-c address] [-n nodes] [-r hz] [-s seconds] [-l loss_permille] [-t]
+//       -c   the collector, found with a query on the multicast group if not given
+//       -n   UDP nodes, 8 by default, each with its own id and clock, batching like
+//            9-wifi_client's udp_telemetry.c
+//       -r   samples per second per node, 200 by default. Past COLLECTOR_NODE_RATE_HZ
+//            the collector drops the rest
+//       -s   seconds to run, 30 by default
+//       -l   datagrams dropped here on purpose, per thousand
+//       -t   one more node streaming records over TCP like tcp_stream.c. The collector
+//            knows a TCP node by its address, so there is only one per host
+//
+// Values count up by one per node, so host/upstream_reader.cpp shows every sample
+// that was lost or dropped on the way as a gap.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "../node_wire.h"
+}
+
+// as in udp_telemetry.h and tcp_stream.h
+static constexpr uint32_t MAX_DELAY_MS = 50;
+
+static uint64_t now_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Asks on the group and takes the first beacon, which comes to the discovery port
+static bool discover(sockaddr_in &collector) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NODE_DISCOVERY_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+        std::perror("node_sim");
+        return false;
+    }
+    ip_mreq mreq{};
+    inet_pton(AF_INET, NODE_GROUP, &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+
+    sockaddr_in group = addr;
+    group.sin_addr = mreq.imr_multiaddr;
+    node_discovery query{ NODE_DISCOVERY_MAGIC, NODE_QUERY, 0, 0 };
+    for (int tries = 0; tries < 5; tries++) {
+        sendto(fd, &query, sizeof(query), 0, reinterpret_cast<sockaddr *>(&group), sizeof(group));
+        pollfd pfd{ fd, POLLIN, 0 };
+        uint64_t until = now_us() + 1000000;
+        while (now_us() < until && poll(&pfd, 1, 100) > 0) {
+            node_discovery beacon{};
+            sockaddr_in from{};
+            socklen_t from_len = sizeof(from);
+            if (recvfrom(fd, &beacon, sizeof(beacon), 0, reinterpret_cast<sockaddr *>(&from), &from_len) == sizeof(beacon) &&
+                beacon.magic == NODE_DISCOVERY_MAGIC && beacon.type == NODE_BEACON) {
+                collector = from;
+                close(fd);
+                return true;
+            }
+        }
+    }
+    close(fd);
+    return false;
+}
+
+// Records at hz, written every MAX_DELAY_MS. A full window blocks the write, which
+// is the collector holding the node back
+static void tcp_node(sockaddr_in collector, uint32_t hz, uint64_t end, uint64_t *sent) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    collector.sin_port = htons(NODE_TCP_PORT);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&collector), sizeof(collector))) {
+        std::perror("node_sim: tcp node");
+        return;
+    }
+    uint32_t clock_offset = std::random_device()();
+    uint64_t start = now_us(), produced = 0;
+    std::vector<node_tcp_record> batch;
+    while (now_us() < end) {
+        uint64_t now = now_us();
+        uint64_t due = (now - start) * hz / 1000000;
+        for (; produced < due; produced++) {
+            node_tcp_record r;
+            r.seq = produced;
+            r.timestamp_us = uint32_t(now) + clock_offset;
+            r.value = int32_t(produced);
+            r.check = r.seq ^ r.timestamp_us ^ uint32_t(r.value) ^ NODE_TCP_CHECK;
+            batch.push_back(r);
+        }
+        if (!batch.empty() && send(fd, batch.data(), batch.size() * sizeof(node_tcp_record), MSG_NOSIGNAL) < 0) {
+            std::perror("node_sim: tcp node");
+            break;
+        }
+        *sent += batch.size();
+        batch.clear();
+        std::this_thread::sleep_for(std::chrono::milliseconds(MAX_DELAY_MS));
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv) {
+    sockaddr_in collector{};
+    collector.sin_family = AF_INET;
+    bool have_collector = false, with_tcp = false;
+    uint32_t nodes = 8, hz = 200, seconds = 30, loss_permille = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:r:s:l:t")) != -1) {
+        switch (opt) {
+        case 'c':
+            have_collector = inet_pton(AF_INET, optarg, &collector.sin_addr) == 1;
+            if (!have_collector) {
+                std::fprintf(stderr, "bad collector address %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n': nodes = std::atoi(optarg); break;
+        case 'r': hz = std::atoi(optarg); break;
+        case 's': seconds = std::atoi(optarg); break;
+        case 'l': loss_permille = std::atoi(optarg); break;
+        case 't': with_tcp = true; break;
+        default:
+            std::fprintf(stderr, "usage: %s [-c address] [-n nodes] [-r hz] [-s seconds] [-l loss_permille] [-t]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!have_collector && !discover(collector)) {
+        std::fprintf(stderr, "no collector answered on %s:%u, give its address with -c\n", NODE_GROUP, NODE_DISCOVERY_PORT);
+        return 1;
+    }
+    collector.sin_port = htons(NODE_UDP_PORT);
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &collector.sin_addr, addr, sizeof(addr));
+    std::printf("%u nodes at %u Hz for %us to %s%s\n", nodes, hz, seconds, addr, with_tcp ? ", one more over TCP" : "");
+
+    uint64_t start = now_us(), end = start + seconds * 1000000ull;
+    uint64_t tcp_sent = 0;
+    std::thread tcp;
+    if (with_tcp)
+        tcp = std::thread(tcp_node, collector, hz, end, &tcp_sent);
+
+    struct SimNode {
+        uint32_t clock_offset;
+        uint32_t seq = 0;
+        uint64_t produced = 0;
+        std::vector<uint8_t> batch;
+        uint16_t count = 0;
+        uint32_t base_us = 0;
+    };
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    std::mt19937 rng(std::random_device{}());
+    std::vector<SimNode> sim(nodes);
+    for (auto &n : sim) {
+        n.clock_offset = rng();
+        n.batch.resize(NODE_UDP_MAX_PAYLOAD);
+    }
+
+    uint64_t sent = 0, dropped = 0;
+    auto flush = [&](uint32_t id, SimNode &n, uint32_t clock) {
+        node_udp_header h{ NODE_UDP_MAGIC, id, n.seq++, clock, n.base_us, n.count, 0 };
+        std::memcpy(n.batch.data(), &h, sizeof(h));
+        size_t len = sizeof(h) + n.count * sizeof(node_udp_sample);
+        if (rng() % 1000 < loss_permille)
+            dropped++;
+        else if (sendto(fd, n.batch.data(), len, 0, reinterpret_cast<sockaddr *>(&collector), sizeof(collector)) > 0)
+            sent++;
+        n.count = 0;
+    };
+    while (true) {
+        uint64_t now = now_us();
+        if (now >= end)
+            break;
+        for (uint32_t i = 0; i < nodes; i++) {
+            SimNode &n = sim[i];
+            uint32_t clock = uint32_t(now) + n.clock_offset;
+            uint64_t due = (now - start) * hz / 1000000;
+            for (; n.produced < due; n.produced++) {
+                if (!n.count)
+                    n.base_us = clock;
+                node_udp_sample s{ clock - n.base_us, int32_t(n.produced) };
+                std::memcpy(&n.batch[sizeof(node_udp_header) + n.count++ * sizeof(s)], &s, sizeof(s));
+                if (n.count == NODE_UDP_MAX_SAMPLES)
+                    flush(0x51000000 + i, n, clock);
+            }
+            if (n.count && clock - n.base_us >= MAX_DELAY_MS * 1000)
+                flush(0x51000000 + i, n, clock);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (tcp.joinable())
+        tcp.join();
+    std::printf("%llu datagrams sent (%.0f/s), %llu dropped on purpose (%.2f%%)",
+                (unsigned long long)sent, sent / double(seconds), (unsigned long long)dropped,
+                sent + dropped ? 100.0 * dropped / (sent + dropped) : 0.0);
+    if (with_tcp)
+        std::printf(", %llu TCP records", (unsigned long long)tcp_sent);
+    std::printf("\n");
+    return 0;
+}
@@ -0,0 +1,186 @@
+// Host side reader for softap_collector's upstream frames (see ../upstream.h).
+//
+//   upstream_reader [file]   a capture or the serial port, stdin if no file. Set the
+//                            port up with stty first: stty -F /dev/ttyACM0 raw for USB,
+//                            add 921600 (COLLECTOR_UART_BAUD) for a UART adapter
+//
+// Text frames are printed as they come. Sample frames are checked: the check word,
+// frames in sequence, samples in time order across all nodes. Every 5 seconds there
+// is a line per node with its samples/s and the gaps in its values; node_sim's nodes
+// count up by one, so for them a gap is a sample that didn't make it.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+extern "C" {
+#include "../upstream.h"
+}
+
+static constexpr uint32_t REPORT_MS = 5000;
+
+static uint64_t now_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst, size_t size) {
+    size_t out = 0;
+    for (size_t i = 0; i < len;) {
+        uint8_t code = src[i++];
+        if (!code || i + code - 1 > len || out + code - 1 > size)
+            return 0;
+        for (uint8_t j = 1; j < code; j++)
+            dst[out++] = src[i++];
+        if (code != 0xff && i < len) {
+            if (out == size)
+                return 0;
+            dst[out++] = 0;
+        }
+    }
+    return out;
+}
+
+static uint32_t fnv1a(const uint8_t *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+class UpstreamReader {
+public:
+    void feed(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if (data[i]) {
+                // no frame is ever this long, we must have missed a delimiter
+                if (encoded_.size() < 2 * UPSTREAM_MAX_FRAME)
+                    encoded_.push_back(data[i]);
+                continue;
+            }
+            if (!encoded_.empty())
+                decode_frame();
+            encoded_.clear();
+        }
+    }
+
+    void report(uint64_t interval_us) {
+        double seconds = interval_us / 1e6;
+        uint64_t samples = 0, gaps = 0;
+        for (auto &[id, node] : nodes_) {
+            samples += node.samples;
+            gaps += node.gaps;
+        }
+        std::printf("\n%zu nodes, %.0f samples/s, %llu value gaps, %llu out of order, %llu bad frames, %llu frames lost\n",
+                    nodes_.size(), samples / seconds, (unsigned long long)gaps, (unsigned long long)out_of_order_,
+                    (unsigned long long)bad_frames_, (unsigned long long)lost_frames_);
+        if (!nodes_.empty())
+            std::printf("  node      samples/s  gaps  total\n");
+        for (auto &[id, node] : nodes_) {
+            std::printf("  %08x %10.1f %5llu %6llu\n", id, node.samples / seconds, (unsigned long long)node.gaps,
+                        (unsigned long long)node.total);
+            node.samples = node.gaps = 0;
+        }
+        std::fflush(stdout);
+        out_of_order_ = bad_frames_ = lost_frames_ = 0;
+    }
+
+private:
+    struct Node {
+        bool seen = false;
+        int32_t last_value = 0;
+        // this interval
+        uint64_t samples = 0, gaps = 0;
+        uint64_t total = 0;
+    };
+
+    void decode_frame() {
+        uint8_t frame[UPSTREAM_MAX_FRAME];
+        size_t len = cobs_decode(encoded_.data(), encoded_.size(), frame, sizeof(frame));
+        upstream_header h;
+        uint32_t check;
+        if (len < sizeof(h) + sizeof(check)) {
+            bad_frames_++;
+            return;
+        }
+        std::memcpy(&h, frame, sizeof(h));
+        std::memcpy(&check, frame + len - sizeof(check), sizeof(check));
+        size_t payload = len - sizeof(h) - sizeof(check);
+        if (check != fnv1a(frame, len - sizeof(check)) ||
+            (h.type == UPSTREAM_SAMPLES && payload != h.count * sizeof(upstream_sample)) ||
+            (h.type != UPSTREAM_SAMPLES && h.type != UPSTREAM_TEXT)) {
+            bad_frames_++;
+            return;
+        }
+        if (synced_)
+            lost_frames_ += uint16_t(h.seq - next_seq_);
+        synced_ = true;
+        next_seq_ = h.seq + 1;
+
+        if (h.type == UPSTREAM_TEXT) {
+            std::printf("%.*s\n", int(payload), reinterpret_cast<const char *>(frame + sizeof(h)));
+            return;
+        }
+        for (uint32_t i = 0; i < h.count; i++) {
+            upstream_sample s;
+            std::memcpy(&s, frame + sizeof(h) + i * sizeof(s), sizeof(s));
+            if (time_synced_ && int32_t(s.time_us - last_time_us_) < 0)
+                out_of_order_++;
+            time_synced_ = true;
+            last_time_us_ = s.time_us;
+
+            Node &node = nodes_[s.node_id];
+            if (node.seen && s.value > node.last_value + 1)
+                node.gaps += s.value - node.last_value - 1;
+            node.seen = true;
+            node.last_value = s.value;
+            node.samples++;
+            node.total++;
+        }
+    }
+
+    std::vector<uint8_t> encoded_;
+    std::map<uint32_t, Node> nodes_;
+    bool synced_ = false, time_synced_ = false;
+    uint16_t next_seq_ = 0;
+    uint32_t last_time_us_ = 0;
+    uint64_t out_of_order_ = 0, bad_frames_ = 0, lost_frames_ = 0;
+};
+
+int main(int argc, char **argv) {
+    int fd = 0;
+    if (argc > 1 && (fd = open(argv[1], O_RDONLY | O_NOCTTY)) < 0) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    UpstreamReader reader;
+    uint8_t buf[4096];
+    uint64_t last_report = now_us();
+    while (true) {
+        // a serial port trickles, read what there is and report on time
+        pollfd pfd{ fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            reader.feed(buf, n);
+            std::fflush(stdout);
+        }
+        uint64_t now = now_us();
+        if (now - last_report >= REPORT_MS * 1000ull) {
+            reader.report(now - last_report);
+            last_report = now;
+        }
+    }
+    reader.report(std::max<uint64_t>(now_us() - last_report, 1));
+    return 0;
+}
@@ -0,0 +1,138 @@
+#ifndef _LWIPOPTS_H
+#define _LWIPOPTS_H
+
+
+// Common settings used in most of the pico_w examples
+// (see https://www.nongnu.org/lwip/2_1_x/group__lwip__opts.html for details)
+
+// allow override in some examples
+#ifndef NO_SYS
+#define NO_SYS                      1
+#endif
+// allow override in some examples
+#ifndef LWIP_SOCKET
+#define LWIP_SOCKET                 0
+#endif
+#if PICO_CYW43_ARCH_POLL
+#define MEM_LIBC_MALLOC             1
+#else
+// MEM_LIBC_MALLOC is incompatible with non polling versions
+#define MEM_LIBC_MALLOC             0
+#endif
+#define MEM_ALIGNMENT               4
+#define MEMP_NUM_ARP_QUEUE          10
+#define LWIP_ARP                    1
+#define LWIP_ETHERNET               1
+#define LWIP_ICMP                   1
+#define LWIP_RAW                    1
+#define TCP_MSS                     1460
+
+// Buffer sizing profiles, pick one with -DLWIPOPTS_PROFILE=LWIPOPTS_PROFILE_...
+// 9-wifi_client's net_bench measures each of them (throughput, RAM, exhaustion)
+#define LWIPOPTS_PROFILE_LOW_RAM        1
+#define LWIPOPTS_PROFILE_BALANCED       2
+#define LWIPOPTS_PROFILE_MAX_THROUGHPUT 3
+#ifndef LWIPOPTS_PROFILE
+#define LWIPOPTS_PROFILE            LWIPOPTS_PROFILE_BALANCED
+#endif
+
+#if LWIPOPTS_PROFILE == LWIPOPTS_PROFILE_LOW_RAM
+// two segments in flight each way
+#define LWIPOPTS_PROFILE_NAME       "low-ram"
+#define MEM_SIZE                    4000
+#define MEMP_NUM_TCP_SEG            8
+#define PBUF_POOL_SIZE              8
+#define TCP_WND                     (2 * TCP_MSS)
+#define TCP_SND_BUF                 (2 * TCP_MSS)
+#elif LWIPOPTS_PROFILE == LWIPOPTS_PROFILE_BALANCED
+// what these examples always used. A copying tcp_write() runs out of MEM_SIZE
+// well before TCP_SND_BUF
+#define LWIPOPTS_PROFILE_NAME       "balanced"
+#define MEM_SIZE                    4000
+#define MEMP_NUM_TCP_SEG            32
+#define PBUF_POOL_SIZE              24
+#define TCP_WND                     (8 * TCP_MSS)
+#define TCP_SND_BUF                 (8 * TCP_MSS)
+#elif LWIPOPTS_PROFILE == LWIPOPTS_PROFILE_MAX_THROUGHPUT
+// a heap that holds the whole send buffer, a pool that holds the whole window
+#define LWIPOPTS_PROFILE_NAME       "max-throughput"
+#define MEM_SIZE                    24000
+#define MEMP_NUM_TCP_SEG            64
+#define PBUF_POOL_SIZE              32
+#define TCP_WND                     (16 * TCP_MSS)
+#define TCP_SND_BUF                 (16 * TCP_MSS)
+#else
+#error unknown LWIPOPTS_PROFILE
+#endif
+#define TCP_SND_QUEUELEN            ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+
+#define LWIP_NETIF_STATUS_CALLBACK  1
+#define LWIP_NETIF_LINK_CALLBACK    1
+#define LWIP_NETIF_HOSTNAME         1
+#define LWIP_NETCONN                0
+#ifdef NET_BENCH
+// pool use and exhaustion counters for net_bench
+#define LWIP_STATS                  1
+#define MEM_STATS                   1
+#define MEMP_STATS                  1
+#else
+#define MEM_STATS                   0
+#define MEMP_STATS                  0
+#endif
+#define SYS_STATS                   0
+#define LINK_STATS                  0
+// #define ETH_PAD_SIZE                2
+#define LWIP_CHKSUM_ALGORITHM       3
+#define LWIP_DHCP                   1
+#define LWIP_IPV4                   1
+#define LWIP_TCP                    1
+#define LWIP_UDP                    1
+#define LWIP_DNS                    1
+#define LWIP_TCP_KEEPALIVE          1
+#define LWIP_NETIF_TX_SINGLE_PBUF   1
+// a connection per TCP node (COLLECTOR_MAX_NODES), the listener and some in TIME_WAIT
+#define MEMP_NUM_TCP_PCB            20
+// collector.c's data and discovery, dhcp_server.c and the DHCP client nobody starts
+#define MEMP_NUM_UDP_PCB            6
+// multicast discovery in collector.c
+#define LWIP_IGMP                   1
+#define DHCP_DOES_ARP_CHECK         0
+#define LWIP_DHCP_DOES_ACD_CHECK    0
+
+#ifndef NDEBUG
+#define LWIP_DEBUG                  1
+#define LWIP_STATS                  1
+#define LWIP_STATS_DISPLAY          1
+#endif
+
+#define ETHARP_DEBUG                LWIP_DBG_OFF
+#define NETIF_DEBUG                 LWIP_DBG_OFF
+#define PBUF_DEBUG                  LWIP_DBG_OFF
+#define API_LIB_DEBUG               LWIP_DBG_OFF
+#define API_MSG_DEBUG               LWIP_DBG_OFF
+#define SOCKETS_DEBUG               LWIP_DBG_OFF
+#define ICMP_DEBUG                  LWIP_DBG_OFF
+#define INET_DEBUG                  LWIP_DBG_OFF
+#define IP_DEBUG                    LWIP_DBG_OFF
+#define IP_REASS_DEBUG              LWIP_DBG_OFF
+#define RAW_DEBUG                   LWIP_DBG_OFF
+#define MEM_DEBUG                   LWIP_DBG_OFF
+#define MEMP_DEBUG                  LWIP_DBG_OFF
+#define SYS_DEBUG                   LWIP_DBG_OFF
+#define TCP_DEBUG                   LWIP_DBG_OFF
+#define TCP_INPUT_DEBUG             LWIP_DBG_OFF
+#define TCP_OUTPUT_DEBUG            LWIP_DBG_OFF
+#define TCP_RTO_DEBUG               LWIP_DBG_OFF
+#define TCP_CWND_DEBUG              LWIP_DBG_OFF
+#define TCP_WND_DEBUG               LWIP_DBG_OFF
+#define TCP_FR_DEBUG                LWIP_DBG_OFF
+#define TCP_QLEN_DEBUG              LWIP_DBG_OFF
+#define TCP_RST_DEBUG               LWIP_DBG_OFF
+#define UDP_DEBUG                   LWIP_DBG_OFF
+#define TCPIP_DEBUG                 LWIP_DBG_OFF
+#define PPP_DEBUG                   LWIP_DBG_OFF
+#define SLIP_DEBUG                  LWIP_DBG_OFF
+#define DHCP_DEBUG                  LWIP_DBG_OFF
+
+
+#endif
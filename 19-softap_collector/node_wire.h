@@ -0,0 +1,65 @@
+#ifndef _NODE_WIRE_H
+#define _NODE_WIRE_H
+
+#include <stdint.h>
+
+// What nodes send, the formats of 9-wifi_client: batched UDP datagrams with multicast
+// discovery (udp_telemetry.h, TELEMETRY_UDP) and a TCP stream of fixed size records
+// (tcp_stream.h, the default). Keep these in step with them. Little endian.
+//
+//   UDP datagram   struct node_udp_header, then count struct node_udp_sample
+//   discovery      struct node_discovery, to and from NODE_DISCOVERY_PORT
+//   TCP stream     struct node_tcp_record after struct node_tcp_record, no framing
+
+#define NODE_GROUP              "239.255.77.77"
+#define NODE_DISCOVERY_PORT     4244
+#define NODE_UDP_PORT           4243
+#define NODE_TCP_PORT           4242
+
+#define NODE_UDP_MAGIC          0x4d4c5455u     // "UTLM"
+#define NODE_DISCOVERY_MAGIC    0x43534455u     // "UDSC"
+#define NODE_TCP_CHECK          0x5354524du
+
+// IP and UDP headers off a 1500 byte MTU
+#define NODE_UDP_MAX_PAYLOAD    1472
+
+#define NODE_BEACON_MS          2000
+
+struct node_udp_header {
+    uint32_t magic;
+    uint32_t node_id;
+    uint32_t seq;               // datagrams, dropped ones included
+    uint32_t sent_us;           // node clock when it was sent
+    uint32_t base_us;           // node clock of the first sample
+    uint16_t count;
+    uint16_t reserved;
+};
+
+struct node_udp_sample {
+    uint32_t offset_us;         // after base_us
+    int32_t value;
+};
+
+#define NODE_UDP_MAX_SAMPLES \
+    ((NODE_UDP_MAX_PAYLOAD - sizeof(struct node_udp_header)) / sizeof(struct node_udp_sample))
+
+enum node_discovery_type {
+    NODE_QUERY = 1,             // node to group
+    NODE_BEACON,                // collector to group, or to the node that asked
+};
+
+struct node_discovery {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t port;              // beacon: where datagrams go, on the beacon's source address
+    uint32_t node_id;           // query: who is asking
+};
+
+struct node_tcp_record {
+    uint32_t seq;               // counts every record put, dropped ones included
+    uint32_t timestamp_us;      // node clock
+    int32_t value;
+    uint32_t check;             // seq ^ timestamp_us ^ value ^ NODE_TCP_CHECK
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/ip4_addr.h"
+#include "lwip/netif.h"
+#include "collector.h"
+#include "dhcp_server.h"
+#include "upstream.h"
+
+// An access point of its own for sites without infrastructure Wi-Fi. Station nodes
+// join it, get an address from dhcp_server.c and send their telemetry to
+// collector.c; what it merges goes up to the host in upstream.c frames, with the
+// stats as text frames among them (host/upstream_reader.cpp shows both).
+//
+// 9-wifi_client nodes built with WIFI_SSID/WIFI_PASSWORD set to AP_SSID/AP_PASSWORD
+// work as they are, with TELEMETRY_UDP (discovery finds the collector) or over TCP
+// with STREAM_SERVER=192.168.4.1. host/node_sim.cpp stands in for many of them.
+
+// set with -DAP_SSID=.. -DAP_PASSWORD=.. on the cmake command line
+#define AP_ADDRESS          "192.168.4.1"
+#define AP_NETMASK          "255.255.255.0"
+
+#define STATS_INTERVAL_MS   5000
+
+_Static_assert(sizeof(AP_PASSWORD) > 8, "WPA2 needs an AP_PASSWORD of 8 characters or more");
+
+// stations the firmware takes, and how many are associated now
+static void ap_stations(int *num, int *max) {
+    cyw43_thread_enter();
+    cyw43_wifi_ap_get_max_stas(&cyw43_state, max);
+    if (cyw43_wifi_ap_get_stas(&cyw43_state, num, NULL))
+        *num = -1;
+    cyw43_thread_exit();
+}
+
+// aggregate first, then a line per node heard from in the interval
+static void print_stats(uint32_t interval_ms) {
+    static struct collector_node_stats nodes[COLLECTOR_MAX_NODES];
+    struct collector_stats stats;
+    struct dhcp_server_stats dhcp;
+    cyw43_arch_lwip_begin();
+    collector_get_stats(&stats, true);
+    uint32_t count = collector_nodes(nodes, COLLECTOR_MAX_NODES, true);
+    dhcp_server_get_stats(&dhcp, true);
+    cyw43_arch_lwip_end();
+    struct upstream_stats up;
+    upstream_get_stats(&up, true);
+    int stations, max_stations;
+    ap_stations(&stations, &max_stations);
+
+    upstream_printf("ingest: %u nodes, %u samples/s in %u datagrams/s, %u out/s, merge max %u",
+                    count, stats.samples * 1000 / interval_ms, stats.datagrams * 1000 / interval_ms,
+                    stats.out * 1000 / interval_ms, stats.merge_max);
+    upstream_printf("dropped: %u over rate, %u late, %u merge full, %u malformed, %u no slot",
+                    stats.rate_dropped, stats.late, stats.overflow, stats.malformed, stats.no_slot);
+    for (uint32_t i = 0; i < count; i++) {
+        const struct collector_node_stats *n = &nodes[i];
+        upstream_printf("  %s %08x %-15s %u/s, %u over rate, %u held, %u lost, %u duplicates",
+                        n->tcp ? "tcp" : "udp", n->node_id, ip4addr_ntoa(&n->addr), n->samples * 1000 / interval_ms,
+                        n->rate_dropped, n->rate_held, n->lost, n->duplicates);
+    }
+    upstream_printf("ap: %d of %d stations, %u leases (%u acks, %u naks, %u refused), %u queries, %u tcp connects",
+                    stations, max_stations, dhcp.leases, dhcp.acks, dhcp.naks, dhcp.full, stats.queries,
+                    stats.tcp_connects);
+    upstream_printf("upstream: %u samples in %u frames, %u B/s",
+                    up.samples, up.frames, up.bytes * 1000 / interval_ms);
+}
+
+int main() {
+    // Initializations
+    stdio_init_all();
+    // everything goes out as frames from here on, stdio carries nothing else
+    if (cyw43_arch_init()) {
+        upstream_printf("failed to initialise wifi");
+        return 1;
+    }
+    cyw43_arch_enable_ap_mode(AP_SSID, AP_PASSWORD, CYW43_AUTH_WPA2_AES_PSK);
+
+    struct netif *netif = &cyw43_state.netif[CYW43_ITF_AP];
+    ip4_addr_t ip, netmask;
+    ip4addr_aton(AP_ADDRESS, &ip);
+    ip4addr_aton(AP_NETMASK, &netmask);
+    cyw43_arch_lwip_begin();
+    netif_set_addr(netif, &ip, &netmask, &ip);
+    bool started = dhcp_server_init(netif) && collector_init(netif, time_us_32);
+    cyw43_arch_lwip_end();
+    if (!started) {
+        upstream_printf("no pcbs for the dhcp server and collector");
+        return 1;
+    }
+
+    int stations, max_stations;
+    ap_stations(&stations, &max_stations);
+    upstream_printf("access point %s on %s, collecting on udp %u and tcp %u, discovery on %s:%u",
+                    AP_SSID, AP_ADDRESS, NODE_UDP_PORT, NODE_TCP_PORT, NODE_GROUP, NODE_DISCOVERY_PORT);
+    upstream_printf("firmware takes %d stations, the collector %u nodes at %u samples/s each",
+                    max_stations, COLLECTOR_MAX_NODES, COLLECTOR_NODE_RATE_HZ);
+    if (max_stations > COLLECTOR_MAX_NODES)
+        upstream_printf("more stations than COLLECTOR_MAX_NODES, the ones past it are not heard");
+
+    // Code here
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+    static struct collector_sample samples[UPSTREAM_FRAME_SAMPLES];
+    while (true) {
+        // only what the link takes without waiting, the rest stays in order in the collector
+        uint32_t room = upstream_room();
+        cyw43_arch_lwip_begin();
+        collector_poll();
+        uint32_t n = collector_pop(samples, room);
+        cyw43_arch_lwip_end();
+        for (uint32_t i = 0; i < n; i++)
+            upstream_put(samples[i].time_us, samples[i].node_id, samples[i].value);
+        // nothing more is due yet, send what there is rather than wait for a full frame
+        bool more = room && n == room;
+        if (room && !more)
+            upstream_flush();
+
+        if (time_reached(next_stats)) {
+            print_stats(STATS_INTERVAL_MS);
+            next_stats = delayed_by_ms(next_stats, STATS_INTERVAL_MS);
+        }
+        if (more)
+            continue;
+        // the following #ifdef is only here so this same example can be used in multiple modes;
+        // you do not need it in your code
+#if PICO_CYW43_ARCH_POLL
+        // poll for Wi-Fi driver and lwIP work, sleep until the next samples are due or until there is work
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(make_timeout_time_ms(1));
+#else
+        // Wi-Fi driver and lwIP work is done via interrupt in the background
+        sleep_ms(1);
+#endif
+    }
+    cyw43_arch_deinit();
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "upstream.h"
+
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#include "tusb.h"
+#endif
+
+// COBS adds a byte per 254, then the two delimiters
+#define ENCODED_MAX     (UPSTREAM_MAX_FRAME + UPSTREAM_MAX_FRAME / 254 + 3)
+
+static struct {
+    uint16_t seq;
+    uint8_t count;
+    struct upstream_sample samples[UPSTREAM_FRAME_SAMPLES];
+    struct upstream_stats stats;
+} upstream;
+
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i]) {
+            dst[out++] = src[i];
+            code++;
+        }
+        if (!src[i] || code == 0xff) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        }
+    }
+    dst[code_pos] = code;
+    return out;
+}
+
+static uint32_t fnv1a(const uint8_t *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+static void write_frame(uint8_t type, uint8_t count, const void *payload, size_t len) {
+    uint8_t raw[UPSTREAM_MAX_FRAME];
+    struct upstream_header header = { type, count, upstream.seq++ };
+    memcpy(raw, &header, sizeof(header));
+    memcpy(raw + sizeof(header), payload, len);
+    len += sizeof(header);
+    uint32_t check = fnv1a(raw, len);
+    memcpy(raw + len, &check, sizeof(check));
+    len += sizeof(check);
+
+    uint8_t out[ENCODED_MAX];
+    out[0] = 0;
+    size_t n = 1 + cobs_encode(raw, len, out + 1);
+    out[n++] = 0;
+    // raw, no CR/LF translation
+    for (size_t i = 0; i < n; i++)
+        putchar_raw(out[i]);
+    upstream.stats.frames++;
+    upstream.stats.bytes += n;
+}
+
+/* API */
+
+uint32_t upstream_room(void) {
+#if LIB_PICO_STDIO_USB
+    // not connected, stdio_usb throws the output away without waiting
+    if (stdio_usb_connected()) {
+        uint32_t frames = tud_cdc_write_available() / ENCODED_MAX;
+        return frames ? UPSTREAM_FRAME_SAMPLES - upstream.count : 0;
+    }
+#endif
+    // UART stdio waits on its FIFO, the samples wait there instead of in the collector
+    return UPSTREAM_FRAME_SAMPLES - upstream.count;
+}
+
+void upstream_put(uint32_t time_us, uint32_t node_id, int32_t value) {
+    upstream.samples[upstream.count++] = (struct upstream_sample){ time_us, node_id, value };
+    if (upstream.count == UPSTREAM_FRAME_SAMPLES)
+        upstream_flush();
+}
+
+void upstream_flush(void) {
+    if (!upstream.count)
+        return;
+    write_frame(UPSTREAM_SAMPLES, upstream.count, upstream.samples, upstream.count * sizeof(struct upstream_sample));
+    upstream.stats.samples += upstream.count;
+    upstream.count = 0;
+}
+
+void upstream_printf(const char *fmt, ...) {
+    char text[UPSTREAM_MAX_TEXT + 1];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    upstream_flush();
+    write_frame(UPSTREAM_TEXT, 0, text, MIN((size_t)len, UPSTREAM_MAX_TEXT));
+}
+
+void upstream_get_stats(struct upstream_stats *stats, bool reset) {
+    *stats = upstream.stats;
+    if (reset)
+        memset(&upstream.stats, 0, sizeof(upstream.stats));
+}
@@ -0,0 +1,61 @@
+#ifndef _UPSTREAM_H
+#define _UPSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames to the host over stdio, USB or UART whichever the build enables, read by
+// host/upstream_reader.cpp. Each is COBS encoded with a 0 on both sides, so a reader
+// that starts mid-stream or misses bytes finds the next one. They are written with
+// putchar_raw(), stdio's CR/LF translation would break them, so stdio carries
+// nothing else. Little endian.
+//
+//   frame      struct upstream_header, payload, FNV-1a of both (32 bits)
+//   payload    UPSTREAM_SAMPLES: count struct upstream_sample
+//              UPSTREAM_TEXT: text, no terminator
+
+#define UPSTREAM_FRAME_SAMPLES  20
+#define UPSTREAM_MAX_TEXT       240
+
+enum upstream_type {
+    UPSTREAM_SAMPLES = 1,
+    UPSTREAM_TEXT,
+};
+
+struct upstream_header {
+    uint8_t type;
+    uint8_t count;              // samples, 0 for text
+    uint16_t seq;               // frames, so the reader sees lost ones
+};
+
+struct upstream_sample {
+    uint32_t time_us;           // collector clock
+    uint32_t node_id;
+    int32_t value;
+};
+
+#define UPSTREAM_MAX_PAYLOAD    (UPSTREAM_FRAME_SAMPLES * sizeof(struct upstream_sample))
+#define UPSTREAM_MAX_FRAME      (sizeof(struct upstream_header) + UPSTREAM_MAX_PAYLOAD + 4)
+
+struct upstream_stats {
+    uint32_t frames;
+    uint32_t samples;
+    uint32_t bytes;             // encoded, delimiters included
+};
+
+// Samples that go out without waiting on the link, at most what a frame holds
+uint32_t upstream_room(void);
+
+// Batched, a frame goes out when UPSTREAM_FRAME_SAMPLES are in
+void upstream_put(uint32_t time_us, uint32_t node_id, int32_t value);
+
+// Sends a part frame
+void upstream_flush(void);
+
+// A line of text for whoever reads the frames, after the samples put so far
+void upstream_printf(const char *fmt, ...);
+
+void upstream_get_stats(struct upstream_stats *stats, bool reset);
+
+#endif
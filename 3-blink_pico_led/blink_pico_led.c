@@ -1,37 +1,91 @@
 #include <stdio.h>
+#include "hardware/pio.h"
+#include "led_pattern.h"
 #include "pico/stdlib.h"
 
 #ifndef LED_DELAY_MS
 #define LED_DELAY_MS 750
 #endif
 
-// Perform initialisation
-int pico_led_init(void) {
-    // A device like Pico that uses a GPIO for the LED will define PICO_DEFAULT_LED_PIN
-    // so we can use normal GPIO functionality to turn the led on and off
-    gpio_init(PICO_DEFAULT_LED_PIN);
-    gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
-    return PICO_OK;
-}
+// CPU load and the pattern playing are printed this often
+#ifndef REPORT_INTERVAL_MS
+#define REPORT_INTERVAL_MS 5000
+#endif
+
+static const char *prio_names[LED_PRIO_COUNT] = { "heartbeat", "link", "alert" };
 
-void pico_set_led(bool led_on) {
-    // Just set the GPIO on or off
-    gpio_put(PICO_DEFAULT_LED_PIN, led_on);
+static volatile bool report_due;
+
+static bool report_cb(repeating_timer_t *rt) {
+    report_due = true;
+    return true;
 }
 
-int count = 0;
+// Walks the LED through its uses, one change per report: link up, an error code
+// over the link pattern, link down again back to the heartbeat
+static void demo_step(int count) {
+    struct led_step steps[LED_PATTERN_MAX_STEPS];
+    uint n;
+
+    switch (count % 4) {
+    case 1:
+        n = led_pattern_blink(steps, count_of(steps), 255, LED_DELAY_MS, LED_DELAY_MS);
+        led_pattern_set(LED_PRIO_LINK, steps, n, 0);
+        break;
+    case 2:
+        // error code 3, twice, then the link pattern again
+        n = led_pattern_blink_code(steps, count_of(steps), 3);
+        led_pattern_set(LED_PRIO_ALERT, steps, n, 2);
+        break;
+    case 3:
+        led_pattern_clear(LED_PRIO_LINK);
+        break;
+    }
+}
 
 int main() {
-    stdio_init_all(); // Can be kept below pico_led_init(). I/O can happen, only after this.
-    int rc = pico_led_init();
+    stdio_init_all(); // Can be kept below led_pattern_init(). I/O can happen, only after this.
+    // A device like Pico that uses a GPIO for the LED will define PICO_DEFAULT_LED_PIN
+    int rc = led_pattern_init(pio0, PICO_DEFAULT_LED_PIN);
     hard_assert(rc == PICO_OK);
+
+    struct led_step steps[LED_PATTERN_MAX_STEPS];
+    uint n = led_pattern_breathe(steps, count_of(steps), 3000);
+    led_pattern_set(LED_PRIO_HEARTBEAT, steps, n, 0);
+
+    repeating_timer_t timer;
+    add_repeating_timer_ms(REPORT_INTERVAL_MS, report_cb, NULL, &timer);
+
+    // Nothing to do between reports, the LED runs on PIO and DMA. Time in WFI is idle,
+    // everything else is CPU load: the interrupts (USB, the report timer, the end of a
+    // pattern) run after the WFI window closes and count as busy
+    int count = 0;
+    uint64_t idle_us = 0;
+    uint64_t window_start = time_us_64();
     while (true) {
-        pico_set_led(true);
-        printf("LED On - %d!\n",count);
-        sleep_ms(LED_DELAY_MS);
-        pico_set_led(false);
-        printf("LED Off - %d!\n",count);
-        sleep_ms(LED_DELAY_MS);
+        uint32_t status = save_and_disable_interrupts();
+        uint64_t t = time_us_64();
+        // checked with interrupts off, so the flag can't be set between check and WFI
+        if (!report_due)
+            __wfi();
+        idle_us += time_us_64() - t;
+        restore_interrupts(status);
+
+        if (!report_due)
+            continue;
+        report_due = false;
+        uint64_t now = time_us_64();
+        uint64_t elapsed = now - window_start;
+        struct led_pattern_stats stats;
+        led_pattern_get_stats(&stats, true);
+        int active = led_pattern_active();
+        printf("LED %s - %d! CPU %.3f%% busy, %u pattern switches, %u pattern IRQs\n",
+               active < 0 ? "off" : prio_names[active], count,
+               100.f * (elapsed - idle_us) / elapsed, stats.switches, stats.irqs);
+        idle_us = 0;
+        window_start = now;
+
         count = (count + 1) % 10;
+        demo_step(count);
     }
 }
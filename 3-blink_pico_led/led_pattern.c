@@ -0,0 +1,215 @@
+#include <string.h>
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "led_pattern.h"
+#include "led_pattern.pio.h"
+
+// cycles the PIO loop spends outside the high and low counts
+#define LOOP_OVERHEAD   8
+#define PWM_CYCLES      (LED_PATTERN_PERIOD - LOOP_OVERHEAD)
+
+struct slot {
+    // two FIFO words per step, see led_pattern.pio
+    uint32_t words[2 * LED_PATTERN_MAX_STEPS];
+    uint num_words;
+    // what the control channel hands the data channel, NULL ends the chain
+    const uint32_t *chain[LED_PATTERN_MAX_REPEATS + 1];
+    bool loop;
+    bool set;
+};
+
+static struct {
+    PIO pio;
+    uint sm;
+    uint offset;
+    uint data_dma;
+    uint ctrl_dma;
+    int active;
+    struct slot slots[LED_PRIO_COUNT];
+    struct led_pattern_stats stats;
+} engine;
+
+static uint32_t encode_level(uint8_t level) {
+    uint32_t high = level * PWM_CYCLES / 255;
+    return high | (PWM_CYCLES - high) << 16;
+}
+
+// one period of encode_level(0), then the pin stays low at the pull
+static const uint32_t off_words[2] = { 0, PWM_CYCLES << 16 };
+static const uint32_t *const off_chain[2] = { off_words, NULL };
+
+static void stop_dma(void) {
+    // an aborted channel can still raise its IRQ, keep it out of the handler
+    dma_channel_set_irq0_enabled(engine.data_dma, false);
+    dma_channel_abort(engine.ctrl_dma);
+    dma_channel_abort(engine.data_dma);
+    dma_channel_acknowledge_irq0(engine.data_dma);
+    dma_channel_set_irq0_enabled(engine.data_dma, true);
+}
+
+static void start_chain(const uint32_t *const *chain, uint num_words, bool loop) {
+    dma_channel_set_trans_count(engine.data_dma, num_words, false);
+    dma_channel_config c = dma_channel_get_default_config(engine.ctrl_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    // looping: the same buffer every time, otherwise down the chain to the NULL
+    channel_config_set_read_increment(&c, !loop);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(engine.ctrl_dma, &c, &dma_hw->ch[engine.data_dma].al3_read_addr_trig,
+                          chain, 1, true);
+}
+
+// Starts the highest pattern that is set. With flush the FIFO and the step playing
+// now are dropped, otherwise the new pattern follows what is already in the FIFO
+static void play_highest(bool flush) {
+    PIO pio = engine.pio;
+    uint sm = engine.sm;
+
+    if (flush) {
+        stop_dma();
+        pio_sm_clear_fifos(pio, sm);
+        pio_sm_restart(pio, sm);
+        pio_sm_exec(pio, sm, pio_encode_jmp(engine.offset));
+    }
+
+    int prio = LED_PRIO_COUNT - 1;
+    while (prio >= 0 && !engine.slots[prio].set)
+        prio--;
+    engine.active = prio;
+    // the off step goes through the DMA as well: without a flush the FIFO may still be
+    // full of the last pattern's steps, and the DREQ waits for room where a put can't
+    if (prio < 0) {
+        start_chain(off_chain, count_of(off_words), false);
+        return;
+    }
+
+    struct slot *s = &engine.slots[prio];
+    start_chain(s->chain, s->num_words, s->loop);
+    engine.stats.switches++;
+}
+
+// the data channel is quiet apart from the NULL trigger at the end of a chain
+static void dma_irq_handler(void) {
+    if (!dma_channel_get_irq0_status(engine.data_dma))
+        return;
+    dma_channel_acknowledge_irq0(engine.data_dma);
+    engine.stats.irqs++;
+    // the off step is out, nothing follows it until a pattern is set
+    if (engine.active < 0)
+        return;
+    engine.slots[engine.active].set = false;
+    play_highest(false);
+}
+
+/* API */
+
+int led_pattern_init(PIO pio, uint pin) {
+    if (!pio_can_add_program(pio, &led_pattern_program))
+        return PICO_ERROR_GENERIC;
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0)
+        return PICO_ERROR_GENERIC;
+
+    memset(&engine, 0, sizeof(engine));
+    engine.pio = pio;
+    engine.sm = sm;
+    engine.offset = pio_add_program(pio, &led_pattern_program);
+    engine.active = -1;
+    engine.data_dma = dma_claim_unused_channel(true);
+    engine.ctrl_dma = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(engine.data_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    channel_config_set_chain_to(&c, engine.ctrl_dma);
+    channel_config_set_irq_quiet(&c, true);
+    dma_channel_configure(engine.data_dma, &c, &pio->txf[sm], NULL, 0, false);
+
+    irq_add_shared_handler(DMA_IRQ_0, dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+    dma_channel_set_irq0_enabled(engine.data_dma, true);
+
+    led_pattern_program_init(pio, sm, engine.offset, pin, LED_PATTERN_HZ);
+    return PICO_OK;
+}
+
+int led_pattern_set(enum led_prio prio, const struct led_step *steps, uint num_steps, uint repeats) {
+    if (prio >= LED_PRIO_COUNT || !num_steps || num_steps > LED_PATTERN_MAX_STEPS || repeats > LED_PATTERN_MAX_REPEATS)
+        return PICO_ERROR_GENERIC;
+
+    // the slot may be playing, take it off the DMA first
+    uint32_t status = save_and_disable_interrupts();
+    if (engine.active == (int)prio)
+        stop_dma();
+    struct slot *s = &engine.slots[prio];
+    for (uint i = 0; i < num_steps; i++) {
+        s->words[2 * i] = MAX(steps[i].ms, 1) - 1;
+        s->words[2 * i + 1] = encode_level(steps[i].level);
+    }
+    s->num_words = 2 * num_steps;
+    s->loop = !repeats;
+    for (uint i = 0; i < MAX(repeats, 1); i++)
+        s->chain[i] = s->words;
+    s->chain[MAX(repeats, 1)] = NULL;
+    s->set = true;
+    if ((int)prio >= engine.active)
+        play_highest(true);
+    restore_interrupts(status);
+    return PICO_OK;
+}
+
+void led_pattern_clear(enum led_prio prio) {
+    if (prio >= LED_PRIO_COUNT)
+        return;
+    uint32_t status = save_and_disable_interrupts();
+    engine.slots[prio].set = false;
+    if (engine.active == (int)prio)
+        play_highest(true);
+    restore_interrupts(status);
+}
+
+int led_pattern_active(void) {
+    return engine.active;
+}
+
+void led_pattern_get_stats(struct led_pattern_stats *stats, bool reset) {
+    *stats = engine.stats;
+    if (reset)
+        memset(&engine.stats, 0, sizeof(engine.stats));
+}
+
+/* Pattern builders */
+
+uint led_pattern_breathe(struct led_step *steps, uint max_steps, uint period_ms) {
+    uint half = max_steps / 2;
+    if (!half)
+        return 0;
+    uint ms = MAX(period_ms / (2 * half), 1);
+    for (uint i = 0; i < half; i++) {
+        uint x = 255 * i / (half - (half > 1));
+        uint8_t level = x * x / 255;
+        steps[i] = (struct led_step){ level, ms };
+        steps[2 * half - 1 - i] = (struct led_step){ level, ms };
+    }
+    return 2 * half;
+}
+
+uint led_pattern_blink_code(struct led_step *steps, uint max_steps, uint code) {
+    if (!code || 2 * code > max_steps)
+        return 0;
+    uint n = led_pattern_blink(steps, max_steps, 255, 150, 250);
+    for (uint i = 1; i < code; i++)
+        n += led_pattern_blink(steps + n, max_steps - n, 255, 150, 250);
+    // the pause tells one code from the next
+    steps[n - 1].ms = 1500;
+    return n;
+}
+
+uint led_pattern_blink(struct led_step *steps, uint max_steps, uint8_t level, uint on_ms, uint off_ms) {
+    if (max_steps < 2)
+        return 0;
+    steps[0] = (struct led_step){ level, MIN(on_ms, UINT16_MAX) };
+    steps[1] = (struct led_step){ 0, MIN(off_ms, UINT16_MAX) };
+    return 2;
+}
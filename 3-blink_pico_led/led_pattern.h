@@ -0,0 +1,71 @@
+#ifndef _LED_PATTERN_H
+#define _LED_PATTERN_H
+
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+
+// LED patterns played by a PIO state machine fed by DMA, see led_pattern.pio.
+//
+// A pattern is a list of (level, duration) steps. Once started it runs without the
+// CPU: a control DMA channel hands the step buffer to a data DMA channel over and
+// over, or as many times as asked and then ends the chain with a NULL trigger. Only
+// that end, or a call here, interrupts the CPU.
+//
+// Each priority has its own pattern. The highest one that is set plays, a higher one
+// cuts in straight away and when it ends or is cleared the next one down resumes
+// from its start.
+
+// PIO cycles per PWM period, level 255 is full on
+#define LED_PATTERN_PERIOD      256
+// PWM periods per second, step durations are counted in these
+#define LED_PATTERN_HZ          1000
+
+#ifndef LED_PATTERN_MAX_STEPS
+#define LED_PATTERN_MAX_STEPS   64
+#endif
+#ifndef LED_PATTERN_MAX_REPEATS
+#define LED_PATTERN_MAX_REPEATS 8
+#endif
+
+enum led_prio {
+    LED_PRIO_HEARTBEAT = 0,     // alive, lowest
+    LED_PRIO_LINK,              // link state
+    LED_PRIO_ALERT,             // error codes
+    LED_PRIO_COUNT
+};
+
+struct led_step {
+    uint8_t level;              // 0 off .. 255 full on, linear duty cycle
+    uint16_t ms;                // 1 .. 65535
+};
+
+struct led_pattern_stats {
+    uint32_t switches;          // patterns started
+    uint32_t irqs;              // end of pattern interrupts, the only CPU time between switches
+};
+
+// Claims a state machine on pio and two DMA channels, takes over pin
+int led_pattern_init(PIO pio, uint pin);
+
+// Sets the pattern for prio, repeats 0 loops it until cleared. The steps are copied
+int led_pattern_set(enum led_prio prio, const struct led_step *steps, uint num_steps, uint repeats);
+
+void led_pattern_clear(enum led_prio prio);
+
+// Priority playing now, -1 for none (LED off)
+int led_pattern_active(void);
+
+void led_pattern_get_stats(struct led_pattern_stats *stats, bool reset);
+
+/* Pattern builders, they return the number of steps written */
+
+// Fades in and out over period_ms, levels follow a square law so it looks even
+uint led_pattern_breathe(struct led_step *steps, uint max_steps, uint period_ms);
+
+// code short flashes, then a long pause
+uint led_pattern_blink_code(struct led_step *steps, uint max_steps, uint code);
+
+// on_ms at level, off_ms off
+uint led_pattern_blink(struct led_step *steps, uint max_steps, uint8_t level, uint on_ms, uint off_ms);
+
+#endif
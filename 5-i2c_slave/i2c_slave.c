@@ -14,12 +14,21 @@
 // E.g. if addresses 0x12 and 0x34 were acknowledged.
 
 #include <hardware/i2c.h>
+#include <hardware/sync.h>
 #include <pico/i2c_slave.h>
 #include <pico/stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "log.h"
 
-static const uint I2C_SLAVE_ADDRESS = 0x17;
+// override per node when several slaves share the bus, e.g. -DI2C_SLAVE_ADDRESS=0x20
+#ifndef I2C_SLAVE_ADDRESS
+#define I2C_SLAVE_ADDRESS 0x17
+#endif
+// the ISR only records the trace (see log.h), build with SLAVE_TRACE=0 to leave it out
+#ifndef SLAVE_TRACE
+#define SLAVE_TRACE 1
+#endif
 static const uint I2C_BAUDRATE = 100000; // 100 kHz
 
 // For this example, we run slave from pin GP4 (SDA) and pin GP5 (SCL).
@@ -30,6 +39,19 @@ static const uint I2C_SLAVE_SCL_PIN = 5;
 // writes the memory address, followed by the data. The address is automatically incremented
 // for each byte transferred, looping back to 0 upon reaching the end. Reading is done
 // sequentially from the current memory address.
+//
+// The last 8 bytes hold telemetry that the main loop refreshes every TELEMETRY_INTERVAL_MS:
+// seq (uint16), uptime in us (uint32), seq again (uint16), little endian. A master that
+// reads both seq copies equal got a consistent block.
+#define TELEMETRY_ADDRESS 0xF8
+#define TELEMETRY_INTERVAL_MS 100
+
+#if SLAVE_TRACE
+#define trace(...) LOG(__VA_ARGS__)
+#else
+#define trace(...)
+#endif
+
 static struct
 {
     uint8_t mem[256];
@@ -38,7 +60,7 @@ static struct
 } context;
 
 // Our handler is called from the I2C ISR, so it must complete quickly. Blocking calls /
-// printing to stdio may interfere with interrupt handling.
+// printing to stdio may interfere with interrupt handling, trace() only queues a record.
 static void i2c_slave_handler(i2c_inst_t *i2c, i2c_slave_event_t event) {
     switch (event) {
     case I2C_SLAVE_RECEIVE: // master has written some data
@@ -46,22 +68,22 @@ static void i2c_slave_handler(i2c_inst_t *i2c, i2c_slave_event_t event) {
             // writes always start with the memory address
             context.mem_address = i2c_read_byte_raw(i2c);
             context.mem_address_written = true;
-            printf("SLAVE_RECEIVE: Address:0x%02X ", context.mem_address);
+            trace("SLAVE_RECEIVE: Address:0x%02X ", context.mem_address);
         } else {
             // save into memory
             context.mem[context.mem_address] = i2c_read_byte_raw(i2c);
-            printf("%c ", (char)context.mem[context.mem_address]);
+            trace("%c ", (char)context.mem[context.mem_address]);
             context.mem_address++;
         }
         break;
     case I2C_SLAVE_REQUEST: // master is requesting data
         // load from memory
         i2c_write_byte_raw(i2c, context.mem[context.mem_address]);
-        printf("%c_", (char)context.mem[context.mem_address]);
+        trace("%c_", (char)context.mem[context.mem_address]);
         context.mem_address++;
         break;
     case I2C_SLAVE_FINISH: // master has signalled Stop / Restart
-        printf("SLAVE_FINISH \n");
+        trace("SLAVE_FINISH \n");
         context.mem_address_written = false;
         break;
     default:
@@ -83,15 +105,40 @@ static void setup_slave() {
     i2c_slave_init(i2c0, I2C_SLAVE_ADDRESS, &i2c_slave_handler); // configure I2C0 for slave mode
 }
 
+static void update_telemetry(uint16_t seq) {
+    uint32_t uptime_us = time_us_32();
+    uint8_t block[8] = {
+        seq & 0xff, seq >> 8,
+        uptime_us & 0xff, (uptime_us >> 8) & 0xff, (uptime_us >> 16) & 0xff, uptime_us >> 24,
+        seq & 0xff, seq >> 8,
+    };
+    // the ISR serves reads byte by byte, keep it out while the block changes
+    uint32_t status = save_and_disable_interrupts();
+    memcpy(&context.mem[TELEMETRY_ADDRESS], block, sizeof(block));
+    restore_interrupts(status);
+}
+
 int main() {
     stdio_init_all();
-    
-    printf("\ni2c0 slave: ");
+    log_init();
+
+    struct log_stats stats;
+    log_get_stats(&stats, false);
+    printf("\ni2c0 slave (log %u cycles per call): ", stats.cycles_per_call);
     setup_slave();
 
+    uint16_t seq = 0;
+    absolute_time_t next_update = get_absolute_time();
     while(true) {
-        printf(".");
-		sleep_ms(100);
+        if (time_reached(next_update)) {
+            update_telemetry(++seq);
+            trace(".");
+            next_update = delayed_by_ms(next_update, TELEMETRY_INTERVAL_MS);
+        }
+        // the trace gets formatted and printed here, as fast as stdio takes it. Then
+        // sleep until the next update or a new record (SEV), unless the batch was full
+        if (log_drain(16) < 16)
+            best_effort_wfe_or_timeout(next_update);
 	}
     return 0;
 }
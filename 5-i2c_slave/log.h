@@ -0,0 +1,81 @@
+#ifndef _LOG_H
+#define _LOG_H
+
+#include "pico/stdlib.h"
+
+// Deferred logging: LOG() only records the format string's address and its
+// arguments as 32 bit words in a ring owned by the calling core, nothing is
+// formatted and no stdio is touched. log_drain() does the formatting later, from
+// the main loop when there is time, and only as much as the sink takes without
+// blocking, so a slow USB host delays the log, not the caller. Safe from IRQs.
+// Every record sends an event, so the drain can wait for one in WFE.
+//
+// Arguments are integers, chars, floats/doubles (stored as float) or pointers to
+// strings that stay valid forever, i.e. literals or const tables. A buffer on the
+// stack is gone by the time the record is formatted.
+//
+// Define LOG_BINARY to send the records as they are, COBS framed, instead of text.
+// Format strings then never get formatted on the device, see host/log_decode which
+// looks them up in the ELF. A record on the wire, little endian words:
+//
+//   fmt         address of the format string
+//   timestamp   us since boot
+//   info        bits 0-7 argument count, 8-15 core, 16-31 records lost before this one
+//   args...
+
+// words per core, must be a power of 2
+#ifndef LOG_RING_WORDS
+#define LOG_RING_WORDS      512
+#endif
+
+#define LOG_MAX_ARGS        4
+#define LOG_HDR_WORDS       3
+
+struct log_stats {
+    uint32_t records;           // drained
+    uint32_t dropped;           // ring full
+    uint32_t max_fill;          // words, high water mark over both cores
+    uint32_t cycles_per_call;   // cost of a LOG with two arguments, measured by log_init
+};
+
+void log_init(void);
+
+// Writes out pending records until the sink is full or max_records are done.
+// Returns the number of records written
+uint log_drain(uint max_records);
+
+void log_get_stats(struct log_stats *stats, bool reset);
+
+void log_record(const char *fmt, uint32_t info, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+static inline uint32_t log_arg_float(double v) {
+    union { float f; uint32_t u; } bits = { .f = (float)v };
+    return bits.u;
+}
+
+static inline uint32_t log_arg_ptr(const void *p) {
+    return (uint32_t)(uintptr_t)p;
+}
+
+static inline uint32_t log_arg_int(uint32_t v) {
+    return v;
+}
+
+#define _LOG_ARG(x) _Generic((x), \
+    float: log_arg_float, \
+    double: log_arg_float, \
+    char *: log_arg_ptr, \
+    const char *: log_arg_ptr, \
+    default: log_arg_int)(x)
+
+#define _LOG0(fmt)              log_record(fmt, 0, 0, 0, 0, 0)
+#define _LOG1(fmt, a)           log_record(fmt, 1, _LOG_ARG(a), 0, 0, 0)
+#define _LOG2(fmt, a, b)        log_record(fmt, 2, _LOG_ARG(a), _LOG_ARG(b), 0, 0)
+#define _LOG3(fmt, a, b, c)     log_record(fmt, 3, _LOG_ARG(a), _LOG_ARG(b), _LOG_ARG(c), 0)
+#define _LOG4(fmt, a, b, c, d)  log_record(fmt, 4, _LOG_ARG(a), _LOG_ARG(b), _LOG_ARG(c), _LOG_ARG(d))
+#define _LOG_SELECT(_0, _1, _2, _3, _4, name, ...) name
+
+// fmt must be a string literal, printf conversions only, up to LOG_MAX_ARGS of them
+#define LOG(fmt, ...) _LOG_SELECT(_0, ##__VA_ARGS__, _LOG4, _LOG3, _LOG2, _LOG1, _LOG0)("" fmt, ##__VA_ARGS__)
+
+#endif
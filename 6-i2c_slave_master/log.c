@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
+#include "log.h"
+
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#include "tusb.h"
+#endif
+
+#define RING_MASK   (LOG_RING_WORDS - 1)
+
+static_assert((LOG_RING_WORDS & RING_MASK) == 0, "LOG_RING_WORDS must be a power of 2");
+
+// Single producer (its core, IRQs included) and single consumer (log_drain)
+struct log_ring {
+    uint32_t words[LOG_RING_WORDS];
+    // free running indices, masked on access
+    volatile uint32_t head;     // producer only
+    volatile uint32_t tail;     // consumer only
+    uint32_t lost;              // since the last record that made it in
+    // written by the producer, read and reset by the drain, good enough for stats
+    uint32_t dropped;
+    uint32_t max_fill;
+};
+
+static struct log_ring rings[NUM_CORES];
+
+static struct {
+    // a formatted record the sink had no room for yet
+    char pending[160];
+    size_t pending_len;
+    uint32_t records;
+    uint32_t cycles_per_call;
+} drain;
+
+// in RAM, so a LOG costs the same whether or not the XIP cache has it
+void __not_in_flash_func(log_record)(const char *fmt, uint32_t info, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3) {
+    uint core = get_core_num();
+    struct log_ring *r = &rings[core];
+    uint n = LOG_HDR_WORDS + info;
+
+    uint32_t status = save_and_disable_interrupts();
+    uint32_t head = r->head;
+    if (LOG_RING_WORDS - (head - r->tail) < n) {
+        r->lost++;
+        r->dropped++;
+        restore_interrupts(status);
+        return;
+    }
+    uint32_t *w = r->words;
+    w[head++ & RING_MASK] = (uint32_t)(uintptr_t)fmt;
+    w[head++ & RING_MASK] = time_us_32();
+    w[head++ & RING_MASK] = info | core << 8 | MIN(r->lost, 0xffff) << 16;
+    switch (info) {
+    case 4: w[(head + 3) & RING_MASK] = a3;   // fall through
+    case 3: w[(head + 2) & RING_MASK] = a2;   // fall through
+    case 2: w[(head + 1) & RING_MASK] = a1;   // fall through
+    case 1: w[head & RING_MASK] = a0;
+    }
+    head += info;
+    r->lost = 0;
+    r->max_fill = MAX(r->max_fill, head - r->tail);
+    // the record must be visible before the drain, maybe on the other core, sees it
+    __mem_fence_release();
+    r->head = head;
+    restore_interrupts(status);
+    // the drain may be waiting for it in WFE
+    __sev();
+}
+
+// cycles for one LOG with two arguments, the records written are thrown away again
+static uint32_t measure_cost(void) {
+    struct log_ring *r = &rings[get_core_num()];
+    const int calls = 16;
+    uint32_t csr = systick_hw->csr;
+
+    systick_hw->rvr = 0xffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;      // enabled, processor clock, no interrupt
+    uint32_t head = r->head;
+    uint32_t start = systick_hw->cvr;
+    for (int i = 0; i < calls; i++)
+        LOG("cost %d %u", i, start);
+    uint32_t cycles = (start - systick_hw->cvr) & 0xffffff;
+    r->head = head;
+    systick_hw->csr = csr;
+    return cycles / calls;
+}
+
+void log_init(void) {
+    memset(rings, 0, sizeof(rings));
+    drain.cycles_per_call = measure_cost();
+}
+
+/* Drain */
+
+// how much the sink takes right now without blocking
+static size_t sink_room(void) {
+#if LIB_PICO_STDIO_USB
+    // not connected, stdio_usb throws the output away without waiting
+    if (stdio_usb_connected())
+        return tud_cdc_write_available();
+#endif
+    // UART stdio waits on its FIFO, keep drain calls short instead
+    return SIZE_MAX;
+}
+
+static void sink_write(const char *data, size_t len) {
+#ifdef LOG_BINARY
+    // raw, no CR/LF translation
+    for (size_t i = 0; i < len; i++)
+        putchar_raw(data[i]);
+#else
+    printf("%.*s", (int)len, data);
+#endif
+}
+
+#ifdef LOG_BINARY
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i]) {
+            dst[out++] = src[i];
+            code++;
+        }
+        if (!src[i] || code == 0xff) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        }
+    }
+    dst[code_pos] = code;
+    return out;
+}
+
+static size_t format_record(const uint32_t *w, char *out, size_t size) {
+    uint nargs = w[2] & 0xff;
+    uint8_t raw[4 * (LOG_HDR_WORDS + LOG_MAX_ARGS)];
+    size_t len = 4 * (LOG_HDR_WORDS + nargs);
+    for (size_t i = 0; i < len; i++)
+        raw[i] = w[i / 4] >> (8 * (i % 4));
+
+    // delimiters on both sides, like the telemetry frames
+    out[0] = 0;
+    size_t n = 1 + cobs_encode(raw, len, (uint8_t *)out + 1);
+    out[n++] = 0;
+    return n;
+}
+#else
+// Formats one conversion at a time, so each argument is passed with the type its
+// conversion expects. Long long and * widths are not supported.
+static size_t format_record(const uint32_t *w, char *out, size_t size) {
+    const char *fmt = (const char *)(uintptr_t)w[0];
+    uint nargs = w[2] & 0xff;
+    uint lost = w[2] >> 16;
+    const uint32_t *args = w + LOG_HDR_WORDS;
+    size_t len = 0;
+
+    if (lost)
+        len += snprintf(out, size, "[%u log records lost]\n", lost);
+
+    for (const char *p = fmt; *p && len < size;) {
+        const char *spec = strchr(p, '%');
+        if (!spec) {
+            len += snprintf(out + len, size - len, "%s", p);
+            break;
+        }
+        // text up to the conversion, then the conversion on its own
+        len += snprintf(out + len, size - len, "%.*s", (int)(spec - p), p);
+        if (len >= size)
+            break;
+        const char *end = spec + 1;
+        while (*end && strchr("-+ #0123456789.hlzjt", *end))
+            end++;
+        if (!*end)
+            break;
+        char conv[16];
+        int conv_len = MIN(end + 1 - spec, (int)sizeof(conv) - 1);
+        memcpy(conv, spec, conv_len);
+        conv[conv_len] = '\0';
+        p = end + 1;
+
+        if (*end == '%') {
+            len += snprintf(out + len, size - len, "%%");
+            continue;
+        }
+        if (!nargs)
+            continue;
+        uint32_t arg = *args++;
+        nargs--;
+        if (strchr("fFeEgGaA", *end)) {
+            union { uint32_t u; float f; } bits = { .u = arg };
+            len += snprintf(out + len, size - len, conv, (double)bits.f);
+        } else if (*end == 's') {
+            len += snprintf(out + len, size - len, conv, (const char *)(uintptr_t)arg);
+        } else {
+            len += snprintf(out + len, size - len, conv, arg);
+        }
+    }
+    return MIN(len, size - 1);
+}
+#endif
+
+// oldest record over both cores, NULL if there is none
+static struct log_ring *next_ring(void) {
+    struct log_ring *next = NULL;
+    for (uint core = 0; core < NUM_CORES; core++) {
+        struct log_ring *r = &rings[core];
+        if (r->head == r->tail)
+            continue;
+        // head first, then what it covers
+        __mem_fence_acquire();
+        if (!next || (int32_t)(r->words[(r->tail + 1) & RING_MASK] - next->words[(next->tail + 1) & RING_MASK]) < 0)
+            next = r;
+    }
+    return next;
+}
+
+uint log_drain(uint max_records) {
+    uint done = 0;
+
+    while (done < max_records) {
+        if (!drain.pending_len) {
+            struct log_ring *r = next_ring();
+            if (!r)
+                break;
+
+            // a record can wrap around the end of the ring, copy it out first
+            uint32_t w[LOG_HDR_WORDS + LOG_MAX_ARGS];
+            uint32_t tail = r->tail;
+            for (int i = 0; i < LOG_HDR_WORDS; i++)
+                w[i] = r->words[(tail + i) & RING_MASK];
+            uint nargs = MIN(w[2] & 0xff, LOG_MAX_ARGS);
+            for (uint i = 0; i < nargs; i++)
+                w[LOG_HDR_WORDS + i] = r->words[(tail + LOG_HDR_WORDS + i) & RING_MASK];
+            __mem_fence_release();
+            r->tail = tail + LOG_HDR_WORDS + nargs;
+
+            drain.pending_len = format_record(w, drain.pending, sizeof(drain.pending));
+            drain.records++;
+        }
+
+        // CR/LF translation may add a few bytes on the way out
+        if (sink_room() < drain.pending_len + 8)
+            break;
+        sink_write(drain.pending, drain.pending_len);
+        drain.pending_len = 0;
+        done++;
+    }
+    return done;
+}
+
+void log_get_stats(struct log_stats *stats, bool reset) {
+    stats->records = drain.records;
+    stats->dropped = 0;
+    stats->max_fill = 0;
+    for (uint core = 0; core < NUM_CORES; core++) {
+        stats->dropped += rings[core].dropped;
+        stats->max_fill = MAX(stats->max_fill, rings[core].max_fill);
+        if (reset) {
+            rings[core].dropped = 0;
+            rings[core].max_fill = 0;
+        }
+    }
+    stats->cycles_per_call = drain.cycles_per_call;
+    if (reset)
+        drain.records = 0;
+}
@@ -8,8 +8,10 @@
 #include <hardware/i2c.h>
 #include <pico/i2c_slave.h>
 #include <pico/stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include "log.h"
 
 static const uint I2C_SLAVE_ADDRESS = 0x17;
 static const uint I2C_BAUDRATE = 100000; // 100 kHz
@@ -33,7 +35,8 @@ static struct
 } context;
 
 // Our handler is called from the I2C ISR, so it must complete quickly. Blocking calls /
-// printing to stdio may interfere with interrupt handling.
+// printing to stdio may interfere with interrupt handling, so it only LOGs (see log.h)
+// and the master prints the records between its own steps.
 static void i2c_slave_handler(i2c_inst_t *i2c, i2c_slave_event_t event) {
     switch (event) {
     case I2C_SLAVE_RECEIVE: // master has written some data
@@ -41,22 +44,22 @@ static void i2c_slave_handler(i2c_inst_t *i2c, i2c_slave_event_t event) {
             // writes always start with the memory address
             context.mem_address = i2c_read_byte_raw(i2c);
             context.mem_address_written = true;
-            printf("SLAVE_RECEIVE: Address:0x%02X ", context.mem_address);
+            LOG("SLAVE_RECEIVE: Address:0x%02X ", context.mem_address);
         } else {
             // save into memory
             context.mem[context.mem_address] = i2c_read_byte_raw(i2c);
-            printf("%c ", (char)context.mem[context.mem_address]);
+            LOG("%c ", (char)context.mem[context.mem_address]);
             context.mem_address++;
         }
         break;
     case I2C_SLAVE_REQUEST: // master is requesting data
         // load from memory
         i2c_write_byte_raw(i2c, context.mem[context.mem_address]);
-        printf("%c_", (char)context.mem[context.mem_address]);
+        LOG("%c_", (char)context.mem[context.mem_address]);
         context.mem_address++;
         break;
     case I2C_SLAVE_FINISH: // master has signalled Stop / Restart
-        printf("SLAVE_FINISH \n");
+        LOG("SLAVE_FINISH \n");
         context.mem_address_written = false;
         break;
     default:
@@ -98,6 +101,7 @@ static void run_master() {
         snprintf(msg, sizeof(msg), "Hello, I2C slave! - 0x%02X", mem_address);
         uint8_t msg_len = strlen(msg);
 
+        log_drain(UINT_MAX);
         printf("Message=%s, Len=%d \n",msg, msg_len);
 
         uint8_t buf[32];
@@ -117,11 +121,14 @@ static void run_master() {
         count = i2c_write_blocking(i2c1, I2C_SLAVE_ADDRESS, buf, 1, true);
         hard_assert(count == 1);
 
+        log_drain(UINT_MAX);
+
         // partial read
         uint8_t split = 5;
         count = i2c_read_blocking(i2c1, I2C_SLAVE_ADDRESS, buf, split, true);
         hard_assert(count == split);
         buf[count] = '\0'; //null terminator
+        log_drain(UINT_MAX);
         printf("Read  at 0x%02X: '%s'\n", mem_address, buf);
         hard_assert(memcmp(buf, msg, split) == 0);
 
@@ -129,9 +136,11 @@ static void run_master() {
         count = i2c_read_blocking(i2c1, I2C_SLAVE_ADDRESS, buf, msg_len - split, false);
         hard_assert(count == msg_len - split);
         buf[count] = '\0'; //null terminator
+        log_drain(UINT_MAX);
         printf("Read  at 0x%02X: '%s'\n", mem_address + split, buf);
         hard_assert(memcmp(buf, msg + split, msg_len - split) == 0);
 
+        log_drain(UINT_MAX);
         printf("\n");
         sleep_ms(2000);
     }
@@ -139,6 +148,7 @@ static void run_master() {
 
 int main() {
     stdio_init_all();
+    log_init();
     printf("\nI2C slave example");
     setup_slave();
     run_master();
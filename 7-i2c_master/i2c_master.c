@@ -3,6 +3,7 @@
 #include <pico/stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "i2c_bus.h"
 
 static const uint I2C_SLAVE_ADDRESS = 0x17;
 static const uint I2C_BAUDRATE = 100000; // 100 kHz
@@ -11,16 +12,24 @@ static const uint I2C_BAUDRATE = 100000; // 100 kHz
 static const uint I2C_MASTER_SDA_PIN = 18;
 static const uint I2C_MASTER_SCL_PIN = 19;
 
-static void setup_master() {
-    gpio_init(I2C_MASTER_SDA_PIN);
-    gpio_set_function(I2C_MASTER_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(I2C_MASTER_SDA_PIN);
+// retry twice with 1ms, 2ms backoff before giving up on a transfer
+#define I2C_MAX_RETRIES 2
+#define I2C_BACKOFF_US 1000
+#define I2C_BACKOFF_MAX_US 8000
 
-    gpio_init(I2C_MASTER_SCL_PIN);
-    gpio_set_function(I2C_MASTER_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(I2C_MASTER_SCL_PIN);
+static i2c_bus_t master_bus;
 
-    i2c_init(i2c1, I2C_BAUDRATE);
+static void setup_master() {
+    master_bus = (i2c_bus_t) {
+        .i2c = i2c1,
+        .sda_pin = I2C_MASTER_SDA_PIN,
+        .scl_pin = I2C_MASTER_SCL_PIN,
+        .baudrate = I2C_BAUDRATE,
+        .max_retries = I2C_MAX_RETRIES,
+        .backoff_us = I2C_BACKOFF_US,
+        .backoff_max_us = I2C_BACKOFF_MAX_US,
+    };
+    i2c_bus_init(&master_bus);
 }
 
 static void run_master() {
@@ -39,32 +48,44 @@ static void run_master() {
 
         // write message at mem_address
         printf("Write at 0x%02X: '%s'\n", mem_address, msg);
-        int count = i2c_write_blocking(i2c1, I2C_SLAVE_ADDRESS, buf, 1 + msg_len, false);
-        if (count < 0) {
-            puts("Couldn't write to slave, please check your wiring!");
-            return;
+        int count = i2c_bus_write(&master_bus, I2C_SLAVE_ADDRESS, buf, 1 + msg_len, false);
+        if (count != 1 + msg_len) {
+            printf("Couldn't write to slave (%d), please check your wiring!\n", count);
+            goto next;
         }
-        hard_assert(count == 1 + msg_len);
 
         // seek to mem_address
-        count = i2c_write_blocking(i2c1, I2C_SLAVE_ADDRESS, buf, 1, true);
-        hard_assert(count == 1);
+        count = i2c_bus_write(&master_bus, I2C_SLAVE_ADDRESS, buf, 1, true);
+        if (count != 1) {
+            printf("Couldn't seek on slave (%d)\n", count);
+            goto next;
+        }
 
-        // partial read
+        // partial read, keeping the bus (repeated start) so the rest continues from here
         uint8_t split = 5;
-        count = i2c_read_blocking(i2c1, I2C_SLAVE_ADDRESS, buf, split, true);
-        hard_assert(count == split);
+        count = i2c_bus_read(&master_bus, I2C_SLAVE_ADDRESS, buf, split, true);
+        if (count != split) {
+            printf("Couldn't read from slave (%d)\n", count);
+            goto next;
+        }
         buf[count] = '\0'; //null terminator
         printf("Read  at 0x%02X: '%s'\n", mem_address, buf);
-        hard_assert(memcmp(buf, msg, split) == 0);
+        if (memcmp(buf, msg, split) != 0)
+            printf("Mismatch at 0x%02X\n", mem_address);
 
         // read the remaining bytes, continuing from last address
-        count = i2c_read_blocking(i2c1, I2C_SLAVE_ADDRESS, buf, msg_len - split, false);
-        hard_assert(count == msg_len - split);
+        count = i2c_bus_read(&master_bus, I2C_SLAVE_ADDRESS, buf, msg_len - split, false);
+        if (count != msg_len - split) {
+            printf("Couldn't read from slave (%d)\n", count);
+            goto next;
+        }
         buf[count] = '\0'; //null terminator
         printf("Read  at 0x%02X: '%s'\n", mem_address + split, buf);
-        hard_assert(memcmp(buf, msg + split, msg_len - split) == 0);
+        if (memcmp(buf, msg + split, msg_len - split) != 0)
+            printf("Mismatch at 0x%02X\n", mem_address + split);
 
+next:
+        i2c_bus_print_counters(&master_bus);
         printf("\n");
         sleep_ms(2000);
     }
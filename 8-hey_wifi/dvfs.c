@@ -0,0 +1,152 @@
+#include <string.h>
+#include "hardware/clocks.h"
+#if LIB_PICO_CYW43_ARCH
+#include "pico/cyw43_arch.h"
+#endif
+#include "dvfs.h"
+
+const struct dvfs_profile_def dvfs_profiles[DVFS_PROFILES] = {
+    [DVFS_IDLE] = { "idle", DVFS_IDLE_KHZ, DVFS_IDLE_VREG },
+    [DVFS_NOMINAL] = { "nominal", DVFS_NOMINAL_KHZ, DVFS_NOMINAL_VREG },
+    [DVFS_BURST] = { "burst", DVFS_BURST_KHZ, DVFS_BURST_VREG },
+};
+
+// a peripheral whose rate is set again after a switch
+struct tracked {
+    uart_inst_t *uart;          // one of the two
+    i2c_inst_t *i2c;
+    uint baud;
+};
+
+static struct {
+    bool valid[DVFS_PROFILES];
+    struct tracked tracked[DVFS_MAX_TRACKED];
+    uint num_tracked;
+    // time accounting
+    enum dvfs_profile current;
+    uint64_t profile_start_us;
+    struct dvfs_stats stats;
+} dvfs;
+
+static void account(enum dvfs_profile next) {
+    uint64_t now = time_us_64();
+    dvfs.stats.time_us[dvfs.current] += now - dvfs.profile_start_us;
+    dvfs.current = next;
+    dvfs.profile_start_us = now;
+}
+
+static bool track(uart_inst_t *uart, i2c_inst_t *i2c, uint baud) {
+    if (dvfs.num_tracked >= DVFS_MAX_TRACKED)
+        return false;
+    dvfs.tracked[dvfs.num_tracked++] = (struct tracked){ uart, i2c, baud };
+    return true;
+}
+
+// the dividers were worked out for the old clock
+static void retime(void) {
+    for (uint i = 0; i < dvfs.num_tracked; i++) {
+        const struct tracked *t = &dvfs.tracked[i];
+        if (t->uart)
+            uart_set_baudrate(t->uart, t->baud);
+        else
+            i2c_set_baudrate(t->i2c, t->baud);
+    }
+}
+
+static void switch_to(enum vreg_voltage from_vreg, const struct dvfs_profile_def *to) {
+    // whatever is in a FIFO would go out at a wrong rate
+    for (uint i = 0; i < dvfs.num_tracked; i++)
+        if (dvfs.tracked[i].uart && uart_is_enabled(dvfs.tracked[i].uart))
+            uart_tx_wait_blocking(dvfs.tracked[i].uart);
+#if LIB_PICO_CYW43_ARCH
+    cyw43_thread_enter();
+#endif
+    // the voltage is never too low for the clock, raised before it and lowered after
+    if (to->vreg > from_vreg) {
+        vreg_set_voltage(to->vreg);
+        busy_wait_us(DVFS_VREG_SETTLE_US);
+    }
+    set_sys_clock_khz(to->sys_khz, true);
+    if (to->vreg < from_vreg)
+        vreg_set_voltage(to->vreg);
+    retime();
+#if LIB_PICO_CYW43_ARCH
+    cyw43_thread_exit();
+#endif
+}
+
+/* API */
+
+bool dvfs_init(void) {
+    memset(&dvfs, 0, sizeof(dvfs));
+#if LIB_PICO_STDIO_UART
+    track(uart_default, NULL, PICO_DEFAULT_UART_BAUD_RATE);
+#endif
+    bool all = true;
+    for (int p = 0; p < DVFS_PROFILES; p++) {
+        uint vco, postdiv1, postdiv2;
+        dvfs.valid[p] = check_sys_clock_khz(dvfs_profiles[p].sys_khz, &vco, &postdiv1, &postdiv2);
+        all &= dvfs.valid[p];
+    }
+    // the boot clock and voltage depend on the chip and the SDK version (rp2350 boots
+    // at 150MHz), start from a profile that is known for certain
+    if (dvfs.valid[DVFS_NOMINAL])
+        switch_to(vreg_get_voltage(), &dvfs_profiles[DVFS_NOMINAL]);
+    dvfs.current = DVFS_NOMINAL;
+    dvfs.profile_start_us = time_us_64();
+    return all;
+}
+
+bool dvfs_set(enum dvfs_profile profile) {
+    if (profile == dvfs.current)
+        return true;
+    if (!dvfs.valid[profile]) {
+        dvfs.stats.rejected++;
+        return false;
+    }
+    uint64_t start = time_us_64();
+    switch_to(dvfs_profiles[dvfs.current].vreg, &dvfs_profiles[profile]);
+
+    uint32_t took = time_us_64() - start;
+    if (took > dvfs.stats.switch_us_max)
+        dvfs.stats.switch_us_max = took;
+    dvfs.stats.entries[profile]++;
+    account(profile);
+    return true;
+}
+
+enum dvfs_profile dvfs_current(void) {
+    return dvfs.current;
+}
+
+bool dvfs_track_uart(uart_inst_t *uart, uint baud) {
+    return track(uart, NULL, baud);
+}
+
+bool dvfs_track_i2c(i2c_inst_t *i2c, uint baud) {
+    return track(NULL, i2c, baud);
+}
+
+void dvfs_get_stats(struct dvfs_stats *stats, bool reset) {
+    account(dvfs.current);
+    *stats = dvfs.stats;
+    if (reset)
+        memset(&dvfs.stats, 0, sizeof(dvfs.stats));
+}
+
+uint32_t dvfs_vreg_mv(enum vreg_voltage vreg) {
+#if PICO_RP2040
+    // every setting up to VREG_VOLTAGE_0_80 is 0.80V, 50mV steps from there
+    return vreg <= VREG_VOLTAGE_0_80 ? 800 : 800 + (vreg - VREG_VOLTAGE_0_80) * 50;
+#else
+    // 50mV steps from 0.55V up to 1.30V, the profiles stay below that
+    return 550 + (vreg - VREG_VOLTAGE_0_55) * 50;
+#endif
+}
+
+uint32_t dvfs_power_proxy(enum dvfs_profile profile) {
+    const struct dvfs_profile_def *p = &dvfs_profiles[profile];
+    const struct dvfs_profile_def *n = &dvfs_profiles[DVFS_NOMINAL];
+    uint64_t mv = dvfs_vreg_mv(p->vreg), nominal_mv = dvfs_vreg_mv(n->vreg);
+    return (uint64_t)p->sys_khz * mv * mv * 1000 / ((uint64_t)n->sys_khz * nominal_mv * nominal_mv);
+}
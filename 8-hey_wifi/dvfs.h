@@ -0,0 +1,105 @@
+#ifndef _DVFS_H
+#define _DVFS_H
+
+#include "pico/stdlib.h"
+#include "hardware/i2c.h"
+#include "hardware/uart.h"
+#include "hardware/vreg.h"
+
+// System clock and core voltage profiles, switched at run time.
+//
+//   DVFS_IDLE      48MHz at 1.00V, waiting and sensing
+//   DVFS_NOMINAL   125MHz at 1.10V, set by dvfs_init
+//   DVFS_BURST     200MHz at 1.15V, display animation, network bursts
+//
+// A switch up raises the voltage first and waits DVFS_VREG_SETTLE_US before the
+// clock goes up, a switch down lowers the clock first. set_sys_clock_khz() moves
+// clk_peri with clk_sys, so the UART baud dividers are stale after a switch, and I2C
+// counts its SCL timing in clk_sys cycles: the UARTs and I2C blocks given to
+// dvfs_track_uart() and dvfs_track_i2c() get their rate set again, the stdio UART
+// is tracked by itself. A UART's FIFO is drained before the switch. USB and the
+// timer run from their own clocks and don't notice.
+//
+// The CYW43 is on a PIO SPI clocked from clk_sys, at CYW43_PIO_CLOCK_DIV_INT 2 it
+// runs at a quarter of it: 12MHz in DVFS_IDLE, 50MHz, its limit, in DVFS_BURST.
+// Burst faster only with a larger divisor. The switch holds the cyw43 lock so no
+// transfer is cut in half.
+//
+// The time in each profile is counted. dvfs_power_proxy() is f * V^2 against
+// DVFS_NOMINAL, dynamic power only, leakage and the radio not included;
+// dvfs_bench measures what each profile gets done for it.
+
+#ifndef DVFS_IDLE_KHZ
+#define DVFS_IDLE_KHZ           48000
+#endif
+#ifndef DVFS_IDLE_VREG
+#define DVFS_IDLE_VREG          VREG_VOLTAGE_1_00
+#endif
+#ifndef DVFS_NOMINAL_KHZ
+#define DVFS_NOMINAL_KHZ        125000
+#endif
+#ifndef DVFS_NOMINAL_VREG
+#define DVFS_NOMINAL_VREG       VREG_VOLTAGE_1_10
+#endif
+#ifndef DVFS_BURST_KHZ
+#define DVFS_BURST_KHZ          200000
+#endif
+#ifndef DVFS_BURST_VREG
+#define DVFS_BURST_VREG         VREG_VOLTAGE_1_15
+#endif
+
+#ifndef DVFS_VREG_SETTLE_US
+#define DVFS_VREG_SETTLE_US     1000
+#endif
+
+// UARTs and I2C blocks together
+#ifndef DVFS_MAX_TRACKED
+#define DVFS_MAX_TRACKED        4
+#endif
+
+enum dvfs_profile {
+    DVFS_IDLE = 0,
+    DVFS_NOMINAL,
+    DVFS_BURST,
+    DVFS_PROFILES
+};
+
+struct dvfs_profile_def {
+    const char *name;
+    uint32_t sys_khz;
+    enum vreg_voltage vreg;
+};
+
+extern const struct dvfs_profile_def dvfs_profiles[DVFS_PROFILES];
+
+struct dvfs_stats {
+    uint64_t time_us[DVFS_PROFILES];
+    uint32_t entries[DVFS_PROFILES];
+    uint32_t switch_us_max;     // voltage settling included
+    uint32_t rejected;          // dvfs_set() to a profile the PLL can't make
+};
+
+// Checks every profile's frequency against the PLL, false if one can't be made
+// (dvfs_set() refuses it). Then switches from the boot clock to DVFS_NOMINAL and
+// starts counting there. UARTs and I2C blocks set up before are at a wrong rate
+// afterwards unless tracked, so call it first. After cyw43_arch_init, if it is used
+bool dvfs_init(void);
+
+// Switches to profile, true once there. Not from an interrupt
+bool dvfs_set(enum dvfs_profile profile);
+
+enum dvfs_profile dvfs_current(void);
+
+// baud is set again after every switch. False once DVFS_MAX_TRACKED are tracked
+bool dvfs_track_uart(uart_inst_t *uart, uint baud);
+bool dvfs_track_i2c(i2c_inst_t *i2c, uint baud);
+
+void dvfs_get_stats(struct dvfs_stats *stats, bool reset);
+
+// core voltage in mV
+uint32_t dvfs_vreg_mv(enum vreg_voltage vreg);
+
+// f * V^2 relative to DVFS_NOMINAL, in thousandths
+uint32_t dvfs_power_proxy(enum dvfs_profile profile);
+
+#endif
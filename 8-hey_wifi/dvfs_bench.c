@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "dvfs.h"
+
+// Throughput of each dvfs.h profile against its power proxy, over and over. Two
+// loads, both from RAM: FNV-1a over a buffer (the core, code runs from the XIP cache)
+// and memcpy (the bus). "per proxy" is throughput divided by the proxy, the work a
+// profile gets done for the same dynamic power; leakage and the rest of the board
+// are left out, so it flatters DVFS_IDLE. Measure the supply to see the real gap.
+
+#ifndef BENCH_MS
+#define BENCH_MS            1000
+#endif
+
+#define BENCH_BUF_SIZE      4096
+#define BENCH_PAUSE_MS      2000
+
+static uint8_t src[BENCH_BUF_SIZE], dst[BENCH_BUF_SIZE];
+static volatile uint32_t sink;
+
+// kB/s of fn over the buffer for BENCH_MS
+static uint32_t run_load(void (*fn)(void)) {
+    uint64_t bytes = 0;
+    uint64_t start = time_us_64(), elapsed;
+    do {
+        fn();
+        bytes += BENCH_BUF_SIZE;
+        elapsed = time_us_64() - start;
+    } while (elapsed < BENCH_MS * 1000);
+    return bytes * 1000 / 1024 / (elapsed / 1000);
+}
+
+static void hash_load(void) {
+    uint32_t h = 2166136261u;
+    for (uint i = 0; i < BENCH_BUF_SIZE; i++)
+        h = (h ^ src[i]) * 16777619u;
+    sink = h;
+}
+
+static void copy_load(void) {
+    memcpy(dst, src, BENCH_BUF_SIZE);
+    sink = dst[BENCH_BUF_SIZE - 1];
+}
+
+static void run_profile(enum dvfs_profile profile) {
+    const struct dvfs_profile_def *p = &dvfs_profiles[profile];
+    if (!dvfs_set(profile)) {
+        printf("%-8s %u kHz can't be made from the PLL\n", p->name, p->sys_khz);
+        return;
+    }
+    uint32_t hash_kbs = run_load(hash_load);
+    uint32_t copy_kbs = run_load(copy_load);
+    uint32_t proxy = dvfs_power_proxy(profile);
+    printf("%-8s %3u MHz %4u mV: hash %6u kB/s, copy %6u kB/s, power proxy %4u, per proxy hash %6u copy %6u\n",
+           p->name, clock_get_hz(clk_sys) / 1000000, dvfs_vreg_mv(p->vreg), hash_kbs, copy_kbs, proxy,
+           hash_kbs * 1000 / proxy, copy_kbs * 1000 / proxy);
+}
+
+int main() {
+    // Initializations
+    stdio_init_all();
+    for (uint i = 0; i < BENCH_BUF_SIZE; i++)
+        src[i] = i * 7;
+    if (!dvfs_init())
+        printf("not every profile can be made from the PLL\n");
+
+    // Code here
+    while (true) {
+        sleep_ms(BENCH_PAUSE_MS);
+        for (int profile = 0; profile < DVFS_PROFILES; profile++)
+            run_profile(profile);
+        dvfs_set(DVFS_NOMINAL);
+
+        struct dvfs_stats stats;
+        dvfs_get_stats(&stats, true);
+        printf("switches take up to %u us\n\n", stats.switch_us_max);
+    }
+    return 0;
+}
@@ -3,15 +3,66 @@
 #include "pico/cyw43_arch.h"
 #include "hardware/vreg.h"
 #include "hardware/clocks.h"
+#include "dvfs.h"
+#include "scan_table.h"
 
-static int scan_result(void *env, const cyw43_ev_scan_result_t *result) {
-    if (result && result->rssi > -50) {
-        printf("ssid: %-32s rssi: %4d chan: %3d mac: %02x:%02x:%02x:%02x:%02x:%02x sec: %u\n",
-            result->ssid, result->rssi, result->channel,
-            result->bssid[0], result->bssid[1], result->bssid[2], result->bssid[3], result->bssid[4], result->bssid[5],
-            result->auth_mode);
+// networks weaker than this (average RSSI) aren't listed, the table keeps them anyway
+#ifndef SCAN_PRINT_MIN_RSSI
+#define SCAN_PRINT_MIN_RSSI     -50
+#endif
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static void print_scan_table(void) {
+    static struct scan_entry entries[SCAN_TABLE_MAX_ENTRIES];
+    cyw43_thread_enter();
+    uint32_t n = scan_table_get(entries, count_of(entries));
+    cyw43_thread_exit();
+
+    uint32_t now = now_ms();
+    for (uint32_t i = 0; i < n; i++) {
+        const struct scan_entry *e = &entries[i];
+        if (e->rssi_avg16 / 16 <= SCAN_PRINT_MIN_RSSI)
+            continue;
+        printf("ssid: %-32s rssi: %4d (last %4d) chan: %3d mac: %02x:%02x:%02x:%02x:%02x:%02x sec: %u seen: %u, %us ago\n",
+            e->ssid, e->rssi_avg16 / 16, e->rssi, e->channel,
+            e->bssid[0], e->bssid[1], e->bssid[2], e->bssid[3], e->bssid[4], e->bssid[5],
+            e->auth_mode, e->seen, (now - e->last_seen_ms) / 1000);
     }
-    return 0;
+    printf("%u networks known\n", n);
+}
+
+// radio on time per kind of scan, the known channel ones should be a fraction of a full one
+static void print_scan_stats(void) {
+    struct scan_table_stats stats;
+    cyw43_thread_enter();
+    scan_table_get_stats(&stats, false);
+    cyw43_thread_exit();
+
+    for (int kind = 0; kind < SCAN_KINDS; kind++) {
+        const struct scan_kind_stats *k = &stats.kinds[kind];
+        if (k->scans)
+            printf("%s scans: %u, %u ms each over %u channels\n", scan_kind_names[kind], k->scans,
+                   k->radio_ms / k->scans, k->channels / k->scans);
+    }
+    printf("%u results, %u networks added, %u aged out, %u dropped (table full), longest probe %u\n",
+           stats.results, stats.added, stats.aged, stats.full, stats.probes_max);
+}
+
+// the core waits between scans at DVFS_IDLE, that is where most of the time should be
+static void print_dvfs_stats(void) {
+    struct dvfs_stats stats;
+    dvfs_get_stats(&stats, false);
+
+    uint64_t total_us = 0;
+    for (int p = 0; p < DVFS_PROFILES; p++)
+        total_us += stats.time_us[p];
+    for (int p = 0; p < DVFS_PROFILES; p++)
+        printf("%s: %u MHz, %u%% of the time, %u switches in\n", dvfs_profiles[p].name,
+               dvfs_profiles[p].sys_khz / 1000, (uint32_t)(stats.time_us[p] * 100 / total_us), stats.entries[p]);
+    printf("switches take up to %u us\n", stats.switch_us_max);
 }
 
 int main() {
@@ -22,27 +73,37 @@ int main() {
         return 1;
     }
     cyw43_arch_enable_sta_mode();
+    scan_table_init(now_ms);
+    if (!dvfs_init())
+        printf("not every clock profile can be made from the PLL\n");
     // Code here
     absolute_time_t scan_time = nil_time;
     bool scan_in_progress = false;
     while(true) {
         if (absolute_time_diff_us(get_absolute_time(), scan_time) < 0) {
             if (!scan_in_progress) {
-                cyw43_wifi_scan_options_t scan_options = {0};
-                int err = cyw43_wifi_scan(&cyw43_state, &scan_options, NULL, scan_result);
+                // the scan results come in over the SPI, which runs off the system clock
+                dvfs_set(DVFS_NOMINAL);
+                enum scan_kind kind = scan_table_next_kind();
+                int err = scan_table_start(kind);
                 if (err == 0) {
-                    printf("\nPerforming wifi scan\n");
+                    printf("\nPerforming %s wifi scan\n", scan_kind_names[kind]);
                     scan_in_progress = true;
                     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
                 } else {
                     printf("Failed to start scan: %d\n", err);
                     scan_time = make_timeout_time_ms(10000); // wait 10s and scan again
+                    dvfs_set(DVFS_IDLE);
                 }
-            } else if (!cyw43_wifi_scan_active(&cyw43_state)) {
+            } else if (!scan_table_busy()) {
+                print_scan_table();
+                print_scan_stats();
+                print_dvfs_stats();
                 printf("Will try again in a few seconds..\n");
                 scan_time = make_timeout_time_ms(10000); // wait 10s and scan again
                 scan_in_progress = false;
                 cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
+                dvfs_set(DVFS_IDLE);
             }
         }
         // the following #ifdef is only here so this same example can be used in multiple modes;
@@ -57,8 +118,8 @@ int main() {
 #else
         // if you are not using pico_cyw43_arch_poll, then WiFI driver and lwIP work
         // is done via interrupt in the background. This sleep is just an example of some (blocking)
-        // work you might be doing.
-        sleep_ms(3000);
+        // work you might be doing. It is short during a scan, its end is when the radio time stops
+        sleep_ms(scan_in_progress ? 10 : 3000);
 #endif
         //tight_loop_contents();
     }
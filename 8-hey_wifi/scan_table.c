@@ -0,0 +1,273 @@
+#include <stddef.h>
+#include <string.h>
+#include "scan_table.h"
+
+#define SLOT_MASK       (SCAN_TABLE_SIZE - 1)
+
+_Static_assert((SCAN_TABLE_SIZE & SLOT_MASK) == 0, "SCAN_TABLE_SIZE must be a power of 2");
+
+// legacy chanspec for a 20MHz 2.4GHz channel, what this firmware takes in a channel list
+#define CHANSPEC_2G_20MHZ   0x2b00
+
+const char *const scan_kind_names[SCAN_KINDS] = {
+    [SCAN_FULL] = "full",
+    [SCAN_KNOWN] = "known channels",
+    [SCAN_KNOWN_PASSIVE] = "known channels, passive",
+};
+
+static struct {
+    struct scan_entry slots[SCAN_TABLE_SIZE];
+    uint32_t count;
+    uint32_t (*now_ms)(void);
+
+    uint32_t scans;             // started, for SCAN_TABLE_FULL_EVERY
+    bool scanning;
+    enum scan_kind kind;
+    uint32_t scan_channels;
+    uint32_t scan_start_ms;
+
+    struct scan_table_stats stats;
+} table;
+
+static bool slot_used(const struct scan_entry *e) {
+    return e->seen != 0;
+}
+
+// the vendor half of the BSSID varies most, FNV-1a over all of it anyway
+static uint32_t slot_of(const uint8_t *bssid) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; i++)
+        h = (h ^ bssid[i]) * 16777619u;
+    return h & SLOT_MASK;
+}
+
+// the BSSID's slot, or the free one where it would go. NULL if neither, the table
+// never fills past SCAN_TABLE_MAX_ENTRIES so there is always a free slot to stop at
+static struct scan_entry *find(const uint8_t *bssid) {
+    uint32_t slot = slot_of(bssid);
+    for (uint32_t probes = 1; probes <= SCAN_TABLE_SIZE; probes++) {
+        struct scan_entry *e = &table.slots[slot];
+        if (!slot_used(e) || !memcmp(e->bssid, bssid, 6)) {
+            if (probes > table.stats.probes_max)
+                table.stats.probes_max = probes;
+            return e;
+        }
+        slot = (slot + 1) & SLOT_MASK;
+    }
+    return NULL;
+}
+
+// from the driver, every result of every scan
+static int scan_result(void *env, const cyw43_ev_scan_result_t *result) {
+    if (!result)
+        return 0;
+    table.stats.results++;
+    struct scan_entry *e = find(result->bssid);
+    if (!e)
+        return 0;
+    uint32_t now = table.now_ms();
+    if (!slot_used(e)) {
+        if (table.count >= SCAN_TABLE_MAX_ENTRIES) {
+            table.stats.full++;
+            return 0;
+        }
+        memcpy(e->bssid, result->bssid, 6);
+        e->rssi_avg16 = result->rssi * 16;
+        e->first_seen_ms = now;
+        table.count++;
+        table.stats.added++;
+    }
+    // an access point can change its name or security, the last result wins
+    e->ssid_len = MIN(result->ssid_len, 32);
+    memcpy(e->ssid, result->ssid, e->ssid_len);
+    e->ssid[e->ssid_len] = '\0';
+    e->auth_mode = result->auth_mode;
+    e->channel = result->channel;
+    e->rssi = result->rssi;
+    // a quarter of the way to the new value
+    e->rssi_avg16 += (result->rssi * 16 - e->rssi_avg16) / 4;
+    e->last_seen_ms = now;
+    if (e->seen < UINT16_MAX)
+        e->seen++;
+    return 0;
+}
+
+// Drops what wasn't seen for SCAN_TABLE_MAX_AGE_MS. Removing from the middle of a
+// probe run would cut it short, so the survivors go back in from scratch
+static void age_entries(void) {
+    static struct scan_entry keep[SCAN_TABLE_MAX_ENTRIES];
+    uint32_t now = table.now_ms();
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < SCAN_TABLE_SIZE; i++) {
+        const struct scan_entry *e = &table.slots[i];
+        if (!slot_used(e))
+            continue;
+        if (now - e->last_seen_ms > SCAN_TABLE_MAX_AGE_MS)
+            table.stats.aged++;
+        else
+            keep[n++] = *e;
+    }
+    if (n == table.count)
+        return;
+    memset(table.slots, 0, sizeof(table.slots));
+    for (uint32_t i = 0; i < n; i++)
+        *find(keep[i].bssid) = keep[i];
+    table.count = n;
+}
+
+static uint32_t mask_channels(uint32_t mask) {
+    uint32_t n = 0;
+    for (; mask; mask &= mask - 1)
+        n++;
+    return n;
+}
+
+// An escan with a channel list, set up like cyw43_wifi_scan() sets up its own so the
+// driver passes the results to scan_result() and clears the scan state at the end
+static int start_channel_scan(uint32_t mask, bool passive) {
+    cyw43_wifi_scan_options_t opts;
+    const size_t fixed = offsetof(cyw43_wifi_scan_options_t, channel_list);
+    uint8_t buf[sizeof("escan") + sizeof(opts) + 2 * SCAN_TABLE_CHANNELS];
+
+    memset(&opts, 0, sizeof(opts));
+    opts.version = 1;
+    opts.action = 1;
+    memset(opts.bssid, 0xff, sizeof(opts.bssid));
+    opts.bss_type = 2;
+    opts.scan_type = passive;
+    opts.nprobes = -1;
+    opts.active_time = -1;
+    opts.passive_time = -1;
+    opts.home_time = -1;
+    opts.channel_num = 0;
+
+    // the name, the fixed part, then one little endian chanspec per channel
+    uint8_t *p = buf + sizeof("escan") + fixed;
+    for (uint32_t ch = 1; ch <= SCAN_TABLE_CHANNELS; ch++) {
+        if (!(mask & (1u << ch)))
+            continue;
+        uint16_t chanspec = CHANSPEC_2G_20MHZ | ch;
+        *p++ = chanspec;
+        *p++ = chanspec >> 8;
+        opts.channel_num++;
+    }
+    memcpy(buf, "escan", sizeof("escan"));
+    memcpy(buf + sizeof("escan"), &opts, fixed);
+
+    cyw43_thread_enter();
+    cyw43_state.wifi_scan_state = 1;
+    cyw43_state.wifi_scan_env = NULL;
+    cyw43_state.wifi_scan_cb = scan_result;
+    int err = cyw43_ioctl(&cyw43_state, CYW43_IOCTL_SET_VAR, p - buf, buf, CYW43_ITF_STA);
+    if (err)
+        cyw43_state.wifi_scan_state = 0;
+    cyw43_thread_exit();
+    return err;
+}
+
+static int compare_rssi(const void *a, const void *b) {
+    return ((const struct scan_entry *)b)->rssi_avg16 - ((const struct scan_entry *)a)->rssi_avg16;
+}
+
+/* API */
+
+void scan_table_init(uint32_t (*now_ms)(void)) {
+    memset(&table, 0, sizeof(table));
+    table.now_ms = now_ms;
+}
+
+enum scan_kind scan_table_next_kind(void) {
+    if (!table.count || table.scans % SCAN_TABLE_FULL_EVERY == 0)
+        return SCAN_FULL;
+#ifdef SCAN_TABLE_ACTIVE
+    return SCAN_KNOWN;
+#else
+    return SCAN_KNOWN_PASSIVE;
+#endif
+}
+
+int scan_table_start(enum scan_kind kind) {
+    cyw43_thread_enter();
+    uint32_t mask = scan_table_channel_mask();
+    cyw43_thread_exit();
+    if (!mask)
+        kind = SCAN_FULL;
+
+    int err;
+    if (kind == SCAN_FULL) {
+        cyw43_wifi_scan_options_t opts = {0};
+        err = cyw43_wifi_scan(&cyw43_state, &opts, NULL, scan_result);
+        mask = ((1u << SCAN_TABLE_CHANNELS) - 1) << 1;
+    } else {
+        err = start_channel_scan(mask, kind == SCAN_KNOWN_PASSIVE);
+    }
+    if (err)
+        return err;
+    table.scans++;
+    table.scanning = true;
+    table.kind = kind;
+    table.scan_channels = mask_channels(mask);
+    table.scan_start_ms = table.now_ms();
+    return 0;
+}
+
+bool scan_table_busy(void) {
+    if (!table.scanning)
+        return false;
+    if (cyw43_wifi_scan_active(&cyw43_state))
+        return true;
+    table.scanning = false;
+    struct scan_kind_stats *k = &table.stats.kinds[table.kind];
+    k->scans++;
+    k->channels += table.scan_channels;
+    k->radio_ms += table.now_ms() - table.scan_start_ms;
+    cyw43_thread_enter();
+    age_entries();
+    cyw43_thread_exit();
+    return false;
+}
+
+uint32_t scan_table_channel_mask(void) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < SCAN_TABLE_SIZE; i++) {
+        const struct scan_entry *e = &table.slots[i];
+        if (slot_used(e) && e->channel >= 1 && e->channel <= SCAN_TABLE_CHANNELS)
+            mask |= 1u << e->channel;
+    }
+    return mask;
+}
+
+uint32_t scan_table_count(void) {
+    return table.count;
+}
+
+uint32_t scan_table_get(struct scan_entry *entries, uint32_t max) {
+    // insertion into entries kept sorted, over every used slot, so a cut at max keeps
+    // the strongest and not the first ones in hash order
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < SCAN_TABLE_SIZE && max; i++) {
+        const struct scan_entry *e = &table.slots[i];
+        if (!slot_used(e))
+            continue;
+        uint32_t at;
+        if (n < max)
+            at = n++;
+        else if (compare_rssi(e, &entries[max - 1]) < 0)
+            at = max - 1;       // the weakest one goes
+        else
+            continue;
+        while (at && compare_rssi(e, &entries[at - 1]) < 0) {
+            entries[at] = entries[at - 1];
+            at--;
+        }
+        entries[at] = *e;
+    }
+    return n;
+}
+
+void scan_table_get_stats(struct scan_table_stats *stats, bool reset) {
+    *stats = table.stats;
+    if (reset)
+        memset(&table.stats, 0, sizeof(table.stats));
+}
@@ -0,0 +1,103 @@
+#ifndef _SCAN_TABLE_H
+#define _SCAN_TABLE_H
+
+#include "pico/cyw43_arch.h"
+
+// Wi-Fi scan results kept between scans, one entry per BSSID.
+//
+// The scan callback hashes the BSSID into an open addressing table, so every result,
+// duplicates included, is a constant time update: RSSI goes into a moving average
+// and the last seen time is refreshed. Entries not seen for SCAN_TABLE_MAX_AGE_MS
+// are dropped at the end of each scan.
+//
+// What the table knows drives the next scan. A full active scan, every channel
+// probed, runs when the table is empty or every SCAN_TABLE_FULL_EVERY scans to find
+// new networks. The scans in between only listen (passive, no probe requests sent,
+// or active with SCAN_TABLE_ACTIVE) on the channels the table has entries on, which
+// for a typical site is 3 channels out of 13. cyw43_wifi_scan() always scans every
+// channel, so those go to the firmware as an escan iovar with a channel list; the
+// driver handles the results as for its own scans.
+//
+// The table is updated from the cyw43 driver's context, read it with
+// cyw43_thread_enter() held.
+
+// slots, a power of 2. A quarter stays free to keep the probe runs short
+#ifndef SCAN_TABLE_SIZE
+#define SCAN_TABLE_SIZE         64
+#endif
+#define SCAN_TABLE_MAX_ENTRIES  (SCAN_TABLE_SIZE * 3 / 4)
+
+#ifndef SCAN_TABLE_MAX_AGE_MS
+#define SCAN_TABLE_MAX_AGE_MS   120000
+#endif
+
+// a full scan every this many, the others on known channels only
+#ifndef SCAN_TABLE_FULL_EVERY
+#define SCAN_TABLE_FULL_EVERY   6
+#endif
+
+// 2.4GHz channels 1 .. 14
+#define SCAN_TABLE_CHANNELS     14
+
+enum scan_kind {
+    SCAN_FULL = 0,              // every channel, active
+    SCAN_KNOWN,                 // the table's channels, active
+    SCAN_KNOWN_PASSIVE,         // the table's channels, listening for beacons only
+    SCAN_KINDS
+};
+
+extern const char *const scan_kind_names[SCAN_KINDS];
+
+struct scan_entry {
+    uint8_t bssid[6];
+    uint8_t ssid_len;
+    uint8_t auth_mode;
+    char ssid[33];
+    uint8_t channel;
+    int8_t rssi;                // last seen
+    int16_t rssi_avg16;         // moving average, 16ths of a dB
+    uint16_t seen;              // results, duplicates in a scan included
+    uint32_t first_seen_ms;
+    uint32_t last_seen_ms;
+};
+
+struct scan_kind_stats {
+    uint32_t scans;
+    uint32_t channels;          // scanned, over scans
+    uint32_t radio_ms;          // scan start to done, over scans
+};
+
+struct scan_table_stats {
+    uint32_t results;           // callbacks
+    uint32_t added;
+    uint32_t aged;
+    uint32_t full;              // results dropped, no free entry
+    uint32_t probes_max;        // longest slot run an update walked
+    struct scan_kind_stats kinds[SCAN_KINDS];
+};
+
+// now_ms is the clock for seen times and scan durations
+void scan_table_init(uint32_t (*now_ms)(void));
+
+// What scan_table_start() would run next
+enum scan_kind scan_table_next_kind(void);
+
+// Starts a scan of kind, a known channels scan without known channels becomes a
+// full one. 0 or the cyw43 error
+int scan_table_start(enum scan_kind kind);
+
+// True while a scan runs. Once it is done the scan's time is counted and the
+// entries that weren't seen for too long are dropped
+bool scan_table_busy(void);
+
+// Channels with entries, bit n for channel n
+uint32_t scan_table_channel_mask(void);
+
+uint32_t scan_table_count(void);
+
+// Copies up to max entries, strongest first by average RSSI, returns how many
+uint32_t scan_table_get(struct scan_entry *entries, uint32_t max);
+
+void scan_table_get_stats(struct scan_table_stats *stats, bool reset);
+
+#endif
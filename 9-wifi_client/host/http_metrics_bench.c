@@ -0,0 +1,229 @@
+// Scrapes http_metrics.c with clients in the same lwIP, over its loopback netif,
+// while samples keep updating the responses.
+//
+//   http_metrics_bench [seconds] [clients] [updates_per_s]
+//
+// Each client keeps its connection alive and asks for /metrics and /latest in turn.
+// More clients than HTTP_METRICS_MAX_CONN get 503s and reconnect. Every response is
+// checked for torn values: the three bench metrics are derived from one sequence
+// number and have to agree. Heap and pool use come from net_bench_get_mem() and
+// cover both ends of every connection.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include "http_metrics.h"
+#include "net_bench.h"
+
+#define PORT            8080
+#define MAX_CLIENTS     64
+#define RESPONSE_MAX    4096
+
+static const struct http_metrics_def defs[] = {
+    { "bench_seq", "Update sequence number", true, 0 },
+    { "bench_triple", "Three times bench_seq", false, 3 },
+    { "bench_negative", "Minus bench_seq", false, 2 },
+};
+
+static const char *const requests[2] = {
+    "GET /metrics HTTP/1.1\r\nHost: bench\r\nAccept: */*\r\n\r\n",
+    "GET /latest HTTP/1.1\r\nHost: bench\r\n\r\n",
+};
+
+struct client {
+    struct tcp_pcb *pcb;
+    char response[RESPONSE_MAX + 1];
+    uint32_t len;
+    uint32_t which;
+    uint64_t sent_us;
+};
+
+static struct client clients[MAX_CLIENTS];
+static uint32_t num_clients;
+
+static struct {
+    uint64_t ok;
+    uint64_t rejected;
+    uint64_t torn;
+    uint64_t bad;
+    uint64_t connects;
+    uint64_t latency_total_us;
+    uint32_t latency_max_us;
+} results;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// lwIP's clock with NO_SYS
+u32_t sys_now(void) {
+    return now_us() / 1000;
+}
+
+static bool find_value(const char *body, const char *name, bool json, double *value) {
+    char key[64];
+    snprintf(key, sizeof(key), json ? "\"%s\":" : "\n%s ", name);
+    const char *p = strstr(body, key);
+    if (!p)
+        return false;
+    *value = strtod(p + strlen(key), NULL);
+    return true;
+}
+
+// the three values come from one update or the buffer was rewritten under a send
+static void check_body(const char *body, bool json) {
+    double seq, triple, negative;
+    if (!find_value(body, "bench_seq", json, &seq) || !find_value(body, "bench_triple", json, &triple) ||
+        !find_value(body, "bench_negative", json, &negative)) {
+        results.bad++;
+        return;
+    }
+    if (triple != 3 * seq || negative != -seq)
+        results.torn++;
+    else
+        results.ok++;
+}
+
+static void client_connect(struct client *c);
+
+static void send_request(struct client *c) {
+    const char *req = requests[c->which++ & 1];
+    c->sent_us = now_us();
+    c->len = 0;
+    tcp_write(c->pcb, req, strlen(req), TCP_WRITE_FLAG_COPY);
+    tcp_output(c->pcb);
+}
+
+static void client_close(struct client *c) {
+    tcp_arg(c->pcb, NULL);
+    tcp_recv(c->pcb, NULL);
+    tcp_err(c->pcb, NULL);
+    if (tcp_close(c->pcb) != ERR_OK)
+        tcp_abort(c->pcb);
+    c->pcb = NULL;
+}
+
+// true once a whole response is in and handled
+static bool handle_response(struct client *c) {
+    c->response[c->len] = '\0';
+    char *body = strstr(c->response, "\r\n\r\n");
+    if (!body)
+        return false;
+    body += 4;
+    const char *cl = strstr(c->response, "Content-Length: ");
+    uint32_t body_len = cl ? strtoul(cl + 16, NULL, 10) : 0;
+    if ((uint32_t)(c->len - (body - c->response)) < body_len)
+        return false;
+
+    uint32_t latency_us = now_us() - c->sent_us;
+    results.latency_total_us += latency_us;
+    if (latency_us > results.latency_max_us)
+        results.latency_max_us = latency_us;
+    if (!strncmp(c->response, "HTTP/1.1 503", 12))
+        results.rejected++;
+    else if (!strncmp(c->response, "HTTP/1.1 200", 12))
+        check_body(body - 1, (c->which & 1) == 0);
+    else
+        results.bad++;
+    return true;
+}
+
+static err_t client_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    struct client *c = arg;
+    if (!p) {
+        // rejected, or the server closed an idle connection: start over
+        client_close(c);
+        client_connect(c);
+        return ERR_OK;
+    }
+    uint32_t n = LWIP_MIN(p->tot_len, RESPONSE_MAX - c->len);
+    pbuf_copy_partial(p, c->response + c->len, n, 0);
+    c->len += n;
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    if (handle_response(c)) {
+        bool rejected = !strncmp(c->response, "HTTP/1.1 503", 12);
+        c->len = 0;
+        // the server closes after a 503, wait for it
+        if (!rejected)
+            send_request(c);
+    }
+    return ERR_OK;
+}
+
+static void client_err(void *arg, err_t err) {
+    struct client *c = arg;
+    c->pcb = NULL;
+    client_connect(c);
+}
+
+static err_t client_connected(void *arg, struct tcp_pcb *pcb, err_t err) {
+    results.connects++;
+    send_request(arg);
+    return ERR_OK;
+}
+
+static void client_connect(struct client *c) {
+    c->pcb = tcp_new_ip_type(IPADDR_TYPE_V4);
+    if (!c->pcb)
+        return;
+    tcp_arg(c->pcb, c);
+    tcp_recv(c->pcb, client_recv);
+    tcp_err(c->pcb, client_err);
+    tcp_connect(c->pcb, IP_ADDR_LOOPBACK, PORT, client_connected);
+}
+
+int main(int argc, char **argv) {
+    uint32_t seconds = argc > 1 ? atoi(argv[1]) : 5;
+    num_clients = LWIP_MIN(argc > 2 ? atoi(argv[2]) : HTTP_METRICS_MAX_CONN, MAX_CLIENTS);
+    uint32_t rate = argc > 3 ? atoi(argv[3]) : 1000;
+
+    lwip_init();
+    if (!http_metrics_init(defs, sizeof(defs) / sizeof(defs[0]), PORT)) {
+        fprintf(stderr, "http_metrics_init failed\n");
+        return 1;
+    }
+    struct net_bench_mem mem;
+    net_bench_get_mem(&mem, true);
+
+    for (uint32_t i = 0; i < num_clients; i++)
+        client_connect(&clients[i]);
+
+    int64_t seq = 0;
+    uint64_t start = now_us(), next_update = start;
+    while (now_us() - start < seconds * 1000000ull) {
+        if (rate && now_us() >= next_update) {
+            seq++;
+            int64_t values[] = { seq, seq * 3000, -seq * 100 };
+            http_metrics_update(values);
+            next_update += 1000000 / rate;
+        }
+        netif_poll_all();
+        sys_check_timeouts();
+    }
+    uint64_t elapsed_us = now_us() - start;
+
+    struct http_metrics_stats stats;
+    http_metrics_get_stats(&stats, false);
+    net_bench_get_mem(&mem, false);
+    uint64_t responses = results.ok + results.rejected + results.torn + results.bad;
+    printf("%u clients, %u updates/s for %us: %.0f requests/s, %llu ok, %llu rejected, %llu torn, %llu bad, %llu connects\n",
+           num_clients, rate, seconds, responses * 1e6 / elapsed_us, (unsigned long long)results.ok,
+           (unsigned long long)results.rejected, (unsigned long long)results.torn, (unsigned long long)results.bad,
+           (unsigned long long)results.connects);
+    if (responses)
+        printf("request to response: avg %llu us, max %u us\n",
+               (unsigned long long)(results.latency_total_us / responses), results.latency_max_us);
+    printf("server: %u requests, %u updates, %u deferred, %u connections at most\n",
+           stats.requests, stats.updates, stats.deferred, stats.conns_max);
+    printf("lwIP, both ends: heap and pools %u B peak of %u B, exhausted: heap %u, pbuf %u, tcp seg %u\n",
+           mem.peak_bytes, mem.static_bytes, mem.mem_err, mem.pbuf_err, mem.tcp_seg_err);
+    return results.torn || results.bad ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+// lwip_bench on the host: the same net_bench.c and lwipopts.h profile, on a tap
+// device through lwIP's unix port, against net_bench_peer on the host side of it.
+//
+//   lwip_bench_<profile> [peer] [seconds] [udp_kbps]
+//
+// lwIP takes 192.168.7.2 and tapif.c gives the tap device the gateway address,
+// 192.168.7.1, the default peer. Opening /dev/net/tun needs root, or create the
+// device first and point PRECONFIGURED_TAPIF at it:
+//
+//   sudo ip tuntap add tap0 mode tap user $USER
+//   sudo ip addr add 192.168.7.1/24 dev tap0 && sudo ip link set tap0 up
+//   PRECONFIGURED_TAPIF=tap0 ./lwip_bench_balanced
+//
+// The numbers are lwIP's with the profile's buffers rather than the radio's, which
+// is what tells the profiles apart.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/timeouts.h"
+#include "netif/ethernet.h"
+#include "netif/tapif.h"
+#include "net_bench.h"
+
+#define PAUSE_MS    1000
+
+// lwIP's clock with NO_SYS
+u32_t sys_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// tapif_select() sleeps until a frame comes in or the next lwIP timeout is due,
+// net_bench keeps one pending for as long as it sends
+static void run_until(struct netif *netif, u32_t until_ms, bool (*done)(void)) {
+    while ((done && !done()) || (!done && (s32_t)(sys_now() - until_ms) < 0)) {
+        tapif_select(netif);
+        sys_check_timeouts();
+    }
+}
+
+static struct net_bench_result result;
+
+static bool test_done(void) {
+    return net_bench_done(&result);
+}
+
+int main(int argc, char **argv) {
+    const char *peer_name = argc > 1 ? argv[1] : "192.168.7.1";
+    uint32_t seconds = argc > 2 ? atoi(argv[2]) : 10;
+    uint32_t udp_kbps = argc > 3 ? atoi(argv[3]) : 20000;
+
+    ip_addr_t peer;
+    if (!ipaddr_aton(peer_name, &peer)) {
+        fprintf(stderr, "bad peer address %s\n", peer_name);
+        return 1;
+    }
+
+    lwip_init();
+    struct netif netif;
+    ip4_addr_t ip, mask, gw;
+    IP4_ADDR(&ip, 192, 168, 7, 2);
+    IP4_ADDR(&mask, 255, 255, 255, 0);
+    IP4_ADDR(&gw, 192, 168, 7, 1);
+    if (!netif_add(&netif, &ip, &mask, &gw, NULL, tapif_init, ethernet_input)) {
+        fprintf(stderr, "can't open the tap device\n");
+        return 1;
+    }
+    netif_set_default(&netif);
+    netif_set_up(&netif);
+    netif_set_link_up(&netif);
+
+    printf("lwipopts profile %s, %us tests against %s:%u\n",
+           LWIPOPTS_PROFILE_NAME, seconds, peer_name, NET_BENCH_PORT);
+    for (int mode = 0; mode < NET_BENCH_MODES; mode++) {
+        struct net_bench_mem mem;
+        net_bench_get_mem(&mem, true);
+        if (!net_bench_start(mode, &peer, NET_BENCH_PORT, seconds, udp_kbps)) {
+            printf("%s: can't start\n", net_bench_mode_names[mode]);
+            continue;
+        }
+        run_until(&netif, 0, test_done);
+        net_bench_get_mem(&mem, false);
+        net_bench_print(mode, &result, &mem);
+        // the peer settles, lwIP finishes closing
+        run_until(&netif, sys_now() + PAUSE_MS, NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef _HOST_LWIPOPTS_H
+#define _HOST_LWIPOPTS_H
+
+// The Pico settings, so the host builds see the same profile: TCP_WND, TCP_SND_BUF,
+// pool and queue sizes. Only what a host run needs on top is changed here
+#include "../lwipopts.h"
+
+#ifdef LWIP_HOST_LOOPBACK
+// loopback benches: both ends of each connection live in this heap, with up to
+// TCP_WND in flight, and packets loop back in netif_poll_all()
+#undef MEM_SIZE
+#define MEM_SIZE                    (64 * 1024)
+#define MEMP_NUM_PBUF               64
+#undef MEMP_NUM_TCP_PCB
+#define MEMP_NUM_TCP_PCB            64
+#define LWIP_HAVE_LOOPIF            1
+#define LWIP_NETIF_LOOPBACK         1
+#define LWIP_LOOPBACK_MAX_PBUFS     0
+#endif
+
+// single threaded, no sys_arch protection
+#define SYS_LIGHTWEIGHT_PROT        0
+
+// addresses are static, keep DHCP and DNS out
+#undef LWIP_DHCP
+#define LWIP_DHCP                   0
+#undef LWIP_DNS
+#define LWIP_DNS                    0
+
+#endif
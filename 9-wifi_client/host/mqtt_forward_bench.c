@@ -0,0 +1,272 @@
+// Publishes samples with mqtt_forward.c and lwIP's MQTT client to a broker stand-in
+// in the same lwIP, over its loopback netif, then takes the broker away and brings
+// it back to time the drain of the backlog.
+//
+//   mqtt_forward_bench [seconds] [samples_per_s] [offline_seconds]
+//
+// samples_per_s 0 puts samples as fast as the queue frees up, which shows the
+// throughput batching gets. The stand-in answers CONNECT, PUBLISH at QoS 1 and
+// PINGREQ and nothing else, enough for mqtt_forward.c; it counts samples from the
+// seq and v of each batch, so lost and duplicated ones show. While it is down it
+// resets the connection and refuses new ones, as a broker that went away would look.
+// For a real broker run wifi_client with TELEMETRY_MQTT against mosquitto and
+// watch the same numbers in its stats.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include "mqtt_forward.h"
+
+#define BROKER_PORT     1883
+#define BUF_SIZE        8192
+
+enum { CONNECT = 1, CONNACK, PUBLISH, PUBACK, PINGREQ = 12, PINGRESP, DISCONNECT };
+
+static struct {
+    struct tcp_pcb *pcb;
+    bool down;
+    uint8_t buf[BUF_SIZE];
+    uint32_t len;
+    uint32_t next_seq;
+    uint64_t samples;
+    uint64_t publishes;
+    uint64_t dups;
+    uint64_t lost;
+    uint64_t bad;
+    uint64_t connects;
+    uint64_t refused;
+} broker;
+
+static uint32_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000u + ts.tv_nsec / 1000000;
+}
+
+// lwIP's clock with NO_SYS
+u32_t sys_now(void) {
+    return now_ms();
+}
+
+static void broker_send(const uint8_t *data, uint16_t len) {
+    tcp_write(broker.pcb, data, len, TCP_WRITE_FLAG_COPY);
+}
+
+// {"seq":..,"t":..,"dt":[..],"v":[..]}, the samples are counted from v
+static void broker_batch(const uint8_t *payload, uint32_t len) {
+    char text[BUF_SIZE + 1];
+    memcpy(text, payload, len);
+    text[len] = '\0';
+    const char *seq = strstr(text, "\"seq\":");
+    const char *v = strstr(text, "\"v\":[");
+    if (!seq || !v) {
+        broker.bad++;
+        return;
+    }
+    uint32_t first = strtoul(seq + 6, NULL, 10);
+    uint32_t n = 1;
+    for (const char *p = v + 5; *p && *p != ']'; p++)
+        n += *p == ',';
+
+    broker.publishes++;
+    if (first > broker.next_seq)
+        broker.lost += first - broker.next_seq;
+    // a batch sent again after a reconnect overlaps what came before
+    uint32_t dup = first < broker.next_seq ? LWIP_MIN(broker.next_seq - first, n) : 0;
+    broker.dups += dup;
+    broker.samples += n - dup;
+    broker.next_seq = LWIP_MAX(broker.next_seq, first + n);
+}
+
+static void broker_packet(uint8_t type, uint8_t flags, const uint8_t *body, uint32_t len) {
+    switch (type) {
+    case CONNECT: {
+        static const uint8_t connack[] = { CONNACK << 4, 2, 0, 0 };
+        broker_send(connack, sizeof(connack));
+        broker.connects++;
+        break;
+    }
+    case PUBLISH: {
+        uint8_t qos = (flags >> 1) & 3;
+        uint32_t at = 2 + (body[0] << 8 | body[1]);
+        uint8_t puback[] = { PUBACK << 4, 2, 0, 0 };
+        if (qos) {
+            puback[2] = body[at];
+            puback[3] = body[at + 1];
+            at += 2;
+        }
+        broker_batch(body + at, len - at);
+        if (qos)
+            broker_send(puback, sizeof(puback));
+        break;
+    }
+    case PINGREQ: {
+        static const uint8_t pingresp[] = { PINGRESP << 4, 0 };
+        broker_send(pingresp, sizeof(pingresp));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// whole packets off the front of the buffer, a partial one waits for more
+static void broker_parse(void) {
+    uint32_t at = 0;
+    while (broker.len - at >= 2) {
+        uint32_t remaining = 0, header = 1;
+        uint8_t b;
+        do {
+            if (at + header >= broker.len)
+                goto partial;
+            b = broker.buf[at + header];
+            remaining |= (b & 0x7f) << (7 * (header - 1));
+            header++;
+        } while (b & 0x80);
+        if (broker.len - at < header + remaining)
+            break;
+        broker_packet(broker.buf[at] >> 4, broker.buf[at] & 15, broker.buf + at + header, remaining);
+        at += header + remaining;
+    }
+partial:
+    memmove(broker.buf, broker.buf + at, broker.len - at);
+    broker.len -= at;
+}
+
+static void broker_err(void *arg, err_t err) {
+    broker.pcb = NULL;
+}
+
+static err_t broker_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    if (!p) {
+        tcp_arg(pcb, NULL);
+        tcp_recv(pcb, NULL);
+        tcp_err(pcb, NULL);
+        tcp_close(pcb);
+        broker.pcb = NULL;
+        return ERR_OK;
+    }
+    uint32_t n = LWIP_MIN(p->tot_len, BUF_SIZE - broker.len);
+    pbuf_copy_partial(p, broker.buf + broker.len, n, 0);
+    broker.len += n;
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    broker_parse();
+    tcp_output(pcb);
+    return ERR_OK;
+}
+
+static err_t broker_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (broker.down || broker.pcb) {
+        broker.refused++;
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    broker.pcb = pcb;
+    broker.len = 0;
+    tcp_recv(pcb, broker_recv);
+    tcp_err(pcb, broker_err);
+    return ERR_OK;
+}
+
+static void broker_set_down(bool down) {
+    broker.down = down;
+    if (down && broker.pcb) {
+        struct tcp_pcb *pcb = broker.pcb;
+        broker.pcb = NULL;
+        tcp_abort(pcb);
+    }
+}
+
+static void print_stats(const char *phase, uint32_t elapsed_ms) {
+    struct mqtt_forward_stats stats;
+    mqtt_forward_get_stats(&stats, true);
+    printf("%s: %u samples in %u publishes over %u ms (%.0f samples/s, %.0f publishes/s, %.0f kB/s), "
+           "%u dropped, %u resent, %u stalls",
+           phase, stats.samples, stats.publishes, elapsed_ms, stats.samples * 1e3 / elapsed_ms,
+           stats.publishes * 1e3 / elapsed_ms, stats.payload_bytes / 1.024 / elapsed_ms,
+           stats.dropped, stats.resent, stats.stalls);
+    if (stats.samples)
+        printf(", put to ack avg %llu ms max %u ms",
+               (unsigned long long)(stats.latency_total_ms / stats.samples), stats.latency_max_ms);
+    printf("\n");
+}
+
+// runs for ms, putting samples at rate or as fast as the queue frees up, until
+// until_drained finds the backlog taken
+static void run(uint32_t ms, uint32_t rate, bool until_drained) {
+    uint32_t start = now_ms();
+    uint64_t put = 0;
+    while (now_ms() - start < ms) {
+        if (rate) {
+            uint64_t due = (uint64_t)(now_ms() - start) * rate / 1000;
+            for (; put < due; put++)
+                mqtt_forward_put(put);
+        } else {
+            while (mqtt_forward_backlog() < MQTT_FORWARD_QUEUE_SAMPLES - MQTT_FORWARD_BATCH_SAMPLES)
+                mqtt_forward_put(put++);
+        }
+        mqtt_forward_poll();
+        netif_poll_all();
+        sys_check_timeouts();
+        if (until_drained) {
+            struct mqtt_forward_stats stats;
+            mqtt_forward_get_stats(&stats, false);
+            if (stats.drain_ms)
+                return;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t seconds = argc > 1 ? atoi(argv[1]) : 5;
+    uint32_t rate = argc > 2 ? atoi(argv[2]) : 0;
+    uint32_t offline = argc > 3 ? atoi(argv[3]) : 5;
+
+    lwip_init();
+    struct tcp_pcb *listen = tcp_new_ip_type(IPADDR_TYPE_V4);
+    tcp_bind(listen, IP_ADDR_LOOPBACK, BROKER_PORT);
+    listen = tcp_listen(listen);
+    tcp_accept(listen, broker_accept);
+
+    mqtt_forward_init(IP_ADDR_LOOPBACK, BROKER_PORT, "bench", "bench/samples", now_ms);
+    run(1000, 0, false);
+    if (!mqtt_forward_connected()) {
+        fprintf(stderr, "no connection to the broker stand-in\n");
+        return 1;
+    }
+    mqtt_forward_get_stats(&(struct mqtt_forward_stats){0}, true);
+
+    // steady state
+    uint32_t start = now_ms();
+    run(seconds * 1000, rate, false);
+    print_stats("connected", now_ms() - start);
+
+    // the broker goes away with batches in flight, the queue fills
+    broker_set_down(true);
+    start = now_ms();
+    run(offline * 1000, rate ? rate : 1000, false);
+    uint32_t backlog = mqtt_forward_backlog();
+    print_stats("offline", now_ms() - start);
+
+    // back: the reconnect comes within MQTT_FORWARD_RECONNECT_MS, then the backlog drains
+    broker_set_down(false);
+    start = now_ms();
+    run(60000, rate ? rate : 1000, true);
+    struct mqtt_forward_stats stats;
+    mqtt_forward_get_stats(&stats, false);
+    print_stats("reconnect", now_ms() - start);
+    printf("backlog %u samples when the broker came back, %u at the reconnect, drained in %u ms (%.0f samples/s)\n",
+           backlog, stats.drain_samples, stats.drain_ms, stats.drain_ms ? stats.drain_samples * 1e3 / stats.drain_ms : 0.0);
+
+    printf("broker: %llu samples in %llu publishes, %llu lost, %llu duplicated, %llu bad, %llu connects, %llu refused\n",
+           (unsigned long long)broker.samples, (unsigned long long)broker.publishes, (unsigned long long)broker.lost,
+           (unsigned long long)broker.dups, (unsigned long long)broker.bad, (unsigned long long)broker.connects,
+           (unsigned long long)broker.refused);
+    return broker.bad || !stats.drain_ms ? 1 : 0;
+}
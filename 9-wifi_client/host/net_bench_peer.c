@@ -0,0 +1,168 @@
+// The other end of net_bench, with plain sockets: runs on the host the Pico (or
+// lwip_bench_<profile> on a tap device) points at, one test at a time.
+//
+//   net_bench_peer [port]
+//
+// Prints its own view of every test. For UDP_TX that is the one that counts, only
+// the receiver sees what was lost.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "net_bench_wire.h"
+
+#define UDP_IDLE_MS         3000
+// UDP_RX asked for "as fast as possible", wifi won't take more
+#define UDP_MAX_KBPS        100000
+
+static uint8_t buf[64 * 1024] __attribute__((aligned(4)));
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void report(const char *mode, const char *from, uint64_t bytes, uint64_t elapsed_us) {
+    double mbps = elapsed_us ? bytes * 8.0 / elapsed_us : 0;
+    printf("%s from %s: %.2f Mbit/s, %llu bytes in %llu ms\n",
+           mode, from, mbps, (unsigned long long)bytes, (unsigned long long)(elapsed_us / 1000));
+}
+
+static void tcp_test(int fd, const char *from) {
+    struct net_bench_hello hello;
+    if (recv(fd, &hello, sizeof(hello), MSG_WAITALL) != sizeof(hello) || hello.magic != NET_BENCH_HELLO) {
+        printf("tcp from %s: no hello\n", from);
+        return;
+    }
+    uint64_t bytes = 0, start = now_us();
+    if (hello.mode == NET_BENCH_TCP_TX) {
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+            bytes += n;
+    } else if (hello.mode == NET_BENCH_TCP_RX) {
+        uint64_t end = start + hello.seconds * 1000000ull;
+        while (now_us() < end) {
+            ssize_t n = send(fd, buf, sizeof(buf), MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            bytes += n;
+        }
+    } else {
+        printf("tcp from %s: mode %u is not a TCP test\n", from, hello.mode);
+        return;
+    }
+    report(hello.mode == NET_BENCH_TCP_TX ? "tcp_tx" : "tcp_rx", from, bytes, now_us() - start);
+}
+
+static void udp_drain(int fd) {
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+// the device sends, count it and the gaps
+static void udp_receive(int fd, const struct sockaddr_in *device, const char *from) {
+    uint64_t bytes = 0, start = now_us(), last = start;
+    uint32_t next_seq = 0, datagrams = 0, lost = 0;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (poll(&pfd, 1, UDP_IDLE_MS) > 0) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addr_len);
+        const struct net_bench_dgram *d = (const void *)buf;
+        if (n < (ssize_t)sizeof(*d) || addr.sin_addr.s_addr != device->sin_addr.s_addr || d->magic != NET_BENCH_MAGIC)
+            continue;
+        if (d->flags & NET_BENCH_UDP_END)
+            break;
+        if ((int32_t)(d->seq - next_seq) < 0)
+            continue;
+        lost += d->seq - next_seq;
+        next_seq = d->seq + 1;
+        datagrams++;
+        bytes += n;
+        last = now_us();
+    }
+    report("udp_tx", from, bytes, last - start);
+    printf("udp_tx from %s: %u datagrams, %u lost (%.1f%%)\n", from, datagrams, lost,
+           datagrams + lost ? 100.0 * lost / (datagrams + lost) : 0);
+    udp_drain(fd);
+}
+
+// the device receives, pace datagrams at the rate it asked for
+static void udp_send(int fd, const struct sockaddr_in *device, const struct net_bench_hello *hello, const char *from) {
+    uint32_t kbps = hello->rate_kbps ? hello->rate_kbps : UDP_MAX_KBPS;
+    uint64_t interval_us = NET_BENCH_UDP_LEN * 8000ull / kbps;
+    uint64_t start = now_us(), end = start + hello->seconds * 1000000ull, next = start;
+    uint64_t bytes = 0;
+    struct net_bench_dgram *d = (void *)buf;
+    d->magic = NET_BENCH_MAGIC;
+    d->seq = 0;
+    d->flags = 0;
+    while (next < end) {
+        while (now_us() < next)
+            ;
+        if (sendto(fd, buf, NET_BENCH_UDP_LEN, 0, (const struct sockaddr *)device, sizeof(*device)) > 0)
+            bytes += NET_BENCH_UDP_LEN;
+        d->seq++;
+        next += interval_us;
+    }
+    d->flags = NET_BENCH_UDP_END;
+    for (int i = 0; i < 3; i++)
+        sendto(fd, buf, sizeof(*d), 0, (const struct sockaddr *)device, sizeof(*device));
+    report("udp_rx", from, bytes, now_us() - start);
+    // the device repeats its hello until data arrives, don't start over on those
+    udp_drain(fd);
+}
+
+int main(int argc, char **argv) {
+    uint16_t port = argc > 1 ? atoi(argv[1]) : NET_BENCH_PORT;
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+    int one = 1;
+
+    int tcp = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(tcp, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bind(tcp, (struct sockaddr *)&addr, sizeof(addr)) || listen(tcp, 1) ||
+        bind(udp, (struct sockaddr *)&addr, sizeof(addr))) {
+        perror("net_bench_peer");
+        return 1;
+    }
+    memset(buf, 0xa5, sizeof(buf));
+    printf("net_bench_peer on port %u\n", port);
+
+    while (true) {
+        struct pollfd fds[2] = { { tcp, POLLIN, 0 }, { udp, POLLIN, 0 } };
+        if (poll(fds, 2, -1) <= 0)
+            continue;
+        struct sockaddr_in device;
+        socklen_t device_len = sizeof(device);
+        char from[INET_ADDRSTRLEN];
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(tcp, (struct sockaddr *)&device, &device_len);
+            if (fd < 0)
+                continue;
+            inet_ntop(AF_INET, &device.sin_addr, from, sizeof(from));
+            tcp_test(fd, from);
+            close(fd);
+        }
+        if (fds[1].revents & POLLIN) {
+            struct net_bench_hello hello;
+            ssize_t n = recvfrom(udp, &hello, sizeof(hello), 0, (struct sockaddr *)&device, &device_len);
+            if (n != sizeof(hello) || hello.magic != NET_BENCH_HELLO)
+                continue;
+            inet_ntop(AF_INET, &device.sin_addr, from, sizeof(from));
+            if (hello.mode == NET_BENCH_UDP_TX)
+                udp_receive(udp, &device, from);
+            else if (hello.mode == NET_BENCH_UDP_RX)
+                udp_send(udp, &device, &hello, from);
+        }
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,201 @@
+// Streams records with tcp_stream.c to a sink in the same lwIP, over its loopback
+// netif, and measures what arrives.
+//
+//   tcp_stream_bench [seconds] [records_per_s]
+//
+// records_per_s 0 (the default) puts records as fast as the ring frees up, which
+// shows the throughput the batching and send buffer allow. A rate shows the latency
+// at that load: put to received at the sink, and put to acked as the sender sees it.
+// Everything runs on one thread, so the numbers are lwIP's cost on this host rather
+// than a network's.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include "tcp_stream.h"
+
+#define SINK_PORT       4242
+#define LATENCY_BINS    32
+
+static struct {
+    uint8_t partial[sizeof(struct tcp_stream_record)];
+    uint32_t partial_len;
+    uint32_t next_seq;
+    uint64_t records;
+    uint64_t lost;
+    uint64_t dups;
+    uint64_t bad;
+    uint64_t latency_total_us;
+    uint32_t latency_max_us;
+    uint64_t latency_bins[LATENCY_BINS];    // log2 of the latency in us
+} sink;
+
+static uint32_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+// lwIP's clock with NO_SYS
+u32_t sys_now(void) {
+    return now_us() / 1000;
+}
+
+static void sink_record(const struct tcp_stream_record *r, uint32_t now) {
+    if (r->check != (r->seq ^ r->timestamp_us ^ (uint32_t)r->value ^ TCP_STREAM_CHECK)) {
+        sink.bad++;
+        return;
+    }
+    // records already seen come again after a reconnect
+    if ((int32_t)(r->seq - sink.next_seq) < 0) {
+        sink.dups++;
+        return;
+    }
+    sink.lost += r->seq - sink.next_seq;
+    sink.next_seq = r->seq + 1;
+    sink.records++;
+
+    uint32_t latency_us = now - r->timestamp_us;
+    sink.latency_total_us += latency_us;
+    if (latency_us > sink.latency_max_us)
+        sink.latency_max_us = latency_us;
+    unsigned bin = 0;
+    while (bin < LATENCY_BINS - 1 && latency_us >> (bin + 1))
+        bin++;
+    sink.latency_bins[bin]++;
+}
+
+static err_t sink_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    if (!p) {
+        tcp_close(pcb);
+        return ERR_OK;
+    }
+    uint32_t now = now_us();
+    // records don't line up with segments, put them back together
+    for (struct pbuf *q = p; q; q = q->next) {
+        const uint8_t *data = q->payload;
+        for (uint32_t i = 0; i < q->len;) {
+            uint32_t n = sizeof(sink.partial) - sink.partial_len;
+            if (n > q->len - i)
+                n = q->len - i;
+            memcpy(sink.partial + sink.partial_len, data + i, n);
+            sink.partial_len += n;
+            i += n;
+            if (sink.partial_len == sizeof(sink.partial)) {
+                struct tcp_stream_record r;
+                memcpy(&r, sink.partial, sizeof(r));
+                sink_record(&r, now);
+                sink.partial_len = 0;
+            }
+        }
+    }
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t sink_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK || !pcb)
+        return ERR_VAL;
+    sink.partial_len = 0;
+    tcp_recv(pcb, sink_recv);
+    return ERR_OK;
+}
+
+static void sink_init(void) {
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_V4);
+    if (!pcb || tcp_bind(pcb, IP_ADDR_ANY, SINK_PORT) != ERR_OK) {
+        fprintf(stderr, "sink: can't bind port %d\n", SINK_PORT);
+        exit(1);
+    }
+    pcb = tcp_listen(pcb);
+    tcp_accept(pcb, sink_accept);
+}
+
+static uint32_t latency_percentile(uint32_t percent) {
+    uint64_t want = (sink.records * percent + 99) / 100, seen = 0;
+    for (unsigned bin = 0; bin < LATENCY_BINS; bin++) {
+        seen += sink.latency_bins[bin];
+        if (seen >= want && seen)
+            return 2u << bin;
+    }
+    return 0;
+}
+
+static void run(uint32_t run_us, uint32_t step_us, bool drain) {
+    uint32_t start = now_us();
+    uint32_t next_put = start;
+    while (now_us() - start < run_us) {
+        if (drain) {
+            // until everything put has been acked
+            if (tcp_stream_free() == TCP_STREAM_RING_RECORDS)
+                break;
+        } else if (step_us) {
+            // on a schedule, like the Pico's sample timer
+            while ((int32_t)(now_us() - next_put) >= 0) {
+                tcp_stream_put(0);
+                next_put += step_us;
+            }
+        } else {
+            // as fast as the ring frees up, never dropping
+            for (uint32_t n = tcp_stream_free(); n; n--)
+                tcp_stream_put(0);
+        }
+        tcp_stream_poll();
+        netif_poll_all();
+        sys_check_timeouts();
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t seconds = argc > 1 ? atoi(argv[1]) : 5;
+    uint32_t rate = argc > 2 ? atoi(argv[2]) : 0;
+
+    lwip_init();
+    sink_init();
+    ip_addr_t server;
+    ip_addr_copy(server, *IP_ADDR_LOOPBACK);
+    tcp_stream_init(&server, SINK_PORT, now_us);
+
+    // connect first so the numbers don't include the handshake
+    uint32_t start = now_us();
+    while (!tcp_stream_connected() && now_us() - start < 1000000) {
+        tcp_stream_poll();
+        netif_poll_all();
+        sys_check_timeouts();
+    }
+    if (!tcp_stream_connected()) {
+        fprintf(stderr, "can't connect to the sink\n");
+        return 1;
+    }
+
+    struct tcp_stream_stats stats, drained;
+    start = now_us();
+    run(seconds * 1000000, rate ? 1000000 / rate : 0, false);
+    uint32_t elapsed_us = now_us() - start;
+    tcp_stream_get_stats(&stats, true);
+    run(1000000, 0, true);
+    tcp_stream_get_stats(&drained, true);
+
+    printf("%u s at %s: %llu records (%.0f/s, %.2f MB/s), %llu lost, %llu dups, %llu bad\n",
+           seconds, rate ? argv[2] : "full speed", (unsigned long long)sink.records,
+           sink.records * 1e6 / elapsed_us,
+           sink.records * sizeof(struct tcp_stream_record) / (double)elapsed_us,
+           (unsigned long long)sink.lost, (unsigned long long)sink.dups, (unsigned long long)sink.bad);
+    printf("sender: %u acked (+%u after the run), %u dropped, %u resent, %u writes, %u sndbuf stalls, %u records/write\n",
+           stats.records, drained.records, stats.dropped, stats.resent, stats.writes, stats.sndbuf_stalls,
+           stats.writes ? stats.records / stats.writes : 0);
+    if (sink.records)
+        printf("put to received: avg %llu us, p50 < %u us, p99 < %u us, max %u us\n",
+               (unsigned long long)(sink.latency_total_us / sink.records),
+               latency_percentile(50), latency_percentile(99), sink.latency_max_us);
+    if (stats.records)
+        printf("put to acked: avg %llu us, max %u us\n",
+               (unsigned long long)(stats.latency_total_us / stats.records), stats.latency_max_us);
+    return sink.bad || sink.lost ? 1 : 0;
+}
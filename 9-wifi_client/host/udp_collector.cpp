@@ -0,0 +1,350 @@
+// Host side collector for udp_telemetry.c (see ../udp_telemetry.h).
+//
+//   udp_collector [port]
+//       answer discovery queries and beacon on the group, take datagrams from every
+//       node on one socket and report rate, loss and latency per node every 5 seconds
+//   udp_collector --loopback [nodes] [hz] [seconds] [loss_permille]
+//       no devices: stand-in nodes batch samples the way udp_telemetry.c does, find
+//       a collector running on this host with a unicast query, and send to it with
+//       random drops. Its report should show the same loss
+//
+// Latency has two parts. Batching, first sample to sent, is exact: both times are
+// on the node's clock. The network part can only be measured against the node's
+// clock offset, which isn't known, so it is reported as the excess over the
+// fastest datagram of the interval: queueing and retries, not the base path delay.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "../udp_telemetry.h"
+}
+
+static constexpr uint32_t REPORT_MS = 5000;
+static constexpr size_t MAX_NODES_SHOWN = 32;
+// a sequence number this far back is a reboot, not reordering
+static constexpr int32_t RESTART_GAP = 1024;
+
+static uint64_t now_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static int udp_socket(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // bursts from many nodes at once
+    int rcvbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+        std::perror("udp_collector");
+        std::exit(1);
+    }
+    return fd;
+}
+
+class Collector {
+public:
+    explicit Collector(uint16_t port) : port_(port) {
+        data_fd_ = udp_socket(port);
+        discovery_fd_ = udp_socket(UDP_TELEMETRY_DISCOVERY_PORT);
+        ip_mreq mreq{};
+        inet_pton(AF_INET, UDP_TELEMETRY_GROUP, &mreq.imr_multiaddr);
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(discovery_fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)))
+            std::perror("udp_collector: no multicast, nodes have to be told where it is");
+        group_.sin_family = AF_INET;
+        group_.sin_port = htons(UDP_TELEMETRY_DISCOVERY_PORT);
+        group_.sin_addr = mreq.imr_multiaddr;
+    }
+
+    void run() {
+        std::printf("collecting on port %u, discovery on %s:%u\n", port_, UDP_TELEMETRY_GROUP,
+                    UDP_TELEMETRY_DISCOVERY_PORT);
+        uint64_t next_beacon = 0, last_report = now_us();
+        while (true) {
+            uint64_t now = now_us();
+            if (now >= next_beacon) {
+                send_beacon(group_);
+                next_beacon = now + UDP_TELEMETRY_BEACON_MS * 1000ull;
+            }
+            if (now - last_report >= REPORT_MS * 1000ull) {
+                report(now - last_report, now);
+                last_report = now;
+            }
+            pollfd fds[2] = { { data_fd_, POLLIN, 0 }, { discovery_fd_, POLLIN, 0 } };
+            if (poll(fds, 2, 100) <= 0)
+                continue;
+            if (fds[0].revents & POLLIN)
+                receive_data();
+            if (fds[1].revents & POLLIN)
+                receive_discovery();
+        }
+    }
+
+private:
+    struct Node {
+        sockaddr_in addr{};
+        bool synced = false;
+        uint32_t next_seq = 0;
+        uint64_t last_seen_us = 0;
+        // this interval
+        uint64_t datagrams = 0, samples = 0, lost = 0, late = 0, restarts = 0;
+        uint64_t batch_total_us = 0;
+        uint32_t batch_max_us = 0;
+        uint32_t delay_ref = 0;             // arrival minus sent, mod 2^32, of the first datagram
+        int64_t delay_total = 0, delay_min = 0, delay_max = 0;
+        // since the start
+        uint64_t all_datagrams = 0, all_lost = 0;
+    };
+
+    static constexpr int BATCH = 64;
+
+    // recvmmsg takes a burst in one call, which is what keeps up with thousands a second
+    void receive_data() {
+        static uint8_t bufs[BATCH][UDP_TELEMETRY_MAX_PAYLOAD + 1];
+        sockaddr_in addrs[BATCH];
+        iovec iov[BATCH];
+        mmsghdr msgs[BATCH];
+        for (int i = 0; i < BATCH; i++) {
+            iov[i] = { bufs[i], sizeof(bufs[i]) };
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+        int n = recvmmsg(data_fd_, msgs, BATCH, MSG_DONTWAIT, nullptr);
+        uint64_t now = now_us();
+        for (int i = 0; i < n; i++)
+            handle_datagram(bufs[i], msgs[i].msg_len, addrs[i], now);
+    }
+
+    void handle_datagram(const uint8_t *data, size_t len, const sockaddr_in &from, uint64_t now) {
+        udp_telemetry_header h;
+        if (len < sizeof(h)) {
+            malformed_++;
+            return;
+        }
+        std::memcpy(&h, data, sizeof(h));
+        if (h.magic != UDP_TELEMETRY_MAGIC || h.count > UDP_TELEMETRY_MAX_SAMPLES ||
+            len != sizeof(h) + h.count * sizeof(udp_telemetry_sample)) {
+            malformed_++;
+            return;
+        }
+        Node &node = nodes_[h.node_id];
+        node.addr = from;
+        node.last_seen_us = now;
+
+        int32_t gap = int32_t(h.seq - node.next_seq);
+        if (!node.synced || gap < -RESTART_GAP) {
+            node.restarts += node.synced;
+            node.synced = true;
+            node.next_seq = h.seq + 1;
+        } else if (gap < 0) {
+            // counted as lost when the ones after it came
+            node.late++;
+            if (node.lost)
+                node.lost--;
+            if (node.all_lost)
+                node.all_lost--;
+        } else {
+            node.lost += gap;
+            node.all_lost += gap;
+            node.next_seq = h.seq + 1;
+        }
+
+        node.datagrams++;
+        node.samples += h.count;
+        node.all_datagrams++;
+        uint32_t batch_us = h.sent_us - h.base_us;
+        node.batch_total_us += batch_us;
+        node.batch_max_us = std::max(node.batch_max_us, batch_us);
+
+        uint32_t delay = uint32_t(now) - h.sent_us;
+        if (node.datagrams == 1)
+            node.delay_ref = delay;
+        int64_t rel = int32_t(delay - node.delay_ref);
+        node.delay_total += rel;
+        node.delay_min = node.datagrams == 1 ? rel : std::min(node.delay_min, rel);
+        node.delay_max = node.datagrams == 1 ? rel : std::max(node.delay_max, rel);
+    }
+
+    void receive_discovery() {
+        udp_telemetry_discovery d;
+        sockaddr_in from{};
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(discovery_fd_, &d, sizeof(d), MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&from), &from_len);
+        if (n == sizeof(d) && d.magic == UDP_TELEMETRY_DISCOVERY_MAGIC && d.type == UDP_TELEMETRY_QUERY) {
+            queries_++;
+            send_beacon(from);
+        }
+    }
+
+    void send_beacon(const sockaddr_in &to) {
+        udp_telemetry_discovery d{ UDP_TELEMETRY_DISCOVERY_MAGIC, UDP_TELEMETRY_BEACON, port_, 0 };
+        sendto(discovery_fd_, &d, sizeof(d), 0, reinterpret_cast<const sockaddr *>(&to), sizeof(to));
+    }
+
+    void report(uint64_t interval_us, uint64_t now) {
+        double seconds = interval_us / 1e6;
+        uint64_t datagrams = 0, samples = 0, lost = 0;
+        size_t silent = 0;
+        std::vector<std::pair<uint32_t, Node *>> active;
+        for (auto &[id, node] : nodes_) {
+            datagrams += node.datagrams;
+            samples += node.samples;
+            lost += node.lost;
+            if (node.datagrams)
+                active.emplace_back(id, &node);
+            else if (now - node.last_seen_us > 3 * REPORT_MS * 1000ull)
+                silent++;
+        }
+        std::printf("\n%zu nodes (%zu silent), %.0f datagrams/s, %.0f samples/s, %llu lost (%.2f%%), %llu malformed, %llu queries\n",
+                    nodes_.size(), silent, datagrams / seconds, samples / seconds, (unsigned long long)lost,
+                    datagrams + lost ? 100.0 * lost / (datagrams + lost) : 0.0,
+                    (unsigned long long)malformed_, (unsigned long long)queries_);
+
+        // the worst first, there may be too many to show
+        std::sort(active.begin(), active.end(), [](const auto &a, const auto &b) {
+            return a.second->lost != b.second->lost ? a.second->lost > b.second->lost : a.first < b.first;
+        });
+        if (!active.empty())
+            std::printf("  node     address          samples/s  dgrams/s  lost      late restarts  batch avg/max ms  net +avg/+max ms  lost/dgrams total\n");
+        for (size_t i = 0; i < active.size() && i < MAX_NODES_SHOWN; i++) {
+            const Node &node = *active[i].second;
+            char addr[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &node.addr.sin_addr, addr, sizeof(addr));
+            double excess_avg = double(node.delay_total) / node.datagrams - node.delay_min;
+            std::printf("  %08x %-15s %10.1f %9.1f %5llu %5.2f%% %4llu %8llu %8.1f/%-7.1f %8.1f/%-7.1f %6llu/%llu\n",
+                        active[i].first, addr, node.samples / seconds, node.datagrams / seconds,
+                        (unsigned long long)node.lost, 100.0 * node.lost / (node.datagrams + node.lost),
+                        (unsigned long long)node.late, (unsigned long long)node.restarts,
+                        node.batch_total_us / 1000.0 / node.datagrams, node.batch_max_us / 1000.0,
+                        excess_avg / 1000.0, (node.delay_max - node.delay_min) / 1000.0,
+                        (unsigned long long)node.all_lost, (unsigned long long)node.all_datagrams);
+        }
+        if (active.size() > MAX_NODES_SHOWN)
+            std::printf("  .. %zu more without loss\n", active.size() - MAX_NODES_SHOWN);
+        std::fflush(stdout);
+
+        for (auto &[id, node] : nodes_) {
+            node.datagrams = node.samples = node.lost = node.late = node.restarts = 0;
+            node.batch_total_us = node.batch_max_us = 0;
+            node.delay_total = 0;
+        }
+    }
+
+    uint16_t port_;
+    int data_fd_;
+    int discovery_fd_;
+    sockaddr_in group_{};
+    std::unordered_map<uint32_t, Node> nodes_;
+    uint64_t malformed_ = 0;
+    uint64_t queries_ = 0;
+};
+
+// Stand-in nodes, batching like udp_telemetry.c: a datagram when the batch is full
+// or its oldest sample is UDP_TELEMETRY_MAX_DELAY_MS old
+static int loopback(uint32_t nodes, uint32_t hz, uint32_t seconds, uint32_t loss_permille) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in collector{};
+    collector.sin_family = AF_INET;
+    collector.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // discovery without the group: ask the collector's port directly
+    collector.sin_port = htons(UDP_TELEMETRY_DISCOVERY_PORT);
+    udp_telemetry_discovery query{ UDP_TELEMETRY_DISCOVERY_MAGIC, UDP_TELEMETRY_QUERY, 0, 0 };
+    sendto(fd, &query, sizeof(query), 0, reinterpret_cast<sockaddr *>(&collector), sizeof(collector));
+    pollfd pfd{ fd, POLLIN, 0 };
+    udp_telemetry_discovery beacon{};
+    if (poll(&pfd, 1, 1000) <= 0 || recv(fd, &beacon, sizeof(beacon), 0) != sizeof(beacon) ||
+        beacon.type != UDP_TELEMETRY_BEACON) {
+        std::fprintf(stderr, "no collector answered on 127.0.0.1:%u, start one first\n", UDP_TELEMETRY_DISCOVERY_PORT);
+        return 1;
+    }
+    collector.sin_port = htons(beacon.port);
+
+    struct SimNode {
+        uint32_t clock_offset;
+        uint32_t seq = 0;
+        uint64_t produced = 0;
+        std::vector<uint8_t> batch;
+        uint16_t count = 0;
+        uint32_t base_us = 0;
+    };
+    std::mt19937 rng(1);
+    std::vector<SimNode> sim(nodes);
+    for (auto &n : sim) {
+        n.clock_offset = rng();
+        n.batch.resize(UDP_TELEMETRY_MAX_PAYLOAD);
+    }
+
+    uint64_t start = now_us(), end = start + seconds * 1000000ull;
+    uint64_t sent = 0, dropped = 0;
+    auto flush = [&](uint32_t id, SimNode &n, uint32_t clock) {
+        udp_telemetry_header h{ UDP_TELEMETRY_MAGIC, id, n.seq++, clock, n.base_us, n.count, 0 };
+        std::memcpy(n.batch.data(), &h, sizeof(h));
+        size_t len = sizeof(h) + n.count * sizeof(udp_telemetry_sample);
+        if (rng() % 1000 < loss_permille)
+            dropped++;
+        else if (sendto(fd, n.batch.data(), len, 0, reinterpret_cast<sockaddr *>(&collector), sizeof(collector)) > 0)
+            sent++;
+        n.count = 0;
+    };
+    while (true) {
+        uint64_t now = now_us();
+        if (now >= end)
+            break;
+        for (uint32_t i = 0; i < nodes; i++) {
+            SimNode &n = sim[i];
+            uint32_t clock = uint32_t(now) + n.clock_offset;
+            uint64_t due = (now - start) * hz / 1000000;
+            for (; n.produced < due; n.produced++) {
+                if (!n.count)
+                    n.base_us = clock;
+                udp_telemetry_sample s{ clock - n.base_us, int32_t(n.produced) };
+                std::memcpy(&n.batch[sizeof(udp_telemetry_header) + n.count++ * sizeof(s)], &s, sizeof(s));
+                if (n.count == UDP_TELEMETRY_MAX_SAMPLES)
+                    flush(0x51000000 + i, n, clock);
+            }
+            if (n.count && clock - n.base_us >= UDP_TELEMETRY_MAX_DELAY_MS * 1000)
+                flush(0x51000000 + i, n, clock);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::printf("%u nodes at %u Hz for %us: %llu datagrams sent (%.0f/s), %llu dropped on purpose (%.2f%%)\n",
+                nodes, hz, seconds, (unsigned long long)sent, sent / double(seconds), (unsigned long long)dropped,
+                sent + dropped ? 100.0 * dropped / (sent + dropped) : 0.0);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !std::strcmp(argv[1], "--loopback")) {
+        uint32_t nodes = argc > 2 ? std::atoi(argv[2]) : 50;
+        uint32_t hz = argc > 3 ? std::atoi(argv[3]) : 1000;
+        uint32_t seconds = argc > 4 ? std::atoi(argv[4]) : 10;
+        uint32_t loss_permille = argc > 5 ? std::atoi(argv[5]) : 5;
+        return loopback(nodes, hz, seconds, loss_permille);
+    }
+    uint16_t port = argc > 1 ? std::atoi(argv[1]) : UDP_TELEMETRY_DATA_PORT;
+    Collector(port).run();
+}
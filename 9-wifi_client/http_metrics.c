@@ -0,0 +1,419 @@
+#include <string.h>
+#include <strings.h>
+#include "lwip/tcp.h"
+#include "http_metrics.h"
+
+// bytes per response buffer, headers included, two per path
+#ifndef HTTP_METRICS_RESPONSE_SIZE
+#define HTTP_METRICS_RESPONSE_SIZE  2048
+#endif
+
+// fits any int64 with a decimal point and a sign
+#define SLOT_WIDTH          21
+// request headers kept per connection, the rest of a longer request is a 404
+#define REQUEST_SIZE        512
+// tcp_poll() interval, in TCP coarse timer ticks of 500ms
+#define POLL_TICKS          2
+#define POLL_MS             (POLL_TICKS * 500)
+
+enum { PATH_METRICS, PATH_LATEST, PATH_COUNT };
+
+static const char *const paths[PATH_COUNT] = { "/metrics", "/latest" };
+static const char *const content_types[PATH_COUNT] = {
+    "text/plain; version=0.0.4", "application/json"
+};
+
+static const char not_found[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+static const char unavailable[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+struct response {
+    char data[HTTP_METRICS_RESPONSE_SIZE];
+    uint8_t refs;               // connections sending from it
+};
+
+struct endpoint {
+    struct response bufs[2];
+    uint16_t len;               // the same for both, and for every update
+    uint16_t slots[HTTP_METRICS_MAX_VALUES];
+    uint8_t current;            // what a new request gets
+    bool pending;               // an update is waiting for the other buffer
+};
+
+struct conn {
+    struct tcp_pcb *pcb;
+    char request[REQUEST_SIZE];
+    uint16_t request_len;
+    // the response on its way: a pinned buffer, or a static one when response is NULL
+    struct endpoint *endpoint;
+    struct response *response;
+    const char *data;
+    uint16_t len;
+    uint16_t written;
+    uint16_t acked;
+    bool close_after;
+    uint32_t idle_ms;
+};
+
+static struct {
+    struct tcp_pcb *listen;
+    const struct http_metrics_def *defs;
+    uint32_t num_defs;
+    int64_t values[HTTP_METRICS_MAX_VALUES];
+    struct endpoint endpoints[PATH_COUNT];
+    struct conn conns[HTTP_METRICS_MAX_CONN];
+    uint32_t active;
+    struct http_metrics_stats stats;
+} server;
+
+static const uint64_t pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+// right aligned in SLOT_WIDTH, spaces in front
+static void write_slot(char *slot, int64_t value, uint8_t decimals) {
+    bool neg = value < 0;
+    uint64_t mag = neg ? 0 - (uint64_t)value : (uint64_t)value;
+    uint64_t whole = mag / pow10[decimals], frac = mag % pow10[decimals];
+    int i = SLOT_WIDTH;
+
+    for (int d = 0; d < decimals; d++) {
+        slot[--i] = '0' + frac % 10;
+        frac /= 10;
+    }
+    if (decimals)
+        slot[--i] = '.';
+    do {
+        slot[--i] = '0' + whole % 10;
+        whole /= 10;
+    } while (whole);
+    if (neg)
+        slot[--i] = '-';
+    memset(slot, ' ', i);
+}
+
+static bool append(char *buf, uint16_t *len, const char *str) {
+    size_t n = strlen(str);
+    if (*len + n > HTTP_METRICS_RESPONSE_SIZE)
+        return false;
+    memcpy(buf + *len, str, n);
+    *len += n;
+    return true;
+}
+
+static bool append_uint(char *buf, uint16_t *len, uint32_t value) {
+    char digits[11];
+    int i = sizeof(digits) - 1;
+    digits[i] = '\0';
+    do {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    return append(buf, len, &digits[i]);
+}
+
+// a slot, at offset *slot of the body
+static bool append_slot(char *buf, uint16_t *len, uint16_t *slot) {
+    if (*len + SLOT_WIDTH > HTTP_METRICS_RESPONSE_SIZE)
+        return false;
+    *slot = *len;
+    write_slot(buf + *len, 0, 0);
+    *len += SLOT_WIDTH;
+    return true;
+}
+
+// The body goes into bufs[1] first, its length decides the headers in bufs[0]
+static bool layout(int path) {
+    struct endpoint *ep = &server.endpoints[path];
+    char *body = ep->bufs[1].data;
+    uint16_t body_len = 0;
+    bool ok = true;
+
+    if (path == PATH_LATEST)
+        ok = append(body, &body_len, "{");
+    for (uint32_t i = 0; ok && i < server.num_defs; i++) {
+        const struct http_metrics_def *def = &server.defs[i];
+        if (path == PATH_METRICS) {
+            ok = append(body, &body_len, "# HELP ") && append(body, &body_len, def->name) &&
+                 append(body, &body_len, " ") && append(body, &body_len, def->help) &&
+                 append(body, &body_len, "\n# TYPE ") && append(body, &body_len, def->name) &&
+                 append(body, &body_len, def->counter ? " counter\n" : " gauge\n") &&
+                 append(body, &body_len, def->name) && append(body, &body_len, " ") &&
+                 append_slot(body, &body_len, &ep->slots[i]) && append(body, &body_len, "\n");
+        } else {
+            ok = append(body, &body_len, i ? ",\"" : "\"") && append(body, &body_len, def->name) &&
+                 append(body, &body_len, "\":") && append_slot(body, &body_len, &ep->slots[i]);
+        }
+    }
+    if (ok && path == PATH_LATEST)
+        ok = append(body, &body_len, "}\n");
+
+    char *buf = ep->bufs[0].data;
+    uint16_t len = 0;
+    ok = ok && append(buf, &len, "HTTP/1.1 200 OK\r\nContent-Type: ") &&
+         append(buf, &len, content_types[path]) && append(buf, &len, "\r\nContent-Length: ") &&
+         append_uint(buf, &len, body_len) && append(buf, &len, "\r\nCache-Control: no-cache\r\n\r\n");
+    if (!ok || len + body_len > HTTP_METRICS_RESPONSE_SIZE)
+        return false;
+    memcpy(buf + len, body, body_len);
+    for (uint32_t i = 0; i < server.num_defs; i++)
+        ep->slots[i] += len;
+    ep->len = len + body_len;
+    memcpy(ep->bufs[1].data, buf, ep->len);
+    return true;
+}
+
+// New values into the buffer nobody is sending from, which becomes current
+static void refresh(struct endpoint *ep) {
+    struct response *next = &ep->bufs[ep->current ^ 1];
+    if (next->refs) {
+        if (!ep->pending)
+            server.stats.deferred++;
+        ep->pending = true;
+        return;
+    }
+    for (uint32_t i = 0; i < server.num_defs; i++)
+        write_slot(next->data + ep->slots[i], server.values[i], server.defs[i].decimals);
+    ep->current ^= 1;
+    ep->pending = false;
+}
+
+static void release(struct conn *c) {
+    if (c->response) {
+        c->response->refs--;
+        if (!c->response->refs && c->endpoint->pending)
+            refresh(c->endpoint);
+    }
+    c->response = NULL;
+    c->endpoint = NULL;
+    c->data = NULL;
+}
+
+// Returns ERR_ABRT if the pcb had to be aborted, for the callback to pass on. A
+// graceful close only once the response is acked, unacked segments would still
+// point into the buffer
+static err_t close_conn(struct conn *c, bool abort) {
+    struct tcp_pcb *pcb = c->pcb;
+    err_t ret = ERR_OK;
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+    tcp_poll(pcb, NULL, 0);
+    if (abort || tcp_close(pcb) != ERR_OK) {
+        tcp_abort(pcb);
+        ret = ERR_ABRT;
+    }
+    release(c);
+    c->pcb = NULL;
+    server.active--;
+    return ret;
+}
+
+static void write_more(struct conn *c) {
+    bool written = false;
+    while (c->written < c->len) {
+        uint16_t n = LWIP_MIN(c->len - c->written, tcp_sndbuf(c->pcb));
+        if (!n || tcp_sndqueuelen(c->pcb) >= TCP_SND_QUEUELEN - 1)
+            break;
+        // by reference: the buffer stays pinned until all of it is acked
+        if (tcp_write(c->pcb, c->data + c->written, n, 0) != ERR_OK)
+            break;
+        c->written += n;
+        written = true;
+    }
+    if (written)
+        tcp_output(c->pcb);
+}
+
+static void start_response(struct conn *c, int path) {
+    if (path < 0) {
+        c->data = not_found;
+        c->len = sizeof(not_found) - 1;
+        server.stats.not_found++;
+    } else {
+        struct endpoint *ep = &server.endpoints[path];
+        c->endpoint = ep;
+        c->response = &ep->bufs[ep->current];
+        c->response->refs++;
+        c->data = c->response->data;
+        c->len = ep->len;
+    }
+    c->written = 0;
+    c->acked = 0;
+    server.stats.requests++;
+    write_more(c);
+}
+
+static bool header_has(const char *headers, const char *value) {
+    for (const char *p = headers; *p; p++)
+        if (!strncasecmp(p, value, strlen(value)))
+            return true;
+    return false;
+}
+
+// One request at a time, a pipelined one waits in the buffer for this one to finish
+static err_t serve(struct conn *c) {
+    if (c->data)
+        return ERR_OK;
+    char *end = NULL;
+    for (uint16_t i = 0; i + 4 <= c->request_len; i++) {
+        if (!memcmp(c->request + i, "\r\n\r\n", 4)) {
+            end = c->request + i;
+            break;
+        }
+    }
+    if (!end) {
+        if (c->request_len < sizeof(c->request))
+            return ERR_OK;
+        // too long to be for us
+        c->close_after = true;
+        c->request_len = 0;
+        start_response(c, -1);
+        return ERR_OK;
+    }
+    *end = '\0';
+
+    int path = -1;
+    for (int i = 0; i < PATH_COUNT; i++) {
+        size_t n = strlen(paths[i]);
+        if (!strncmp(c->request, "GET ", 4) && !strncmp(c->request + 4, paths[i], n) && c->request[4 + n] == ' ')
+            path = i;
+    }
+    c->close_after = header_has(c->request, "Connection: close") || header_has(c->request, "HTTP/1.0");
+    uint16_t used = end + 4 - c->request;
+    memmove(c->request, end + 4, c->request_len - used);
+    c->request_len -= used;
+    c->idle_ms = 0;
+    start_response(c, path);
+    return ERR_OK;
+}
+
+static err_t conn_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    struct conn *c = arg;
+    if (!p) {
+        // the peer is done sending (HTTP/1.0, nc -N), it still reads the response
+        if (c->data) {
+            c->close_after = true;
+            return ERR_OK;
+        }
+        return close_conn(c, false);
+    }
+    uint16_t n = LWIP_MIN(p->tot_len, sizeof(c->request) - c->request_len);
+    pbuf_copy_partial(p, c->request + c->request_len, n, 0);
+    c->request_len += n;
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return serve(c);
+}
+
+static err_t conn_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    struct conn *c = arg;
+    c->acked += len;
+    if (c->acked < c->len) {
+        write_more(c);
+        return ERR_OK;
+    }
+    release(c);
+    if (c->close_after)
+        return close_conn(c, false);
+    return serve(c);
+}
+
+// the pcb is already freed when this is called
+static void conn_err(void *arg, err_t err) {
+    struct conn *c = arg;
+    release(c);
+    c->pcb = NULL;
+    server.active--;
+}
+
+static err_t conn_poll(void *arg, struct tcp_pcb *pcb) {
+    struct conn *c = arg;
+    if (c->data) {
+        // the send buffer was full the last time round
+        write_more(c);
+        return ERR_OK;
+    }
+    c->idle_ms += POLL_MS;
+    if (c->idle_ms >= HTTP_METRICS_IDLE_MS)
+        return close_conn(c, true);
+    return ERR_OK;
+}
+
+static err_t server_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK || !pcb)
+        return ERR_VAL;
+    struct conn *c = NULL;
+    for (int i = 0; i < HTTP_METRICS_MAX_CONN && !c; i++)
+        if (!server.conns[i].pcb)
+            c = &server.conns[i];
+    if (!c) {
+        // a constant response, nothing to keep track of
+        server.stats.rejected++;
+        tcp_write(pcb, unavailable, sizeof(unavailable) - 1, 0);
+        if (tcp_close(pcb) != ERR_OK) {
+            tcp_abort(pcb);
+            return ERR_ABRT;
+        }
+        return ERR_OK;
+    }
+    memset(c, 0, sizeof(*c));
+    c->pcb = pcb;
+    server.active++;
+    if (server.active > server.stats.conns_max)
+        server.stats.conns_max = server.active;
+    tcp_arg(pcb, c);
+    tcp_recv(pcb, conn_recv);
+    tcp_sent(pcb, conn_sent);
+    tcp_err(pcb, conn_err);
+    tcp_poll(pcb, conn_poll, POLL_TICKS);
+    return ERR_OK;
+}
+
+/* API */
+
+bool http_metrics_init(const struct http_metrics_def *defs, uint32_t num_defs, uint16_t port) {
+    memset(&server, 0, sizeof(server));
+    if (num_defs > HTTP_METRICS_MAX_VALUES)
+        return false;
+    server.defs = defs;
+    server.num_defs = num_defs;
+    for (uint32_t i = 0; i < num_defs; i++)
+        if (defs[i].decimals >= sizeof(pow10) / sizeof(pow10[0]))
+            return false;
+    for (int path = 0; path < PATH_COUNT; path++)
+        if (!layout(path))
+            return false;
+
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb)
+        return false;
+    if (tcp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK) {
+        tcp_close(pcb);
+        return false;
+    }
+    server.listen = tcp_listen_with_backlog(pcb, HTTP_METRICS_MAX_CONN);
+    if (!server.listen) {
+        tcp_close(pcb);
+        return false;
+    }
+    tcp_accept(server.listen, server_accept);
+    return true;
+}
+
+void http_metrics_update(const int64_t *values) {
+    memcpy(server.values, values, server.num_defs * sizeof(values[0]));
+    server.stats.updates++;
+    for (int path = 0; path < PATH_COUNT; path++)
+        refresh(&server.endpoints[path]);
+}
+
+void http_metrics_get_stats(struct http_metrics_stats *stats, bool reset) {
+    *stats = server.stats;
+    if (reset) {
+        memset(&server.stats, 0, sizeof(server.stats));
+        server.stats.conns_max = server.active;
+    }
+}
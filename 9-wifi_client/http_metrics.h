@@ -0,0 +1,67 @@
+#ifndef _HTTP_METRICS_H
+#define _HTTP_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A minimal HTTP/1.1 server on the lwIP raw API for scraping a node directly:
+//
+//   GET /metrics   Prometheus text format
+//   GET /latest    the same values as one JSON object
+//
+// Responses are never formatted on request. http_metrics_init() lays each one out
+// once, headers included, with a fixed width slot for every value, so the
+// Content-Length never changes. http_metrics_update() only rewrites the slots,
+// right aligned with leading spaces, which both formats allow. A scrape then
+// hands the buffer to tcp_write() by reference.
+//
+// Segments keep pointing into a buffer until they are acked, so each response has
+// two: updates go to the one no connection is sending from, and that one becomes
+// current. If both are busy the update waits for the first to be released.
+//
+// Up to HTTP_METRICS_MAX_CONN connections are served at once, keep-alive included,
+// and each keeps its state in a static pool, so the heap only sees lwIP's own
+// segments. More get a 503 and are closed. All calls with the lwIP lock held
+// (cyw43_arch_lwip_begin() on the Pico).
+
+#ifndef HTTP_METRICS_PORT
+#define HTTP_METRICS_PORT           80
+#endif
+
+#ifndef HTTP_METRICS_MAX_CONN
+#define HTTP_METRICS_MAX_CONN       4
+#endif
+
+#ifndef HTTP_METRICS_MAX_VALUES
+#define HTTP_METRICS_MAX_VALUES     8
+#endif
+
+// a keep-alive connection with no request for this long is closed
+#define HTTP_METRICS_IDLE_MS        10000
+
+// one per value, in the order the values are passed to http_metrics_update()
+struct http_metrics_def {
+    const char *name;           // Prometheus metric name, and the JSON key
+    const char *help;
+    bool counter;               // else a gauge
+    uint8_t decimals;           // the value is fixed point with this many, up to 9
+};
+
+struct http_metrics_stats {
+    uint32_t requests;
+    uint32_t not_found;         // anything but GET of the two paths
+    uint32_t rejected;          // 503, over HTTP_METRICS_MAX_CONN
+    uint32_t updates;
+    uint32_t deferred;          // updates that waited for a buffer to be released
+    uint32_t conns_max;         // most connections at once
+};
+
+// False if the values don't fit in the buffers or lwIP is out of pcbs
+bool http_metrics_init(const struct http_metrics_def *defs, uint32_t num_defs, uint16_t port);
+
+// A new sample: num_defs values, fixed point as defined
+void http_metrics_update(const int64_t *values);
+
+void http_metrics_get_stats(struct http_metrics_stats *stats, bool reset);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/ip_addr.h"
+#include "net_bench.h"
+
+// Runs the four net_bench tests against host/net_bench_peer on STREAM_SERVER, over
+// and over. Build once per LWIPOPTS_PROFILE and compare the lines
+
+#ifndef BENCH_SECONDS
+#define BENCH_SECONDS       10
+#endif
+
+// UDP rate both ways, 0 sends as fast as the heap allows
+#ifndef BENCH_UDP_KBPS
+#define BENCH_UDP_KBPS      20000
+#endif
+
+#define BENCH_PAUSE_MS      2000
+
+static void run_test(enum net_bench_mode mode, const ip_addr_t *peer) {
+    struct net_bench_result result;
+    struct net_bench_mem mem;
+
+    cyw43_arch_lwip_begin();
+    net_bench_get_mem(&mem, true);
+    bool started = net_bench_start(mode, peer, NET_BENCH_PORT, BENCH_SECONDS, BENCH_UDP_KBPS);
+    cyw43_arch_lwip_end();
+    if (!started) {
+        printf("%s: can't start\n", net_bench_mode_names[mode]);
+        return;
+    }
+    while (true) {
+        cyw43_arch_lwip_begin();
+        bool done = net_bench_done(&result);
+        cyw43_arch_lwip_end();
+        if (done)
+            break;
+#if PICO_CYW43_ARCH_POLL
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(make_timeout_time_ms(10));
+#else
+        sleep_ms(10);
+#endif
+    }
+    cyw43_arch_lwip_begin();
+    net_bench_get_mem(&mem, false);
+    cyw43_arch_lwip_end();
+    net_bench_print(mode, &result, &mem);
+}
+
+int main() {
+    // Initializations
+    stdio_init_all();
+    if (cyw43_arch_init()) {
+        printf("failed to initialise wifi\n");
+        return 1;
+    }
+    cyw43_arch_enable_sta_mode();
+    printf("Connecting to %s..\n", WIFI_SSID);
+    while (cyw43_arch_wifi_connect_timeout_ms(WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK, 30000))
+        printf("failed to connect, trying again\n");
+
+    ip_addr_t peer;
+    if (!ipaddr_aton(STREAM_SERVER, &peer)) {
+        printf("bad peer address %s\n", STREAM_SERVER);
+        return 1;
+    }
+    printf("lwipopts profile %s, %us tests against %s:%u\n",
+           LWIPOPTS_PROFILE_NAME, BENCH_SECONDS, STREAM_SERVER, NET_BENCH_PORT);
+
+    // Code here
+    while (true) {
+        for (int mode = 0; mode < NET_BENCH_MODES; mode++) {
+            run_test(mode, &peer);
+            sleep_ms(BENCH_PAUSE_MS);
+        }
+        printf("\n");
+    }
+    cyw43_arch_deinit();
+    return 0;
+}
@@ -20,25 +20,66 @@
 #define MEM_LIBC_MALLOC             0
 #endif
 #define MEM_ALIGNMENT               4
-#define MEM_SIZE                    4000
-#define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
-#define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
 #define LWIP_ICMP                   1
 #define LWIP_RAW                    1
-#define TCP_WND                     (8 * TCP_MSS)
 #define TCP_MSS                     1460
+
+// Buffer sizing profiles, pick one with -DLWIPOPTS_PROFILE=LWIPOPTS_PROFILE_...
+// 9-wifi_client's net_bench measures each of them (throughput, RAM, exhaustion)
+#define LWIPOPTS_PROFILE_LOW_RAM        1
+#define LWIPOPTS_PROFILE_BALANCED       2
+#define LWIPOPTS_PROFILE_MAX_THROUGHPUT 3
+#ifndef LWIPOPTS_PROFILE
+#define LWIPOPTS_PROFILE            LWIPOPTS_PROFILE_BALANCED
+#endif
+
+#if LWIPOPTS_PROFILE == LWIPOPTS_PROFILE_LOW_RAM
+// two segments in flight each way
+#define LWIPOPTS_PROFILE_NAME       "low-ram"
+#define MEM_SIZE                    4000
+#define MEMP_NUM_TCP_SEG            8
+#define PBUF_POOL_SIZE              8
+#define TCP_WND                     (2 * TCP_MSS)
+#define TCP_SND_BUF                 (2 * TCP_MSS)
+#elif LWIPOPTS_PROFILE == LWIPOPTS_PROFILE_BALANCED
+// what these examples always used. A copying tcp_write() runs out of MEM_SIZE
+// well before TCP_SND_BUF
+#define LWIPOPTS_PROFILE_NAME       "balanced"
+#define MEM_SIZE                    4000
+#define MEMP_NUM_TCP_SEG            32
+#define PBUF_POOL_SIZE              24
+#define TCP_WND                     (8 * TCP_MSS)
 #define TCP_SND_BUF                 (8 * TCP_MSS)
+#elif LWIPOPTS_PROFILE == LWIPOPTS_PROFILE_MAX_THROUGHPUT
+// a heap that holds the whole send buffer, a pool that holds the whole window
+#define LWIPOPTS_PROFILE_NAME       "max-throughput"
+#define MEM_SIZE                    24000
+#define MEMP_NUM_TCP_SEG            64
+#define PBUF_POOL_SIZE              32
+#define TCP_WND                     (16 * TCP_MSS)
+#define TCP_SND_BUF                 (16 * TCP_MSS)
+#else
+#error unknown LWIPOPTS_PROFILE
+#endif
 #define TCP_SND_QUEUELEN            ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                0
+#ifdef NET_BENCH
+// pool use and exhaustion counters for net_bench
+#define LWIP_STATS                  1
+#define MEM_STATS                   1
+#define MEMP_STATS                  1
+#else
 #define MEM_STATS                   0
-#define SYS_STATS                   0
 #define MEMP_STATS                  0
+#endif
+#define SYS_STATS                   0
 #define LINK_STATS                  0
 // #define ETH_PAD_SIZE                2
 #define LWIP_CHKSUM_ALGORITHM       3
@@ -48,7 +89,18 @@
 #define LWIP_UDP                    1
 #define LWIP_DNS                    1
 #define LWIP_TCP_KEEPALIVE          1
-#define LWIP_NETIF_TX_SINGLE_PBUF   1
+// http_metrics.c connections, tcp_stream.c or mqtt_forward.c, and some in TIME_WAIT
+#define MEMP_NUM_TCP_PCB            8
+// multicast discovery in udp_telemetry.c
+#define LWIP_IGMP                   1
+// 0 or tcp_write() always copies, tcp_stream.c hands it records by reference
+#define LWIP_NETIF_TX_SINGLE_PBUF   0
+// lwIP's MQTT client for mqtt_forward.c: a few batches queued, one request per batch in flight
+#define MQTT_OUTPUT_RINGBUF_SIZE    4096
+#define MQTT_REQ_MAX_IN_FLIGHT      8
+// lwIP's own timers take every MEMP_NUM_SYS_TIMEOUT by default, the MQTT client's
+// cyclic timer and net_bench.c's need more
+#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 4)
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 
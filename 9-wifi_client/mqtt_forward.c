@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+#include "lwip/apps/mqtt.h"
+#include "lwip/apps/mqtt_priv.h"
+#include "lwip/tcp.h"
+#include "mqtt_forward.h"
+
+#define QUEUE_MASK      (MQTT_FORWARD_QUEUE_SAMPLES - 1)
+#define BATCH_MASK      (MQTT_FORWARD_MAX_IN_FLIGHT - 1)
+// the braces and keys, then the longest dt and value for every sample
+#define PAYLOAD_MAX     (64 + MQTT_FORWARD_BATCH_SAMPLES * 24)
+
+_Static_assert((MQTT_FORWARD_QUEUE_SAMPLES & QUEUE_MASK) == 0, "MQTT_FORWARD_QUEUE_SAMPLES must be a power of 2");
+_Static_assert((MQTT_FORWARD_MAX_IN_FLIGHT & BATCH_MASK) == 0, "MQTT_FORWARD_MAX_IN_FLIGHT must be a power of 2");
+_Static_assert(MQTT_FORWARD_MAX_IN_FLIGHT <= MQTT_REQ_MAX_IN_FLIGHT, "lwIP's MQTT client tracks fewer requests");
+// with room for the topic and the fixed header
+_Static_assert(PAYLOAD_MAX + 128 <= MQTT_OUTPUT_RINGBUF_SIZE, "a batch doesn't fit MQTT_OUTPUT_RINGBUF_SIZE");
+
+#if !LWIP_TCP_KEEPALIVE || LWIP_ALTCP
+#error "mqtt_forward.c sets keepalive times on the tcp_pcb, it needs LWIP_TCP_KEEPALIVE and no altcp"
+#endif
+
+struct sample {
+    uint32_t seq;
+    uint32_t ms;
+    int32_t value;
+};
+
+struct batch {
+    uint32_t end;               // queue index after its last sample
+    uint16_t len;
+    bool taken;
+};
+
+enum link { LINK_DOWN, LINK_CONNECTING, LINK_UP };
+
+static struct {
+    struct sample queue[MQTT_FORWARD_QUEUE_SAMPLES];
+    // free running indices, masked on access: taken <= sent <= head
+    uint32_t head;              // next sample put
+    uint32_t sent;              // next sample to publish
+    uint32_t taken;             // oldest sample the broker hasn't taken
+    uint32_t seq;
+
+    // batches in flight by number, free running too: a number outside
+    // oldest .. next belongs to a connection that is gone
+    struct batch batches[MQTT_FORWARD_MAX_IN_FLIGHT];
+    uint32_t batch_oldest;
+    uint32_t batch_next;
+
+    mqtt_client_t client;
+    struct mqtt_connect_client_info_t info;
+    enum link link;
+    bool timed_out;
+    ip_addr_t broker;
+    uint16_t port;
+    const char *topic;
+    uint32_t next_connect_ms;
+    uint32_t (*now_ms)(void);
+
+    // the backlog found at the last connect, until it is taken
+    bool draining;
+    uint32_t drain_end;
+    uint32_t drain_start_ms;
+
+    char payload[PAYLOAD_MAX];
+    struct mqtt_forward_stats stats;
+} fwd;
+
+static void link_down(void) {
+    if (fwd.link == LINK_UP) {
+        // lwIP's client drops its requests without calling back, all of them go again
+        fwd.stats.resent += fwd.sent - fwd.taken;
+        fwd.stats.disconnects++;
+        fwd.sent = fwd.taken;
+        fwd.batch_oldest = fwd.batch_next;
+        fwd.draining = false;
+    }
+    fwd.link = LINK_DOWN;
+    fwd.timed_out = false;
+    fwd.next_connect_ms = fwd.now_ms() + MQTT_FORWARD_RECONNECT_MS;
+}
+
+static void connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status) {
+    if (status != MQTT_CONNECT_ACCEPTED) {
+        link_down();
+        return;
+    }
+    fwd.link = LINK_UP;
+    fwd.stats.connects++;
+    fwd.stats.drain_samples = fwd.head - fwd.taken;
+    fwd.stats.drain_ms = 0;
+    fwd.drain_end = fwd.head;
+    fwd.drain_start_ms = fwd.now_ms();
+    fwd.draining = fwd.stats.drain_samples != 0;
+}
+
+// the PUBACK at QoS 1, the TCP ack at QoS 0, ERR_TIMEOUT after MQTT_REQ_TIMEOUT without
+static void publish_cb(void *arg, err_t err) {
+    uint32_t n = (uint32_t)(uintptr_t)arg;
+    if (n - fwd.batch_oldest >= fwd.batch_next - fwd.batch_oldest)
+        return;
+    if (err != ERR_OK) {
+        // not from in here, lwIP is walking its request list
+        fwd.timed_out = true;
+        return;
+    }
+    fwd.batches[n & BATCH_MASK].taken = true;
+
+    // PUBACKs can overtake each other, the queue frees in order
+    uint32_t now = fwd.now_ms();
+    while (fwd.batch_oldest != fwd.batch_next && fwd.batches[fwd.batch_oldest & BATCH_MASK].taken) {
+        const struct batch *b = &fwd.batches[fwd.batch_oldest & BATCH_MASK];
+        for (; fwd.taken != b->end; fwd.taken++) {
+            uint32_t latency_ms = now - fwd.queue[fwd.taken & QUEUE_MASK].ms;
+            fwd.stats.latency_total_ms += latency_ms;
+            if (latency_ms > fwd.stats.latency_max_ms)
+                fwd.stats.latency_max_ms = latency_ms;
+            fwd.stats.samples++;
+        }
+        fwd.stats.publishes++;
+        fwd.stats.payload_bytes += b->len;
+        fwd.batch_oldest++;
+    }
+    if (fwd.draining && (int32_t)(fwd.taken - fwd.drain_end) >= 0) {
+        fwd.stats.drain_ms = LWIP_MAX(now - fwd.drain_start_ms, 1);
+        fwd.draining = false;
+    }
+}
+
+static void start_connect(void) {
+    fwd.link = LINK_CONNECTING;
+    if (mqtt_client_connect(&fwd.client, &fwd.broker, fwd.port, connection_cb, NULL, &fwd.info) != ERR_OK) {
+        link_down();
+        return;
+    }
+    // without altcp the connection is a plain tcp_pcb
+    struct tcp_pcb *pcb = fwd.client.conn;
+    ip_set_option(pcb, SOF_KEEPALIVE);
+    pcb->keep_idle = MQTT_FORWARD_TCP_KEEPIDLE_MS;
+    pcb->keep_intvl = MQTT_FORWARD_TCP_KEEPINTVL_MS;
+    pcb->keep_cnt = 3;
+}
+
+// a batch is full, or its oldest sample has waited long enough
+static bool batch_ready(void) {
+    uint32_t unsent = fwd.head - fwd.sent;
+    if (!unsent)
+        return false;
+    if (unsent >= MQTT_FORWARD_BATCH_SAMPLES)
+        return true;
+    return fwd.now_ms() - fwd.queue[fwd.sent & QUEUE_MASK].ms >= MQTT_FORWARD_MAX_DELAY_MS;
+}
+
+// the next batch from sent into payload, returns the number of samples in it
+static uint32_t build_payload(uint16_t *len) {
+    const struct sample *first = &fwd.queue[fwd.sent & QUEUE_MASK];
+    uint32_t n = 1;
+
+    // consecutive sequence numbers only, a gap starts the next batch
+    while (n < MQTT_FORWARD_BATCH_SAMPLES && fwd.sent + n != fwd.head &&
+           fwd.queue[(fwd.sent + n) & QUEUE_MASK].seq == first->seq + n)
+        n++;
+
+    char *p = fwd.payload;
+    p += sprintf(p, "{\"seq\":%u,\"t\":%u,\"dt\":[", first->seq, first->ms);
+    for (uint32_t i = 0; i < n; i++)
+        p += sprintf(p, i ? ",%u" : "%u", fwd.queue[(fwd.sent + i) & QUEUE_MASK].ms - first->ms);
+    p += sprintf(p, "],\"v\":[");
+    for (uint32_t i = 0; i < n; i++)
+        p += sprintf(p, i ? ",%d" : "%d", fwd.queue[(fwd.sent + i) & QUEUE_MASK].value);
+    p += sprintf(p, "]}");
+    *len = p - fwd.payload;
+    return n;
+}
+
+static void publish_batches(void) {
+    while (fwd.batch_next - fwd.batch_oldest < MQTT_FORWARD_MAX_IN_FLIGHT && batch_ready()) {
+        uint16_t len;
+        uint32_t n = build_payload(&len);
+        struct batch *b = &fwd.batches[fwd.batch_next & BATCH_MASK];
+        b->end = fwd.sent + n;
+        b->len = len;
+        b->taken = false;
+        // copied into the client's output ring buffer, the payload buffer is free again
+        err_t err = mqtt_publish(&fwd.client, fwd.topic, fwd.payload, len, MQTT_FORWARD_QOS, 0, publish_cb,
+                                 (void *)(uintptr_t)fwd.batch_next);
+        if (err != ERR_OK) {
+            // the ring buffer is full or the connection is going, try again next poll
+            fwd.stats.stalls++;
+            break;
+        }
+        fwd.sent += n;
+        fwd.batch_next++;
+    }
+}
+
+/* API */
+
+void mqtt_forward_init(const ip_addr_t *broker, uint16_t port, const char *client_id, const char *topic,
+                       uint32_t (*now_ms)(void)) {
+    memset(&fwd, 0, sizeof(fwd));
+    ip_addr_copy(fwd.broker, *broker);
+    fwd.port = port;
+    fwd.topic = topic;
+    fwd.info.client_id = client_id;
+    fwd.info.keep_alive = MQTT_FORWARD_KEEP_ALIVE_S;
+    fwd.now_ms = now_ms;
+    fwd.link = LINK_DOWN;
+    fwd.next_connect_ms = now_ms();
+}
+
+bool mqtt_forward_put(int32_t value) {
+    uint32_t seq = fwd.seq++;
+    if (fwd.head - fwd.taken >= MQTT_FORWARD_QUEUE_SAMPLES) {
+        fwd.stats.dropped++;
+        // samples in flight stay where they are, the new one goes instead
+        if (fwd.sent != fwd.taken)
+            return false;
+        fwd.taken++;
+        fwd.sent++;
+    }
+    struct sample *s = &fwd.queue[fwd.head & QUEUE_MASK];
+    s->seq = seq;
+    s->ms = fwd.now_ms();
+    s->value = value;
+    fwd.head++;
+    return true;
+}
+
+void mqtt_forward_poll(void) {
+    switch (fwd.link) {
+    case LINK_DOWN:
+        if ((int32_t)(fwd.now_ms() - fwd.next_connect_ms) >= 0)
+            start_connect();
+        break;
+    case LINK_CONNECTING:
+        break;
+    case LINK_UP:
+        if (fwd.timed_out)
+            mqtt_forward_disconnect();
+        else
+            publish_batches();
+        break;
+    }
+}
+
+bool mqtt_forward_connected(void) {
+    return fwd.link == LINK_UP;
+}
+
+uint32_t mqtt_forward_backlog(void) {
+    return fwd.head - fwd.taken;
+}
+
+void mqtt_forward_disconnect(void) {
+    if (fwd.link == LINK_DOWN)
+        return;
+    // no connection callback for this one, the bookkeeping is done here
+    mqtt_disconnect(&fwd.client);
+    link_down();
+}
+
+void mqtt_forward_get_stats(struct mqtt_forward_stats *stats, bool reset) {
+    *stats = fwd.stats;
+    if (reset) {
+        // the drain result stays until the next connect
+        memset(&fwd.stats, 0, sizeof(fwd.stats));
+        fwd.stats.drain_samples = stats->drain_samples;
+        fwd.stats.drain_ms = stats->drain_ms;
+    }
+}
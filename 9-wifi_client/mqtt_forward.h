@@ -0,0 +1,98 @@
+#ifndef _MQTT_FORWARD_H
+#define _MQTT_FORWARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lwip/ip_addr.h"
+
+// Store-and-forward MQTT 3.1.1 publisher on lwIP's MQTT client (lwip/apps/mqtt.h,
+// pico_lwip_mqtt on the Pico), which runs on the raw API.
+//
+// Samples go into a queue in RAM and are published in batches, one JSON payload per
+// PUBLISH. They stay queued until the broker has taken them: the PUBACK at QoS 1,
+// the TCP ack at QoS 0. While there is no connection the queue keeps filling, once
+// it is full the oldest samples are dropped. After a reconnect the backlog goes out
+// as full batches back to back, up to MQTT_FORWARD_MAX_IN_FLIGHT unacked at a time;
+// what was in flight when the connection went is sent again, so at QoS 1 a sample
+// can arrive twice but is never lost short of the queue overflowing.
+//
+// The broker is pinged with MQTT keep alive. TCP keepalive (LWIP_TCP_KEEPALIVE) is
+// set on the connection as well, it finds a dead link in
+// MQTT_FORWARD_TCP_KEEPIDLE_MS + 3 * MQTT_FORWARD_TCP_KEEPINTVL_MS without waiting
+// for the MQTT watchdog at 1.5 times the keep alive. All calls with the lwIP lock held
+// (cyw43_arch_lwip_begin() on the Pico).
+//
+// A batch, seq counts every sample put so the gaps show what was dropped, t is
+// when the first one was put and dt the others' offsets from it, in ms:
+//
+//   {"seq":1200,"t":52011,"dt":[0,10,20],"v":[24312,24305,24340]}
+
+// samples, a power of 2
+#ifndef MQTT_FORWARD_QUEUE_SAMPLES
+#define MQTT_FORWARD_QUEUE_SAMPLES  2048
+#endif
+
+// samples per PUBLISH, fewer when the oldest has waited MQTT_FORWARD_MAX_DELAY_MS
+#ifndef MQTT_FORWARD_BATCH_SAMPLES
+#define MQTT_FORWARD_BATCH_SAMPLES  64
+#endif
+
+#ifndef MQTT_FORWARD_MAX_DELAY_MS
+#define MQTT_FORWARD_MAX_DELAY_MS   1000
+#endif
+
+#ifndef MQTT_FORWARD_QOS
+#define MQTT_FORWARD_QOS            1
+#endif
+
+// a power of 2, no more than MQTT_REQ_MAX_IN_FLIGHT in lwipopts.h
+#ifndef MQTT_FORWARD_MAX_IN_FLIGHT
+#define MQTT_FORWARD_MAX_IN_FLIGHT  8
+#endif
+
+#define MQTT_FORWARD_PORT           1883
+#define MQTT_FORWARD_KEEP_ALIVE_S   60
+#define MQTT_FORWARD_TCP_KEEPIDLE_MS    10000
+#define MQTT_FORWARD_TCP_KEEPINTVL_MS   5000
+#define MQTT_FORWARD_RECONNECT_MS   2000
+
+struct mqtt_forward_stats {
+    uint32_t samples;           // taken by the broker
+    uint32_t publishes;         // batches taken by the broker
+    uint32_t payload_bytes;     // in those batches
+    uint32_t dropped;           // queue full
+    uint32_t resent;            // in flight when the connection went, queued again
+    uint32_t stalls;            // polls with a batch ready and no room in lwIP's MQTT client
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t drain_samples;     // backlog when the last connection came up
+    uint32_t drain_ms;          // until that backlog was taken, 0 while it isn't yet
+    uint64_t latency_total_ms;  // put to taken, over samples
+    uint32_t latency_max_ms;
+};
+
+// Publishes to topic on broker:port as client_id, both strings have to outlive the
+// publisher. now_ms is the clock for timestamps and batching, wrapping at 32 bits is
+// fine. Connects from the first poll
+void mqtt_forward_init(const ip_addr_t *broker, uint16_t port, const char *client_id, const char *topic,
+                       uint32_t (*now_ms)(void));
+
+// Queues a sample, dropping the oldest one if the queue is full. False if the new
+// one was dropped instead, when everything queued is in flight
+bool mqtt_forward_put(int32_t value);
+
+// Connects or reconnects and publishes what is ready, call often
+void mqtt_forward_poll(void);
+
+bool mqtt_forward_connected(void);
+
+// Samples not yet taken by the broker, in flight included
+uint32_t mqtt_forward_backlog(void);
+
+// Drops the connection, the queue keeps filling until the reconnect
+// MQTT_FORWARD_RECONNECT_MS later. For testing the store-and-forward path
+void mqtt_forward_disconnect(void);
+
+void mqtt_forward_get_stats(struct mqtt_forward_stats *stats, bool reset);
+
+#endif
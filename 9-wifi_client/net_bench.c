@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+#include "net_bench.h"
+
+#if !MEMP_STATS || !MEM_STATS
+#error net_bench needs NET_BENCH defined for lwipopts.h
+#endif
+
+// longest an RX test waits for the peer past its time
+#define RX_GRACE_MS         5000
+#define HELLO_RETRY_MS      500
+// UDP_TX sends from a 1ms timer, at most this many datagrams a tick
+#define UDP_BURST           16
+#define UDP_END_COPIES      3
+
+const char *const net_bench_mode_names[NET_BENCH_MODES] = {
+    "tcp_tx", "tcp_rx", "udp_tx", "udp_rx"
+};
+
+static struct {
+    enum net_bench_mode mode;
+    bool running;
+    bool done;
+    ip_addr_t peer;
+    uint16_t port;
+    uint16_t seconds;
+    uint32_t rate_kbps;
+    struct tcp_pcb *tcp;
+    struct udp_pcb *udp;
+    uint32_t start_ms;
+    uint32_t last_tick_ms;
+    uint32_t credit_bytes;      // UDP_TX pacing
+    uint32_t hello_unacked;     // TCP_TX: hello bytes the sent callback still has to see
+    uint32_t seq;               // next datagram sent or expected
+    bool sending;
+    struct net_bench_result result;
+} bench;
+
+// the payload, copied by tcp_write()
+static uint8_t pattern[TCP_MSS];
+
+static void end_timeout(void *arg);
+static void hello_timeout(void *arg);
+static void udp_tick(void *arg);
+
+static void finish(bool ok) {
+    sys_untimeout(end_timeout, NULL);
+    sys_untimeout(hello_timeout, NULL);
+    sys_untimeout(udp_tick, NULL);
+    if (bench.tcp) {
+        struct tcp_pcb *pcb = bench.tcp;
+        bench.tcp = NULL;
+        tcp_arg(pcb, NULL);
+        tcp_err(pcb, NULL);
+        tcp_sent(pcb, NULL);
+        tcp_recv(pcb, NULL);
+        if (tcp_close(pcb) != ERR_OK)
+            tcp_abort(pcb);
+    }
+    if (bench.udp) {
+        udp_remove(bench.udp);
+        bench.udp = NULL;
+    }
+    bench.result.ok = ok;
+    bench.result.elapsed_ms = sys_now() - bench.start_ms;
+    bench.running = false;
+    bench.done = true;
+}
+
+static void make_hello(struct net_bench_hello *hello) {
+    hello->magic = NET_BENCH_HELLO;
+    hello->mode = bench.mode;
+    hello->reserved = 0;
+    hello->seconds = bench.seconds;
+    hello->rate_kbps = bench.rate_kbps;
+}
+
+/* TCP */
+
+static void tcp_fill(struct tcp_pcb *pcb) {
+    bool written = false;
+    while (bench.sending) {
+        u16_t n = LWIP_MIN(tcp_sndbuf(pcb), sizeof(pattern));
+        if (!n || tcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN - 1)
+            break;
+        // a failed write is retried from the next sent callback
+        if (tcp_write(pcb, pattern, n, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+            bench.result.send_errors++;
+            break;
+        }
+        written = true;
+    }
+    if (written)
+        tcp_output(pcb);
+}
+
+static err_t bench_tcp_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    uint32_t hello = LWIP_MIN(len, bench.hello_unacked);
+    bench.hello_unacked -= hello;
+    bench.result.bytes += len - hello;
+    tcp_fill(pcb);
+    return ERR_OK;
+}
+
+static err_t bench_tcp_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    if (!p) {
+        // TCP_RX: the peer closes when its time is up
+        finish(bench.mode == NET_BENCH_TCP_RX);
+        return ERR_OK;
+    }
+    bench.result.bytes += p->tot_len;
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+// the pcb is already freed when this is called
+static void bench_tcp_err(void *arg, err_t err) {
+    bench.tcp = NULL;
+    finish(false);
+}
+
+static err_t bench_tcp_connected(void *arg, struct tcp_pcb *pcb, err_t err) {
+    struct net_bench_hello hello;
+    make_hello(&hello);
+    if (tcp_write(pcb, &hello, sizeof(hello), TCP_WRITE_FLAG_COPY) != ERR_OK) {
+        tcp_err(pcb, NULL);
+        tcp_abort(pcb);
+        bench.tcp = NULL;
+        finish(false);
+        return ERR_ABRT;
+    }
+    bench.hello_unacked = sizeof(hello);
+    bench.start_ms = sys_now();
+    if (bench.mode == NET_BENCH_TCP_TX) {
+        bench.sending = true;
+        tcp_fill(pcb);
+        sys_timeout(bench.seconds * 1000, end_timeout, NULL);
+    } else {
+        tcp_output(pcb);
+        sys_timeout(bench.seconds * 1000 + RX_GRACE_MS, end_timeout, NULL);
+    }
+    return ERR_OK;
+}
+
+static bool tcp_start(void) {
+    struct tcp_pcb *pcb = tcp_new_ip_type(IP_GET_TYPE(&bench.peer));
+    if (!pcb)
+        return false;
+    tcp_err(pcb, bench_tcp_err);
+    tcp_sent(pcb, bench_tcp_sent);
+    tcp_recv(pcb, bench_tcp_recv);
+    bench.tcp = pcb;
+    if (tcp_connect(pcb, &bench.peer, bench.port, bench_tcp_connected) != ERR_OK) {
+        tcp_close(pcb);
+        bench.tcp = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* UDP */
+
+static bool udp_send_dgram(uint32_t flags) {
+    uint16_t len = flags & NET_BENCH_UDP_END ? sizeof(struct net_bench_dgram) : NET_BENCH_UDP_LEN;
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (!p) {
+        bench.result.send_errors++;
+        return false;
+    }
+    struct net_bench_dgram *d = p->payload;
+    d->magic = NET_BENCH_MAGIC;
+    d->seq = bench.seq;
+    d->flags = flags;
+    if (len > sizeof(*d))
+        memcpy(d + 1, pattern, len - sizeof(*d));
+    err_t err = udp_sendto(bench.udp, p, &bench.peer, bench.port);
+    pbuf_free(p);
+    if (err != ERR_OK) {
+        bench.result.send_errors++;
+        return false;
+    }
+    if (!flags) {
+        bench.seq++;
+        bench.result.datagrams++;
+        bench.result.bytes += len;
+    }
+    return true;
+}
+
+static void udp_send_hello(void) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct net_bench_hello), PBUF_RAM);
+    if (!p)
+        return;
+    make_hello(p->payload);
+    udp_sendto(bench.udp, p, &bench.peer, bench.port);
+    pbuf_free(p);
+}
+
+static void udp_tick(void *arg) {
+    uint32_t now = sys_now();
+    uint32_t budget = UDP_BURST;
+    if (bench.rate_kbps) {
+        // kbit/s is bytes/ms times 8
+        bench.credit_bytes += (now - bench.last_tick_ms) * bench.rate_kbps / 8;
+        bench.credit_bytes = LWIP_MIN(bench.credit_bytes, UDP_BURST * NET_BENCH_UDP_LEN);
+        budget = bench.credit_bytes / NET_BENCH_UDP_LEN;
+    }
+    bench.last_tick_ms = now;
+    while (budget-- && udp_send_dgram(0))
+        if (bench.rate_kbps)
+            bench.credit_bytes -= NET_BENCH_UDP_LEN;
+    sys_timeout(1, udp_tick, NULL);
+}
+
+// UDP_RX: until the first datagram shows the peer has it
+static void hello_timeout(void *arg) {
+    udp_send_hello();
+    sys_timeout(HELLO_RETRY_MS, hello_timeout, NULL);
+}
+
+static void bench_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    struct net_bench_dgram d;
+    if (bench.mode != NET_BENCH_UDP_RX || pbuf_copy_partial(p, &d, sizeof(d), 0) != sizeof(d) ||
+        d.magic != NET_BENCH_MAGIC) {
+        pbuf_free(p);
+        return;
+    }
+    uint16_t len = p->tot_len;
+    pbuf_free(p);
+    if (!bench.result.datagrams)
+        sys_untimeout(hello_timeout, NULL);
+    if (d.flags & NET_BENCH_UDP_END) {
+        finish(true);
+        return;
+    }
+    // late or repeated
+    if ((int32_t)(d.seq - bench.seq) < 0)
+        return;
+    bench.result.lost += d.seq - bench.seq;
+    bench.seq = d.seq + 1;
+    bench.result.datagrams++;
+    bench.result.bytes += len;
+}
+
+static bool udp_start(void) {
+    bench.udp = udp_new_ip_type(IP_GET_TYPE(&bench.peer));
+    if (!bench.udp)
+        return false;
+    udp_bind(bench.udp, IP_ANY_TYPE, 0);
+    udp_recv(bench.udp, bench_udp_recv, NULL);
+    udp_send_hello();
+    bench.start_ms = sys_now();
+    if (bench.mode == NET_BENCH_UDP_TX) {
+        bench.sending = true;
+        bench.last_tick_ms = bench.start_ms;
+        sys_timeout(1, udp_tick, NULL);
+        sys_timeout(bench.seconds * 1000, end_timeout, NULL);
+    } else {
+        sys_timeout(HELLO_RETRY_MS, hello_timeout, NULL);
+        sys_timeout(bench.seconds * 1000 + RX_GRACE_MS, end_timeout, NULL);
+    }
+    return true;
+}
+
+static void end_timeout(void *arg) {
+    switch (bench.mode) {
+    case NET_BENCH_TCP_TX:
+        bench.sending = false;
+        finish(true);
+        break;
+    case NET_BENCH_UDP_TX:
+        bench.sending = false;
+        sys_untimeout(udp_tick, NULL);
+        // the peer takes any of these as the end, losing one is fine
+        for (int i = 0; i < UDP_END_COPIES; i++)
+            udp_send_dgram(NET_BENCH_UDP_END);
+        finish(true);
+        break;
+    default:
+        // the peer never said it was done
+        finish(bench.mode == NET_BENCH_UDP_RX && bench.result.datagrams);
+        break;
+    }
+}
+
+/* API */
+
+bool net_bench_start(enum net_bench_mode mode, const ip_addr_t *peer, uint16_t port,
+                     uint32_t seconds, uint32_t rate_kbps) {
+    if (bench.running || mode >= NET_BENCH_MODES || !seconds)
+        return false;
+    memset(&bench, 0, sizeof(bench));
+    for (unsigned i = 0; i < sizeof(pattern); i++)
+        pattern[i] = i;
+    bench.mode = mode;
+    ip_addr_copy(bench.peer, *peer);
+    bench.port = port;
+    bench.seconds = LWIP_MIN(seconds, UINT16_MAX);
+    bench.rate_kbps = rate_kbps;
+    bench.start_ms = sys_now();
+    bench.running = true;
+    bool started = mode == NET_BENCH_TCP_TX || mode == NET_BENCH_TCP_RX ? tcp_start() : udp_start();
+    if (!started)
+        finish(false);
+    return true;
+}
+
+bool net_bench_done(struct net_bench_result *result) {
+    if (!bench.done)
+        return false;
+    *result = bench.result;
+    return true;
+}
+
+void net_bench_get_mem(struct net_bench_mem *mem, bool reset) {
+    memset(mem, 0, sizeof(*mem));
+    mem->static_bytes = MEM_SIZE;
+    mem->peak_bytes = lwip_stats.mem.max;
+    mem->mem_err = lwip_stats.mem.err;
+    for (int i = 0; i < MEMP_MAX; i++) {
+        const struct memp_desc *pool = memp_pools[i];
+        mem->static_bytes += pool->num * pool->size;
+        mem->peak_bytes += pool->stats->max * pool->size;
+    }
+    mem->pbuf_pool_err = memp_pools[MEMP_PBUF_POOL]->stats->err;
+    mem->pbuf_err = memp_pools[MEMP_PBUF]->stats->err;
+    mem->tcp_seg_err = memp_pools[MEMP_TCP_SEG]->stats->err;
+
+    if (reset) {
+        lwip_stats.mem.max = lwip_stats.mem.used;
+        lwip_stats.mem.err = 0;
+        for (int i = 0; i < MEMP_MAX; i++) {
+            memp_pools[i]->stats->max = memp_pools[i]->stats->used;
+            memp_pools[i]->stats->err = 0;
+        }
+    }
+}
+
+void net_bench_print(enum net_bench_mode mode, const struct net_bench_result *result,
+                     const struct net_bench_mem *mem) {
+    // bits per ms is kbit/s
+    uint32_t kbps = result->elapsed_ms ? (uint32_t)(result->bytes * 8 / result->elapsed_ms) : 0;
+    printf("%-14s %s: %s%u.%02u Mbit/s, %u datagrams, %u lost, %u send errors | "
+           "ram %u B static, %u B peak | exhausted: heap %u, pbuf pool %u, pbuf %u, tcp seg %u\n",
+           LWIPOPTS_PROFILE_NAME, net_bench_mode_names[mode], result->ok ? "" : "FAILED ",
+           kbps / 1000, kbps % 1000 / 10, result->datagrams, result->lost, result->send_errors,
+           mem->static_bytes, mem->peak_bytes, mem->mem_err, mem->pbuf_pool_err, mem->pbuf_err,
+           mem->tcp_seg_err);
+}
@@ -0,0 +1,61 @@
+#ifndef _NET_BENCH_H
+#define _NET_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lwip/ip_addr.h"
+#include "net_bench_wire.h"
+
+// iperf style throughput tests with the lwIP raw API, against host/net_bench_peer.
+//
+// The device always opens the test, over TCP or with a UDP datagram to the peer,
+// so it works from behind NAT. A hello tells the peer which way data goes, then one
+// side sends for the given time:
+//
+//   TCP_TX  device -> peer, tcp_write() with copy as fast as the send buffer allows
+//   TCP_RX  peer -> device
+//   UDP_TX  device -> peer, datagrams at rate_kbps (0 as fast as the heap allows)
+//   UDP_RX  peer -> device at rate_kbps
+//
+// Everything runs from lwIP callbacks and sys_timeout()s, there is nothing to poll.
+// All calls with the lwIP lock held (cyw43_arch_lwip_begin() on the Pico).
+//
+// Alongside throughput, net_bench_get_mem() reports what the lwipopts.h profile
+// costs in RAM and where it ran short. It needs NET_BENCH defined for lwipopts.h,
+// which turns on MEM_STATS and MEMP_STATS. The wire format is in net_bench_wire.h.
+
+struct net_bench_result {
+    bool ok;                    // false if the test couldn't start or was cut off
+    uint64_t bytes;             // payload sent (acked for TCP) or received
+    uint32_t elapsed_ms;
+    uint32_t datagrams;
+    uint32_t lost;              // UDP_RX: sequence gaps
+    uint32_t send_errors;       // tcp_write() or udp_sendto() out of memory
+};
+
+struct net_bench_mem {
+    uint32_t static_bytes;      // MEM_SIZE plus every memp pool
+    uint32_t peak_bytes;        // heap and pool high water marks
+    uint32_t mem_err;           // heap allocations that failed
+    uint32_t pbuf_pool_err;     // receive buffers, PBUF_POOL_SIZE
+    uint32_t pbuf_err;          // by-reference pbufs, MEMP_NUM_PBUF
+    uint32_t tcp_seg_err;       // MEMP_NUM_TCP_SEG
+};
+
+extern const char *const net_bench_mode_names[NET_BENCH_MODES];
+
+// Starts a test, false if one is running or it can't
+bool net_bench_start(enum net_bench_mode mode, const ip_addr_t *peer, uint16_t port,
+                     uint32_t seconds, uint32_t rate_kbps);
+
+// True once the test has finished, with its result
+bool net_bench_done(struct net_bench_result *result);
+
+// reset starts the high water marks and counters over, for the next test
+void net_bench_get_mem(struct net_bench_mem *mem, bool reset);
+
+// One line with the profile, the test and both sets of numbers
+void net_bench_print(enum net_bench_mode mode, const struct net_bench_result *result,
+                     const struct net_bench_mem *mem);
+
+#endif
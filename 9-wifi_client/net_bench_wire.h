@@ -0,0 +1,44 @@
+#ifndef _NET_BENCH_WIRE_H
+#define _NET_BENCH_WIRE_H
+
+#include <stdint.h>
+
+// What net_bench and host/net_bench_peer say to each other, without lwIP so the peer
+// builds with plain sockets. Little endian.
+//
+//   TCP    struct net_bench_hello, then the test data
+//   UDP    struct net_bench_hello on its own, then datagrams of NET_BENCH_UDP_LEN
+//          that start with struct net_bench_dgram
+
+#define NET_BENCH_PORT          5001
+#define NET_BENCH_HELLO         0x4948424eu     // "NBHI" on the wire
+#define NET_BENCH_MAGIC         0x4e45424eu     // "NBEN", datagrams
+// UDP payload, fills a 1500 byte MTU
+#define NET_BENCH_UDP_LEN       1472
+#define NET_BENCH_UDP_END       1               // flags: the last datagrams of a test
+
+enum net_bench_mode {
+    NET_BENCH_TCP_TX = 0,
+    NET_BENCH_TCP_RX,
+    NET_BENCH_UDP_TX,
+    NET_BENCH_UDP_RX,
+    NET_BENCH_MODES
+};
+
+// first bytes of a test
+struct net_bench_hello {
+    uint32_t magic;
+    uint8_t mode;
+    uint8_t reserved;
+    uint16_t seconds;
+    uint32_t rate_kbps;
+};
+
+// starts every datagram
+struct net_bench_dgram {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t flags;
+};
+
+#endif
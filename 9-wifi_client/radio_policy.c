@@ -0,0 +1,159 @@
+#include <string.h>
+#include "pico/cyw43_arch.h"
+#include "radio_policy.h"
+
+const char *const radio_policy_names[RADIO_POLICIES] = {
+    [RADIO_POLICY_ALWAYS_ON] = "always on",
+    [RADIO_POLICY_POWER_SAVE] = "power save",
+    [RADIO_POLICY_DUTY_CYCLE] = "duty cycle",
+};
+
+const char *const radio_state_names[RADIO_STATES] = {
+    [RADIO_PERFORMANCE] = "performance",
+    [RADIO_POWER_SAVE] = "power save",
+    [RADIO_OFF] = "off",
+};
+
+static const uint32_t state_ua[RADIO_STATES] = {
+    [RADIO_PERFORMANCE] = RADIO_POLICY_PERFORMANCE_UA,
+    [RADIO_POWER_SAVE] = RADIO_POLICY_POWER_SAVE_UA,
+    [RADIO_OFF] = RADIO_POLICY_OFF_UA,
+};
+
+static struct {
+    const struct radio_policy_config *config;
+    uint32_t (*now_ms)(void);
+
+    enum radio_state state;
+    uint32_t state_start_ms;    // time counted up to here
+
+    bool open;
+    uint32_t next_window_ms;
+    uint32_t window_start_ms;
+    uint32_t window_put;        // put when it opened, it closes once these are taken
+    uint32_t last_put;          // at the last window, nothing new means no wake
+
+    struct radio_policy_stats stats;
+} radio;
+
+// time so far goes to the state it was spent in
+static void count_time(void) {
+    uint32_t now = radio.now_ms();
+    radio.stats.state_ms[radio.state] += now - radio.state_start_ms;
+    radio.state_start_ms = now;
+}
+
+static void set_state(enum radio_state state) {
+    count_time();
+    if (state == radio.state)
+        return;
+    switch (state) {
+    case RADIO_PERFORMANCE:
+        cyw43_wifi_pm(&cyw43_state, CYW43_PERFORMANCE_PM);
+        break;
+    case RADIO_POWER_SAVE:
+        cyw43_wifi_pm(&cyw43_state, CYW43_AGGRESSIVE_PM);
+        break;
+    case RADIO_OFF:
+        cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+        break;
+    default:
+        break;
+    }
+    radio.state = state;
+}
+
+static enum radio_state idle_state(void) {
+    return radio.config->policy == RADIO_POLICY_DUTY_CYCLE ? RADIO_OFF : RADIO_POWER_SAVE;
+}
+
+// false if the radio didn't come up, the window is given up
+static bool open_window(uint32_t put) {
+    radio.stats.windows++;
+    if (radio.state == RADIO_OFF) {
+        uint32_t start = radio.now_ms();
+        // the join counts as performance time, the radio is busy throughout
+        count_time();
+        radio.state = RADIO_PERFORMANCE;
+        int err = wifi_conn_connect(radio.config->wifi, NULL);
+        radio.stats.joins++;
+        radio.stats.join_ms += radio.now_ms() - start;
+        if (err != PICO_OK) {
+            radio.stats.join_failures++;
+            set_state(RADIO_OFF);
+            return false;
+        }
+    }
+    set_state(RADIO_PERFORMANCE);
+    radio.open = true;
+    radio.window_start_ms = radio.now_ms();
+    radio.window_put = put;
+    return true;
+}
+
+static void close_window(void) {
+    radio.open = false;
+    set_state(idle_state());
+}
+
+/* API */
+
+void radio_policy_init(const struct radio_policy_config *config, uint32_t (*now_ms)(void)) {
+    memset(&radio, 0, sizeof(radio));
+    radio.config = config;
+    radio.now_ms = now_ms;
+    // associated and in performance, as cyw43_arch leaves it once joined
+    radio.state = RADIO_PERFORMANCE;
+    radio.state_start_ms = now_ms();
+    cyw43_wifi_pm(&cyw43_state, CYW43_PERFORMANCE_PM);
+    if (config->policy != RADIO_POLICY_ALWAYS_ON)
+        set_state(idle_state());
+    radio.next_window_ms = radio.state_start_ms + config->window_ms;
+}
+
+bool radio_policy_poll(uint32_t backlog, uint32_t put) {
+    if (radio.config->policy == RADIO_POLICY_ALWAYS_ON)
+        return true;
+    uint32_t now = radio.now_ms();
+
+    if (radio.open) {
+        // put - backlog is what was taken (or dropped), in order, so everything from
+        // before the window has gone once it reaches window_put
+        bool done = (int32_t)(put - backlog - radio.window_put) >= 0;
+        if (!done && now - radio.window_start_ms < radio.config->max_awake_ms)
+            return true;
+        if (!done)
+            radio.stats.cut++;
+        close_window();
+        return false;
+    }
+
+    if ((int32_t)(now - radio.next_window_ms) < 0)
+        return false;
+    // windows stay on their schedule unless one overran it
+    radio.next_window_ms += radio.config->window_ms;
+    if ((int32_t)(now - radio.next_window_ms) >= 0)
+        radio.next_window_ms = now + radio.config->window_ms;
+    if (put == radio.last_put && !backlog) {
+        radio.stats.skipped++;
+        return false;
+    }
+    radio.last_put = put;
+    return open_window(put);
+}
+
+void radio_policy_get_stats(struct radio_policy_stats *stats, bool reset) {
+    count_time();
+    *stats = radio.stats;
+    if (reset)
+        memset(&radio.stats, 0, sizeof(radio.stats));
+}
+
+uint32_t radio_policy_average_ua(const struct radio_policy_stats *stats) {
+    uint64_t charge = 0, ms = 0;
+    for (int state = 0; state < RADIO_STATES; state++) {
+        charge += (uint64_t)stats->state_ms[state] * state_ua[state];
+        ms += stats->state_ms[state];
+    }
+    return ms ? charge / ms : 0;
+}
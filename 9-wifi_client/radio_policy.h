@@ -0,0 +1,92 @@
+#ifndef _RADIO_POLICY_H
+#define _RADIO_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wifi_conn.h"
+
+// When the CYW43 radio is up, for a node whose telemetry link queues samples
+// (tcp_stream.c, mqtt_forward.c) and sends them from its poll.
+//
+// RADIO_POLICY_ALWAYS_ON keeps the radio in CYW43_PERFORMANCE_PM and lets the link
+// send whenever it has a batch, the lowest latency. The other two open a send window
+// every window_ms: the link is only polled while one is open, so what it queued since
+// the last one goes out back to back and the radio wakes once per window rather than
+// once per batch. A window closes once everything queued before it opened has been
+// taken, or after max_awake_ms.
+//
+//   RADIO_POLICY_POWER_SAVE   stays associated, CYW43_AGGRESSIVE_PM between windows
+//                             (the radio sleeps between beacons), CYW43_PERFORMANCE_PM
+//                             while one is open
+//   RADIO_POLICY_DUTY_CYCLE   leaves the network between windows and joins again with
+//                             wifi_conn_connect(), its cached path, when one opens
+//
+// A window with nothing queued since the last one is skipped. Latency is up to
+// window_ms plus the drain, and the queue has to hold a window's samples. Off means
+// not associated: no beacons to wake for and no traffic, but the chip stays powered,
+// cyw43_arch_deinit() would cost a firmware download on every wake.
+//
+// The time in each state is counted; with a current for each the average current
+// comes out as an energy proxy. The RADIO_POLICY_*_UA defaults are rough, measure the
+// board at the supply and set them. Not thread safe, call from the thread that owns
+// cyw43_arch, without the lwIP lock.
+
+// per state, in uA
+#ifndef RADIO_POLICY_PERFORMANCE_UA
+#define RADIO_POLICY_PERFORMANCE_UA     40000
+#endif
+#ifndef RADIO_POLICY_POWER_SAVE_UA
+#define RADIO_POLICY_POWER_SAVE_UA      2000
+#endif
+#ifndef RADIO_POLICY_OFF_UA
+#define RADIO_POLICY_OFF_UA             500
+#endif
+
+// plain numbers so a build can pick one with -DRADIO_POLICY=RADIO_POLICY_... and test it in #if
+#define RADIO_POLICY_ALWAYS_ON          0
+#define RADIO_POLICY_POWER_SAVE         1
+#define RADIO_POLICY_DUTY_CYCLE         2
+#define RADIO_POLICIES                  3
+
+enum radio_state {
+    RADIO_PERFORMANCE = 0,
+    RADIO_POWER_SAVE,
+    RADIO_OFF,
+    RADIO_STATES
+};
+
+extern const char *const radio_policy_names[RADIO_POLICIES];
+extern const char *const radio_state_names[RADIO_STATES];
+
+struct radio_policy_config {
+    uint32_t policy;            // RADIO_POLICY_...
+    uint32_t window_ms;         // one send window every this long
+    uint32_t max_awake_ms;      // a window closes after this even with samples left
+    const struct wifi_conn_config *wifi;    // to join again with RADIO_POLICY_DUTY_CYCLE
+};
+
+struct radio_policy_stats {
+    uint32_t state_ms[RADIO_STATES];
+    uint32_t windows;           // opened
+    uint32_t skipped;           // nothing queued, the radio stayed down
+    uint32_t cut;               // closed at max_awake_ms with samples left
+    uint32_t joins;             // RADIO_POLICY_DUTY_CYCLE wakes
+    uint32_t join_failures;
+    uint32_t join_ms;           // over joins, failed ones included
+};
+
+// Puts the radio in the policy's state between windows, the first window opens
+// window_ms from now. config has to outlive the policy
+void radio_policy_init(const struct radio_policy_config *config, uint32_t (*now_ms)(void));
+
+// Opens and closes windows. backlog is what the link has queued and not had taken,
+// put counts every sample ever put, free running. True while the link may send, poll
+// it only then. Joining blocks for as long as wifi_conn_connect() takes
+bool radio_policy_poll(uint32_t backlog, uint32_t put);
+
+void radio_policy_get_stats(struct radio_policy_stats *stats, bool reset);
+
+// The state times weighted by the RADIO_POLICY_*_UA currents, 0 without time counted
+uint32_t radio_policy_average_ua(const struct radio_policy_stats *stats);
+
+#endif
@@ -0,0 +1,196 @@
+#include <string.h>
+#include "lwip/tcp.h"
+#include "tcp_stream.h"
+
+#define RING_MASK       (TCP_STREAM_RING_RECORDS - 1)
+#define RECORD_LEN      sizeof(struct tcp_stream_record)
+
+_Static_assert((TCP_STREAM_RING_RECORDS & RING_MASK) == 0, "TCP_STREAM_RING_RECORDS must be a power of 2");
+
+static struct {
+    struct tcp_stream_record ring[TCP_STREAM_RING_RECORDS];
+    // free running indices, masked on access: acked <= queued <= head
+    uint32_t head;              // next record put
+    uint32_t queued;            // next record handed to tcp_write()
+    uint32_t acked;             // oldest record the server hasn't acked
+    uint32_t ack_bytes;         // acked bytes short of a whole record
+    uint32_t seq;
+
+    struct tcp_pcb *pcb;
+    bool connected;
+    ip_addr_t server;
+    uint16_t port;
+    uint32_t next_connect_us;
+    uint32_t (*now_us)(void);
+
+    struct tcp_stream_stats stats;
+} stream;
+
+static void schedule_reconnect(void) {
+    stream.pcb = NULL;
+    stream.connected = false;
+    stream.next_connect_us = stream.now_us() + TCP_STREAM_RECONNECT_MS * 1000;
+}
+
+// the pcb is already freed when this is called
+static void stream_err(void *arg, err_t err) {
+    schedule_reconnect();
+}
+
+static err_t stream_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    uint32_t now = stream.now_us();
+    uint32_t bytes = stream.ack_bytes + len;
+
+    // whole records only, the ring slots are free once lwIP is done with them
+    while (bytes >= RECORD_LEN) {
+        const struct tcp_stream_record *r = &stream.ring[stream.acked & RING_MASK];
+        uint32_t latency_us = now - r->timestamp_us;
+        stream.stats.latency_total_us += latency_us;
+        if (latency_us > stream.stats.latency_max_us)
+            stream.stats.latency_max_us = latency_us;
+        stream.stats.records++;
+        stream.acked++;
+        bytes -= RECORD_LEN;
+    }
+    stream.ack_bytes = bytes;
+    return ERR_OK;
+}
+
+static err_t stream_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    if (!p) {
+        // the server closed, start over with a new connection
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    // nothing is expected back, throw it away
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t stream_connected(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK)
+        return err;
+    // what wasn't acked on the last connection goes again
+    stream.stats.resent += stream.queued - stream.acked;
+    stream.queued = stream.acked;
+    stream.ack_bytes = 0;
+    stream.connected = true;
+    stream.stats.connects++;
+    return ERR_OK;
+}
+
+static void start_connect(void) {
+    struct tcp_pcb *pcb = tcp_new_ip_type(IP_GET_TYPE(&stream.server));
+    if (!pcb) {
+        schedule_reconnect();
+        return;
+    }
+#ifdef TCP_STREAM_NODELAY
+    tcp_nagle_disable(pcb);
+#endif
+    tcp_arg(pcb, NULL);
+    tcp_err(pcb, stream_err);
+    tcp_sent(pcb, stream_sent);
+    tcp_recv(pcb, stream_recv);
+    stream.pcb = pcb;
+    if (tcp_connect(pcb, &stream.server, stream.port, stream_connected) != ERR_OK) {
+        tcp_abort(pcb);
+        schedule_reconnect();
+    }
+}
+
+// a batch fills a segment, or has waited long enough
+static bool batch_ready(void) {
+    uint32_t unsent = stream.head - stream.queued;
+    if (!unsent)
+        return false;
+    if (unsent * RECORD_LEN >= tcp_mss(stream.pcb))
+        return true;
+    const struct tcp_stream_record *oldest = &stream.ring[stream.queued & RING_MASK];
+    return stream.now_us() - oldest->timestamp_us >= TCP_STREAM_MAX_DELAY_MS * 1000;
+}
+
+static void write_batches(void) {
+    struct tcp_pcb *pcb = stream.pcb;
+    bool written = false;
+
+    if (!batch_ready())
+        return;
+    while (stream.queued != stream.head) {
+        // the segment queue runs out before the send buffer with many small writes
+        if (tcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN - 1)
+            break;
+        uint32_t room = tcp_sndbuf(pcb) / RECORD_LEN;
+        if (!room) {
+            stream.stats.sndbuf_stalls++;
+            break;
+        }
+        // up to the end of the ring, the rest in the next write
+        uint32_t start = stream.queued & RING_MASK;
+        uint32_t n = stream.head - stream.queued;
+        if (n > TCP_STREAM_RING_RECORDS - start)
+            n = TCP_STREAM_RING_RECORDS - start;
+        if (n > room)
+            n = room;
+        bool more = stream.queued + n != stream.head;
+        // no copy: the segments point into the ring until the data is acked
+        err_t err = tcp_write(pcb, &stream.ring[start], n * RECORD_LEN, more ? TCP_WRITE_FLAG_MORE : 0);
+        if (err != ERR_OK)
+            break;
+        stream.queued += n;
+        stream.stats.writes++;
+        written = true;
+    }
+    if (written)
+        tcp_output(pcb);
+}
+
+/* API */
+
+void tcp_stream_init(const ip_addr_t *server, uint16_t port, uint32_t (*now_us)(void)) {
+    memset(&stream, 0, sizeof(stream));
+    ip_addr_copy(stream.server, *server);
+    stream.port = port;
+    stream.now_us = now_us;
+    stream.next_connect_us = now_us();
+}
+
+bool tcp_stream_put(int32_t value) {
+    uint32_t seq = stream.seq++;
+    if (stream.head - stream.acked >= TCP_STREAM_RING_RECORDS) {
+        stream.stats.dropped++;
+        return false;
+    }
+    struct tcp_stream_record *r = &stream.ring[stream.head & RING_MASK];
+    r->seq = seq;
+    r->timestamp_us = stream.now_us();
+    r->value = value;
+    r->check = r->seq ^ r->timestamp_us ^ (uint32_t)r->value ^ TCP_STREAM_CHECK;
+    stream.head++;
+    return true;
+}
+
+uint32_t tcp_stream_free(void) {
+    return TCP_STREAM_RING_RECORDS - (stream.head - stream.acked);
+}
+
+void tcp_stream_poll(void) {
+    if (!stream.pcb) {
+        if ((int32_t)(stream.now_us() - stream.next_connect_us) >= 0)
+            start_connect();
+        return;
+    }
+    if (stream.connected)
+        write_batches();
+}
+
+bool tcp_stream_connected(void) {
+    return stream.connected;
+}
+
+void tcp_stream_get_stats(struct tcp_stream_stats *stats, bool reset) {
+    *stats = stream.stats;
+    if (reset)
+        memset(&stream.stats, 0, sizeof(stream.stats));
+}
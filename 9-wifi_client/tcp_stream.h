@@ -0,0 +1,80 @@
+#ifndef _TCP_STREAM_H
+#define _TCP_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lwip/ip_addr.h"
+
+// Fixed size records streamed to a TCP server with the lwIP raw API, without copying
+// them into lwIP.
+//
+// Records go into a ring and stay there until the server has acked them. tcp_write()
+// is called without TCP_WRITE_FLAG_COPY, so the segments reference the ring (PBUF_ROM,
+// lwIP's by-reference pbuf for data that doesn't change) and retransmissions read it
+// from there too. LWIP_NETIF_TX_SINGLE_PBUF has to be off, tcp_write() copies
+// everything with it on; the one copy left is the cyw43 driver's into its bus buffer.
+//
+// Batching works with Nagle rather than around it: records are written once they
+// fill a segment, which Nagle never holds back, or once the oldest of them is
+// TCP_STREAM_MAX_DELAY_MS old. How much is written is bounded by tcp_sndbuf() and
+// the segment queue, what doesn't fit stays in the ring. A full ring drops new
+// records, the sequence numbers show the gap.
+//
+// After a reconnect everything not acked is sent again, the server drops records
+// with a sequence number it has seen. All calls with the lwIP lock held
+// (cyw43_arch_lwip_begin() on the Pico).
+//
+// A record on the wire, little endian:
+//
+//   seq           counts every record put, dropped ones included
+//   timestamp_us  when it was put, on the sender's clock
+//   value
+//   check         seq ^ timestamp_us ^ value ^ TCP_STREAM_CHECK
+
+// records, a power of 2. Should hold more than TCP_SND_BUF, 16KB by default
+#ifndef TCP_STREAM_RING_RECORDS
+#define TCP_STREAM_RING_RECORDS     1024
+#endif
+
+#ifndef TCP_STREAM_MAX_DELAY_MS
+#define TCP_STREAM_MAX_DELAY_MS     50
+#endif
+
+#define TCP_STREAM_RECONNECT_MS     2000
+#define TCP_STREAM_CHECK            0x5354524du
+
+struct tcp_stream_record {
+    uint32_t seq;
+    uint32_t timestamp_us;
+    int32_t value;
+    uint32_t check;
+};
+
+struct tcp_stream_stats {
+    uint32_t records;           // acked by the server
+    uint32_t dropped;           // ring full
+    uint32_t resent;            // not acked before a reconnect, sent again
+    uint32_t writes;            // tcp_write() calls
+    uint32_t sndbuf_stalls;     // polls with a batch ready but no send buffer for it
+    uint32_t connects;
+    uint64_t latency_total_us;  // put to acked, over records
+    uint32_t latency_max_us;
+};
+
+// now_us is the clock for timestamps and batching, wrapping at 32 bits is fine
+void tcp_stream_init(const ip_addr_t *server, uint16_t port, uint32_t (*now_us)(void));
+
+// Appends a record, false if the ring is full
+bool tcp_stream_put(int32_t value);
+
+// Records that can be put now, for producers that would rather wait than drop
+uint32_t tcp_stream_free(void);
+
+// Connects or reconnects and writes what is ready, call often
+void tcp_stream_poll(void);
+
+bool tcp_stream_connected(void);
+
+void tcp_stream_get_stats(struct tcp_stream_stats *stats, bool reset);
+
+#endif
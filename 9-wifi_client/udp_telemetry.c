@@ -0,0 +1,143 @@
+#include <string.h>
+#include "lwip/igmp.h"
+#include "lwip/netif.h"
+#include "lwip/udp.h"
+#include "udp_telemetry.h"
+
+#if !LWIP_IGMP
+#error udp_telemetry needs LWIP_IGMP for discovery
+#endif
+
+static struct {
+    // one datagram, handed to lwIP by reference when it goes
+    struct {
+        struct udp_telemetry_header header;
+        struct udp_telemetry_sample samples[UDP_TELEMETRY_MAX_SAMPLES];
+    } batch;
+    uint32_t node_id;
+    uint32_t seq;
+
+    struct udp_pcb *pcb;
+    ip_addr_t group;
+    ip_addr_t collector;
+    uint16_t collector_port;
+    bool discovered;
+    uint32_t last_beacon_us;
+    uint32_t next_query_us;
+    uint32_t (*now_us)(void);
+
+    struct udp_telemetry_stats stats;
+} telemetry;
+
+static void send_query(void) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct udp_telemetry_discovery), PBUF_RAM);
+    if (!p)
+        return;
+    struct udp_telemetry_discovery *q = p->payload;
+    q->magic = UDP_TELEMETRY_DISCOVERY_MAGIC;
+    q->type = UDP_TELEMETRY_QUERY;
+    q->port = 0;
+    q->node_id = telemetry.node_id;
+    if (udp_sendto(telemetry.pcb, p, &telemetry.group, UDP_TELEMETRY_DISCOVERY_PORT) == ERR_OK)
+        telemetry.stats.queries++;
+    pbuf_free(p);
+}
+
+// beacons, multicast or in answer to a query
+static void discovery_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    struct udp_telemetry_discovery d;
+    if (pbuf_copy_partial(p, &d, sizeof(d), 0) == sizeof(d) && d.magic == UDP_TELEMETRY_DISCOVERY_MAGIC &&
+        d.type == UDP_TELEMETRY_BEACON && d.port) {
+        // the first collector heard wins until it goes quiet
+        if (!telemetry.discovered || (ip_addr_cmp(addr, &telemetry.collector) && d.port == telemetry.collector_port)) {
+            ip_addr_copy(telemetry.collector, *addr);
+            telemetry.collector_port = d.port;
+            telemetry.discovered = true;
+            telemetry.last_beacon_us = telemetry.now_us();
+            telemetry.stats.beacons++;
+        }
+    }
+    pbuf_free(p);
+}
+
+static bool send_batch(uint16_t len) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_REF);
+    if (!p)
+        return false;
+    // no copy here, the driver copies the frame out (or ARP a pbuf it has to queue)
+    // before udp_sendto() returns and the batch starts over
+    p->payload = &telemetry.batch;
+    err_t err = udp_sendto(telemetry.pcb, p, &telemetry.collector, telemetry.collector_port);
+    pbuf_free(p);
+    return err == ERR_OK;
+}
+
+static void flush(void) {
+    struct udp_telemetry_header *h = &telemetry.batch.header;
+    h->seq = telemetry.seq++;
+    h->sent_us = telemetry.now_us();
+    if (!telemetry.discovered) {
+        telemetry.stats.dropped += h->count;
+    } else if (!send_batch(sizeof(*h) + h->count * sizeof(struct udp_telemetry_sample))) {
+        telemetry.stats.send_errors++;
+        telemetry.stats.dropped += h->count;
+    } else {
+        telemetry.stats.datagrams++;
+        telemetry.stats.samples += h->count;
+    }
+    h->count = 0;
+}
+
+/* API */
+
+bool udp_telemetry_init(uint32_t node_id, uint32_t (*now_us)(void)) {
+    memset(&telemetry, 0, sizeof(telemetry));
+    telemetry.node_id = node_id;
+    telemetry.now_us = now_us;
+    telemetry.next_query_us = now_us();
+    telemetry.batch.header.magic = UDP_TELEMETRY_MAGIC;
+    telemetry.batch.header.node_id = node_id;
+    ipaddr_aton(UDP_TELEMETRY_GROUP, &telemetry.group);
+
+    telemetry.pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (!telemetry.pcb)
+        return false;
+    // beacons come to the group and the port, answers to queries to the port
+    udp_bind(telemetry.pcb, IP4_ADDR_ANY, UDP_TELEMETRY_DISCOVERY_PORT);
+    udp_recv(telemetry.pcb, discovery_recv, NULL);
+    igmp_joingroup_netif(netif_default, ip_2_ip4(&telemetry.group));
+    return true;
+}
+
+void udp_telemetry_put(int32_t value) {
+    struct udp_telemetry_header *h = &telemetry.batch.header;
+    uint32_t now = telemetry.now_us();
+    if (!h->count)
+        h->base_us = now;
+    telemetry.batch.samples[h->count++] = (struct udp_telemetry_sample){ now - h->base_us, value };
+    if (h->count == UDP_TELEMETRY_MAX_SAMPLES)
+        flush();
+}
+
+void udp_telemetry_poll(void) {
+    uint32_t now = telemetry.now_us();
+    if (telemetry.discovered && now - telemetry.last_beacon_us >= UDP_TELEMETRY_LOST_MS * 1000)
+        telemetry.discovered = false;
+    if (!telemetry.discovered && (int32_t)(now - telemetry.next_query_us) >= 0) {
+        send_query();
+        telemetry.next_query_us = now + UDP_TELEMETRY_QUERY_MS * 1000;
+    }
+    struct udp_telemetry_header *h = &telemetry.batch.header;
+    if (h->count && now - h->base_us >= UDP_TELEMETRY_MAX_DELAY_MS * 1000)
+        flush();
+}
+
+bool udp_telemetry_discovered(void) {
+    return telemetry.discovered;
+}
+
+void udp_telemetry_get_stats(struct udp_telemetry_stats *stats, bool reset) {
+    *stats = telemetry.stats;
+    if (reset)
+        memset(&telemetry.stats, 0, sizeof(telemetry.stats));
+}
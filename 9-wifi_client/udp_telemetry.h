@@ -0,0 +1,98 @@
+#ifndef _UDP_TELEMETRY_H
+#define _UDP_TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Samples batched into UDP datagrams for a collector that serves many nodes, see
+// host/udp_collector.cpp. One socket there takes every node, where TCP would need a
+// connection each.
+//
+// Samples collect in a batch until it fills a datagram up to the MTU or its oldest
+// sample is UDP_TELEMETRY_MAX_DELAY_MS old. Every datagram has a sequence number
+// and the time it was sent, the collector counts the gaps as loss and the age of the
+// samples as latency. Nothing is resent: a lost datagram is a gap in the data.
+//
+// Discovery: a node multicasts a query to UDP_TELEMETRY_GROUP every second until a
+// collector answers with a beacon, which says where the telemetry goes. Collectors
+// also multicast a beacon every few seconds, and a node that hasn't heard one for
+// UDP_TELEMETRY_LOST_MS asks again. Batches that fill up before a collector is known
+// are dropped, their sequence numbers still count so the collector sees the gap.
+//
+// Needs LWIP_IGMP for the group. All calls with the lwIP lock held
+// (cyw43_arch_lwip_begin() on the Pico). On the wire, little endian:
+//
+//   datagram   struct udp_telemetry_header, then count struct udp_telemetry_sample
+//   discovery  struct udp_telemetry_discovery, to and from UDP_TELEMETRY_DISCOVERY_PORT
+
+#define UDP_TELEMETRY_GROUP             "239.255.77.77"
+#define UDP_TELEMETRY_DISCOVERY_PORT    4244
+#define UDP_TELEMETRY_DATA_PORT         4243
+
+#define UDP_TELEMETRY_MAGIC             0x4d4c5455u     // "UTLM"
+#define UDP_TELEMETRY_DISCOVERY_MAGIC   0x43534455u     // "UDSC"
+
+// IP and UDP headers off a 1500 byte MTU, no fragments
+#define UDP_TELEMETRY_MAX_PAYLOAD       1472
+
+#ifndef UDP_TELEMETRY_MAX_DELAY_MS
+#define UDP_TELEMETRY_MAX_DELAY_MS      50
+#endif
+
+#define UDP_TELEMETRY_QUERY_MS          1000
+#define UDP_TELEMETRY_BEACON_MS         2000
+#define UDP_TELEMETRY_LOST_MS           (5 * UDP_TELEMETRY_BEACON_MS)
+
+struct udp_telemetry_header {
+    uint32_t magic;
+    uint32_t node_id;
+    uint32_t seq;               // datagrams, dropped ones included
+    uint32_t sent_us;           // node clock when it was sent
+    uint32_t base_us;           // node clock of the first sample
+    uint16_t count;
+    uint16_t reserved;
+};
+
+struct udp_telemetry_sample {
+    uint32_t offset_us;         // after base_us
+    int32_t value;
+};
+
+#define UDP_TELEMETRY_MAX_SAMPLES \
+    ((UDP_TELEMETRY_MAX_PAYLOAD - sizeof(struct udp_telemetry_header)) / sizeof(struct udp_telemetry_sample))
+
+enum udp_telemetry_discovery_type {
+    UDP_TELEMETRY_QUERY = 1,    // node to group
+    UDP_TELEMETRY_BEACON,       // collector to group, or to the node that asked
+};
+
+struct udp_telemetry_discovery {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t port;              // beacon: where datagrams go, on the beacon's source address
+    uint32_t node_id;           // query: who is asking
+};
+
+struct udp_telemetry_stats {
+    uint32_t datagrams;
+    uint32_t samples;           // sent
+    uint32_t dropped;           // samples in batches with no collector to go to
+    uint32_t send_errors;
+    uint32_t queries;
+    uint32_t beacons;
+};
+
+// node_id tells this node apart at the collector, now_us is the clock for the
+// samples and timers, wrapping at 32 bits is fine. False if lwIP is out of pcbs
+bool udp_telemetry_init(uint32_t node_id, uint32_t (*now_us)(void));
+
+void udp_telemetry_put(int32_t value);
+
+// Sends a batch that has waited long enough, runs discovery, call often
+void udp_telemetry_poll(void);
+
+bool udp_telemetry_discovered(void);
+
+void udp_telemetry_get_stats(struct udp_telemetry_stats *stats, bool reset);
+
+#endif
@@ -1,9 +1,351 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "pico/unique_id.h"
+#include "hardware/adc.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "http_metrics.h"
+#include "mqtt_forward.h"
+#include "radio_policy.h"
+#include "tcp_stream.h"
+#include "udp_telemetry.h"
+#include "wifi_conn.h"
+
+// TCP to STREAM_SERVER by default, with TELEMETRY_UDP batched datagrams to whichever
+// collector answers on the multicast group (host/udp_collector.cpp), with
+// TELEMETRY_MQTT batched publishes to MQTT_BROKER, queued while it can't be reached
+
+// set with -DWIFI_SSID=.. -DWIFI_PASSWORD=.. -DSTREAM_SERVER=.. -DMQTT_BROKER=.. on the cmake command line
+#ifndef STREAM_SERVER_PORT
+#define STREAM_SERVER_PORT  4242
+#endif
+
+// records per second, each one a reading of the on-chip temperature sensor
+#ifndef RECORD_RATE_HZ
+#define RECORD_RATE_HZ      100
+#endif
+
+#define STATS_INTERVAL_MS   5000
+
+// RADIO_POLICY_ALWAYS_ON unless the build picks another, see radio_policy.h
+#ifndef RADIO_POLICY
+#define RADIO_POLICY        RADIO_POLICY_ALWAYS_ON
+#endif
+#ifndef RADIO_WINDOW_MS
+#define RADIO_WINDOW_MS     5000
+#endif
+#ifndef RADIO_MAX_AWAKE_MS
+#define RADIO_MAX_AWAKE_MS  2000
+#endif
+
+#if defined(TELEMETRY_UDP) && RADIO_POLICY != RADIO_POLICY_ALWAYS_ON
+#error "udp_telemetry.c sends full batches from its put and queues nothing, it needs RADIO_POLICY_ALWAYS_ON"
+#endif
+
+// scraped from http://<address>/metrics, in this order
+enum { METRIC_TEMPERATURE, METRIC_SAMPLES, METRIC_UPTIME, METRIC_DROPPED, METRIC_COUNT };
+
+static const struct http_metrics_def metric_defs[METRIC_COUNT] = {
+    [METRIC_TEMPERATURE] = { "pico_temperature_celsius", "On-chip temperature sensor", false, 3 },
+    [METRIC_SAMPLES] = { "pico_samples_total", "Samples taken", true, 0 },
+    [METRIC_UPTIME] = { "pico_uptime_seconds", "Time since boot", false, 3 },
+    [METRIC_DROPPED] = { "pico_telemetry_dropped_total", "Samples the telemetry link dropped", true, 0 },
+};
+
+static void temp_sensor_init(void) {
+    adc_init();
+    adc_set_temp_sensor_enabled(true);
+    adc_select_input(ADC_TEMPERATURE_CHANNEL_NUM);
+}
+
+// millidegrees C, 27 degrees at 0.706V and -1.721mV per degree (see datasheet)
+static int32_t temp_sensor_read(void) {
+    // in 64 bits, raw * 3300000 overflows an int from a raw 651 up
+    int32_t uv = (int32_t)((uint64_t)adc_read() * 3300000 / 4096);
+    return 27000 - (int32_t)((int64_t)(uv - 706000) * 1000 / 1721);
+}
+
+// returns the records dropped since the last call
+static uint32_t print_stream_stats(uint32_t interval_ms) {
+    struct tcp_stream_stats stats;
+    cyw43_arch_lwip_begin();
+    tcp_stream_get_stats(&stats, true);
+    bool connected = tcp_stream_connected();
+    cyw43_arch_lwip_end();
+
+    printf("%s: %u records acked (%u/s, %u B/s), %u dropped, %u resent, %u writes, %u sndbuf stalls",
+           connected ? "connected" : "not connected", stats.records,
+           stats.records * 1000 / interval_ms,
+           stats.records * (uint32_t)sizeof(struct tcp_stream_record) * 1000 / interval_ms,
+           stats.dropped, stats.resent, stats.writes, stats.sndbuf_stalls);
+    if (stats.records)
+        printf(", put to ack avg %u us max %u us", (uint32_t)(stats.latency_total_us / stats.records), stats.latency_max_us);
+    printf("\n");
+    return stats.dropped;
+}
+
+// returns the samples dropped since the last call
+static uint32_t print_telemetry_stats(uint32_t interval_ms) {
+    struct udp_telemetry_stats stats;
+    cyw43_arch_lwip_begin();
+    udp_telemetry_get_stats(&stats, true);
+    bool discovered = udp_telemetry_discovered();
+    cyw43_arch_lwip_end();
+
+    printf("%s: %u samples in %u datagrams (%u/s), %u dropped, %u send errors, %u queries, %u beacons\n",
+           discovered ? "collector found" : "no collector", stats.samples, stats.datagrams,
+           stats.datagrams * 1000 / interval_ms, stats.dropped, stats.send_errors, stats.queries, stats.beacons);
+    return stats.dropped;
+}
+
+// returns the samples dropped since the last call
+static uint32_t print_mqtt_stats(uint32_t interval_ms) {
+    struct mqtt_forward_stats stats;
+    cyw43_arch_lwip_begin();
+    mqtt_forward_get_stats(&stats, true);
+    bool connected = mqtt_forward_connected();
+    uint32_t backlog = mqtt_forward_backlog();
+    cyw43_arch_lwip_end();
+
+    printf("%s: %u samples in %u publishes (%u/s, %u B/s), %u queued, %u dropped, %u resent, %u stalls, %u disconnects",
+           connected ? "connected" : "not connected", stats.samples, stats.publishes,
+           stats.samples * 1000 / interval_ms, stats.payload_bytes * 1000 / interval_ms, backlog,
+           stats.dropped, stats.resent, stats.stalls, stats.disconnects);
+    if (stats.samples)
+        printf(", put to ack avg %u ms max %u ms", (uint32_t)(stats.latency_total_ms / stats.samples), stats.latency_max_ms);
+    if (stats.drain_ms)
+        printf(", last backlog of %u drained in %u ms", stats.drain_samples, stats.drain_ms);
+    printf("\n");
+    return stats.dropped;
+}
+
+static void print_http_stats(void) {
+    struct http_metrics_stats stats;
+    cyw43_arch_lwip_begin();
+    http_metrics_get_stats(&stats, true);
+    cyw43_arch_lwip_end();
+
+    printf("http: %u requests, %u not found, %u rejected, %u connections at most, %u updates (%u deferred)\n",
+           stats.requests, stats.not_found, stats.rejected, stats.conns_max, stats.updates, stats.deferred);
+}
+
+// time per radio state and what that comes to at the RADIO_POLICY_*_UA currents
+static void print_radio_stats(void) {
+    struct radio_policy_stats stats;
+    radio_policy_get_stats(&stats, true);
+
+    printf("radio:");
+    for (int state = 0; state < RADIO_STATES; state++)
+        printf(" %s %u ms,", radio_state_names[state], stats.state_ms[state]);
+    printf(" %u windows (%u skipped, %u cut short), ~%u uA average",
+           stats.windows, stats.skipped, stats.cut, radio_policy_average_ua(&stats));
+    if (stats.joins)
+        printf(", %u joins avg %u ms, %u failed", stats.joins, stats.join_ms / stats.joins, stats.join_failures);
+    printf("\n");
+}
+
+// what the collector knows this board by, the flash chip's id folded to 32 bits (FNV-1a)
+static uint32_t node_id(void) {
+    pico_unique_board_id_t board_id;
+    pico_get_unique_board_id(&board_id);
+    uint32_t hash = 2166136261u;
+    for (uint i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++)
+        hash = (hash ^ board_id.id[i]) * 16777619u;
+    return hash;
+}
+
+// wake to link up, by phase. Joins from wifi_conn.c's cache skip the scan and DHCP
+static void print_connect_times(const struct wifi_conn_times *times, uint32_t connected_us) {
+    printf("Wi-Fi up %u ms after boot: %s join %u ms, %s address %u ms",
+           connected_us / 1000, times->cached_join ? "cached" : "scan",
+           (times->cached_join ? times->cached_join_us : times->scan_join_us - times->cached_join_us) / 1000,
+           times->cached_address ? "reused" : "DHCP", times->address_us / 1000);
+    if (times->cached_join_us && !times->cached_join)
+        printf(" (cached join failed after %u ms)", times->cached_join_us / 1000);
+    if (times->save_us)
+        printf(", cache written in %u ms", times->save_us / 1000);
+    printf("\n");
+}
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
 
 int main() {
+    // Initializations
     stdio_init_all();
-    //Code here
-    
+    if (cyw43_arch_init()) {
+        printf("failed to initialise wifi\n");
+        return 1;
+    }
+    cyw43_arch_enable_sta_mode();
+    printf("Connecting to %s..\n", WIFI_SSID);
+    struct wifi_conn_config wifi = { WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK };
+#ifdef WIFI_STATIC_IP
+    wifi.static_ip = ip4addr_aton(WIFI_STATIC_IP, &wifi.ip) && ip4addr_aton(WIFI_NETMASK, &wifi.netmask) &&
+                     ip4addr_aton(WIFI_GATEWAY, &wifi.gw);
+    if (!wifi.static_ip)
+        printf("bad static address %s/%s via %s, using DHCP\n", WIFI_STATIC_IP, WIFI_NETMASK, WIFI_GATEWAY);
+#endif
+    struct wifi_conn_times times;
+    while (wifi_conn_connect(&wifi, &times) != PICO_OK)
+        printf("failed to connect, trying again\n");
+    print_connect_times(&times, time_us_32());
+    temp_sensor_init();
+    cyw43_arch_lwip_begin();
+    if (!http_metrics_init(metric_defs, METRIC_COUNT, HTTP_METRICS_PORT))
+        printf("no http server\n");
+    cyw43_arch_lwip_end();
+#ifdef TELEMETRY_UDP
+    printf("Connected as %s, node %08x, looking for a collector on %s\n",
+           ip4addr_ntoa(netif_ip4_addr(netif_default)), node_id(), UDP_TELEMETRY_GROUP);
+    cyw43_arch_lwip_begin();
+    bool started = udp_telemetry_init(node_id(), time_us_32);
+    cyw43_arch_lwip_end();
+    if (!started) {
+        printf("no udp pcb for telemetry\n");
+        return 1;
+    }
+#elif defined(TELEMETRY_MQTT)
+    // both have to outlive the publisher
+    static char client_id[16], topic[32];
+    snprintf(client_id, sizeof(client_id), "pico-%08x", node_id());
+    snprintf(topic, sizeof(topic), "pico/%08x/temperature", node_id());
+    printf("Connected as %s, publishing to %s on %s:%u\n",
+           ip4addr_ntoa(netif_ip4_addr(netif_default)), topic, MQTT_BROKER, MQTT_FORWARD_PORT);
+
+    ip_addr_t broker;
+    if (!ipaddr_aton(MQTT_BROKER, &broker)) {
+        printf("bad broker address %s\n", MQTT_BROKER);
+        return 1;
+    }
+    cyw43_arch_lwip_begin();
+    mqtt_forward_init(&broker, MQTT_FORWARD_PORT, client_id, topic, now_ms);
+    cyw43_arch_lwip_end();
+#else
+    printf("Connected as %s, streaming to %s:%u\n",
+           ip4addr_ntoa(netif_ip4_addr(netif_default)), STREAM_SERVER, STREAM_SERVER_PORT);
+
+    ip_addr_t server;
+    if (!ipaddr_aton(STREAM_SERVER, &server)) {
+        printf("bad server address %s\n", STREAM_SERVER);
+        return 1;
+    }
+    cyw43_arch_lwip_begin();
+    tcp_stream_init(&server, STREAM_SERVER_PORT, time_us_32);
+    cyw43_arch_lwip_end();
+#endif
+
+    // between windows the link only queues, it has to hold one window's records.
+    // main() doesn't return, radio and wifi outlive the policy
+    const struct radio_policy_config radio = { RADIO_POLICY, RADIO_WINDOW_MS, RADIO_MAX_AWAKE_MS, &wifi };
+#ifdef TELEMETRY_MQTT
+    const uint32_t queue_records = MQTT_FORWARD_QUEUE_SAMPLES;
+#else
+    const uint32_t queue_records = TCP_STREAM_RING_RECORDS;
+#endif
+    if (RADIO_POLICY != RADIO_POLICY_ALWAYS_ON && (uint64_t)RADIO_WINDOW_MS * RECORD_RATE_HZ / 1000 > queue_records)
+        printf("a %u ms window is more records than the link queues, some will be dropped\n", RADIO_WINDOW_MS);
+    printf("radio policy: %s, %u ms windows\n", radio_policy_names[RADIO_POLICY], RADIO_WINDOW_MS);
+    radio_policy_init(&radio, now_ms);
+
+    // Code here
+    absolute_time_t next_record = get_absolute_time();
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+    int64_t metrics[METRIC_COUNT] = {0};
+    // the link's stats start over every STATS_INTERVAL_MS, the metric doesn't
+    uint32_t dropped_total = 0;
+    // boot to the telemetry link answering, and the cache updated once DHCP has settled
+    uint32_t first_packet_us = 0;
+    bool cache_checked = false;
+    while (true) {
+        if (time_reached(next_record)) {
+            int32_t value = temp_sensor_read();
+            cyw43_arch_lwip_begin();
+#ifdef TELEMETRY_UDP
+            udp_telemetry_put(value);
+            struct udp_telemetry_stats link;
+            udp_telemetry_get_stats(&link, false);
+#elif defined(TELEMETRY_MQTT)
+            mqtt_forward_put(value);
+            struct mqtt_forward_stats link;
+            mqtt_forward_get_stats(&link, false);
+#else
+            tcp_stream_put(value);
+            struct tcp_stream_stats link;
+            tcp_stream_get_stats(&link, false);
+#endif
+            // the responses are rewritten here, not when they are scraped
+            metrics[METRIC_TEMPERATURE] = value;
+            metrics[METRIC_SAMPLES]++;
+            metrics[METRIC_UPTIME] = to_ms_since_boot(get_absolute_time());
+            metrics[METRIC_DROPPED] = dropped_total + link.dropped;
+            http_metrics_update(metrics);
+            cyw43_arch_lwip_end();
+            next_record = delayed_by_us(next_record, 1000000 / RECORD_RATE_HZ);
+        }
+        // the radio policy may join the network again, that is done without the lwIP lock
+        cyw43_arch_lwip_begin();
+#ifdef TELEMETRY_UDP
+        uint32_t backlog = 0;
+#elif defined(TELEMETRY_MQTT)
+        uint32_t backlog = mqtt_forward_backlog();
+#else
+        uint32_t backlog = TCP_STREAM_RING_RECORDS - tcp_stream_free();
+#endif
+        cyw43_arch_lwip_end();
+        bool send = radio_policy_poll(backlog, metrics[METRIC_SAMPLES]);
+
+        // batches that are full or old enough go out here, while the radio policy lets them
+        cyw43_arch_lwip_begin();
+#ifdef TELEMETRY_UDP
+        if (send)
+            udp_telemetry_poll();
+        bool link_up = udp_telemetry_discovered();
+#elif defined(TELEMETRY_MQTT)
+        if (send)
+            mqtt_forward_poll();
+        bool link_up = mqtt_forward_connected();
+#else
+        if (send)
+            tcp_stream_poll();
+        bool link_up = tcp_stream_connected();
+#endif
+        cyw43_arch_lwip_end();
+        if (link_up && !first_packet_us) {
+            first_packet_us = time_us_32();
+            printf("telemetry link up %u ms after boot\n", first_packet_us / 1000);
+        }
+
+        if (time_reached(next_stats)) {
+#ifdef TELEMETRY_UDP
+            dropped_total += print_telemetry_stats(STATS_INTERVAL_MS);
+#elif defined(TELEMETRY_MQTT)
+            dropped_total += print_mqtt_stats(STATS_INTERVAL_MS);
+#else
+            dropped_total += print_stream_stats(STATS_INTERVAL_MS);
+#endif
+            print_http_stats();
+            print_radio_stats();
+            if (!cache_checked) {
+                if (wifi_conn_save())
+                    printf("Wi-Fi cache updated\n");
+                cache_checked = true;
+            }
+            next_stats = delayed_by_ms(next_stats, STATS_INTERVAL_MS);
+        }
+        // the following #ifdef is only here so this same example can be used in multiple modes;
+        // you do not need it in your code
+#if PICO_CYW43_ARCH_POLL
+        // poll for Wi-Fi driver and lwIP work, sleep until the next record or until there is work
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(next_record);
+#else
+        // Wi-Fi driver and lwIP work is done via interrupt in the background
+        sleep_until(next_record);
+#endif
+    }
+    cyw43_arch_deinit();
     return 0;
 }
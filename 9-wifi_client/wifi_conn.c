@@ -0,0 +1,225 @@
+#include <stddef.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "lwip/dhcp.h"
+#include "lwip/netif.h"
+#include "wifi_conn.h"
+
+#define CACHE_MAGIC     0x4e4f4357u     // "WCON"
+
+// what flash holds, one page
+struct cache {
+    uint32_t magic;
+    uint32_t ssid_hash;         // another network, another cache
+    uint8_t bssid[6];
+    uint16_t channel;
+    uint32_t ip;                // 0 without a lease, static addresses come from the build
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t check;
+};
+
+static struct {
+    struct cache stored;        // as in flash, zeroed if flash has nothing valid
+    uint32_t ssid_hash;
+    bool static_ip;
+} conn;
+
+// FNV-1a
+static uint32_t hash(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t cache_check(const struct cache *c) {
+    return hash(c, offsetof(struct cache, check));
+}
+
+static void cache_load(void) {
+    memcpy(&conn.stored, (const void *)(XIP_BASE + WIFI_CONN_FLASH_OFFSET), sizeof(conn.stored));
+    if (conn.stored.magic != CACHE_MAGIC || conn.stored.check != cache_check(&conn.stored))
+        memset(&conn.stored, 0, sizeof(conn.stored));
+}
+
+// called by flash_safe_execute(), nothing else runs from flash meanwhile. NULL erases
+static void flash_write(void *param) {
+    flash_range_erase(WIFI_CONN_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+    if (!param)
+        return;
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xff, sizeof(page));
+    memcpy(page, param, sizeof(struct cache));
+    flash_range_program(WIFI_CONN_FLASH_OFFSET, page, FLASH_PAGE_SIZE);
+}
+
+static struct netif *sta_netif(void) {
+    return &cyw43_state.netif[CYW43_ITF_STA];
+}
+
+// with the lwIP lock held. DHCP is stopped first, it would take the address back
+static void set_address(uint32_t ip, uint32_t netmask, uint32_t gw) {
+    ip4_addr_t a, m, g;
+    ip4_addr_set_u32(&a, ip);
+    ip4_addr_set_u32(&m, netmask);
+    ip4_addr_set_u32(&g, gw);
+    dhcp_stop(sta_netif());
+    netif_set_addr(sta_netif(), &a, &m, &g);
+}
+
+// CYW43_LINK_JOIN once associated and keyed, a CYW43_LINK_ error, or PICO_ERROR_TIMEOUT
+static int join(const struct wifi_conn_config *config, const uint8_t *bssid, uint32_t channel, uint32_t timeout_ms) {
+    const char *pw = config->password;
+    int err = cyw43_wifi_join(&cyw43_state, strlen(config->ssid), (const uint8_t *)config->ssid,
+                              pw ? strlen(pw) : 0, (const uint8_t *)pw, pw ? config->auth : CYW43_AUTH_OPEN,
+                              bssid, channel);
+    if (err)
+        return CYW43_LINK_FAIL;
+    absolute_time_t until = make_timeout_time_ms(timeout_ms);
+    while (true) {
+        int status = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
+        if (status == CYW43_LINK_JOIN || status < 0)
+            return status;
+        if (time_reached(until))
+            return PICO_ERROR_TIMEOUT;
+        // 1ms steps, the phase times are what this is for
+#if PICO_CYW43_ARCH_POLL
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(make_timeout_time_ms(1));
+#else
+        sleep_ms(1);
+#endif
+    }
+}
+
+static bool wait_for_lease(uint32_t timeout_ms) {
+    absolute_time_t until = make_timeout_time_ms(timeout_ms);
+    while (!time_reached(until)) {
+        cyw43_arch_lwip_begin();
+        bool bound = dhcp_supplied_address(sta_netif());
+        cyw43_arch_lwip_end();
+        if (bound)
+            return true;
+#if PICO_CYW43_ARCH_POLL
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(make_timeout_time_ms(1));
+#else
+        sleep_ms(1);
+#endif
+    }
+    return false;
+}
+
+/* API */
+
+int wifi_conn_connect(const struct wifi_conn_config *config, struct wifi_conn_times *times) {
+    struct wifi_conn_times t = {0};
+    uint32_t start = time_us_32();
+    int result = PICO_OK;
+
+    conn.ssid_hash = hash(config->ssid, strlen(config->ssid));
+    conn.static_ip = config->static_ip;
+    cache_load();
+    bool cached = conn.stored.magic && conn.stored.ssid_hash == conn.ssid_hash;
+
+    // the address goes on before the join, so packets can go the moment it is done
+    bool preset = config->static_ip || (cached && conn.stored.ip);
+    cyw43_arch_lwip_begin();
+    if (config->static_ip)
+        set_address(ip4_addr_get_u32(&config->ip), ip4_addr_get_u32(&config->netmask), ip4_addr_get_u32(&config->gw));
+    else if (preset)
+        set_address(conn.stored.ip, conn.stored.netmask, conn.stored.gw);
+    cyw43_arch_lwip_end();
+
+    if (cached) {
+        int status = join(config, conn.stored.bssid, conn.stored.channel, WIFI_CONN_CACHED_TIMEOUT_MS);
+        t.cached_join_us = time_us_32() - start;
+        t.cached_join = status == CYW43_LINK_JOIN;
+        if (!t.cached_join)
+            cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+    }
+    if (!t.cached_join) {
+        // another access point may mean another network, the lease can't be trusted
+        if (preset && !config->static_ip) {
+            cyw43_arch_lwip_begin();
+            netif_set_addr(sta_netif(), IP4_ADDR_ANY4, IP4_ADDR_ANY4, IP4_ADDR_ANY4);
+            dhcp_start(sta_netif());
+            cyw43_arch_lwip_end();
+            preset = false;
+        }
+        int status = join(config, NULL, CYW43_CHANNEL_NONE, WIFI_CONN_TIMEOUT_MS);
+        t.scan_join_us = time_us_32() - start;
+        if (status != CYW43_LINK_JOIN) {
+            cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+            result = status == PICO_ERROR_TIMEOUT ? PICO_ERROR_TIMEOUT : PICO_ERROR_CONNECT_FAILED;
+        }
+    }
+
+    if (result == PICO_OK) {
+        uint32_t joined = time_us_32();
+        if (preset) {
+            t.cached_address = true;
+            // renew the reused lease next to it
+            if (!config->static_ip) {
+                cyw43_arch_lwip_begin();
+                dhcp_start(sta_netif());
+                cyw43_arch_lwip_end();
+            }
+        } else if (!wait_for_lease(WIFI_CONN_TIMEOUT_MS)) {
+            cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+            result = PICO_ERROR_TIMEOUT;
+        }
+        t.address_us = time_us_32() - joined;
+    }
+
+    if (result == PICO_OK) {
+        uint32_t before = time_us_32();
+        if (wifi_conn_save())
+            t.save_us = time_us_32() - before;
+    }
+    if (times)
+        *times = t;
+    return result;
+}
+
+bool wifi_conn_save(void) {
+    if (cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_JOIN)
+        return false;
+    struct cache c;
+    memset(&c, 0, sizeof(c));
+    c.magic = CACHE_MAGIC;
+    c.ssid_hash = conn.ssid_hash;
+    if (cyw43_wifi_get_bssid(&cyw43_state, c.bssid))
+        return false;
+    // WLC_GET_CHANNEL: hw, target and scan channel, little endian
+    uint8_t channel[12];
+    if (cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channel), channel, CYW43_ITF_STA))
+        return false;
+    c.channel = channel[0] | channel[1] << 8;
+    if (!conn.static_ip) {
+        // the lease DHCP gave, or the reused one until it renews
+        cyw43_arch_lwip_begin();
+        struct netif *n = sta_netif();
+        c.ip = ip4_addr_get_u32(netif_ip4_addr(n));
+        c.netmask = ip4_addr_get_u32(netif_ip4_netmask(n));
+        c.gw = ip4_addr_get_u32(netif_ip4_gw(n));
+        cyw43_arch_lwip_end();
+    }
+    c.check = cache_check(&c);
+    if (!memcmp(&c, &conn.stored, sizeof(c)))
+        return false;
+    if (flash_safe_execute(flash_write, &c, 100) != PICO_OK)
+        return false;
+    conn.stored = c;
+    return true;
+}
+
+void wifi_conn_forget(void) {
+    if (flash_safe_execute(flash_write, NULL, 100) == PICO_OK)
+        memset(&conn.stored, 0, sizeof(conn.stored));
+}
@@ -0,0 +1,74 @@
+#ifndef _WIFI_CONN_H
+#define _WIFI_CONN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hardware/flash.h"
+#include "lwip/ip4_addr.h"
+
+// Fast Wi-Fi reconnect for nodes that wake, send and sleep again.
+//
+// A full join scans every channel for the SSID and then waits for DHCP's four
+// messages. After the first one the BSSID, channel and address are kept in the last
+// flash sector, and the next wifi_conn_connect() joins that BSSID on that channel
+// directly (cyw43_wifi_join() with both given) and puts the address on the netif
+// before the link is up, so the first packet can go as soon as the join completes.
+// Only if the directed join fails is there a full scan and a DHCP wait.
+//
+// A reused lease is taken on trust: there is no clock across a power cycle to tell
+// if it ran out. DHCP is started next to it to renew it, if the server hands out
+// another address lwIP moves to it and wifi_conn_save() records it for the next
+// wake. A static address skips DHCP altogether.
+//
+// Flash is only written when what is stored changes, so a node that keeps meeting
+// the same access point doesn't wear the sector. Not thread safe, call from the
+// thread that owns cyw43_arch, without the lwIP lock.
+
+// offset of the sector in flash
+#ifndef WIFI_CONN_FLASH_OFFSET
+#define WIFI_CONN_FLASH_OFFSET      (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#endif
+
+// the directed join either works quickly or the access point has moved
+#ifndef WIFI_CONN_CACHED_TIMEOUT_MS
+#define WIFI_CONN_CACHED_TIMEOUT_MS 2000
+#endif
+
+#ifndef WIFI_CONN_TIMEOUT_MS
+#define WIFI_CONN_TIMEOUT_MS        30000
+#endif
+
+struct wifi_conn_config {
+    const char *ssid;
+    const char *password;
+    uint32_t auth;              // CYW43_AUTH_...
+    bool static_ip;             // use the three below, no DHCP
+    ip4_addr_t ip;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+};
+
+// each phase in us, from the wifi_conn_connect() call
+struct wifi_conn_times {
+    uint32_t cached_join_us;    // directed join tried, 0 without a cache
+    uint32_t scan_join_us;      // full scan and join, 0 if the directed one worked
+    uint32_t address_us;        // link up to an address on the netif
+    uint32_t save_us;           // flash written, 0 if nothing changed
+    bool cached_join;           // the directed join worked
+    bool cached_address;        // the address was there without waiting for DHCP
+};
+
+// Joins config->ssid, cached path first. PICO_OK once the netif has an address,
+// PICO_ERROR_TIMEOUT or PICO_ERROR_CONNECT_FAILED if the full join didn't work
+// either, call again to retry. times can be NULL
+int wifi_conn_connect(const struct wifi_conn_config *config, struct wifi_conn_times *times);
+
+// Stores the BSSID, channel and address in use if they differ from what is stored.
+// wifi_conn_connect() does it once connected, call it again once DHCP has had time
+// to renew a reused lease. True if flash was written
+bool wifi_conn_save(void);
+
+// Erases the cache, the next connect does a full scan
+void wifi_conn_forget(void);
+
+#endif